@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "alloc.h"
+#include "common.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <atomic>
+
+// glibc's allocator under its internal names, what the replacements
+// below forward to
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t align, size_t size);
+void __libc_free(void *ptr);
+}
+
+namespace robo {
+
+namespace {
+
+// Written by its own thread only (but the shared last one), read by
+// anyone. Zero initialized before any constructor runs, malloc is
+// called that early.
+struct AllocSlot
+{
+    std::atomic<uint64_t>   allocs[ALLOC_STAGE_MAX];
+    std::atomic<uint64_t>   frees[ALLOC_STAGE_MAX];
+    std::atomic<uint64_t>   bytes[ALLOC_STAGE_MAX];
+    std::atomic<int>        tid;
+};
+
+} // namespace
+
+static AllocSlot g_slots[ALLOC_MAX_THREADS];
+static std::atomic<int> g_threads(0);
+static std::atomic<int> g_stage(ALLOC_STAGE_OTHER);
+
+static __thread AllocSlot *t_slot;
+static __thread int t_stage = -1;      // pinned stage, -1 follows g_stage
+
+static AllocSlot *get_slot()
+{
+    AllocSlot *slot = t_slot;
+    if (slot)
+        return slot;
+
+    const int index = g_threads.fetch_add(1);
+    if (index < ALLOC_MAX_THREADS) {
+        slot = &g_slots[index];
+        slot->tid.store((int) syscall(SYS_gettid), std::memory_order_relaxed);
+    }
+    else {
+        slot = &g_slots[ALLOC_MAX_THREADS - 1];
+        slot->tid.store(0, std::memory_order_relaxed);     // shared
+    }
+
+    t_slot = slot;
+    return slot;
+}
+
+static inline void count_alloc(size_t size)
+{
+    AllocSlot *slot = get_slot();
+    const int stage = t_stage < 0 ? g_stage.load(std::memory_order_relaxed) : t_stage;
+
+    slot->allocs[stage].fetch_add(1, std::memory_order_relaxed);
+    slot->bytes[stage].fetch_add(size, std::memory_order_relaxed);
+}
+
+static inline void count_free(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    AllocSlot *slot = get_slot();
+    const int stage = t_stage < 0 ? g_stage.load(std::memory_order_relaxed) : t_stage;
+    slot->frees[stage].fetch_add(1, std::memory_order_relaxed);
+}
+
+static int get_slots()
+{
+    const int threads = g_threads.load();
+    return threads < ALLOC_MAX_THREADS ? threads : ALLOC_MAX_THREADS;
+}
+
+const char *get_alloc_stage_str(int stage)
+{
+    switch (stage)
+    {
+        case ALLOC_STAGE_OTHER:     return "other";
+        case ALLOC_STAGE_CAPTURE:   return "capture";
+        case ALLOC_STAGE_PROCESS:   return "process";
+        case ALLOC_STAGE_SEND:      return "send";
+        default:
+            break;
+    }
+    return "unknown";
+}
+
+void get_alloc_counts(AllocCount counts[ALLOC_STAGE_MAX])
+{
+    memset(counts, 0, sizeof(AllocCount) * ALLOC_STAGE_MAX);
+
+    const int slots = get_slots();
+    for (int i = 0; i < slots; ++i) {
+        const AllocSlot &slot = g_slots[i];
+        for (int stage = 0; stage < ALLOC_STAGE_MAX; ++stage) {
+            counts[stage].allocs    += slot.allocs[stage].load(std::memory_order_relaxed);
+            counts[stage].frees     += slot.frees[stage].load(std::memory_order_relaxed);
+            counts[stage].bytes     += slot.bytes[stage].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void get_thread_alloc_count(AllocCount &count)
+{
+    memset(&count, 0, sizeof(count));
+
+    const AllocSlot *slot = get_slot();
+    for (int stage = 0; stage < ALLOC_STAGE_MAX; ++stage) {
+        count.allocs    += slot->allocs[stage].load(std::memory_order_relaxed);
+        count.frees     += slot->frees[stage].load(std::memory_order_relaxed);
+        count.bytes     += slot->bytes[stage].load(std::memory_order_relaxed);
+    }
+}
+
+void log_alloc_counts()
+{
+    const int slots = get_slots();
+    for (int i = 0; i < slots; ++i) {
+        const AllocSlot &slot = g_slots[i];
+
+        uint64_t allocs[ALLOC_STAGE_MAX];
+        uint64_t bytes = 0;
+        uint64_t frees = 0;
+        for (int stage = 0; stage < ALLOC_STAGE_MAX; ++stage) {
+            allocs[stage] = slot.allocs[stage].load(std::memory_order_relaxed);
+            bytes += slot.bytes[stage].load(std::memory_order_relaxed);
+            frees += slot.frees[stage].load(std::memory_order_relaxed);
+        }
+
+        logger(LOG_INFO, "allocs tid %d: other %llu capture %llu process %llu send %llu, %llu bytes, %llu frees",
+            slot.tid.load(std::memory_order_relaxed),
+            (unsigned long long) allocs[ALLOC_STAGE_OTHER], (unsigned long long) allocs[ALLOC_STAGE_CAPTURE],
+            (unsigned long long) allocs[ALLOC_STAGE_PROCESS], (unsigned long long) allocs[ALLOC_STAGE_SEND],
+            (unsigned long long) bytes, (unsigned long long) frees);
+    }
+}
+
+int get_alloc_threads()
+{
+    return g_threads.load();
+}
+
+AllocStage set_alloc_stage(AllocStage stage)
+{
+    return (AllocStage) g_stage.exchange(stage);
+}
+
+void pin_thread_alloc_stage(AllocStage stage)
+{
+    t_stage = stage;
+}
+
+int get_fault_count(FaultCount &count)
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) {
+        memset(&count, 0, sizeof(count));
+        return errno;
+    }
+
+    count.minor = usage.ru_minflt;
+    count.major = usage.ru_majflt;
+    return 0;
+}
+
+FrameProbe::FrameProbe()
+    :
+    m_allocs(0),
+    m_bytes(0),
+    m_minor(0),
+    m_major(0)
+{
+    memset(m_start, 0, sizeof(m_start));
+    memset(m_stages, 0, sizeof(m_stages));
+    memset(&m_faults, 0, sizeof(m_faults));
+}
+
+void FrameProbe::begin()
+{
+    get_alloc_counts(m_start);
+    get_fault_count(m_faults);
+}
+
+void FrameProbe::end()
+{
+    FaultCount faults;
+    get_fault_count(faults);
+    get_alloc_counts(m_stages);
+
+    m_allocs = 0;
+    m_bytes = 0;
+    for (int stage = 0; stage < ALLOC_STAGE_MAX; ++stage) {
+        m_stages[stage].allocs  -= m_start[stage].allocs;
+        m_stages[stage].frees   -= m_start[stage].frees;
+        m_stages[stage].bytes   -= m_start[stage].bytes;
+        if (stage == ALLOC_STAGE_OTHER)
+            continue;
+        m_allocs                += m_stages[stage].allocs;
+        m_bytes                 += m_stages[stage].bytes;
+    }
+
+    m_minor = faults.minor - m_faults.minor;
+    m_major = faults.major - m_faults.major;
+}
+
+} // namespace robo
+
+// The replacements. operator new/delete end up in malloc/free.
+
+extern "C" void *malloc(size_t size)
+{
+    robo::count_alloc(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void free(void *ptr)
+{
+    robo::count_free(ptr);
+    __libc_free(ptr);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    robo::count_alloc(count * size);
+    return __libc_calloc(count, size);
+}
+
+// a move to a new block as far as the counts go
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    if (size)
+        robo::count_alloc(size);
+    robo::count_free(ptr);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void *memalign(size_t align, size_t size)
+{
+    robo::count_alloc(size);
+    return __libc_memalign(align, size);
+}
+
+extern "C" void *aligned_alloc(size_t align, size_t size)
+{
+    robo::count_alloc(size);
+    return __libc_memalign(align, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t align, size_t size)
+{
+    if (!align || (align & (align - 1)) || align % sizeof(void *))
+        return EINVAL;
+
+    robo::count_alloc(size);
+    void *p = __libc_memalign(align, size);
+    if (!p)
+        return ENOMEM;
+
+    *ptr = p;
+    return 0;
+}
+
+extern "C" void *valloc(size_t size)
+{
+    robo::count_alloc(size);
+    return __libc_memalign(getpagesize(), size);
+}
+
+extern "C" void *pvalloc(size_t size)
+{
+    const size_t page = getpagesize();
+    size = (size + page - 1) & ~(page - 1);
+
+    robo::count_alloc(size);
+    return __libc_memalign(page, size ? size : page);
+}
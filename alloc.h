@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __ALLOC__H__
+#define __ALLOC__H__
+
+#include <stdint.h>
+
+namespace robo {
+
+// Heap accounting. Linking alloc.cpp replaces the malloc family (and so
+// operator new) with glibc's own allocator plus per thread counters,
+// each allocation is charged to its thread and to the stage the main
+// loop is in. The steady state frame loop is expected to allocate
+// nothing, everything is sized at startup and on geometry changes.
+enum AllocStage
+{
+    ALLOC_STAGE_OTHER,      // startup, commands, reconfiguration
+    ALLOC_STAGE_CAPTURE,    // wait_frame() to luma
+    ALLOC_STAGE_PROCESS,    // Pipeline::process*()
+    ALLOC_STAGE_SEND,       // payload and response
+    ALLOC_STAGE_MAX
+};
+
+const char *get_alloc_stage_str(int stage);
+
+struct AllocCount
+{
+    uint64_t    allocs;     // malloc/calloc/realloc/memalign calls
+    uint64_t    frees;
+    uint64_t    bytes;      // requested
+};
+
+// threads beyond this share the last slot
+const int ALLOC_MAX_THREADS = 64;
+
+// whole process, per stage
+void get_alloc_counts(AllocCount counts[ALLOC_STAGE_MAX]);
+
+// the calling thread, all stages
+void get_thread_alloc_count(AllocCount &count);
+
+// threads that allocated so far
+int get_alloc_threads();
+
+// one line per thread that allocated so far
+void log_alloc_counts();
+
+// Process wide, the pool workers allocate on behalf of whichever stage
+// runs them. Returns the previous one.
+AllocStage set_alloc_stage(AllocStage stage);
+
+// The calling thread's allocations count in stage whatever the process
+// wide one is, for threads outside the frame (eg. the preview).
+void pin_thread_alloc_stage(AllocStage stage);
+
+// minor and major page faults of the process so far (getrusage)
+struct FaultCount
+{
+    uint64_t    minor;
+    uint64_t    major;
+};
+
+int get_fault_count(FaultCount &count);
+
+// Allocations and faults of one frame, begin() before the capture and
+// end() after the response. allocs() and bytes() are of the frame
+// stages, ALLOC_STAGE_OTHER is only in stage().
+class FrameProbe
+{
+public:
+    FrameProbe();
+
+    void begin();
+    void end();
+
+    // of the last begin()/end()
+    uint64_t allocs() const { return m_allocs; }
+    uint64_t bytes() const { return m_bytes; }
+    uint64_t minor_faults() const { return m_minor; }
+    uint64_t major_faults() const { return m_major; }
+    const AllocCount &stage(int stage) const { return m_stages[stage]; }
+
+private:
+    AllocCount  m_start[ALLOC_STAGE_MAX];
+    AllocCount  m_stages[ALLOC_STAGE_MAX];
+    FaultCount  m_faults;
+    uint64_t    m_allocs;
+    uint64_t    m_bytes;
+    uint64_t    m_minor;
+    uint64_t    m_major;
+};
+
+} // namespace robo
+
+#endif // __ALLOC__H__
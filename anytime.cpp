@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "anytime.h"
+#include "parallel.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+namespace robo {
+
+int half_scale(const ImageView &src, const ImageView &dst)
+{
+    if (src.format != PIX_FMT_GRAY8 || dst.format != PIX_FMT_GRAY8 ||
+        dst.width != src.width / 2 || dst.height != src.height / 2)
+        return EINVAL;
+
+    const int w = dst.width;
+
+    parallel_for(dst.height, 16, [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const uint8_t *a = src.row(2 * y);
+            const uint8_t *b = src.row(2 * y + 1);
+            uint8_t *out = dst.row(y);
+
+            for (int x = 0; x < w; ++x)
+                out[x] = (uint8_t) ((a[2 * x] + a[2 * x + 1] + b[2 * x] + b[2 * x + 1] + 2) >> 2);
+        }
+    });
+    return 0;
+}
+
+int upscale_double(const ImageView &half, const ImageView &dst)
+{
+    if (half.format != dst.format || half.empty() ||
+        (dst.format != PIX_FMT_DISP16 && dst.format != PIX_FMT_GRAY8) ||
+        half.width != dst.width / 2 || half.height != dst.height / 2)
+        return EINVAL;
+
+    const int w = dst.width;
+    const int last_x = half.width - 1;
+    const int last_y = half.height - 1;
+
+    parallel_for(dst.height, 16, [&](int, int y0, int y1) {
+        for (int y = y0; y < y1; ++y) {
+            const int hy = y / 2 < last_y ? y / 2 : last_y;
+
+            if (dst.format == PIX_FMT_GRAY8) {
+                const uint8_t *in = half.row(hy);
+                uint8_t *out = dst.row(y);
+                for (int x = 0; x < w; ++x)
+                    out[x] = in[x / 2 < last_x ? x / 2 : last_x];
+                continue;
+            }
+
+            const int16_t *in = half.row_as<int16_t>(hy);
+            int16_t *out = dst.row_as<int16_t>(y);
+            for (int x = 0; x < w; ++x) {
+                const int16_t d = in[x / 2 < last_x ? x / 2 : last_x];
+                out[x] = d < 0 ? (int16_t) DISP_INVALID : (int16_t) (d * 2);
+            }
+        }
+    });
+    return 0;
+}
+
+void get_default_anytime_config(AnytimeConfig &config)
+{
+    config.refine_rows  = 16;
+    config.margin       = 2.0;
+}
+
+static int get_coarse_disparities(int num_disparities)
+{
+    return num_disparities / 2 > 8 ? num_disparities / 2 : 8;
+}
+
+static StereoConfig get_coarse_config(const StereoConfig &full)
+{
+    StereoConfig config = full;
+    config.num_disparities  = get_coarse_disparities(full.num_disparities);
+    config.block_size       = full.block_size / 2 > 5 ? (full.block_size / 2) | 1 : 5;
+    return config;
+}
+
+AnytimeMatcher::AnytimeMatcher(const AnytimeConfig &config, BlockMatcher &full)
+    :
+    m_config(config),
+    m_full(full),
+    m_coarse(get_coarse_config(full.config())),
+    m_refined(0.0)
+{
+}
+
+void AnytimeMatcher::set_num_disparities(int num_disparities)
+{
+    m_coarse.set_num_disparities(get_coarse_disparities(num_disparities));
+}
+
+double AnytimeMatcher::coarse_usec() const
+{
+    return m_coarse_stat.mean() + m_config.margin * m_coarse_stat.stddev();
+}
+
+double AnytimeMatcher::row_usec() const
+{
+    return m_row_stat.mean() + m_config.margin * m_row_stat.stddev();
+}
+
+int AnytimeMatcher::compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                            const ImageView &confidence, uint64_t stop_usec)
+{
+    m_refined = 0.0;
+
+    if (!left.same_size(disp) || !left.same_size(confidence) || left.width < 2 || left.height < 2)
+        return EINVAL;
+
+    const int hw = left.width / 2;
+    const int hh = left.height / 2;
+
+    int res = m_half_left.allocate(hw, hh, PIX_FMT_GRAY8);
+    res = res || m_half_right.allocate(hw, hh, PIX_FMT_GRAY8);
+    res = res || m_half_disp.allocate(hw, hh, PIX_FMT_DISP16);
+    res = res || m_half_conf.allocate(hw, hh, PIX_FMT_GRAY8);
+    if (res)
+        return ENOMEM;
+
+    uint64_t start = get_time_usec();
+
+    res = half_scale(left, m_half_left.view());
+    res = res ? res : half_scale(right, m_half_right.view());
+    res = res ? res : m_coarse.compute(m_half_left.view(), m_half_right.view(),
+                                       m_half_disp.view(), &m_half_conf.view());
+    res = res ? res : upscale_double(m_half_disp.view(), disp);
+    res = res ? res : upscale_double(m_half_conf.view(), confidence);
+    if (res)
+        return res;
+
+    uint64_t now = get_time_usec();
+    m_coarse_stat.add((double) (now - start));
+
+    // bottom up, the first strip is tried even before its cost is known
+    const int rows = m_config.refine_rows;
+    int y1 = left.height;
+    while (y1 > 0 && now + row_usec() * rows <= stop_usec) {
+        const int y0 = y1 > rows ? y1 - rows : 0;
+
+        start = now;
+        res = m_full.compute_rows(left, right, disp, y0, y1, &confidence);
+        if (res)
+            return res;
+
+        now = get_time_usec();
+        m_row_stat.add((double) (now - start) / (y1 - y0));
+        y1 = y0;
+    }
+
+    m_refined = (double) (left.height - y1) / left.height;
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __ANYTIME__H__
+#define __ANYTIME__H__
+
+#include "image.h"
+#include "stereo.h"
+#include "stats.h"
+
+#include <stdint.h>
+
+namespace robo {
+
+// 2x2 box average of a GRAY8 image into dst of half its size (rounded
+// down), EINVAL otherwise.
+int half_scale(const ImageView &src, const ImageView &dst);
+
+// Nearest neighbour 2x upscale of a half size map into dst, DISP16
+// values are doubled (invalid stays invalid), GRAY8 copied. Odd dst
+// rows/columns past the half map repeat the last one.
+int upscale_double(const ImageView &half, const ImageView &dst);
+
+struct AnytimeConfig
+{
+    int     refine_rows;        // rows per refinement strip
+    double  margin;             // cost estimates are taken as mean + margin * stddev
+};
+
+void get_default_anytime_config(AnytimeConfig &config);
+
+// Disparity by quality tiers for a deadline: a half resolution match
+// first (about 1/8 of the full cost), upscaled to the full geometry, then
+// full resolution strips from the bottom of the image up (nearest floor
+// and obstacles first) for as long as the time left allows another
+// strip. A map refined all the way is the full quality map.
+class AnytimeMatcher
+{
+public:
+    // full is the caller's full resolution matcher, its strips are used
+    // for refinement. The coarse one searches half the range.
+    AnytimeMatcher(const AnytimeConfig &config, BlockMatcher &full);
+
+    // disp (DISP16) and confidence (GRAY8) have the geometry of left and
+    // right. Refinement stops before stop_usec (get_time_usec()) would
+    // be passed, the coarse map is always computed.
+    int compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                const ImageView &confidence, uint64_t stop_usec);
+
+    // rows of the last compute() at full resolution, 0..1
+    double refined() const { return m_refined; }
+
+    // expected cost of the coarse tier and of a full resolution row
+    double coarse_usec() const;
+    double row_usec() const;
+
+    // The full matcher's range changed to num_disparities, the coarse one
+    // follows with half of it.
+    void set_num_disparities(int num_disparities);
+    const StereoConfig &coarse_config() const { return m_coarse.config(); }
+
+private:
+    AnytimeConfig   m_config;
+    BlockMatcher    &m_full;
+    BlockMatcher    m_coarse;
+    Image           m_half_left;
+    Image           m_half_right;
+    Image           m_half_disp;
+    Image           m_half_conf;
+    double          m_refined;
+    RunningStat     m_coarse_stat;      // usec
+    RunningStat     m_row_stat;         // usec per refined row
+};
+
+} // namespace robo
+
+#endif // __ANYTIME__H__
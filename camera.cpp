@@ -18,6 +18,9 @@
  */
 
 #include "camera.h"
+#include "convert.h"
+#include "parallel.h"
+#include "realtime.h"
 
 #include <string.h>
 #include <assert.h>
@@ -32,52 +35,16 @@
 #include <sys/time.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <asm/types.h>          /* for videodev2.h */
 
 #include <linux/videodev2.h>
 
-namespace robo {
 
-static int g_lookup_done;
-static unsigned char g_yv[256][256];
-static unsigned char g_yu[256][256];
-static int g_y2v[256][256];
-static int g_y2u[256][256];
+namespace robo {
 
 const size_t g_num_of_bufs = 4;
 
-static void create_YUV_RGB_table()
-{
-    if (g_lookup_done)
-        return;
-
-    int iyv, iyu, iy2v, iy2u;
-    int i, j;
-
-    for(i = 0; i < 256; i++) {
-        for(j = 0; j < 256; j++) {
-
-            iyv = i + (1.370705 * (j-128));  //Red
-            iyu = i + (1.732446 * (j-128)); //Blue
-            iy2v = (i/2) - (0.698001 * (j-128));//Green 1/2
-            iy2u = (i/2) - (0.337633 * (j-128));//Green 1/2
-
-            if (iyv > 255) iyv = 255;
-            if (iyu > 255) iyu = 255;
-            if (iyv < 0) iyv = 0;
-            if (iyu < 0) iyu = 0;
-            
-            g_yv[i][j] = (unsigned char) iyv;
-            g_yu[i][j] = (unsigned char) iyu;
-
-            g_y2v[i][j] = iy2v;
-            g_y2u[i][j] = iy2u;
-        }
-    }
-
-    g_lookup_done = 1;
-}
-
 static int query_device(const char *name, const char *tag, int fd, struct v4l2_queryctrl *queryctrl)
 {
     assert(fd != -1);
@@ -109,14 +76,28 @@ static int control_device(const char *name, const char *tag, int fd, struct v4l2
 
 Camera::Camera()
   :
-  m_width_h(0),
+  m_width(0),
   m_height(0),
-  m_data(NULL),
+  m_bytesperline(0),
+  m_jpeg(NULL),
+  m_jpeg_size(0),
+  m_jpeg_capacity(0),
+  m_decode_usec(0),
+  m_sequence(0),
+  m_timestamp_usec(0),
+  m_skipped(0),
+  m_start_usec(0),
+  m_first_frame_usec(0),
+  m_paused(false),
   m_fd(-1),
   m_name(NULL),
+  m_synthetic(-1),
+  m_next_frame_usec(0),
+  m_free_running(false),
   m_buffers(NULL)
 {
     memset(m_settings, 0, sizeof(m_settings));
+    memset(&m_mode, 0, sizeof(m_mode));
 
     m_settings[SETTING_BRIGHTNESS].vl_id  = V4L2_CID_BRIGHTNESS;
     m_settings[SETTING_CONTRAST].vl_id    = V4L2_CID_CONTRAST;
@@ -131,24 +112,75 @@ Camera::Camera()
     m_settings[SETTING_HUE].tag         = "hue";
     m_settings[SETTING_HUE_AUTO].tag    = "hue auto";
     m_settings[SETTING_SHARPNESS].tag   = "sharpness";
+
+    memset(m_controls, 0, sizeof(m_controls));
+
+    m_controls[CONTROL_EXPOSURE_AUTO].vl_id                 = V4L2_CID_EXPOSURE_AUTO;
+    m_controls[CONTROL_EXPOSURE_AUTO_PRIORITY].vl_id        = V4L2_CID_EXPOSURE_AUTO_PRIORITY;
+    m_controls[CONTROL_EXPOSURE_ABSOLUTE].vl_id             = V4L2_CID_EXPOSURE_ABSOLUTE;
+    m_controls[CONTROL_GAIN].vl_id                          = V4L2_CID_GAIN;
+    m_controls[CONTROL_FOCUS_AUTO].vl_id                    = V4L2_CID_FOCUS_AUTO;
+    m_controls[CONTROL_FOCUS_ABSOLUTE].vl_id                = V4L2_CID_FOCUS_ABSOLUTE;
+    m_controls[CONTROL_WHITE_BALANCE_AUTO].vl_id            = V4L2_CID_AUTO_WHITE_BALANCE;
+    m_controls[CONTROL_WHITE_BALANCE_TEMPERATURE].vl_id     = V4L2_CID_WHITE_BALANCE_TEMPERATURE;
+    m_controls[CONTROL_POWER_LINE_FREQUENCY].vl_id          = V4L2_CID_POWER_LINE_FREQUENCY;
+
+    m_controls[CONTROL_EXPOSURE_AUTO].tag                   = "exposure_auto";
+    m_controls[CONTROL_EXPOSURE_AUTO_PRIORITY].tag          = "exposure_auto_priority";
+    m_controls[CONTROL_EXPOSURE_ABSOLUTE].tag               = "exposure_absolute";
+    m_controls[CONTROL_GAIN].tag                            = "gain";
+    m_controls[CONTROL_FOCUS_AUTO].tag                      = "focus_auto";
+    m_controls[CONTROL_FOCUS_ABSOLUTE].tag                  = "focus_absolute";
+    m_controls[CONTROL_WHITE_BALANCE_AUTO].tag              = "white_balance_temperature_auto";
+    m_controls[CONTROL_WHITE_BALANCE_TEMPERATURE].tag       = "white_balance_temperature";
+    m_controls[CONTROL_POWER_LINE_FREQUENCY].tag            = "power_line_frequency";
 }
 
 int Camera::initialize(const char *name, int w, int h, int f) 
 {
-    assert(name);
-    assert(w > 0);
-    assert(h > 0);
     assert(f > 0);
 
+    CaptureMode mode;
+    memset(&mode, 0, sizeof(mode));
+
+    mode.pixelformat    = V4L2_PIX_FMT_YUYV;
+    mode.width          = w;
+    mode.height         = h;
+    mode.interval_num   = 1;
+    mode.interval_den   = f;
+
+    return initialize(name, mode);
+}
+
+int Camera::initialize(const char *name, const CaptureMode &mode)
+{
+    assert(name);
+    assert(mode.width > 0);
+    assert(mode.height > 0);
+    assert(mode.interval_num > 0 && mode.interval_den > 0);
+
     if (m_buffers)
         return EINVAL;
 
+    m_synthetic = get_synthetic_camera(name);
+
+    if (m_synthetic < 0 &&
+        mode.pixelformat != V4L2_PIX_FMT_YUYV &&
+        mode.pixelformat != V4L2_PIX_FMT_MJPEG) {
+        logger(LOG_ERROR, "%s unsupported pixel format %.4s", name,
+            (const char *) &mode.pixelformat);
+        return EINVAL;
+    }
+
     int res = 0;
 
-    create_YUV_RGB_table();
+    m_start_usec = get_time_usec();
+    m_first_frame_usec = 0;
+    m_paused = false;
 
-    m_width_h = w / 2;
-    m_height = h;
+    m_width = mode.width;
+    m_height = mode.height;
+    m_mode = mode;
     m_name = name;
 
     m_buffers = (Buffer *)::calloc(g_num_of_bufs, sizeof (*m_buffers));
@@ -157,12 +189,14 @@ int Camera::initialize(const char *name, int w, int h, int f)
         goto fail;
     }
 
-    m_data = (unsigned char *)::malloc(w * h * 4);
-    if (!m_data)
-      res = ENOMEM;
-    res = res || open_cam_device();
-    res = res || initialize_device(f);
-    res = res || init_mmap();
+    if (m_synthetic >= 0) {
+        res = initialize_synthetic();
+    }
+    else {
+        res = res || open_cam_device();
+        res = res || initialize_device(mode.interval_num, mode.interval_den);
+        res = res || init_mmap();
+    }
     res = res || start_capture();
     if (res)
         goto fail;
@@ -193,7 +227,7 @@ void Camera::shutdown()
 
     if (m_buffers) {
       
-        for(size_t i = 0; i < g_num_of_bufs; ++i) {
+        for(size_t i = 0; m_synthetic < 0 && i < g_num_of_bufs; ++i) {
             res = ::munmap(m_buffers[i].start, m_buffers[i].length);
             if (res)
                 logger(LOG_WARN, "%s munmap i=%d res=%d errno=%d", tag, i, res, errno);
@@ -210,13 +244,20 @@ void Camera::shutdown()
         m_fd = -1;
     }
 
-    if (m_data)
-        free(m_data);
-    m_data = NULL;
+    m_frame.release();
+    m_decoder.shutdown();
+
+    if (m_jpeg)
+        free(m_jpeg);
+    m_jpeg = NULL;
+    m_jpeg_size = 0;
+    m_jpeg_capacity = 0;
     m_name = NULL;
+    m_synthetic = -1;
+    m_scene.release();
 }
 
-int Camera::initialize_device(int fps)
+int Camera::initialize_device(uint32_t interval_num, uint32_t interval_den)
 {
     assert(m_buffers);
 
@@ -263,10 +304,11 @@ int Camera::initialize_device(int fps)
     memset(&fmt, 0, sizeof(fmt));
 
     fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width       = m_width_h * 2;
+    fmt.fmt.pix.width       = m_width;
     fmt.fmt.pix.height      = m_height;
-    fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
-    fmt.fmt.pix.field       = V4L2_FIELD_INTERLACED;
+    fmt.fmt.pix.pixelformat = m_mode.pixelformat;
+    fmt.fmt.pix.field       = m_mode.pixelformat == V4L2_PIX_FMT_MJPEG ?
+        V4L2_FIELD_ANY : V4L2_FIELD_INTERLACED;
 
     res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_S_FMT, &fmt));
     if (res) {
@@ -274,16 +316,22 @@ int Camera::initialize_device(int fps)
         return EFAULT;
     }
 
+    if (fmt.fmt.pix.pixelformat != m_mode.pixelformat) {
+        logger(LOG_ERROR, "%s VIDIOC_S_FMT %.4s not accepted", m_name,
+            (const char *) &m_mode.pixelformat);
+        return EFAULT;
+    }
+
     struct v4l2_streamparm p;
     memset(&p, 0, sizeof(p));
 
     p.type=V4L2_BUF_TYPE_VIDEO_CAPTURE;
     //p.parm.capture.capability=V4L2_CAP_TIMEPERFRAME;
     //p.parm.capture.capturemode=V4L2_MODE_HIGHQUALITY;
-    p.parm.capture.timeperframe.numerator = 1;
-    p.parm.capture.timeperframe.denominator = fps;
-    p.parm.output.timeperframe.numerator = 1;
-    p.parm.output.timeperframe.denominator = fps;
+    p.parm.capture.timeperframe.numerator = interval_num;
+    p.parm.capture.timeperframe.denominator = interval_den;
+    p.parm.output.timeperframe.numerator = interval_num;
+    p.parm.output.timeperframe.denominator = interval_den;
     //p.parm.output.outputmode=V4L2_MODE_HIGHQUALITY;
     //p.parm.capture.extendedmode=0;
     //p.parm.capture.readbuffers=n_buffers;
@@ -301,20 +349,56 @@ int Camera::initialize_device(int fps)
     initialize_setting(SETTING_HUE_AUTO);
     initialize_setting(SETTING_SHARPNESS);
 
+    for (int i = 0; i < CONTROL_MAX; ++i)
+        initialize_control((ControlType) i);
+
     //TODO: TO ADD SETTINGS
     //here should go custom calls to xioctl
     //END TO ADD SETTINGS
 
-    /* Buggy driver paranoia. */
-    min = fmt.fmt.pix.width * 2;
-    if(fmt.fmt.pix.bytesperline < min)
-        fmt.fmt.pix.bytesperline = min;
-    
-    min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-    if(fmt.fmt.pix.sizeimage < min)
-        fmt.fmt.pix.sizeimage = min;
+    if (m_mode.pixelformat == V4L2_PIX_FMT_MJPEG) {
 
-    return 0;
+        if (!fmt.fmt.pix.sizeimage)
+            fmt.fmt.pix.sizeimage = fmt.fmt.pix.width * fmt.fmt.pix.height * 2;
+
+        m_jpeg_capacity = fmt.fmt.pix.sizeimage;
+        m_jpeg = (uint8_t *) ::malloc(m_jpeg_capacity);
+        if (!m_jpeg)
+            return ENOMEM;
+
+        res = m_decoder.initialize();
+        if (res)
+            return res;
+    }
+    else {
+        /* Buggy driver paranoia. */
+        min = fmt.fmt.pix.width * 2;
+        if(fmt.fmt.pix.bytesperline < min)
+            fmt.fmt.pix.bytesperline = min;
+
+        min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
+        if(fmt.fmt.pix.sizeimage < min)
+            fmt.fmt.pix.sizeimage = min;
+    }
+
+    if ((int) fmt.fmt.pix.width != m_width || (int) fmt.fmt.pix.height != m_height)
+        logger(LOG_WARN, "%s requested %dx%d got %ux%u", m_name, m_width, m_height,
+            fmt.fmt.pix.width, fmt.fmt.pix.height);
+
+    m_width         = fmt.fmt.pix.width;
+    m_height        = fmt.fmt.pix.height;
+    m_bytesperline  = fmt.fmt.pix.bytesperline;
+
+    m_mode.width    = m_width;
+    m_mode.height   = m_height;
+    if (p.parm.capture.timeperframe.numerator && p.parm.capture.timeperframe.denominator) {
+        m_mode.interval_num = p.parm.capture.timeperframe.numerator;
+        m_mode.interval_den = p.parm.capture.timeperframe.denominator;
+    }
+
+    if (m_jpeg)
+        return 0;
+    return m_frame.allocate(m_width, m_height, PIX_FMT_YUYV);
 }
 
 int Camera::open_cam_device()
@@ -395,9 +479,28 @@ int Camera::init_mmap()
     return 0;
 }
 
+void Camera::prefault()
+{
+    // the driver fills these, reading maps them in
+    for (size_t i = 0; m_buffers && i < g_num_of_bufs; ++i)
+        prefault_read(m_buffers[i].start, m_buffers[i].length);
+
+    if (!m_frame.empty())
+        robo::prefault(m_frame.data(), m_frame.view().size());
+    if (m_jpeg)
+        robo::prefault(m_jpeg, m_jpeg_capacity);
+}
+
 int Camera::start_capture()
 {
     assert(m_buffers);
+
+    if (m_synthetic >= 0) {
+        // first frame one interval in, like a device
+        m_next_frame_usec = get_time_usec() + get_synthetic_interval_usec();
+        return 0;
+    }
+
     assert(m_fd != -1);
 
     int res = 0;
@@ -431,38 +534,145 @@ int Camera::start_capture()
     return res;
 }
 
+int Camera::dequeue(struct v4l2_buffer &buf)
+{
+    memset(&buf, 0, sizeof(buf));
+
+    buf.type    = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory  = V4L2_MEMORY_MMAP;
+
+    int res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_DQBUF, &buf));
+    if (res) {
+        res = errno;
+        if (res != EAGAIN)
+            logger(LOG_ERROR, "%s VIDIOC_DQBUF errno=%d", m_name, res);
+        return res;
+    }
+
+    assert(buf.index < g_num_of_bufs);
+    return 0;
+}
+
+int Camera::requeue(struct v4l2_buffer &buf)
+{
+    int res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_QBUF, &buf));
+    if (res) {
+        res = errno;
+        logger(LOG_ERROR, "%s VIDIOC_QBUF errno=%d", m_name, res);
+    }
+    return res;
+}
+
 int Camera::capture()
 {
-    if (!m_buffers)
+    if (!m_buffers || m_paused)
         return EINVAL;
+    if (m_synthetic >= 0)
+        return capture_synthetic();
 
-    assert(m_data);
+    assert(!m_frame.empty() || m_jpeg);
     assert(m_fd != -1);
 
     int res = 0;
     struct v4l2_buffer buf;
+    struct v4l2_buffer next;
 
-    memset(&buf, 0, sizeof(buf));
+    res = dequeue(buf);
+    if (res)
+        return res;
 
-    buf.type    = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory  = V4L2_MEMORY_MMAP;
+    // Frames queue up while nobody asks for them (idle client, slow
+    // processing). Skip to the newest one, stale frames only add latency.
+    while (!dequeue(next)) {
+        res = requeue(buf);
+        if (res)
+            return res;
+        buf = next;
+        ++m_skipped;
+    }
 
-    res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_DQBUF, &buf));
-    if (res) {
-        logger(LOG_ERROR, "%s VIDIOC_DQBUF res=%d errno=%d", m_name, res, errno);
-        return res;
+    if (m_jpeg)
+        copy_jpeg(m_buffers[buf.index], buf.bytesused);
+    else
+        copy_frame(m_buffers[buf.index], buf.bytesused);
+
+    m_sequence = buf.sequence;
+
+    // uvcvideo stamps CLOCK_MONOTONIC at the start of frame, anything
+    // else is not comparable to get_time_usec(), stamp it ourselves.
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+        m_timestamp_usec = (uint64_t) buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+    else
+        m_timestamp_usec = get_time_usec();
+
+    if (!m_first_frame_usec)
+        m_first_frame_usec = get_time_usec() - m_start_usec;
+
+    return requeue(buf);
+}
+
+int Camera::wait_frame(int timeout_msec)
+{
+    if (!m_buffers || m_paused)
+        return EINVAL;
+
+    if (m_synthetic >= 0) {
+        const uint64_t now = get_time_usec();
+        if (m_next_frame_usec > now + (uint64_t) timeout_msec * 1000) {
+            usleep(timeout_msec * 1000);
+            return ETIMEDOUT;
+        }
+        if (m_next_frame_usec > now)
+            usleep(m_next_frame_usec - now);
+        return capture_synthetic();
     }
 
-    assert(buf.index < g_num_of_bufs);
-    memcpy(m_data, (unsigned char *)m_buffers[buf.index].start, m_buffers[buf.index].length);
+    struct pollfd pfd;
+    pfd.fd      = m_fd;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
 
-    res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_QBUF, &buf));
+    int res = HANDLE_EINTR(::poll(&pfd, 1, timeout_msec));
+    if (res < 0)
+        return errno;
+    if (res == 0)
+        return ETIMEDOUT;
+
+    return capture();
+}
+
+int Camera::pause()
+{
+    if (!m_buffers || m_paused)
+        return 0;
+
+    // STREAMOFF also returns every queued buffer to us
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    int res = m_synthetic < 0 ? HANDLE_EINTR(::ioctl(m_fd, VIDIOC_STREAMOFF, &type)) : 0;
     if (res) {
-        logger(LOG_ERROR, "%s VIDIOC_QBUF res=%d errno=%d", m_name, res, errno);
+        res = errno;
+        logger(LOG_ERROR, "%s VIDIOC_STREAMOFF errno=%d", m_name, res);
         return res;
     }
 
-    return res;
+    m_paused = true;
+    return 0;
+}
+
+int Camera::resume()
+{
+    if (!m_buffers || !m_paused)
+        return 0;
+
+    m_start_usec = get_time_usec();
+    m_first_frame_usec = 0;
+
+    int res = start_capture();
+    if (res)
+        return res;
+
+    m_paused = false;
+    return 0;
 }
 
 int Camera::update(uint64_t now)
@@ -470,157 +680,138 @@ int Camera::update(uint64_t now)
     return capture();
 }
 
-int Camera::toIplImage(unsigned char *buf, int width) const
+int get_synthetic_camera(const char *name)
 {
-    assert(buf);
-    assert(width > 0);
+    const size_t len = strlen(SYNTHETIC_DEVICE);
+    if (!name || strncmp(name, SYNTHETIC_DEVICE, len) || (name[len] != '0' && name[len] != '1'))
+        return -1;
+    return name[len] - '0';
+}
 
-    if (!m_buffers)
-        return EINVAL;
+uint64_t Camera::get_synthetic_interval_usec() const
+{
+    if (m_free_running)
+        return 0;
+    return (uint64_t) m_mode.interval_num * 1000000 / m_mode.interval_den;
+}
 
-    const int w2 = m_width_h;
-    const int h  = m_height;
-
-    for(int x = 0; x < w2; ++x) {
-        for(int y = 0; y < h; ++y) {
-
-          int y0, y1, u, v; //y0 u y1 v
-
-          int i=(y*w2+x)*4;
-          y0 = m_data[i];
-          u  = m_data[i+1];
-          y1 = m_data[i+2];
-          v  = m_data[i+3];
-
-          int g;
-          i=(y*width+2*x)*3;
-          
-          g = g_y2u[y0][u] + g_y2v[y0][v];
-          if(g>255){g=255;}
-          if(g<0){g=0;}
-          buf[i] = g_yu[y0][u];
-          buf[i+1] = g;
-          buf[i+2] = g_yv[y0][v];
-          
-          g = g_y2u[y1][u] + g_y2v[y1][v];
-          if(g>255){g=255;}
-          if(g<0){g=0;}
-          buf[i+3] = g_yu[y1][u];
-          buf[i+4] = g;
-          buf[i+5] = g_yv[y1][v];
-        }
+int Camera::initialize_synthetic()
+{
+    m_mode.pixelformat  = V4L2_PIX_FMT_YUYV;
+    m_bytesperline      = m_width * 2;
+
+    int res = m_scene.initialize(m_width, m_height);
+    res = res || m_frame.allocate(m_width, m_height, PIX_FMT_YUYV);
+    if (res) {
+        logger(LOG_ERROR, "%s synthetic %dx%d failed", m_name, m_width, m_height);
+        return ENOMEM;
     }
 
+    logger(LOG_INFO, "%s synthetic %dx%d @ %.1f fps%s", m_name, m_width, m_height, m_mode.fps(),
+        m_free_running ? ", free running" : "");
     return 0;
 }
 
-int Camera::toGrayScaleIplImage(unsigned char *buf, int width) const
+int Camera::capture_synthetic()
 {
-    assert(buf);
-    assert(width > 0);
+    const uint64_t now = get_time_usec();
+    if (now < m_next_frame_usec)
+        return EAGAIN;
 
-    if (!m_buffers)
-        return EINVAL;
+    // frames nobody asked for are dropped, as capture() does
+    const uint64_t interval = get_synthetic_interval_usec();
+    const uint64_t stale = interval ? (now - m_next_frame_usec) / interval : 0;
 
-    const int w2 = m_width_h;
-    const int h  = m_height;
-    
-    for (int x = 0; x < w2; ++x) {
-        for (int y = 0; y < h; ++y) {
-
-            int y0, y1;
-            
-            int i = (y * w2 + x)*4;
-            y0 = m_data[i];
-            y1 = m_data[i + 2];
-
-            i = (y * width + 2 * x)*1;
-            buf[i] = (unsigned char) (y0);
-            buf[i + 1] = (unsigned char) (y1);
-        }
-    }
+    m_skipped           += stale;
+    m_sequence          += (uint32_t) stale + 1;
+    m_timestamp_usec    = interval ? m_next_frame_usec + stale * interval : now;
+    m_next_frame_usec   = m_timestamp_usec + interval;
+
+    m_scene.render_yuyv(m_synthetic, m_sequence, m_frame.view());
 
+    if (!m_first_frame_usec)
+        m_first_frame_usec = now - m_start_usec;
     return 0;
 }
 
-int Camera::toMat(unsigned char *buf, int channels, int cols) const
+void Camera::copy_frame(const Buffer &buffer, size_t bytesused)
 {
-    assert(buf);
-    assert(channels > 0);
-    assert(cols > 0);
-
-    if (!m_buffers)
-        return EINVAL;
+    const ImageView &dst = m_frame.view();
+    const size_t avail = bytesused ? bytesused : buffer.length;
+    const uint8_t *src = (const uint8_t *) buffer.start;
+
+    int rows = dst.height;
+    if (avail < (size_t) m_bytesperline * rows) {
+        rows = avail / m_bytesperline;
+        logger(LOG_WARN, "%s short frame %zu bytes, %d rows", m_name, avail, rows);
+    }
 
-    const int w2 = m_width_h;
-    const int h  = m_height;
-
-    for(int x = 0; x < w2; ++x) {
-        for(int y = 0; y < h; ++y) {
-
-          int y0, y1, u, v; //y0 u y1 v
-
-          int i=(y*w2+x)*4;
-          y0 = m_data[i];
-          u  = m_data[i+1];
-          y1 = m_data[i+2];
-          v  = m_data[i+3];
-                
-          int g;
-          
-          i = y*cols*channels + x*2*channels;  
-
-          g = g_y2u[y0][u] + g_y2v[y0][v];
-          if(g>255){g=255;}
-          if(g<0){g=0;}
-          buf[i] = g_yu[y0][u];
-          buf[i+1] = (unsigned char)g;
-          buf[i+2] = g_yv[y0][v];
-          
-          g = g_y2u[y1][u] + g_y2v[y1][v];
-          if(g>255){g=255;}
-          if(g<0){g=0;}
-          buf[i+3] = g_yu[y1][u];
-          buf[i+4] = g;
-          buf[i+5] = g_yv[y1][v];
-        }
+    if (m_bytesperline == dst.stride) {
+        memcpy(dst.data, src, (size_t) dst.stride * rows);
+        return;
     }
 
-    return 0;
-}   
+    for (int y = 0; y < rows; ++y, src += m_bytesperline)
+        memcpy(dst.row(y), src, dst.row_bytes());
+}
+
+void Camera::copy_jpeg(const Buffer &buffer, size_t bytesused)
+{
+    size_t size = bytesused ? bytesused : buffer.length;
+    if (size > m_jpeg_capacity) {
+        logger(LOG_WARN, "%s MJPEG frame %zu bytes truncated to %zu", m_name, size, m_jpeg_capacity);
+        size = m_jpeg_capacity;
+    }
 
-int Camera::toGrayScaleMat(unsigned char *buf, int channels, int cols) const
-{   
-    assert(buf);
-    assert(channels > 0);
-    assert(cols > 0);
+    memcpy(m_jpeg, buffer.start, size);
+    m_jpeg_size = size;
+}
 
+int Camera::toBGR(const ImageView &dst)
+{
     if (!m_buffers)
         return EINVAL;
+    if (!m_jpeg)
+        return yuyv_to_bgr(m_frame.view(), dst);
+    if (!m_jpeg_size)
+        return EAGAIN;
+
+    const uint64_t start = get_time_usec();
+    int res = m_decoder.decode_bgr(m_jpeg, m_jpeg_size, dst);
+    m_decode_usec = get_time_usec() - start;
+    return res;
+}
 
-    const int w2 = m_width_h;
-    const int h  = m_height;
-
-    for (int x = 0; x < w2; ++x) {
-        for (int y = 0; y < h; ++y) {
-
-            int y0, y1;
-
-            int i = (y * w2 + x)*4;
-            y0 = m_data[i];
-            y1 = m_data[i + 2];
-            
-            i = y*cols*channels + x*2*channels; 
-            buf[i + 0] = (unsigned char) (y0);
-            buf[i + 1] = (unsigned char) (y1);
-            
-            //More clear in logic but slower solution
-            //m.at<uchar>(y, (2*x)) = (unsigned char) (y0);
-            //m.at<uchar>(y, (2*x)+1) = (unsigned char) (y1);
-        }
+int Camera::toGrayScale(const ImageView &dst)
+{
+    if (!m_buffers || !dst.width)
+        return EINVAL;
+    if (!m_jpeg)
+        return yuyv_to_gray(m_frame.view(), dst);
+    if (!m_jpeg_size)
+        return EAGAIN;
+
+    const uint64_t start = get_time_usec();
+    int res = m_decoder.decode_luma(m_jpeg, m_jpeg_size, (m_width + dst.width - 1) / dst.width, dst);
+    m_decode_usec = get_time_usec() - start;
+    return res;
+}
+
+int to_grayscale_pair(Camera &c1, Camera &c2, const ImageView &g1, const ImageView &g2)
+{
+    if (!c1.is_compressed() && !c2.is_compressed()) {
+        int res = c1.toGrayScale(g1);
+        return res ? res : c2.toGrayScale(g2);
     }
 
-    return 0;
+    // two decodes of a few milliseconds each, one of them on the pool
+    int res[2] = { 0, 0 };
+    parallel_for(2, 1, [&](int, int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            res[i] = i ? c2.toGrayScale(g2) : c1.toGrayScale(g1);
+    });
+
+    return res[0] ? res[0] : res[1];
 }
 
 void Camera::initialize_setting(SettingType set_type)
@@ -665,6 +856,146 @@ int Camera::setSetting(SettingType set_type, int v)
     return control_device(m_name, set.tag, m_fd, &control);
 }
 
+void Camera::initialize_control(ControlType type)
+{
+    assert(type >= 0 && type < CONTROL_MAX);
+
+    int res = 0;
+    struct v4l2_queryctrl queryctrl;
+    memset(&queryctrl, 0, sizeof(queryctrl));
+    queryctrl.id = m_controls[type].vl_id;
+
+    res = query_device(m_name, m_controls[type].tag, m_fd, &queryctrl);
+
+    m_controls[type].err = res;
+
+    if (!res) {
+        m_controls[type].min  = queryctrl.minimum;
+        m_controls[type].max  = queryctrl.maximum;
+        m_controls[type].def  = queryctrl.default_value;
+    }
+}
+
+Camera::Setting Camera::getControlInfo(ControlType type) const
+{
+    if (m_buffers && type >= 0 && type < CONTROL_MAX)
+        return m_controls[type];
+
+    Setting tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.err = EINVAL;
+    return tmp;
+}
+
+int Camera::setControls(const Controls &controls)
+{
+    if (!m_buffers)
+        return EINVAL;
+    if (m_synthetic >= 0)
+        return ENODEV;
+
+    struct v4l2_ext_control items[CONTROL_MAX];
+    int types[CONTROL_MAX];
+    uint32_t count = 0;
+
+    memset(items, 0, sizeof(items));
+
+    for (int i = 0; i < CONTROL_MAX; ++i) {
+
+        if (!(controls.mask & (1u << i)))
+            continue;
+
+        const Setting &set = m_controls[i];
+        if (set.err) {
+            logger(LOG_WARN, "%s %s not supported, skipped", m_name, set.tag);
+            continue;
+        }
+
+        int32_t v = controls.values[i];
+        if (v < set.min)
+            v = set.min;
+        if (v > set.max)
+            v = set.max;
+
+        items[count].id = set.vl_id;
+        items[count].value = v;
+        types[count] = i;
+        ++count;
+    }
+
+    if (!count)
+        return 0;
+
+    struct v4l2_ext_controls ext;
+    memset(&ext, 0, sizeof(ext));
+
+    // mixes user and camera class controls
+    ext.which       = V4L2_CTRL_WHICH_CUR_VAL;
+    ext.count       = count;
+    ext.controls    = items;
+
+    int res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_S_EXT_CTRLS, &ext));
+    if (res) {
+        res = errno;
+        const char *tag = ext.error_idx < count ? m_controls[types[ext.error_idx]].tag : "N/A";
+        logger(LOG_ERROR, "%s VIDIOC_S_EXT_CTRLS (%s) errno=%d", m_name, tag, res);
+        return res;
+    }
+
+    return 0;
+}
+
+int Camera::getControls(Controls &controls)
+{
+    if (!m_buffers)
+        return EINVAL;
+    if (m_synthetic >= 0)
+        return ENODEV;
+
+    struct v4l2_ext_control items[CONTROL_MAX];
+    int types[CONTROL_MAX];
+    uint32_t count = 0;
+
+    memset(items, 0, sizeof(items));
+
+    for (int i = 0; i < CONTROL_MAX; ++i) {
+
+        if (!(controls.mask & (1u << i)))
+            continue;
+
+        if (m_controls[i].err) {
+            controls.mask &= ~(1u << i);
+            continue;
+        }
+
+        items[count].id = m_controls[i].vl_id;
+        types[count] = i;
+        ++count;
+    }
+
+    if (!count)
+        return 0;
+
+    struct v4l2_ext_controls ext;
+    memset(&ext, 0, sizeof(ext));
+
+    ext.which       = V4L2_CTRL_WHICH_CUR_VAL;
+    ext.count       = count;
+    ext.controls    = items;
+
+    int res = HANDLE_EINTR(::ioctl(m_fd, VIDIOC_G_EXT_CTRLS, &ext));
+    if (res) {
+        res = errno;
+        logger(LOG_ERROR, "%s VIDIOC_G_EXT_CTRLS errno=%d", m_name, res);
+        return res;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+        controls.values[types[i]] = items[i].value;
+
+    return 0;
+}
+
 Camera::Setting Camera::getSetting(SettingType set_type) const
 {
     if (m_buffers && set_type >= 0 && set_type < SETTING_MAX)
@@ -10,12 +10,27 @@
 #define __CAMERA__H__
 
 #include "common.h"
+#include "image.h"
+#include "modes.h"
+#include "jpeg.h"
+#include "synthetic.h"
 
 #include <stdint.h>
 #include <string.h>
 
+struct v4l2_buffer;
+
 namespace robo {
 
+// Device names SYNTHETIC_DEVICE "0" (left) and "1" (right) open a
+// SyntheticScene camera instead, YUYV paced at the mode's frame rate (or
+// a new frame on every wait with m_free_running). No controls,
+// everything else behaves like a device.
+#define SYNTHETIC_DEVICE "synthetic:"
+
+// 0/1 for a synthetic camera name, -1 otherwise
+int get_synthetic_camera(const char *name);
+
 class Camera
 {
 public:
@@ -30,6 +45,27 @@ public:
         SETTING_MAX
     };
 
+    // Applied together with one VIDIOC_S_EXT_CTRLS, in this order, so an
+    // auto mode is switched off before its manual value is written.
+    enum ControlType {
+        CONTROL_EXPOSURE_AUTO,          // V4L2_EXPOSURE_MANUAL / _APERTURE_PRIORITY
+        CONTROL_EXPOSURE_AUTO_PRIORITY, // 1 lets the camera drop fps for exposure
+        CONTROL_EXPOSURE_ABSOLUTE,      // 100 usec units
+        CONTROL_GAIN,
+        CONTROL_FOCUS_AUTO,
+        CONTROL_FOCUS_ABSOLUTE,
+        CONTROL_WHITE_BALANCE_AUTO,
+        CONTROL_WHITE_BALANCE_TEMPERATURE,
+        CONTROL_POWER_LINE_FREQUENCY,   // V4L2_CID_POWER_LINE_FREQUENCY_*
+        CONTROL_MAX
+    };
+
+    // mask has a (1 << ControlType) bit for every value to get/set
+    struct Controls {
+        uint32_t    mask;
+        int32_t     values[CONTROL_MAX];
+    };
+
     struct Buffer {
         void    *start;
         size_t  length;
@@ -44,39 +80,91 @@ public:
         int         err;
     };
 
-    int             m_width_h;
+    int             m_width;
     int             m_height;
-    unsigned char   *m_data;
+    int             m_bytesperline;
+    CaptureMode     m_mode;         // what the driver gave us
+    Image           m_frame;        // last captured YUYV frame
+    uint8_t         *m_jpeg;        // last captured MJPEG frame
+    size_t          m_jpeg_size;
+    size_t          m_jpeg_capacity;
+    JpegDecoder     m_decoder;
+    uint64_t        m_decode_usec;  // duration of the last decode
+    uint32_t        m_sequence;     // driver sequence of m_frame
+    uint64_t        m_timestamp_usec;
+    uint64_t        m_skipped;      // stale frames dropped by capture()
+    uint64_t        m_start_usec;   // initialize()/resume() time
+    uint64_t        m_first_frame_usec; // time from m_start_usec to first frame
+    bool            m_paused;
     int             m_fd;
     const char      *m_name;
+    int             m_synthetic;    // get_synthetic_camera() of m_name
+    SyntheticScene  m_scene;
+    uint64_t        m_next_frame_usec;  // synthetic frame due
+    bool            m_free_running; // synthetic frames are not paced, set before initialize()
 
     Buffer          *m_buffers;
     Setting         m_settings[SETTING_MAX];
+    Setting         m_controls[CONTROL_MAX];
 
     Camera();
     ~Camera();
 
     int initialize(const char *name, int w, int h, int fps = 30);
+    int initialize(const char *name, const CaptureMode &mode);
     void shutdown();
     int update(uint64_t now);
 
-    int toIplImage(unsigned char *buf, int width) const;
-    int toGrayScaleIplImage(unsigned char *buf, int width) const;
-    int toGrayScaleMat(unsigned char *buf, int channels, int cols) const;
-    int toMat(unsigned char *buf, int channels, int cols) const;
+    // Blocks up to timeout_msec for a frame, then captures the newest.
+    int wait_frame(int timeout_msec);
+
+    // Stops/restarts streaming, buffers and format stay as they are.
+    int pause();
+    int resume();
+    bool is_paused() const { return m_paused; }
+
+    // touches the capture buffers, see robo::prefault()
+    void prefault();
+
+    const ImageView &frame() const { return m_frame.view(); }
+    bool is_compressed() const { return m_jpeg != NULL; }
+
+    int toBGR(const ImageView &dst);
+
+    // dst may be 1/2 or 1/4 of the frame size, MJPEG frames then use
+    // DCT scaling and YUYV frames are decimated.
+    int toGrayScale(const ImageView &dst);
 
     Setting getSetting(SettingType set_type) const;
     int setSetting(SettingType set_type, int v);
 
+    // Batched extended controls, safe to call while streaming. Controls
+    // the device does not support are dropped from the mask (and logged),
+    // values are clamped to the queried range.
+    Setting getControlInfo(ControlType type) const;
+    int setControls(const Controls &controls);
+    int getControls(Controls &controls);
+
 private:
     int start_capture();
     int init_mmap();
     int open_cam_device();
-    int initialize_device(int fps);
+    int initialize_device(uint32_t interval_num, uint32_t interval_den);
     int capture();
+    int initialize_synthetic();
+    int capture_synthetic();
+    uint64_t get_synthetic_interval_usec() const;
+    int dequeue(struct v4l2_buffer &buf);
+    int requeue(struct v4l2_buffer &buf);
+    void copy_frame(const Buffer &buffer, size_t bytesused);
+    void copy_jpeg(const Buffer &buffer, size_t bytesused);
     void initialize_setting(SettingType set_type);
+    void initialize_control(ControlType type);
 };
 
+// Luma of both cameras, MJPEG frames are decoded in parallel.
+int to_grayscale_pair(Camera &c1, Camera &c2, const ImageView &g1, const ImageView &g2);
+
 } // namespace robo
 
 #endif // __CAMERA__H__
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "codec.h"
+#include "stereo.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace robo {
+
+typedef int16_t v8s16 __attribute__((vector_size(16)));
+
+static const int g_lanes = 8;
+
+// token ranges, see proto::EncodedDisparity
+static const int g_max_zeros = 0x40;
+static const unsigned g_pair = 0x40;
+static const unsigned g_pair_max = 7;      // per value of a pair
+static const unsigned g_small = 0x7f;
+static const unsigned g_medium = 0xc0;
+static const unsigned g_medium_base = 65;
+static const unsigned g_large = 0xff;
+
+static inline v8s16 load(const int16_t *p)
+{
+    v8s16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store(int16_t *p, v8s16 v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+// every lane set
+static inline bool all_set(v8s16 v)
+{
+    uint64_t half[2];
+    memcpy(half, &v, sizeof(half));
+    return (half[0] & half[1]) == ~(uint64_t) 0;
+}
+
+static inline unsigned zigzag(int16_t v)
+{
+    return (uint16_t) ((uint16_t) v << 1 ^ (uint16_t) (v >> 15));
+}
+
+static inline int16_t unzigzag(unsigned z)
+{
+    return (int16_t) ((z >> 1) ^ (0u - (z & 1)));
+}
+
+static inline uint8_t *put_varint(uint8_t *out, unsigned v)
+{
+    while (v >= 0x80) {
+        *out++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *out++ = (uint8_t) v;
+    return out;
+}
+
+static inline bool get_varint(const uint8_t *&in, const uint8_t *end, unsigned &v)
+{
+    v = 0;
+    for (int shift = 0; shift < 21; shift += 7) {
+        if (in == end)
+            return false;
+        const uint8_t b = *in++;
+        v |= (unsigned) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline uint8_t *put_zeros(uint8_t *out, unsigned &zeros)
+{
+    while (zeros) {
+        const unsigned n = zeros < (unsigned) g_max_zeros ? zeros : g_max_zeros;
+        *out++ = (uint8_t) (n - 1);
+        zeros -= n;
+    }
+    return out;
+}
+
+static inline uint8_t *put_value(uint8_t *out, unsigned z)
+{
+    if (z <= g_medium - g_small - 1) {
+        *out++ = (uint8_t) (g_small + z);
+    }
+    else if (z - g_medium_base < (g_large - g_medium) << 8) {
+        const unsigned v = z - g_medium_base;
+        *out++ = (uint8_t) (g_medium + (v >> 8));
+        *out++ = (uint8_t) v;
+    }
+    else {
+        *out++ = (uint8_t) g_large;
+        *out++ = (uint8_t) z;
+        *out++ = (uint8_t) (z >> 8);
+    }
+    return out;
+}
+
+// Codes count deltas of a valid run. Zero runs carry over to the next
+// run, pairs of small values stay within this one.
+static uint8_t *put_values(uint8_t *out, const int16_t *delta, int count, unsigned &zeros)
+{
+    const v8s16 zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    int i = 0;
+    while (i < count) {
+        // flat surfaces, 8 pixels equal to the row above
+        if (i + g_lanes <= count && all_set(load(delta + i) == zero)) {
+            zeros += g_lanes;
+            i += g_lanes;
+            continue;
+        }
+
+        const unsigned z = zigzag(delta[i]);
+        const bool last = i + 1 == count;
+
+        // a lone zero is better off in a pair
+        if (!z && (last || !delta[i + 1])) {
+            ++zeros;
+            ++i;
+            continue;
+        }
+
+        if (!last && z <= g_pair_max) {
+            const unsigned z1 = zigzag(delta[i + 1]);
+            if (z1 <= g_pair_max) {
+                out = put_zeros(out, zeros);
+                *out++ = (uint8_t) (g_pair + (z << 3) + z1);
+                i += 2;
+                continue;
+            }
+        }
+
+        if (z) {
+            out = put_zeros(out, zeros);
+            out = put_value(out, z);
+        }
+        else {
+            ++zeros;
+        }
+        ++i;
+    }
+    return out;
+}
+
+DisparityEncoder::DisparityEncoder()
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+size_t DisparityEncoder::size() const
+{
+    return sizeof(m_header) + m_header.mask_size + m_header.value_size;
+}
+
+int DisparityEncoder::encode(const ImageView &disp, struct iovec *iov)
+{
+    if (disp.format != PIX_FMT_DISP16 || disp.empty() || disp.width > UINT16_MAX ||
+        disp.height > UINT16_MAX)
+        return 0;
+
+    const int w = disp.width;
+    const int h = disp.height;
+
+    // Image rows hold whole vectors, see IMAGE_ALIGN
+    const int padded = (w + g_lanes - 1) & ~(g_lanes - 1);
+    m_above.assign(padded, 0);
+    m_delta.resize(padded);
+
+    // worst case, 3 byte runs and 3 byte values
+    m_mask.resize((size_t) h * (w + 1) * 3);
+    m_values.resize((size_t) h * w * 3);
+
+    uint8_t *mask = &m_mask[0];
+    uint8_t *out = &m_values[0];
+    unsigned zeros = 0;
+
+    const v8s16 zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    int16_t *above = &m_above[0];
+    int16_t *delta = &m_delta[0];
+
+    for (int y = 0; y < h; ++y) {
+        const int16_t *row = disp.row_as<int16_t>(y);
+
+        for (int x = 0; x < padded; x += g_lanes) {
+            const v8s16 d = load(row + x);
+            const v8s16 a = load(above + x);
+            const v8s16 filled = d >= zero ? d : a;
+            store(delta + x, filled - a);
+            store(above + x, filled);
+        }
+
+        int x = 0;
+        while (x < w) {
+            int start = x;
+            while (x < w && row[x] < 0)
+                ++x;
+            mask = put_varint(mask, x - start);
+            if (x == w)
+                break;
+
+            start = x;
+            while (x < w && row[x] >= 0)
+                ++x;
+            mask = put_varint(mask, x - start);
+            out = put_values(out, delta + start, x - start, zeros);
+        }
+    }
+    out = put_zeros(out, zeros);
+
+    m_header.width      = w;
+    m_header.height     = h;
+    m_header.mask_size  = mask - &m_mask[0];
+    m_header.value_size = out - &m_values[0];
+
+    iov[0].iov_base = &m_header;
+    iov[0].iov_len  = sizeof(m_header);
+    iov[1].iov_base = &m_mask[0];
+    iov[1].iov_len  = m_header.mask_size;
+    iov[2].iov_base = &m_values[0];
+    iov[2].iov_len  = m_header.value_size;
+    return 3;
+}
+
+namespace {
+
+struct ValueReader
+{
+    const uint8_t   *in;
+    const uint8_t   *end;
+    unsigned        zeros;      // pending of the last zero run
+
+    // count deltas into out, false if the values ran out
+    bool read(int16_t *out, int count)
+    {
+        while (count > 0) {
+            if (zeros) {
+                const int n = (int) zeros < count ? (int) zeros : count;
+                memset(out, 0, n * sizeof(*out));
+                out += n;
+                count -= n;
+                zeros -= n;
+                continue;
+            }
+            if (in == end)
+                return false;
+
+            const unsigned token = *in++;
+            unsigned z = 0;
+
+            if (token < g_max_zeros) {
+                zeros = token + 1;
+                continue;
+            }
+            if (token < g_small + 1) {
+                if (count < 2)
+                    return false;
+                *out++ = unzigzag((token - g_pair) >> 3);
+                *out++ = unzigzag((token - g_pair) & 7);
+                count -= 2;
+                continue;
+            }
+            if (token < g_medium) {
+                z = token - g_small;
+            }
+            else if (token < g_large) {
+                if (in == end)
+                    return false;
+                z = (((token - g_medium) << 8) | *in++) + g_medium_base;
+            }
+            else {
+                if (end - in < 2)
+                    return false;
+                z = in[0] | (unsigned) in[1] << 8;
+                in += 2;
+            }
+            *out++ = unzigzag(z);
+            --count;
+        }
+        return true;
+    }
+};
+
+} // namespace
+
+int decode_disparity(const void *data, size_t size, Image &disp)
+{
+    proto::EncodedDisparity header;
+    if (size < sizeof(header))
+        return EPROTO;
+
+    memcpy(&header, data, sizeof(header));
+    if (!header.width || !header.height ||
+        sizeof(header) + (uint64_t) header.mask_size + header.value_size != size)
+        return EPROTO;
+
+    const int w = header.width;
+    const int h = header.height;
+    if (disp.allocate(w, h, PIX_FMT_DISP16))
+        return ENOMEM;
+
+    const uint8_t *mask = (const uint8_t *) data + sizeof(header);
+    const uint8_t *mask_end = mask + header.mask_size;
+
+    ValueReader values;
+    values.in       = mask_end;
+    values.end      = mask_end + header.value_size;
+    values.zeros    = 0;
+
+    const int padded = (w + g_lanes - 1) & ~(g_lanes - 1);
+    std::vector<int16_t> above(padded, 0);
+    std::vector<int16_t> delta(padded, 0);
+    std::vector<int16_t> valid(padded, 0);
+
+    const v8s16 invalid = { DISP_INVALID, DISP_INVALID, DISP_INVALID, DISP_INVALID,
+                            DISP_INVALID, DISP_INVALID, DISP_INVALID, DISP_INVALID };
+    const v8s16 zero = { 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    for (int y = 0; y < h; ++y) {
+
+        int x = 0;
+        bool is_valid = false;
+        while (x < w) {
+            unsigned run = 0;
+            if (!get_varint(mask, mask_end, run) || run > (unsigned) (w - x))
+                return EPROTO;
+
+            if (is_valid) {
+                if (!values.read(&delta[x], run))
+                    return EPROTO;
+            }
+            else {
+                memset(&delta[x], 0, run * sizeof(int16_t));
+            }
+            for (unsigned i = 0; i < run; ++i)
+                valid[x + i] = is_valid ? -1 : 0;
+
+            x += run;
+            is_valid = !is_valid;
+        }
+
+        int16_t *out = disp.view().row_as<int16_t>(y);
+        for (x = 0; x < padded; x += g_lanes) {
+            const v8s16 filled = load(&above[x]) + load(&delta[x]);
+            store(&above[x], filled);
+            store(out + x, load(&valid[x]) != zero ? filled : invalid);
+        }
+    }
+
+    if (mask != mask_end || values.in != values.end || values.zeros)
+        return EPROTO;
+    return 0;
+}
+
+} // namespace robo
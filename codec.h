@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __CODEC__H__
+#define __CODEC__H__
+
+#include "image.h"
+#include "proto.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct iovec;
+
+namespace robo {
+
+// proto::ENCODING_DELTA_RLE encoder for PAYLOAD_DISP16, see
+// proto::EncodedDisparity for the format. Disparity is piecewise smooth
+// and mostly valid in large blocks: the mask is a few runs per row and
+// most values are within a pixel or two of the one above, a byte each
+// or less in zero runs.
+//
+// The prediction (fill invalid from above, difference to the row
+// above) runs 8 pixels per vector op on both ends, what is left serial
+// is one token per valid pixel.
+class DisparityEncoder
+{
+public:
+    DisparityEncoder();
+
+    // iov[0] gets the header, iov[1] the mask, iov[2] the values.
+    // Returns the iovec count, 0 if disp is not PIX_FMT_DISP16.
+    int encode(const ImageView &disp, struct iovec *iov);
+
+    // of the last encode(), header included
+    size_t size() const;
+
+private:
+    proto::EncodedDisparity     m_header;
+    std::vector<int16_t>        m_above;    // invalid filled, previous row
+    std::vector<int16_t>        m_delta;
+    std::vector<uint8_t>        m_mask;
+    std::vector<uint8_t>        m_values;
+};
+
+// Decodes an ENCODING_DELTA_RLE payload into disp, allocated to the
+// encoded geometry. EPROTO if the payload is malformed.
+int decode_disparity(const void *data, size_t size, Image &disp);
+
+} // namespace robo
+
+#endif // __CODEC__H__
@@ -7,6 +7,7 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
 
 namespace robo {
 
@@ -36,4 +37,11 @@ void logger(LogLevel logLevel, const char *format, ...)
     printf("\n");
 }
 
+uint64_t get_time_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 } // namespace robo
\ No newline at end of file
@@ -15,6 +15,8 @@
     _result;                                \
 })
 
+#include <stdint.h>
+
 namespace robo {
 
 enum LogLevel
@@ -28,6 +30,9 @@ enum LogLevel
 
 void logger(LogLevel logLevel, const char *format, ...);
 
+// CLOCK_MONOTONIC, same clock v4l2 stamps buffers with.
+uint64_t get_time_usec();
+
 
 } // namespace robo
 
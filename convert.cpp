@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2009 Giacomo Spigler
+ * 2013 - George Jordanov - improve in performance for HSV conversion and improvements
+ * 2016 - Tolga Ceylan - ported to robot code, moved out of robo::Camera
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "convert.h"
+
+#include <errno.h>
+
+namespace robo {
+
+// YUV to RGB coefficients in 16.16 fixed point (same as the old double
+// tables: 1.370705, 1.732446, 0.698001, 0.337633). A few integer ops per
+// pixel pair are cheaper than 4 x 64K table lookups thrashing the cache,
+// and there is nothing to build at startup.
+enum {
+    CONVERT_SHIFT   = 16,
+    CONVERT_ROUND   = 1 << (CONVERT_SHIFT - 1),
+    CONVERT_RV      = 89830,
+    CONVERT_BU      = 113538,
+    CONVERT_GV      = 45744,
+    CONVERT_GU      = 22127,
+};
+
+static inline unsigned char clamp_u8(int v)
+{
+    return (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+int yuyv_to_bgr(const ImageView &src, const ImageView &dst)
+{
+    if (src.format != PIX_FMT_YUYV || dst.format != PIX_FMT_BGR24)
+        return EINVAL;
+    if (!src.same_size(dst) || (src.width & 1) || src.empty() || dst.empty())
+        return EINVAL;
+
+    const int w2 = src.width / 2;
+    const int h  = src.height;
+
+    for (int y = 0; y < h; ++y) {
+
+        const uint8_t *in = src.row(y);
+        uint8_t *out = dst.row(y);
+
+        for (int x = 0; x < w2; ++x, in += 4, out += 6) {
+
+            const int y0 = in[0];
+            const int u  = in[1] - 128;
+            const int y1 = in[2];
+            const int v  = in[3] - 128;
+
+            // chroma is shared by the pixel pair
+            const int db = (CONVERT_BU * u + CONVERT_ROUND) >> CONVERT_SHIFT;
+            const int dg = (CONVERT_GV * v + CONVERT_GU * u + CONVERT_ROUND) >> CONVERT_SHIFT;
+            const int dr = (CONVERT_RV * v + CONVERT_ROUND) >> CONVERT_SHIFT;
+
+            out[0] = clamp_u8(y0 + db);
+            out[1] = clamp_u8(y0 - dg);
+            out[2] = clamp_u8(y0 + dr);
+
+            out[3] = clamp_u8(y1 + db);
+            out[4] = clamp_u8(y1 - dg);
+            out[5] = clamp_u8(y1 + dr);
+        }
+    }
+
+    return 0;
+}
+
+int yuyv_to_gray(const ImageView &src, const ImageView &dst)
+{
+    if (src.format != PIX_FMT_YUYV || dst.format != PIX_FMT_GRAY8)
+        return EINVAL;
+    if (src.empty() || dst.empty())
+        return EINVAL;
+
+    // 1:1 or decimation by 2/4 (matches the MJPEG DCT scaled sizes)
+    const int scale = src.width / dst.width;
+    if ((scale != 1 && scale != 2 && scale != 4) ||
+        (src.width + scale - 1) / scale != dst.width ||
+        (src.height + scale - 1) / scale != dst.height)
+        return EINVAL;
+
+    const int w = dst.width;
+    const int h = dst.height;
+    const int step = 2 * scale;
+
+    if (scale == 1 && src.is_aligned() && dst.is_aligned()) {
+        for (int y = 0; y < h; ++y) {
+            const uint8_t *in = (const uint8_t *) __builtin_assume_aligned(src.row(y), IMAGE_ALIGN);
+            uint8_t *out = (uint8_t *) __builtin_assume_aligned(dst.row(y), IMAGE_ALIGN);
+
+            for (int x = 0; x < w; ++x)
+                out[x] = in[2 * x];
+        }
+        return 0;
+    }
+
+    for (int y = 0; y < h; ++y) {
+        const uint8_t *in = src.row(y * scale);
+        uint8_t *out = dst.row(y);
+
+        for (int x = 0; x < w; ++x)
+            out[x] = in[step * x];
+    }
+
+    return 0;
+}
+
+} // namespace robo
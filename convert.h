@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2009 Giacomo Spigler
+ * 2013 - George Jordanov - improve in performance for HSV conversion and improvements
+ * 2016 - Tolga Ceylan - ported to robot code, moved out of robo::Camera
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __CONVERT__H__
+#define __CONVERT__H__
+
+#include "image.h"
+
+namespace robo {
+
+// Pixel format conversion kernels. Geometry and formats are validated
+// once per call (EINVAL on mismatch), the per row loops assume src/dst
+// have identical width/height. Output padding bytes are not touched.
+
+int yuyv_to_bgr(const ImageView &src, const ImageView &dst);
+
+// dst may also be 1/2 or 1/4 of src in both dimensions (decimation).
+int yuyv_to_gray(const ImageView &src, const ImageView &dst);
+
+} // namespace robo
+
+#endif // __CONVERT__H__
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __CV_ADAPTER__H__
+#define __CV_ADAPTER__H__
+
+#include "image.h"
+
+#include <cv.h>
+
+namespace robo {
+
+//
+// Zero-copy wrappers to hand robo::Image memory to OpenCV at the edges
+// (display, debug dumps). Only include this from translation units that
+// already depend on OpenCV, the rest of the module stays OpenCV free.
+// The returned headers borrow the pixel memory, the view must outlive them.
+//
+
+static inline int get_cv_channels(PixelFormat format)
+{
+    switch (format)
+    {
+        case PIX_FMT_YUYV:  return 2;
+        case PIX_FMT_GRAY8: return 1;
+        case PIX_FMT_BGR24: return 3;
+        default: break;
+    }
+    return 0;
+}
+
+static inline IplImage *to_ipl_header(const ImageView &view, IplImage *hdr)
+{
+    const int channels = get_cv_channels(view.format);
+    if (!hdr || view.empty() || !channels)
+        return NULL;
+
+    cvInitImageHeader(hdr, cvSize(view.width, view.height), IPL_DEPTH_8U,
+        channels, IPL_ORIGIN_TL, 4);
+    cvSetData(hdr, view.data, view.stride);
+    return hdr;
+}
+
+} // namespace robo
+
+#endif // __CV_ADAPTER__H__
@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "governor.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace robo {
+
+// Cheapest last. Halving the luma halves the disparities of the same
+// depths, the range follows so the nearest depth seen stays put. The
+// range never shrinks on its own: near objects beyond it would be
+// matched to a wrong, smaller disparity rather than dropped.
+static const GovernorStep g_steps[] = {
+    { 1, 100, false, 1 },
+    { 2,  50, false, 1 },
+    { 2,  50, true,  1 },
+    { 2,  50, true,  2 },
+    { 4,  25, true,  2 },
+};
+
+static const int g_levels = sizeof(g_steps) / sizeof(g_steps[0]);
+
+// weight of a new busy time in a level's estimate
+static const double g_level_weight = 0.2;
+
+int get_governor_levels()
+{
+    return g_levels;
+}
+
+const GovernorStep &get_governor_step(int level)
+{
+    assert(level >= 0 && level < g_levels);
+    return g_steps[level];
+}
+
+void get_default_governor_config(GovernorConfig &config)
+{
+    config.high_load            = 0.9;
+    config.low_load             = 0.6;
+    config.down_frames          = 5;
+    config.up_frames            = 30;
+    config.settle_frames        = 10;
+    config.max_queued           = 1;
+    config.thermal_path         = "/sys/class/thermal/thermal_zone0/temp";
+    config.hot_mdeg             = 75000;
+    config.cool_mdeg            = 70000;
+    config.thermal_period_msec  = 1000;
+    config.retry_usec           = 30000000;
+}
+
+Governor::Governor(const GovernorConfig &config)
+    :
+    m_changes(0),
+    m_skipped(0),
+    m_config(config),
+    m_level(0),
+    m_over(0),
+    m_under(0),
+    m_settle(0),
+    m_requests(0),
+    m_temperature_mdeg(0),
+    m_thermal_fd(-1),
+    m_thermal_usec(0),
+    m_load(0.0)
+{
+    static_assert(g_levels <= (int) (sizeof(m_level_usec) / sizeof(m_level_usec[0])), "levels");
+
+    memset(m_level_usec, 0, sizeof(m_level_usec));
+    memset(m_level_seen_usec, 0, sizeof(m_level_seen_usec));
+
+    // opened here, not on the main loop
+    if (m_config.thermal_path)
+        m_thermal_fd = HANDLE_EINTR(::open(m_config.thermal_path, O_RDONLY | O_CLOEXEC));
+}
+
+Governor::~Governor()
+{
+    if (m_thermal_fd != -1)
+        ::close(m_thermal_fd);
+}
+
+void Governor::read_temperature(uint64_t now_usec)
+{
+    if (!m_config.thermal_path)
+        return;
+    if (m_thermal_usec && now_usec - m_thermal_usec < (uint64_t) m_config.thermal_period_msec * 1000)
+        return;
+    const bool first = !m_thermal_usec;
+    m_thermal_usec = now_usec;
+
+    if (m_thermal_fd == -1)
+        m_thermal_fd = HANDLE_EINTR(::open(m_config.thermal_path, O_RDONLY | O_CLOEXEC));
+
+    // sysfs makes up the value again on each read from offset 0, one
+    // syscall and no stdio buffers
+    char buf[32];
+    ssize_t len = -1;
+    if (m_thermal_fd != -1)
+        len = HANDLE_EINTR(::pread(m_thermal_fd, buf, sizeof(buf) - 1, 0));
+
+    char *end = buf;
+    long mdeg = 0;
+    if (len > 0) {
+        buf[len] = '\0';
+        mdeg = strtol(buf, &end, 10);
+    }
+    if (end == buf || mdeg < INT32_MIN || mdeg > INT32_MAX) {
+        // once, not every period on boards without the zone
+        if (first || m_temperature_mdeg)
+            logger(LOG_INFO, "governor cannot read %s, temperature unknown", m_config.thermal_path);
+        mdeg = 0;
+    }
+
+    m_temperature_mdeg = (int) mdeg;
+}
+
+void Governor::change(int level, const char *reason)
+{
+    const GovernorStep &step = get_governor_step(level);
+
+    logger(LOG_WARN, "governor level %d -> %d (%s load %.2f temp %d): luma 1/%d range %d%% coarse %d every %d",
+        m_level, level, reason, m_load, m_temperature_mdeg,
+        step.luma_scale, step.range_percent, step.coarse, step.process_every);
+
+    m_level     = level;
+    m_over      = 0;
+    m_under     = 0;
+    m_settle    = m_config.settle_frames;
+    m_requests  = 0;
+    ++m_changes;
+}
+
+void Governor::revert(int level)
+{
+    assert(level >= 0 && level < g_levels);
+    if (level != m_level)
+        change(level, "not applied");
+}
+
+bool Governor::update(uint64_t now_usec, uint64_t busy_usec, double interval_usec, int queued)
+{
+    read_temperature(now_usec);
+
+    // skipped requests leave their time to the processed one
+    const double budget = interval_usec * step().process_every;
+    m_load = budget > 0.0 ? busy_usec / budget : 0.0;
+
+    double &estimate = m_level_usec[m_level];
+    estimate = estimate ? estimate + g_level_weight * (busy_usec - estimate) : busy_usec;
+    m_level_seen_usec[m_level] = now_usec;
+
+    const bool thermal = m_config.thermal_path && m_temperature_mdeg;
+    const bool hot = thermal && m_temperature_mdeg >= m_config.hot_mdeg;
+    const bool warm = thermal && m_temperature_mdeg >= m_config.cool_mdeg;
+
+    const bool over = m_load > m_config.high_load || queued > m_config.max_queued || hot;
+    const bool room = m_load < m_config.low_load && !queued && !warm;
+
+    m_over = over ? m_over + 1 : 0;
+    m_under = room ? m_under + 1 : 0;
+
+    if (m_settle > 0) {
+        --m_settle;
+        return false;
+    }
+
+    if (m_over >= m_config.down_frames && m_level + 1 < g_levels) {
+        change(m_level + 1, hot ? "hot" : (queued > m_config.max_queued ? "queue" : "slow"));
+        return true;
+    }
+
+    if (m_under >= m_config.up_frames && m_level > 0) {
+        const int up = m_level - 1;
+        const double up_budget = interval_usec * get_governor_step(up).process_every;
+
+        // the level above did not fit last time, it will not now either
+        const bool stale = now_usec - m_level_seen_usec[up] > m_config.retry_usec;
+        if (!m_level_usec[up] || stale || m_level_usec[up] < m_config.high_load * up_budget) {
+            change(up, "headroom");
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Governor::process_next()
+{
+    const int every = step().process_every;
+    const bool process = m_requests == 0;
+
+    m_requests = every > 1 ? (m_requests + 1) % every : 0;
+    if (!process)
+        ++m_skipped;
+    return process;
+}
+
+} // namespace robo
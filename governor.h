@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __GOVERNOR__H__
+#define __GOVERNOR__H__
+
+#include <stdint.h>
+
+namespace robo {
+
+// What the pipeline does at one governor level. Levels go from 0 (the
+// configured processing) down to get_governor_levels() - 1, each
+// cheaper than the one before.
+struct GovernorStep
+{
+    int     luma_scale;         // processing at 1/luma_scale of the capture size
+    int     range_percent;      // of the configured disparity range
+    bool    coarse;             // AnytimeMatcher coarse tier only
+    int     process_every;      // n'th request is processed, the rest get the last map
+};
+
+int get_governor_levels();
+const GovernorStep &get_governor_step(int level);
+
+struct GovernorConfig
+{
+    // busy time of a frame (frame ready to response sent) per target
+    // frame interval: above high_load is overloaded, below low_load
+    // has room for the level above
+    double      high_load;
+    double      low_load;
+
+    int         down_frames;    // consecutive overloaded frames to step down
+    int         up_frames;      // consecutive frames with room to step up
+    int         settle_frames;  // no change for this many frames after one
+    int         max_queued;     // more requests waiting count as overloaded
+
+    // millidegrees C like /sys/class/thermal/thermal_zone*/temp, NULL
+    // to ignore temperature. At or above hot_mdeg is overloaded, no step
+    // up until below cool_mdeg.
+    const char  *thermal_path;
+    int         hot_mdeg;
+    int         cool_mdeg;
+    int         thermal_period_msec;
+
+    // a level found too slow is not retried until this much later
+    uint64_t    retry_usec;
+};
+
+void get_default_governor_config(GovernorConfig &config);
+
+// Closed loop load governor. Fed every processed frame's busy time, the
+// request queue and the SoC temperature, it steps the pipeline down a
+// level while it falls behind the target frame rate and back up when it
+// has headroom again, with hysteresis on both ways. Each level's busy
+// time is remembered, a step up is only tried if the level above fit
+// last time (or retry_usec passed), so a loaded system does not
+// oscillate between two levels.
+class Governor
+{
+public:
+    explicit Governor(const GovernorConfig &config);
+    ~Governor();
+
+    // One processed frame. Returns true if the level changed, the
+    // caller then applies step().
+    bool update(uint64_t now_usec, uint64_t busy_usec, double interval_usec, int queued);
+
+    // The caller could not apply step(), back to level. Settles before
+    // the next change like any other.
+    void revert(int level);
+
+    // Per CMD_GET_MAP, false for the ones answered from the last map.
+    bool process_next();
+
+    int level() const { return m_level; }
+    const GovernorStep &step() const { return get_governor_step(m_level); }
+
+    // last reading, 0 without a thermal_path
+    int temperature_mdeg() const { return m_temperature_mdeg; }
+
+    // last frame's busy time per frame interval
+    double load() const { return m_load; }
+
+public:
+    uint64_t    m_changes;      // level changes
+    uint64_t    m_skipped;      // requests answered from the last map
+
+private:
+    Governor(const Governor &);
+    Governor &operator=(const Governor &);
+
+    void read_temperature(uint64_t now_usec);
+    void change(int level, const char *reason);
+
+private:
+    GovernorConfig  m_config;
+    int             m_level;
+    int             m_over;         // consecutive overloaded frames
+    int             m_under;        // consecutive frames with room
+    int             m_settle;       // frames until the next change
+    int             m_requests;     // since the last processed one
+    int             m_temperature_mdeg;
+    int             m_thermal_fd;   // kept open, -1 until it opens
+    uint64_t        m_thermal_usec; // last reading
+    double          m_load;
+    double          m_level_usec[8];        // busy time per level, 0 unknown
+    uint64_t        m_level_seen_usec[8];   // when it was measured
+};
+
+} // namespace robo
+
+#endif // __GOVERNOR__H__
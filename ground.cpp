@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "ground.h"
+#include "reproject.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+namespace robo {
+
+void get_level_plane(float camera_height_mm, Plane &plane)
+{
+    plane.n[0] = 0.0f;
+    plane.n[1] = -1.0f;
+    plane.n[2] = 0.0f;
+    plane.d = camera_height_mm;
+}
+
+void get_default_ground_config(GroundConfig &config)
+{
+    config.sample_stride        = 16;
+    config.max_samples          = 2048;
+    config.inlier_mm            = 25.0f;
+    config.floor_mm             = 40.0f;
+    config.min_inliers          = 64;
+    config.seeded_iterations    = 4;
+    config.max_iterations       = 64;
+    config.max_tilt_deg         = 30.0f;
+}
+
+GroundPlane::GroundPlane(const GroundConfig &config)
+    :
+    m_config(config),
+    m_valid(false),
+    m_iterations(0),
+    m_inliers(0),
+    m_rng(0x2545f491),
+    m_samples((size_t) config.max_samples * 3)
+{
+    assert(config.sample_stride > 0);
+    assert(config.max_samples >= 3);
+
+    get_level_plane(0.0f, m_plane);
+}
+
+uint32_t GroundPlane::random()
+{
+    // xorshift32, deterministic so runs are reproducible
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return m_rng;
+}
+
+int GroundPlane::count_inliers(const Plane &plane) const
+{
+    const float *p = &m_samples[0];
+    const int n = samples();
+    const float band = m_config.inlier_mm;
+
+    int count = 0;
+    for (int i = 0; i < n; ++i, p += 3)
+        count += fabsf(plane.distance(p[0], p[1], p[2])) < band;
+    return count;
+}
+
+bool GroundPlane::make_plane(const float *a, const float *b, const float *c, Plane &plane) const
+{
+    const float u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+    const float v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+    float n[3] = {
+        u[1] * v[2] - u[2] * v[1],
+        u[2] * v[0] - u[0] * v[2],
+        u[0] * v[1] - u[1] * v[0],
+    };
+
+    const float len = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len < 1e-3f)
+        return false;
+
+    // up is -y
+    const float sign = n[1] > 0.0f ? -1.0f : 1.0f;
+    for (int i = 0; i < 3; ++i)
+        plane.n[i] = sign * n[i] / len;
+    plane.d = -(plane.n[0] * a[0] + plane.n[1] * a[1] + plane.n[2] * a[2]);
+
+    // mostly horizontal and below the camera
+    return -plane.n[1] >= cosf(m_config.max_tilt_deg * (float) M_PI / 180.0f) && plane.d > 0.0f;
+}
+
+bool GroundPlane::refit(const Plane &plane, Plane &refined) const
+{
+    // least squares y = a x + b z + c over the inliers
+    double sxx = 0, sxz = 0, sx = 0, szz = 0, sz = 0, n = 0;
+    double sxy = 0, szy = 0, sy = 0;
+
+    const float *p = &m_samples[0];
+    const int count = samples();
+
+    for (int i = 0; i < count; ++i, p += 3) {
+        if (fabsf(plane.distance(p[0], p[1], p[2])) >= m_config.inlier_mm)
+            continue;
+        const double x = p[0], y = p[1], z = p[2];
+        sxx += x * x; sxz += x * z; sx += x;
+        szz += z * z; sz += z; n += 1;
+        sxy += x * y; szy += z * y; sy += y;
+    }
+
+    if (n < 3)
+        return false;
+
+    // Cramer's rule on the 3x3 normal equations
+    const double det =
+        sxx * (szz * n - sz * sz) - sxz * (sxz * n - sz * sx) + sx * (sxz * sz - szz * sx);
+    if (fabs(det) < 1e-9)
+        return false;
+
+    const double a =
+        (sxy * (szz * n - sz * sz) - sxz * (szy * n - sz * sy) + sx * (szy * sz - szz * sy)) / det;
+    const double b =
+        (sxx * (szy * n - sy * sz) - sxy * (sxz * n - sz * sx) + sx * (sxz * sy - szy * sx)) / det;
+    const double c = (sy - a * sx - b * sz) / n;
+
+    // a x - y + b z + c = 0
+    const double len = sqrt(a * a + 1.0 + b * b);
+    refined.n[0] = (float) (a / len);
+    refined.n[1] = (float) (-1.0 / len);
+    refined.n[2] = (float) (b / len);
+    refined.d = (float) (c / len);
+
+    return refined.d > 0.0f;
+}
+
+int GroundPlane::fit(const Reprojector &points)
+{
+    m_iterations = 0;
+    m_inliers = 0;
+
+    // spread the samples over the whole cloud, floor is at the bottom
+    const uint32_t total = points.count();
+    uint32_t stride = m_config.sample_stride;
+    if (total / stride > (uint32_t) m_config.max_samples)
+        stride = (total + m_config.max_samples - 1) / m_config.max_samples;
+
+    m_samples.clear();
+    for (int i = 0; i < points.num_bands(); ++i) {
+        uint32_t count = 0;
+        const int16_t *p = points.get_band(i, count);
+        for (uint32_t j = 0; j < count; j += stride) {
+            const int16_t *q = p + 3 * j;
+            if (q[1] <= 0)  // above the camera
+                continue;
+            if (m_samples.size() >= (size_t) m_config.max_samples * 3)
+                break;
+            m_samples.push_back(q[0]);
+            m_samples.push_back(q[1]);
+            m_samples.push_back(q[2]);
+        }
+    }
+
+    const int n = samples();
+    if (n < m_config.min_inliers) {
+        m_valid = false;
+        return ENOENT;
+    }
+
+    Plane best;
+    int best_inliers = 0;
+
+    if (m_valid) {
+        best = m_plane;
+        best_inliers = count_inliers(best);
+    }
+
+    const int rounds = m_valid && best_inliers >= m_config.min_inliers ?
+        m_config.seeded_iterations : m_config.max_iterations;
+
+    for (int i = 0; i < rounds; ++i) {
+        const float *a = &m_samples[3 * (random() % n)];
+        const float *b = &m_samples[3 * (random() % n)];
+        const float *c = &m_samples[3 * (random() % n)];
+
+        Plane candidate;
+        if (!make_plane(a, b, c, candidate))
+            continue;
+
+        const int inliers = count_inliers(candidate);
+        if (inliers > best_inliers) {
+            best = candidate;
+            best_inliers = inliers;
+        }
+    }
+
+    m_iterations = rounds;
+
+    Plane refined;
+    if (best_inliers < m_config.min_inliers || !refit(best, refined)) {
+        m_valid = false;
+        return ENOENT;
+    }
+
+    m_plane = refined;
+    m_inliers = count_inliers(refined);
+    m_valid = true;
+    return 0;
+}
+
+} // namespace robo
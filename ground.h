@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __GROUND__H__
+#define __GROUND__H__
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+class Reprojector;
+
+// n . p + d = 0, n unit length pointing up (away from the floor), so
+// n . p + d is the height of p above the plane and d the camera height.
+struct Plane
+{
+    float   n[3];
+    float   d;
+
+    float distance(float x, float y, float z) const { return n[0] * x + n[1] * y + n[2] * z + d; }
+};
+
+// Level camera camera_height_mm above the floor (y is down).
+void get_level_plane(float camera_height_mm, Plane &plane);
+
+struct GroundConfig
+{
+    int     sample_stride;      // every n'th point below the camera
+    int     max_samples;
+    float   inlier_mm;          // RANSAC/refit inlier band
+    float   floor_mm;           // points below this height are floor
+    int     min_inliers;
+    int     seeded_iterations;  // RANSAC rounds next to last frame's plane
+    int     max_iterations;     // RANSAC rounds without a usable seed
+    float   max_tilt_deg;       // normal vs. camera up, rejects walls
+};
+
+void get_default_ground_config(GroundConfig &config);
+
+// Floor plane fit on a subsample of the point cloud. Last frame's plane
+// competes with a few random 3 point candidates, only when it stops
+// explaining enough points the full RANSAC runs. The winner is refined
+// by least squares on its inliers.
+class GroundPlane
+{
+public:
+    explicit GroundPlane(const GroundConfig &config);
+
+    // ENOENT if no plane was found, valid() is false until one is.
+    int fit(const Reprojector &points);
+    void reset() { m_valid = false; }
+
+    bool valid() const { return m_valid; }
+    const Plane &plane() const { return m_plane; }
+
+    // last fit()
+    int iterations() const { return m_iterations; }
+    int inliers() const { return m_inliers; }
+    int samples() const { return (int) m_samples.size() / 3; }
+
+private:
+    int count_inliers(const Plane &plane) const;
+    bool make_plane(const float *a, const float *b, const float *c, Plane &plane) const;
+    bool refit(const Plane &plane, Plane &refined) const;
+    uint32_t random();
+
+private:
+    GroundConfig        m_config;
+    Plane               m_plane;
+    bool                m_valid;
+    int                 m_iterations;
+    int                 m_inliers;
+    uint32_t            m_rng;
+    std::vector<float>  m_samples;  // xyz
+};
+
+} // namespace robo
+
+#endif // __GROUND__H__
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "image.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace robo {
+
+int get_pixel_size(PixelFormat format)
+{
+    switch (format)
+    {
+        case PIX_FMT_YUYV:  return 2;
+        case PIX_FMT_GRAY8: return 1;
+        case PIX_FMT_BGR24: return 3;
+        case PIX_FMT_DISP16: return 2;
+        default: break;
+    }
+    return 0;
+}
+
+const char *get_pixel_format_str(PixelFormat format)
+{
+    switch (format)
+    {
+        case PIX_FMT_YUYV:  return "YUYV";
+        case PIX_FMT_GRAY8: return "GRAY8";
+        case PIX_FMT_BGR24: return "BGR24";
+        case PIX_FMT_DISP16: return "DISP16";
+        default: break;
+    }
+    return "NONE";
+}
+
+ImageView::ImageView()
+    :
+    data(NULL),
+    width(0),
+    height(0),
+    stride(0),
+    format(PIX_FMT_NONE)
+{
+}
+
+ImageView::ImageView(uint8_t *d, int w, int h, int s, PixelFormat f)
+    :
+    data(d),
+    width(w),
+    height(h),
+    stride(s),
+    format(f)
+{
+}
+
+bool ImageView::is_aligned() const
+{
+    return !((uintptr_t) data % IMAGE_ALIGN) && !(stride % IMAGE_ALIGN);
+}
+
+ImageView ImageView::sub_rows(int y, int rows) const
+{
+    assert(y >= 0 && rows >= 0 && y + rows <= height);
+    return ImageView(row(y), width, rows, stride, format);
+}
+
+Image::Image()
+{
+}
+
+Image::~Image()
+{
+    release();
+}
+
+int Image::allocate(int width, int height, PixelFormat format)
+{
+    assert(width > 0);
+    assert(height > 0);
+
+    const int pix_size = get_pixel_size(format);
+    if (!pix_size)
+        return EINVAL;
+
+    if (m_view.data &&
+        m_view.width == width &&
+        m_view.height == height &&
+        m_view.format == format)
+        return 0;
+
+    release();
+
+    const size_t stride = align_up((size_t) width * pix_size, IMAGE_ALIGN);
+    void *ptr = NULL;
+
+    int res = ::posix_memalign(&ptr, IMAGE_ALIGN, stride * height);
+    if (res) {
+        logger(LOG_ERROR, "Image::allocate %dx%d %s res=%d",
+            width, height, get_pixel_format_str(format), res);
+        return ENOMEM;
+    }
+
+    m_view = ImageView((uint8_t *) ptr, width, height, (int) stride, format);
+    return 0;
+}
+
+void Image::release()
+{
+    if (m_view.data)
+        ::free(m_view.data);
+    m_view = ImageView();
+}
+
+} // namespace robo
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __IMAGE__H__
+#define __IMAGE__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace robo {
+
+enum PixelFormat {
+    PIX_FMT_NONE,
+    PIX_FMT_YUYV,       // 2 bytes per pixel, Y0 U Y1 V macro pixels
+    PIX_FMT_GRAY8,      // 1 byte per pixel
+    PIX_FMT_BGR24,      // 3 bytes per pixel
+    PIX_FMT_DISP16,     // int16_t disparity, see stereo.h
+    PIX_FMT_MAX
+};
+
+// Every Image row starts on IMAGE_ALIGN boundary and the stride is a
+// multiple of IMAGE_ALIGN, which means kernels can always process full
+// IMAGE_ALIGN byte chunks per row without any tail handling. Contents of
+// the padding bytes are undefined.
+const size_t IMAGE_ALIGN = 32;
+
+int get_pixel_size(PixelFormat format);
+const char *get_pixel_format_str(PixelFormat format);
+
+// Non-owning view on pixel memory. Cheap to copy, pass by value or
+// const ref. Views created from Image carry the IMAGE_ALIGN guarantee,
+// views wrapped around foreign memory (eg. mmap'ed v4l2 buffers) may
+// not, see is_aligned().
+struct ImageView
+{
+    uint8_t         *data;
+    int             width;
+    int             height;
+    int             stride;     // bytes between rows
+    PixelFormat     format;
+
+    ImageView();
+    ImageView(uint8_t *data, int width, int height, int stride, PixelFormat format);
+
+    bool empty() const { return !data; }
+    bool is_aligned() const;
+    bool same_size(const ImageView &other) const
+    {
+        return width == other.width && height == other.height;
+    }
+
+    size_t row_bytes() const { return (size_t) width * get_pixel_size(format); }
+    size_t size() const { return (size_t) stride * height; }
+
+    uint8_t *row(int y) const { return data + (size_t) y * stride; }
+
+    template <typename T>
+    T *row_as(int y) const { return (T *) (data + (size_t) y * stride); }
+
+    // rows [y, y + rows) of this view, shares memory.
+    ImageView sub_rows(int y, int rows) const;
+};
+
+// Owning image with IMAGE_ALIGN aligned rows. Non-copyable, allocate once
+// at startup and reuse, allocate() is a no-op if the geometry matches.
+class Image
+{
+public:
+    Image();
+    ~Image();
+
+    int allocate(int width, int height, PixelFormat format);
+    void release();
+
+    const ImageView &view() const { return m_view; }
+    uint8_t *data() const { return m_view.data; }
+    int width() const { return m_view.width; }
+    int height() const { return m_view.height; }
+    int stride() const { return m_view.stride; }
+    PixelFormat format() const { return m_view.format; }
+    bool empty() const { return m_view.empty(); }
+
+private:
+    Image(const Image &);
+    Image &operator=(const Image &);
+
+    ImageView   m_view;
+};
+
+static inline size_t align_up(size_t v, size_t align)
+{
+    return (v + align - 1) & ~(align - 1);
+}
+
+} // namespace robo
+
+#endif // __IMAGE__H__
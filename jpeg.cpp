@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "jpeg.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+namespace robo {
+
+//
+// UVC MJPEG frames usually come without DHT markers, the device relies
+// on the default tables of the JPEG spec (ITU T.81 K.3). We install them
+// when the frame does not carry its own.
+//
+static const UINT8 g_dc_luma_bits[17] =
+    { 0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const UINT8 g_dc_chroma_bits[17] =
+    { 0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const UINT8 g_dc_vals[12] =
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const UINT8 g_ac_luma_bits[17] =
+    { 0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const UINT8 g_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const UINT8 g_ac_chroma_bits[17] =
+    { 0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const UINT8 g_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+struct JpegError
+{
+    struct jpeg_error_mgr   mgr;
+    jmp_buf                 jump;
+};
+
+struct JpegState
+{
+    struct jpeg_decompress_struct   cinfo;
+    JpegError                       error;
+};
+
+static void on_jpeg_error(j_common_ptr cinfo)
+{
+    JpegError *error = (JpegError *) cinfo->err;
+
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    logger(LOG_ERROR, "JpegDecoder %s", msg);
+
+    longjmp(error->jump, 1);
+}
+
+static void on_jpeg_message(j_common_ptr cinfo, int level)
+{
+    // corrupt data warnings are common on a busy bus, keep them quiet
+    if (level < 0)
+        logger(LOG_TRACE, "JpegDecoder warning %d", cinfo->err->msg_code);
+}
+
+static void set_huff_table(j_decompress_ptr cinfo, JHUFF_TBL **slot,
+                           const UINT8 *bits, const UINT8 *vals, size_t num_vals)
+{
+    if (*slot)
+        return;
+
+    *slot = jpeg_alloc_huff_table((j_common_ptr) cinfo);
+    memcpy((*slot)->bits, bits, sizeof((*slot)->bits));
+    memcpy((*slot)->huffval, vals, num_vals);
+    (*slot)->sent_table = FALSE;
+}
+
+static void set_default_huff_tables(j_decompress_ptr cinfo)
+{
+    set_huff_table(cinfo, &cinfo->dc_huff_tbl_ptrs[0], g_dc_luma_bits, g_dc_vals, sizeof(g_dc_vals));
+    set_huff_table(cinfo, &cinfo->dc_huff_tbl_ptrs[1], g_dc_chroma_bits, g_dc_vals, sizeof(g_dc_vals));
+    set_huff_table(cinfo, &cinfo->ac_huff_tbl_ptrs[0], g_ac_luma_bits, g_ac_luma_vals, sizeof(g_ac_luma_vals));
+    set_huff_table(cinfo, &cinfo->ac_huff_tbl_ptrs[1], g_ac_chroma_bits, g_ac_chroma_vals, sizeof(g_ac_chroma_vals));
+}
+
+JpegDecoder::JpegDecoder()
+    :
+    m_state(NULL)
+{
+}
+
+JpegDecoder::~JpegDecoder()
+{
+    shutdown();
+}
+
+int JpegDecoder::initialize()
+{
+    if (m_state)
+        return 0;
+
+    m_state = (JpegState *) ::calloc(1, sizeof(*m_state));
+    if (!m_state)
+        return ENOMEM;
+
+    m_state->cinfo.err = jpeg_std_error(&m_state->error.mgr);
+    m_state->error.mgr.error_exit = on_jpeg_error;
+    m_state->error.mgr.emit_message = on_jpeg_message;
+
+    if (setjmp(m_state->error.jump)) {
+        ::free(m_state);
+        m_state = NULL;
+        return EFAULT;
+    }
+
+    jpeg_create_decompress(&m_state->cinfo);
+    return 0;
+}
+
+void JpegDecoder::shutdown()
+{
+    if (!m_state)
+        return;
+
+    jpeg_destroy_decompress(&m_state->cinfo);
+    ::free(m_state);
+    m_state = NULL;
+}
+
+void JpegDecoder::get_scaled_size(int width, int height, int scale, int &scaled_width, int &scaled_height)
+{
+    // libjpeg rounds scaled dimensions up
+    scaled_width = (width + scale - 1) / scale;
+    scaled_height = (height + scale - 1) / scale;
+}
+
+int JpegDecoder::decode_luma(const uint8_t *data, size_t size, int scale, const ImageView &dst)
+{
+    if (dst.format != PIX_FMT_GRAY8)
+        return EINVAL;
+    if (scale != 1 && scale != 2 && scale != 4)
+        return EINVAL;
+    return decode(data, size, scale, true, dst);
+}
+
+int JpegDecoder::decode_bgr(const uint8_t *data, size_t size, const ImageView &dst)
+{
+    if (dst.format != PIX_FMT_BGR24)
+        return EINVAL;
+    return decode(data, size, 1, false, dst);
+}
+
+int JpegDecoder::decode(const uint8_t *data, size_t size, int scale, bool luma, const ImageView &dst)
+{
+    assert(data);
+
+    if (!m_state || dst.empty() || !size)
+        return EINVAL;
+
+    struct jpeg_decompress_struct *cinfo = &m_state->cinfo;
+
+    if (setjmp(m_state->error.jump)) {
+        jpeg_abort_decompress(cinfo);
+        return EBADMSG;
+    }
+
+    jpeg_mem_src(cinfo, (unsigned char *) data, size);
+
+    if (jpeg_read_header(cinfo, TRUE) != JPEG_HEADER_OK) {
+        jpeg_abort_decompress(cinfo);
+        return EBADMSG;
+    }
+
+    set_default_huff_tables(cinfo);
+
+    // grayscale output from YCbCr skips IDCT and color conversion of
+    // the chroma components altogether.
+    cinfo->out_color_space      = luma ? JCS_GRAYSCALE : JCS_EXT_BGR;
+    cinfo->scale_num            = 1;
+    cinfo->scale_denom          = scale;
+    cinfo->dct_method           = JDCT_IFAST;
+    cinfo->do_fancy_upsampling  = FALSE;
+    cinfo->do_block_smoothing   = FALSE;
+
+    jpeg_start_decompress(cinfo);
+
+    if ((int) cinfo->output_width != dst.width || (int) cinfo->output_height != dst.height) {
+        logger(LOG_ERROR, "JpegDecoder frame %ux%u does not match %dx%d",
+            cinfo->output_width, cinfo->output_height, dst.width, dst.height);
+        jpeg_abort_decompress(cinfo);
+        return EINVAL;
+    }
+
+    // scanlines go straight into dst rows
+    JSAMPROW rows[16];
+    const int max_rows = cinfo->rec_outbuf_height < 16 ? cinfo->rec_outbuf_height : 16;
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+
+        const int y = cinfo->output_scanline;
+        int count = dst.height - y;
+        if (count > max_rows)
+            count = max_rows;
+
+        for (int i = 0; i < count; ++i)
+            rows[i] = dst.row(y + i);
+
+        jpeg_read_scanlines(cinfo, rows, count);
+    }
+
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __JPEG__H__
+#define __JPEG__H__
+
+#include "image.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace robo {
+
+struct JpegState;
+
+// MJPEG frame decoder on top of libjpeg. One instance per stream, the
+// decompressor is set up once and reused for every frame. Not thread
+// safe, but two decoders can run in parallel.
+class JpegDecoder
+{
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    int initialize();
+    void shutdown();
+
+    // Decodes the luma plane only (chroma is entropy decoded but never
+    // run through IDCT/upsampling/color conversion). scale is 1, 2 or 4
+    // and uses libjpeg DCT scaling, dst must be GRAY8 of get_scaled_size().
+    int decode_luma(const uint8_t *data, size_t size, int scale, const ImageView &dst);
+
+    // Full color decode, dst must be BGR24 of the frame size.
+    int decode_bgr(const uint8_t *data, size_t size, const ImageView &dst);
+
+    static void get_scaled_size(int width, int height, int scale, int &scaled_width, int &scaled_height);
+
+private:
+    JpegDecoder(const JpegDecoder &);
+    JpegDecoder &operator=(const JpegDecoder &);
+
+    int decode(const uint8_t *data, size_t size, int scale, bool luma, const ImageView &dst);
+
+private:
+    JpegState   *m_state;
+};
+
+} // namespace robo
+
+#endif // __JPEG__H__
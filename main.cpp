@@ -5,11 +5,33 @@
 #include "common.h"
 #include "camera.h"
 #include "server.h"
+#include "image.h"
+#include "modes.h"
+#include "rig.h"
+#include "pipeline.h"
+#include "parallel.h"
+#include "realtime.h"
+#include "governor.h"
+#include "alloc.h"
+#include "recorder.h"
+#include "preview.h"
+#include "cv_adapter.h"
 
 #include <cv.h>
 #include <highgui.h>
 
+#include <linux/videodev2.h>
+
 #include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+
+#include <vector>
+#include <thread>
 
 #ifdef __arm__
 #define RASPBERRY
@@ -18,50 +40,782 @@
 using namespace robo;
 
 // these should goto config.json/yaml
+// where clients connect, -U for another one (eg. a test run next to
+// the real module)
 const char *UDS_PATH = "/tmp/robo.vision.s";
 
+// clients connect over TCP on this port instead of UDS_PATH, 0 off (-t)
+int tcp_port = 0;
+
+// "host:port,..." of strip workers sharing the disparity (-o)
+const char *offload_workers = NULL;
+
+// Runtime profile, see RuntimeProfile. Capture and serving run on the
+// main loop: pinned to main_cpu (-c), SCHED_FIFO at fifo_priority (-f).
+// Pool workers run on worker_cpus (-p, eg. "1-3"). lock_memory (-m)
+// mlockall()s and prefaults the frame buffers at startup.
+int main_cpu = -1;
+const char *worker_cpus = NULL;
+int fifo_priority = 0;
+bool lock_memory = false;
+
 const char *VIDEO_0 = "/dev/video0";
 const char *VIDEO_1 = "/dev/video1";
 
-const char *VIDEO_0_IMG = "img1.png";
-const char *VIDEO_1_IMG = "img2.png";
-
 /*
 int ww = 800;
 int hh = 600;
 */
 int ww = 640;
 int hh = 480;
+int fps = 15;
+
+// how often delivered fps is checked against the negotiated mode
+uint64_t throughput_window_usec = 5000000;
+
+// luma is decoded at 1/luma_scale size, MJPEG decode may take at most
+// this fraction of the frame interval before we scale down further.
+// max_luma_scale is the most JpegDecoder::decode_luma() scales by.
+int luma_scale = 1;
+const int max_luma_scale = 4;
+double decode_budget = 0.5;
+
+// Steps resolution, disparity range, engine and frame rate down while
+// processing falls behind the capture rate or the SoC runs hot, see
+// Governor. thermal_path (-T) may point at a stand-in file. The
+// governor's luma scale multiplies the decode one, up to max_luma_scale.
+bool governor_enabled = true;
+const char *thermal_path = "/sys/class/thermal/thermal_zone0/temp";
+int governor_luma_scale = 1;
+
+// SyntheticScene cameras at ww x hh @ fps instead of VIDEO_0/VIDEO_1,
+// runs (and measures) the whole loop without hardware (-S)
+bool synthetic = false;
+// and every wait gets a new frame, as fast as the loop goes (-F)
+bool synthetic_free = false;
+
+// A frame that allocates after steady_warmup frames of its kind is
+// counted in CMD_STATS. Strict (-A) makes it fatal: logged with the per
+// thread counts and the loop exits with ENOMEM. See SteadyCheck.
+int steady_warmup = 30;
+bool steady_strict = false;
+
+// Binary record of every CMD_GET_MAP in an mmap()ed ring, see
+// FlightRecorder, tools/flight_decode dumps it as CSV. -R sets the file,
+// an empty one turns it off. By default it is robo.flight in
+// $XDG_RUNTIME_DIR, private to the user, or in /var/lib/robo (which has
+// to exist) without one.
+const char *flight_path = NULL;
+int flight_records = 8192;      // 9 minutes at 15 fps
+
+// Debug preview off the request loop, see Preview: a window on desktop
+// builds (-H turns it off), the latest composite as a PPM at
+// preview_snapshot (-P path), eg. on a headless Pi.
+#ifdef RASPBERRY
+bool preview_window = false;
+#else
+bool preview_window = true;
+#endif
+const char *preview_snapshot = NULL;
+
+// identical manual exposure/focus/gain/white balance on both cameras
+bool rig_lock = true;
+
+// keep streaming while no client is connected (and across server
+// restarts), a new client's first frame is then one frame interval
+// away instead of a full bring-up. Cold standby pauses the cameras.
+bool warm_standby = true;
+
+int capture_timeout_msec = 2000;
+
+// occupancy grid region (mm, left camera frame: x right, y down, z
+// forward) used when a request does not specify one, 8m x 8m in front of
+// the robot. Voxel queries without one get the whole map.
+int32_t roi_default_min[3] = { -4000, -1500, 0 };
+int32_t roi_default_max[3] = { 4000, 1500, 8000 };
+
+static int start_server(Server &srv)
+{
+    return tcp_port ? srv.initialize_tcp(NULL, tcp_port) : srv.initialize(UDS_PATH);
+}
+
+// -w: no cameras, disparity strips for a capture node's StripScheduler
+static int run_worker(int port)
+{
+    StripWorker worker;
+
+    int res = worker.initialize(NULL, port);
+    return res ? res : worker.run();
+}
+
+// Luma is processed at 1/scale of the capture size: the decode scale
+// (luma_scale, raised when MJPEG decode runs over decode_budget) times
+// the governor's (governor_luma_scale), at most max_luma_scale.
+static int get_luma_scale()
+{
+    const int scale = luma_scale * governor_luma_scale;
+    return scale < max_luma_scale ? scale : max_luma_scale;
+}
+
+// (Re)allocates the luma pair for a w x h capture at get_luma_scale().
+static int allocate_luma(int w, int h, Image &g1, Image &g2)
+{
+    const int scale = get_luma_scale();
+
+    int sw = 0;
+    int sh = 0;
+    JpegDecoder::get_scaled_size(w, h, scale, sw, sh);
+
+    int res = g1.allocate(sw, sh, PIX_FMT_GRAY8);
+    return res ? res : g2.allocate(sw, sh, PIX_FMT_GRAY8);
+}
+
+// Restarts both cameras in the given mode and sizes images accordingly.
+static int start_cameras(Camera &c1, Camera &c2, const CaptureMode &mode, Image &g1, Image &g2)
+{
+    c1.shutdown();
+    c2.shutdown();
+
+    // S_FMT alone can take hundreds of ms on UVC, bring both up at once
+    int res2 = 0;
+    std::thread right([&]() { res2 = c2.initialize(VIDEO_1, mode); });
 
-int max_attempts = 100;
-int attemp_sleep_usec = 1000;
+    int res = c1.initialize(VIDEO_0, mode);
+    right.join();
 
-int main() {
+    res = res ? res : res2;
+    if (res) {
+        c1.shutdown();
+        c2.shutdown();
+    }
+
+    if (!res && !c1.m_mode.same(c2.m_mode))
+        logger(LOG_WARN, "cameras disagree on mode %dx%d vs %dx%d",
+            c1.m_width, c1.m_height, c2.m_width, c2.m_height);
+
+    // images are needed even without cameras (PING only operation)
+    const int w = res ? mode.width : c1.m_width;
+    const int h = res ? mode.height : c1.m_height;
+
+    return allocate_luma(w, h, g1, g2) ? ENOMEM : res;
+}
+
+// frame buffers of a camera (re)start, before the first frame needs them
+static void prefault_frames(Camera &c1, Camera &c2, Image &g1, Image &g2)
+{
+    c1.prefault();
+    c2.prefault();
+
+    Image *images[2] = { &g1, &g2 };
+    for (int i = 0; i < 2; ++i)
+        prefault(images[i]->data(), images[i]->view().size());
+}
+
+#ifndef RASPBERRY
+struct PreviewWindow
+{
+    const char  *name;
+    bool        created;
+};
+
+// Preview sink, on the preview thread. HighGUI windows belong to the
+// thread that runs their event loop, so it is created and destroyed
+// here. ESC stops.
+static bool show_preview(void *ctx, const ImageView &bgr)
+{
+    PreviewWindow *window = (PreviewWindow *) ctx;
+
+    if (bgr.empty()) {
+        if (window->created)
+            cvDestroyWindow(window->name);
+        window->created = false;
+        return true;
+    }
+
+    if (!window->created) {
+        cvNamedWindow(window->name, CV_WINDOW_AUTOSIZE);
+        window->created = true;
+    }
+
+    IplImage ipl;
+    cvShowImage(window->name, to_ipl_header(bgr, &ipl));
+    return (cvWaitKey(1) & 255) != 27;
+}
+#endif
+
+static uint64_t get_first_frame_usec(const Camera &c1, const Camera &c2)
+{
+    return c1.m_first_frame_usec > c2.m_first_frame_usec ?
+        c1.m_first_frame_usec : c2.m_first_frame_usec;
+}
+
+// Waits for the first frame on both cameras, returns the slower one's
+// bring-up (or resume) to first frame time.
+static uint64_t wait_first_frame(Camera &c1, Camera &c2)
+{
+    int res = c1.wait_frame(capture_timeout_msec);
+    res = res ? res : c2.wait_frame(capture_timeout_msec);
+    if (res) {
+        logger(LOG_WARN, "no first frame res=%d", res);
+        return 0;
+    }
+
+    logger(LOG_INFO, "first frame after %llu usec (left) %llu usec (right)",
+        (unsigned long long) c1.m_first_frame_usec, (unsigned long long) c2.m_first_frame_usec);
+
+    return get_first_frame_usec(c1, c2);
+}
+
+static void pause_cameras(void *ctx)
+{
+    Camera **cameras = (Camera **) ctx;
+
+    logger(LOG_INFO, "no client, pausing cameras");
+    cameras[0]->pause();
+    cameras[1]->pause();
+}
+
+// The step's range assumes its whole luma scale, when max_luma_scale
+// cuts that short the range shrinks only by what was applied so the
+// nearest depth seen stays put.
+static void set_governor_range(const GovernorStep &step, Pipeline &pipeline)
+{
+    const int applied = get_luma_scale() / luma_scale;
+    const int percent = step.range_percent * step.luma_scale / (applied ? applied : 1);
+    pipeline.set_range_percent(percent < 100 ? percent : 100);
+}
+
+// Nothing of step is applied if its luma images cannot be allocated, the
+// old ones are reallocated then (empty if even that failed).
+static int apply_governor_step(const GovernorStep &step, Pipeline &pipeline,
+                               const Camera &c1, Image &g1, Image &g2)
+{
+    // the pipeline follows the luma geometry with the next frame
+    if (governor_luma_scale != step.luma_scale) {
+        const int old_scale = governor_luma_scale;
+        governor_luma_scale = step.luma_scale;
+
+        int res = allocate_luma(c1.m_width, c1.m_height, g1, g2);
+        if (res) {
+            logger(LOG_ERROR, "governor luma 1/%d res=%d, staying at 1/%d",
+                step.luma_scale, res, old_scale);
+            governor_luma_scale = old_scale;
+            allocate_luma(c1.m_width, c1.m_height, g1, g2);
+            return res;
+        }
+    }
+
+    set_governor_range(step, pipeline);
+    pipeline.set_coarse_only(step.coarse);
+    return 0;
+}
+
+// Request's region of interest, all zero picks the whole map for
+// PAYLOAD_VOXELS and the default grid for PAYLOAD_OCCUPANCY.
+static void get_roi(const proto::Request &request, uint32_t payload, VoxelBox &box)
+{
+    bool set = false;
+    for (int i = 0; i < 3; ++i) {
+        box.min[i] = request.roi_min[i];
+        box.max[i] = request.roi_max[i];
+        set = set || box.min[i] || box.max[i];
+    }
+    if (set)
+        return;
+
+    const bool voxels = payload == proto::PAYLOAD_VOXELS;
+    for (int i = 0; i < 3; ++i) {
+        box.min[i] = voxels ? INT32_MIN : roi_default_min[i];
+        box.max[i] = voxels ? INT32_MAX : roi_default_max[i];
+    }
+}
+
+// Payloads served in proto::STEREO_SPARSE, the rest needs dense disparity.
+static bool is_sparse_payload(uint32_t payload)
+{
+    return payload == proto::PAYLOAD_GRAY8 || payload == proto::PAYLOAD_FEATURES;
+}
+
+// Sends the CMD_GET_MAP response with the payload the client asked for.
+static int send_map(Server &srv, const proto::Request &request, proto::Response &response,
+                    uint32_t payload, Pipeline &pipeline, const Image &luma)
+{
+    switch (payload)
+    {
+        case proto::PAYLOAD_GRAY8:
+            response.payload_type = proto::PAYLOAD_GRAY8;
+            return srv.send_response(response, &luma.view());
+
+        case proto::PAYLOAD_DISP16: {
+            response.payload_type = proto::PAYLOAD_DISP16;
+            if (srv.get_encoding() != proto::ENCODING_DELTA_RLE)
+                return srv.send_response(response, &pipeline.disparity());
+
+            struct iovec iov[3];
+            const int count = pipeline.encode_disparity(iov);
+
+            response.payload_encoding = proto::ENCODING_DELTA_RLE;
+            return srv.send_response(response, iov, count);
+        }
+
+        case proto::PAYLOAD_CONFIDENCE:
+            response.payload_type = proto::PAYLOAD_CONFIDENCE;
+            return srv.send_response(response, &pipeline.confidence());
+
+        case proto::PAYLOAD_POINTS: {
+            struct iovec iov[Server::MAX_PAYLOAD_PARTS];
+            const int count = pipeline.points().get_payload(iov, Server::MAX_PAYLOAD_PARTS);
+
+            response.payload_type = proto::PAYLOAD_POINTS;
+            return srv.send_response(response, iov, count);
+        }
+
+        case proto::PAYLOAD_SCAN: {
+            struct iovec iov[2];
+            const int count = pipeline.compute_scan(iov);
+
+            response.payload_type = proto::PAYLOAD_SCAN;
+            return srv.send_response(response, iov, count);
+        }
+
+        case proto::PAYLOAD_VOXELS:
+        case proto::PAYLOAD_OCCUPANCY: {
+            VoxelBox box;
+            get_roi(request, payload, box);
+
+            struct iovec iov[2];
+            const int count = payload == proto::PAYLOAD_VOXELS ?
+                pipeline.query_voxels(box, iov) : pipeline.project_occupancy(box, iov);
+
+            response.payload_type = payload;
+            return srv.send_response(response, iov, count);
+        }
+
+        case proto::PAYLOAD_FEATURES: {
+            struct iovec iov[2];
+            const int count = pipeline.get_features(iov);
+
+            response.payload_type = proto::PAYLOAD_FEATURES;
+            return srv.send_response(response, iov, count);
+        }
+
+        default:
+            break;
+    }
+    return srv.send_response(response);
+}
+
+// CMD_GET_MAP requests with a deadline, and those answered after it
+struct DeadlineCount
+{
+    uint64_t    requests;
+    uint64_t    missed;
+};
+
+static void count_deadline(DeadlineCount &deadlines, uint64_t deadline_usec, uint32_t trx_id)
+{
+    if (!deadline_usec)
+        return;
+
+    ++deadlines.requests;
+    const uint64_t now = get_time_usec();
+    if (now > deadline_usec) {
+        ++deadlines.missed;
+        logger(LOG_DEBUG, "trx_id=%u missed its deadline by %llu usec", trx_id,
+            (unsigned long long) (now - deadline_usec));
+    }
+}
+
+// Buffers are sized on first use, so every new kind of frame (payload,
+// stereo mode, quality tier) and every reconfiguration (capture mode,
+// luma scale, governor level) gets steady_warmup frames to allocate in
+// before its allocations count.
+struct SteadyCheck
+{
+    uint64_t    seen[2];        // frame kinds, see check_steady()
+    int         frames;         // since the last warm up started
+    uint64_t    allocated;      // frames past their warm up that allocated
+};
+
+// false if a frame past its warm up allocated
+static bool check_steady(SteadyCheck &steady, const FrameProbe &probe, uint32_t payload,
+                         bool sparse, int quality)
+{
+    const uint32_t kind = ((payload & 15) << 3 | (sparse ? 4 : 0) | (quality & 3)) & 127;
+    const uint64_t bit = (uint64_t) 1 << (kind & 63);
+    if (!(steady.seen[kind >> 6] & bit)) {
+        steady.seen[kind >> 6] |= bit;
+        steady.frames = 0;
+        return true;
+    }
+    if (++steady.frames <= steady_warmup || !probe.allocs())
+        return true;
+
+    ++steady.allocated;
+    logger(steady_strict ? LOG_ERROR : LOG_WARN,
+        "steady frame allocated %llu times %llu bytes: capture %llu process %llu send %llu",
+        (unsigned long long) probe.allocs(), (unsigned long long) probe.bytes(),
+        (unsigned long long) probe.stage(ALLOC_STAGE_CAPTURE).allocs,
+        (unsigned long long) probe.stage(ALLOC_STAGE_PROCESS).allocs,
+        (unsigned long long) probe.stage(ALLOC_STAGE_SEND).allocs);
+    return false;
+}
+
+// What every CMD_GET_MAP leaves in the flight recorder, the caller adds
+// the frame's durations.
+static void fill_flight_record(FlightRecord &record, const proto::Request &request,
+                               const proto::Response &response, const Server &srv, int queued,
+                               const Camera &c1, const Camera &c2, const Governor &governor,
+                               uint64_t deadline_usec)
+{
+    memset(&record, 0, sizeof(record));
+
+    const uint64_t now = get_time_usec();
+
+    record.time_usec            = now;
+    record.left_timestamp_usec  = response.left_timestamp_usec;
+    record.right_timestamp_usec = response.right_timestamp_usec;
+    record.left_sequence        = response.left_sequence;
+    record.right_sequence       = response.right_sequence;
+    record.trx_id               = request.trx_id;
+    record.skipped              = (uint32_t) (c1.m_skipped + c2.m_skipped);
+    record.payload_size         = (uint32_t) srv.get_sent_payload();
+    record.clients              = (uint32_t) srv.get_accepted();
+    record.queued               = queued > UINT16_MAX ? UINT16_MAX : (uint16_t) queued;
+    record.payload              = (uint8_t) request.payload;
+    record.stereo_mode          = (uint8_t) response.stereo_mode;
+    record.quality              = (uint8_t) response.quality;
+    record.governor_level       = (uint8_t) governor.level();
+
+    if (deadline_usec)
+        record.flags |= FLIGHT_DEADLINE | (now > deadline_usec ? FLIGHT_MISSED : 0);
+}
+
+static void fill_stats(proto::Stats &stats, const Server &srv, const Pipeline &pipeline,
+                       uint64_t frames, uint64_t startup_usec, uint64_t first_frame_usec,
+                       const DeadlineCount &deadlines, const Governor &governor,
+                       const FrameProbe &probe, const SteadyCheck &steady)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    const Histogram &latency = srv.get_latency();
+
+    stats.frames                = frames;
+    stats.latency_count         = latency.count();
+    stats.latency_mean_usec     = (uint32_t) latency.mean();
+    stats.latency_min_usec      = latency.min();
+    stats.latency_max_usec      = latency.max();
+    stats.latency_p50_usec      = latency.percentile(50.0);
+    stats.latency_p99_usec      = latency.percentile(99.0);
+    stats.latency_p999_usec     = latency.percentile(99.9);
+    stats.startup_usec          = startup_usec;
+    stats.first_frame_usec      = first_frame_usec;
+    stats.voxels                = pipeline.map().size();
+    stats.voxels_dropped        = pipeline.map().dropped();
+
+    stats.tiles_recomputed_permille         = (uint32_t) (pipeline.m_tiles_recomputed * 1000.0);
+    stats.tiles_recomputed_mean_permille    = (uint32_t) (pipeline.m_tiles_stat.mean() * 1000.0);
+    stats.search_range_decipx               = (uint32_t) (pipeline.m_search_range * 10.0);
+    stats.search_range_mean_decipx          = (uint32_t) (pipeline.m_search_stat.mean() * 10.0);
+
+    stats.dense_usec            = pipeline.m_dense_usec;
+    stats.dense_mean_usec       = (uint32_t) pipeline.m_dense_stat.mean();
+    stats.sparse_usec           = pipeline.m_sparse_usec;
+    stats.sparse_mean_usec      = (uint32_t) pipeline.m_sparse_stat.mean();
+    stats.sparse_features       = pipeline.features().count();
+    stats.speckle_removed       = pipeline.m_speckle_removed;
+
+    PoolStats pool;
+    get_pool_stats(pool);
+    stats.pool_tasks            = pool.tasks;
+    stats.pool_steals           = pool.steals;
+    stats.pool_parks            = pool.parks;
+
+    stats.offload_workers           = pipeline.offload().connected();
+    stats.offload_remote_permille   = (uint32_t) (pipeline.offload().m_remote_fraction * 1000.0);
+    stats.offload_fallbacks         = pipeline.offload().m_fallbacks;
+
+    stats.encode_usec           = pipeline.m_encode_usec;
+    stats.encoded_permille      = (uint32_t) (pipeline.m_encoded_ratio * 1000.0);
+
+    stats.deadline_requests     = deadlines.requests;
+    stats.deadline_missed       = deadlines.missed;
+    memcpy(stats.quality_frames, pipeline.m_quality_frames, sizeof(stats.quality_frames));
+
+    stats.governor_level            = governor.level();
+    stats.governor_load_permille    = (uint32_t) (governor.load() * 1000.0);
+    stats.governor_changes          = governor.m_changes;
+    stats.governor_skipped          = governor.m_skipped;
+    stats.temperature_mdeg          = governor.temperature_mdeg();
+
+    AllocCount allocs[ALLOC_STAGE_MAX];
+    get_alloc_counts(allocs);
+    for (int i = 0; i < ALLOC_STAGE_MAX; ++i) {
+        stats.allocs[i] = allocs[i].allocs;
+        stats.alloc_bytes += allocs[i].bytes;
+    }
+
+    AllocCount main_thread;
+    get_thread_alloc_count(main_thread);
+    stats.main_thread_allocs    = main_thread.allocs;
+    stats.alloc_threads         = get_alloc_threads();
+    stats.frame_allocs          = (uint32_t) probe.allocs();
+    stats.steady_alloc_frames   = steady.allocated;
+
+    FaultCount faults;
+    get_fault_count(faults);
+    stats.frame_minor_faults    = (uint32_t) probe.minor_faults();
+    stats.frame_major_faults    = (uint32_t) probe.major_faults();
+    stats.minor_faults          = faults.minor;
+    stats.major_faults          = faults.major;
+
+    struct rusage usage;
+    if (!getrusage(RUSAGE_SELF, &usage)) {
+        stats.cpu_usec          = (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+                                  usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        stats.max_rss_kb        = (uint32_t) usage.ru_maxrss;
+    }
+    stats.clients               = (uint32_t) srv.get_clients();
+}
+
+int main(int argc, char **argv) {
+
+    const uint64_t start_usec = get_time_usec();
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "t:U:w:o:c:p:f:mgT:SFAR:HP:")) != -1) {
+        switch (opt)
+        {
+            case 't':
+                tcp_port = atoi(optarg);
+                break;
+            case 'U':
+                UDS_PATH = optarg;
+                break;
+            case 'w':
+                return run_worker(atoi(optarg));
+            case 'o':
+                offload_workers = optarg;
+                break;
+            case 'c':
+                main_cpu = atoi(optarg);
+                break;
+            case 'p':
+                worker_cpus = optarg;
+                break;
+            case 'f':
+                fifo_priority = atoi(optarg);
+                break;
+            case 'm':
+                lock_memory = true;
+                break;
+            case 'g':
+                governor_enabled = false;
+                break;
+            case 'T':
+                thermal_path = optarg;
+                break;
+            case 'S':
+                synthetic = true;
+                break;
+            case 'F':
+                synthetic = true;
+                synthetic_free = true;
+                break;
+            case 'A':
+                steady_strict = true;
+                break;
+            case 'R':
+                flight_path = optarg;
+                break;
+            case 'H':
+                preview_window = false;
+                break;
+            case 'P':
+                preview_snapshot = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-t port | -U uds_path] [-o host:port,...] [-c cpu] [-p cpus] "
+                    "[-f priority] [-m] [-g] [-T thermal_path] [-S] [-F] [-A] [-R flight_path] [-H] [-P snapshot.ppm] | -w port\n", argv[0]);
+                return EINVAL;
+        }
+    }
+
+    log_topology();
+
+    if (synthetic) {
+        VIDEO_0 = SYNTHETIC_DEVICE "0";
+        VIDEO_1 = SYNTHETIC_DEVICE "1";
+        rig_lock = false;
+    }
+
+    RuntimeProfile profile;
+    get_default_runtime_profile(profile);
+    profile.main_cpu        = main_cpu;
+    profile.fifo_priority   = fifo_priority;
+    profile.lock_memory     = lock_memory;
+    profile.prefault        = lock_memory;
+
+    if (worker_cpus && parse_cpu_list(worker_cpus, profile.worker_cpus)) {
+        fprintf(stderr, "bad cpu list %s\n", worker_cpus);
+        return EINVAL;
+    }
+
+    if (main_cpu >= 32) {
+        fprintf(stderr, "bad cpu %d\n", main_cpu);
+        return EINVAL;
+    }
+
+    // under -f the main loop never yields its cpu to a worker
+    if (main_cpu >= 0 && (profile.worker_cpus & (1u << main_cpu))) {
+        fprintf(stderr, "worker cpus %s include the main loop's cpu %d\n",
+            worker_cpus ? worker_cpus : "-", main_cpu);
+        return EINVAL;
+    }
+
+    // carry on without what was not granted, the loop still works
+    apply_runtime_profile(profile);
+
+    // the same goes for the flight recorder
+    FlightRecorder recorder;
+    char default_flight_path[256];
+    if (!flight_path) {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        snprintf(default_flight_path, sizeof(default_flight_path), "%s/robo.flight",
+            dir && *dir ? dir : "/var/lib/robo");
+        flight_path = default_flight_path;
+    }
+    if (*flight_path)
+        recorder.open(flight_path, flight_records);
 
     int res = 0;
     uint64_t iterations = 0;
+    uint64_t frames = 0;
+    uint64_t startup_usec = 0;
+    uint64_t first_frame_usec = 0;
 
     Camera c1;
     Camera c2;
     Server srv;
 
-    res = srv.initialize(UDS_PATH);
+    Camera *cameras[2] = { &c1, &c2 };
+
+    c1.m_free_running = synthetic_free;
+    c2.m_free_running = synthetic_free;
+
+    res = start_server(srv);
     if (res)
         return res;
 
-    /* POC Code Below, pulls two images and saved them. Or if not
-    on raspberry, then displays them. */
+    if (!warm_standby)
+        srv.set_idle_handler(pause_cameras, cameras);
+
+    NegotiatorConfig neg_config;
+    get_default_negotiator_config(neg_config);
+
+    ModeNegotiator negotiator(neg_config);
+    ThroughputMeter meter;
+
+    RigLockConfig rig_config;
+    get_default_rig_lock_config(rig_config);
+
+    RigControl rig(rig_config);
+
+    PipelineConfig pipeline_config;
+    get_default_pipeline_config(pipeline_config);
+    pipeline_config.workers = offload_workers;
+
+    Pipeline pipeline(pipeline_config);
+
+    std::vector<CaptureMode> modes0;
+    std::vector<CaptureMode> modes1;
+    CaptureMode mode;
+
+    memset(&mode, 0, sizeof(mode));
+
+    res = ENODEV;
+    if (!synthetic) {
+        int res1 = 0;
+        std::thread enumerate_right([&]() { res1 = negotiator.enumerate_device(VIDEO_1, modes1); });
+
+        res = negotiator.enumerate_device(VIDEO_0, modes0);
+        enumerate_right.join();
+
+        res = res || res1 || negotiator.negotiate(modes0, modes1, mode);
+        if (res)
+            logger(LOG_WARN, "mode negotiation failed, using %dx%d @ %d fps", ww, hh, fps);
+    }
+    if (res) {
+
+        mode.pixelformat    = V4L2_PIX_FMT_YUYV;
+        mode.width          = ww;
+        mode.height         = hh;
+        mode.interval_num   = 1;
+        mode.interval_den   = fps;
+    }
+
+    Image g1;
+    Image g2;
+
+    res = start_cameras(c1, c2, mode, g1, g2);
+    if (res == ENOMEM) {
+        srv.shutdown();
+        return res;
+    }
+    if (!res) {
+        first_frame_usec = wait_first_frame(c1, c2);
+        if (first_frame_usec) {
+            startup_usec = get_time_usec() - start_usec;
+            logger(LOG_INFO, "startup to first frame pair %llu usec", (unsigned long long) startup_usec);
+        }
+        if (rig_lock)
+            rig.request_lock();
+    }
+
+    if (profile.prefault) {
+        prefault_frames(c1, c2, g1, g2);
+        if (!pipeline.initialize(g1.width(), g1.height()))
+            pipeline.prefault();
+    }
 
-    c1.initialize(VIDEO_0, ww, hh, 15);
-    c2.initialize(VIDEO_1, ww, hh, 15);
+    PreviewConfig preview_config;
+    get_default_preview_config(preview_config);
+    preview_config.snapshot_path = preview_snapshot;
+    if (main_cpu >= 0 && std::thread::hardware_concurrency() > 1)
+        preview_config.cpu_mask = ~(1u << main_cpu);
 
     #ifndef RASPBERRY
-    cvNamedWindow(VIDEO_0, CV_WINDOW_AUTOSIZE);
-    cvNamedWindow(VIDEO_1, CV_WINDOW_AUTOSIZE);
+    PreviewWindow window = { "preview", false };
+    PreviewSink preview_sink = preview_window ? show_preview : NULL;
+    void *preview_ctx = &window;
+    #else
+    PreviewSink preview_sink = NULL;
+    void *preview_ctx = NULL;
     #endif
 
-    IplImage *l1 = cvCreateImage(cvSize(ww, hh), 8, 3);
-    IplImage *l2 = cvCreateImage(cvSize(ww, hh), 8, 3);
+    Preview preview(preview_config);
+    if (preview_sink || preview_snapshot)
+        preview.start(preview_sink, preview_ctx);
+
+    bool last_sparse = false;
+    DeadlineCount deadlines = { 0, 0 };
+
+    GovernorConfig governor_config;
+    get_default_governor_config(governor_config);
+    governor_config.thermal_path = thermal_path;
+
+    Governor governor(governor_config);
+
+    FrameProbe probe;
+    SteadyCheck steady;
+    memset(&steady, 0, sizeof(steady));
+    bool steady_failed = false;
+    bool restarted = false;
+
+    // of the last processed CMD_GET_MAP, reusable if it was a dense map
+    proto::Response last_response;
+    memset(&last_response, 0, sizeof(last_response));
+    bool reusable = false;
 
     while (1) {
 
@@ -70,14 +824,27 @@ int main() {
         proto::Request  request;
         proto::Response response;
 
-        // srv operations can block forever
+        memset(&response, 0, sizeof(response));
+
+        // blocks until a request arrives, stalled clients are closed
+        // after Server::CLIENT_TIMEOUT_MSEC
         res = srv.get_request(request);
+        if (res && warm_standby) {
+            // restart the server only, cameras keep streaming
+            logger(LOG_WARN, "get_request failed res=%d, restarting server", res);
+            srv.shutdown();
+            res = start_server(srv);
+            if (!res)
+                continue;
+        }
         if (res)
             break;
 
+        const uint64_t deadline_usec = request.deadline_usec ?
+            get_time_usec() + request.deadline_usec : 0;
+
         response.trx_id = request.trx_id;
         response.cmd    = request.cmd;
-        response.data   = 0;
 
         if (request.cmd == proto::CMD_PING) {
             // ignore failure, show must go on  
@@ -85,6 +852,27 @@ int main() {
             continue;
         }
 
+        if (request.cmd == proto::CMD_STATS) {
+            proto::Stats stats;
+            fill_stats(stats, srv, pipeline, frames, startup_usec, first_frame_usec, deadlines,
+                governor, probe, steady);
+
+            response.payload_type = proto::PAYLOAD_STATS;
+            srv.send_response(response, &stats, sizeof(stats));
+            continue;
+        }
+
+        if (request.cmd == proto::CMD_SET_ENCODING) {
+            // the only one we have, raw otherwise
+            const uint16_t encoding = request.encodings & (1u << proto::ENCODING_DELTA_RLE) ?
+                proto::ENCODING_DELTA_RLE : proto::ENCODING_RAW;
+            srv.set_encoding(encoding);
+
+            response.payload_encoding = encoding;
+            srv.send_response(response);
+            continue;
+        }
+
         if (request.cmd == proto::CMD_EXIT) {
             logger(LOG_INFO, "Exit cmd received");
             break;
@@ -97,63 +885,234 @@ int main() {
 
         logger(LOG_TRACE, "Loop");
 
+        // sparse is the low power mode, dense requests can still ask
+        // for features on top.
+        const bool sparse = request.stereo_mode == proto::STEREO_SPARSE;
+
+        // the governor skips frames, those get the last map again
+        if (!sparse && reusable && !governor.process_next()) {
+            proto::Response reuse = last_response;
+            reuse.trx_id = request.trx_id;
+            reuse.process_usec = 0;
+
+            send_map(srv, request, reuse, request.payload, pipeline, g1);
+            count_deadline(deadlines, deadline_usec, request.trx_id);
+            ++frames;
+
+            FlightRecord record;
+            fill_flight_record(record, request, reuse, srv, srv.get_queued(), c1, c2, governor,
+                deadline_usec);
+            record.flags |= FLIGHT_REUSED;
+            recorder.write(record);
+            continue;
+        }
+
         // Below is super flawed. Time difference between two captures is important, but
         // for now (in our case where things are not "moving", we are OK). Remember
         // this is an indoor toy robot and we do not expect zipping objects or basketball
         // players, runners, cats, dogs, bees, etc.
 
-        int attempts = max_attempts;
+        probe.begin();
+        set_alloc_stage(ALLOC_STAGE_CAPTURE);
 
-        while (--attempts > 0) {
-            if (!c1.update(0))
-                break;
-            usleep(attemp_sleep_usec);
-        }
-        while (--attempts > 0) {
-            if (!c2.update(0))
-                break;
-            usleep(attemp_sleep_usec);
+        // between frames, streaming keeps going
+        rig.apply(c1, c2, c1.m_mode.fps());
+
+        const bool resumed = c1.is_paused() || c2.is_paused();
+        if (resumed) {
+            c1.resume();
+            c2.resume();
         }
 
-        if (attempts <= 0) {
-            logger(LOG_ERROR, "Failed capturing images in %d attempts", max_attempts);
+        const uint64_t wait_start = get_time_usec();
+
+        res = c1.wait_frame(capture_timeout_msec);
+        res = res ? res : c2.wait_frame(capture_timeout_msec);
+        if (res) {
+            logger(LOG_ERROR, "Failed capturing images res=%d", res);
             break;
         }
 
-        c1.toIplImage((unsigned char *)l1->imageData, l1->width);
-        c2.toIplImage((unsigned char *)l2->imageData, l2->width);
+        const uint64_t frame_ready_usec = get_time_usec();
 
-        #ifndef RASPBERRY
-        cvShowImage(VIDEO_0, l1);
-        cvShowImage(VIDEO_1, l2);
-        if((cvWaitKey(10) & 255) == 27)
-            break;
-        #endif
+        if (resumed)
+            first_frame_usec = get_first_frame_usec(c1, c2);
+
+        res = to_grayscale_pair(c1, c2, g1.view(), g2.view());
+        if (res)
+            logger(LOG_WARN, "luma conversion failed res=%d", res);
+
+        set_alloc_stage(ALLOC_STAGE_PROCESS);
+
+        // luma geometry changes with the mode and the decode scale
+        if (!res && !g1.view().same_size(pipeline.disparity()))
+            res = pipeline.initialize(g1.width(), g1.height());
+
+        const uint64_t process_start = get_time_usec();
+
+        if (!sparse && last_sparse)
+            pipeline.invalidate_prior();
+        last_sparse = sparse;
+
+        if (!res) {
+            if (sparse || request.payload == proto::PAYLOAD_FEATURES)
+                res = pipeline.process_sparse(g1.view(), g2.view());
+            if (!res && !sparse)
+                res = pipeline.process(g1.view(), g2.view(), deadline_usec);
+            if (res)
+                logger(LOG_WARN, "stereo processing failed res=%d", res);
+        }
+
+        response.stereo_mode    = sparse ? proto::STEREO_SPARSE : proto::STEREO_DENSE;
+        response.process_usec   = get_time_usec() - process_start;
+
+        if (!res && !sparse) {
+            response.quality            = pipeline.quality();
+            response.refined_permille   = (uint16_t) (pipeline.refined() * 1000.0);
+        }
+
+        const uint64_t decode_usec = c1.m_decode_usec > c2.m_decode_usec ?
+            c1.m_decode_usec : c2.m_decode_usec;
 
         response.data = iterations; /* dummy, TODO pass actual data here when impl is ready */
+
+        response.left_timestamp_usec    = c1.m_timestamp_usec;
+        response.right_timestamp_usec   = c2.m_timestamp_usec;
+        response.left_sequence          = c1.m_sequence;
+        response.right_sequence         = c2.m_sequence;
+
+        if (!res && !sparse && pipeline.ground().valid()) {
+            const Plane &floor = pipeline.ground().plane();
+            memcpy(response.floor_normal, floor.n, sizeof(response.floor_normal));
+            response.floor_distance = floor.d;
+        }
+
+        uint32_t payload = request.payload;
+        if (res || (sparse && !is_sparse_payload(payload)))
+            payload = proto::PAYLOAD_NONE;
+
+        last_response = response;
+        reusable = !res && !sparse;
+
         // ignore res, show must go on...
-        srv.send_response(response);
+        set_alloc_stage(ALLOC_STAGE_SEND);
+        const uint64_t send_start = get_time_usec();
+        send_map(srv, request, response, payload, pipeline, g1);
+        const uint64_t sent_usec = get_time_usec();
+        ++frames;
+
+        set_alloc_stage(ALLOC_STAGE_OTHER);
+        probe.end();
+
+        if (!check_steady(steady, probe, payload, sparse, response.quality) && steady_strict) {
+            log_alloc_counts();
+            steady_failed = true;
+            break;
+        }
+
+        count_deadline(deadlines, deadline_usec, request.trx_id);
+
+        const int queued = srv.get_queued();
+
+        // after the response, and not while a request waits for its turn
+        if (!queued)
+            preview.publish(g1.view(), g2.view(), res || sparse ? ImageView() : pipeline.disparity(),
+                pipeline.calibration(), c1.m_sequence, c1.m_timestamp_usec, sent_usec);
+        if (preview.quit_requested())
+            break;
+
+        FlightRecord record;
+        fill_flight_record(record, request, response, srv, queued, c1, c2, governor, deadline_usec);
+        record.wait_usec        = (uint32_t) (frame_ready_usec - wait_start);
+        record.luma_usec        = (uint32_t) (process_start - frame_ready_usec);
+        record.process_usec     = (uint32_t) response.process_usec;
+        record.send_usec        = (uint32_t) (sent_usec - send_start);
+        record.busy_usec        = (uint32_t) (sent_usec - frame_ready_usec);
+        record.frame_allocs     = (uint32_t) probe.allocs();
+        record.minor_faults     = (uint32_t) probe.minor_faults();
+        record.result           = res > 255 ? 255 : (uint8_t) res;
+        if (!sparse) {
+            record.stereo_usec      = (uint32_t) pipeline.m_stereo_usec;
+            record.reproject_usec   = (uint32_t) pipeline.m_reproject_usec;
+            record.ground_usec      = (uint32_t) pipeline.m_ground_usec;
+            record.map_usec         = (uint32_t) pipeline.m_map_usec;
+        }
+        if (restarted)
+            record.flags |= FLIGHT_RESTART;
+        restarted = false;
+        recorder.write(record);
+
+        if (governor_enabled && !sparse && !res) {
+            const uint64_t now = get_time_usec();
+            const int level = governor.level();
+            if (governor.update(now, now - frame_ready_usec, 1000000.0 / c1.m_mode.fps(), queued)) {
+                steady.frames = 0;
+                if (apply_governor_step(governor.step(), pipeline, c1, g1, g2)) {
+                    governor.revert(level);
+                    // not even the old geometry, as for a failed camera restart
+                    if (g1.view().empty() || g2.view().empty()) {
+                        logger(LOG_ERROR, "Failed allocating luma");
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (luma_scale < max_luma_scale && decode_usec > decode_budget * 1000000.0 / c1.m_mode.fps()) {
+            luma_scale *= 2;
+            logger(LOG_WARN, "decode took %llu usec, luma scale now 1/%d",
+                (unsigned long long) decode_usec, luma_scale);
+            allocate_luma(c1.m_width, c1.m_height, g1, g2);
+            // less of the governor's scale may fit now
+            set_governor_range(governor.step(), pipeline);
+            steady.frames = 0;
+        }
+
+        double measured_fps = 0.0;
+        if (meter.update(c1.m_sequence, c1.m_timestamp_usec, throughput_window_usec, measured_fps) &&
+            measured_fps < neg_config.min_efficiency * c1.m_mode.fps()) {
+
+            CaptureMode next;
+
+            if (!rig.is_locked()) {
+                // most likely auto exposure stretching frames, lock first
+                logger(LOG_WARN, "delivering %.1f of %.1f fps, locking exposure", measured_fps, c1.m_mode.fps());
+                rig.request_lock();
+            }
+            else {
+                logger(LOG_WARN, "delivering %.1f of %.1f fps, renegotiating", measured_fps, c1.m_mode.fps());
+                negotiator.report_throughput(c1.m_mode, measured_fps);
+
+                if (!negotiator.negotiate(modes0, modes1, next) && !next.same(c1.m_mode)) {
+                    res = start_cameras(c1, c2, next, g1, g2);
+                    meter.reset();
+                    steady.frames = 0;
+                    restarted = true;
+                    if (res) {
+                        logger(LOG_ERROR, "Failed restarting cameras res=%d", res);
+                        break;
+                    }
+                    if (profile.prefault)
+                        prefault_frames(c1, c2, g1, g2);
+                    first_frame_usec = wait_first_frame(c1, c2);
+                    if (rig_lock)
+                        rig.request_lock();
+                }
+            }
+        }
     }
 
     logger(LOG_INFO, "Exiting");
 
-    #ifndef RASPBERRY
-    cvDestroyWindow(VIDEO_0);
-    cvDestroyWindow(VIDEO_1);
-    #else
-    /* DEMO CODE, remove this when impl is ready to send data via srv */
-    cvSaveImage(VIDEO_0_IMG, l1);
-    cvSaveImage(VIDEO_1_IMG, l2);
-    #endif
-
-    cvReleaseImage(&l1);
-    cvReleaseImage(&l2);
+    // the last frame published makes it to the snapshot, the window
+    // goes with the thread
+    preview.stop();
 
     c1.shutdown();
     c2.shutdown();
     srv.shutdown();
 
-    return 0;
+    return steady_failed ? ENOMEM : 0;
 }
 
 
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "modes.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+namespace robo {
+
+// USB 2.0 high speed microframes per second
+const double g_uframes_per_sec = 8000.0;
+
+// Isochronous endpoint packet sizes (bytes per microframe) of the
+// alternate settings a C920 offers. The UVC driver picks the smallest
+// alt setting that fits the stream, so that is what we really reserve.
+static const int g_alt_setting_sizes[] = {
+    192, 384, 512, 640, 800, 944, 1280, 1600, 1984, 2688, 3060,
+};
+
+V4l2DeviceIo::V4l2DeviceIo()
+    :
+    m_fd(-1)
+{
+}
+
+V4l2DeviceIo::~V4l2DeviceIo()
+{
+    close_device();
+}
+
+int V4l2DeviceIo::open_device(const char *name)
+{
+    assert(name);
+
+    close_device();
+
+    m_fd = ::open(name, O_RDWR | O_NONBLOCK, 0);
+    if (m_fd == -1) {
+        int res = errno;
+        logger(LOG_ERROR, "Cannot open '%s': %d, %s", name, res, strerror(res));
+        return res;
+    }
+    return 0;
+}
+
+void V4l2DeviceIo::close_device()
+{
+    if (m_fd != -1)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+int V4l2DeviceIo::xioctl(unsigned long request, void *arg)
+{
+    if (m_fd == -1)
+        return EBADF;
+
+    int res = HANDLE_EINTR(::ioctl(m_fd, request, arg));
+    return res ? errno : 0;
+}
+
+bool CaptureMode::same(const CaptureMode &other) const
+{
+    // compare intervals as fractions, 1/30 == 2/60
+    return pixelformat == other.pixelformat &&
+        width == other.width &&
+        height == other.height &&
+        (uint64_t) interval_num * other.interval_den ==
+        (uint64_t) other.interval_num * interval_den;
+}
+
+static bool is_wanted(const uint32_t *formats, uint32_t pixelformat)
+{
+    if (!formats)
+        return true;
+    for (; *formats; ++formats)
+        if (*formats == pixelformat)
+            return true;
+    return false;
+}
+
+static int enumerate_intervals(DeviceIo &io, CaptureMode mode, std::vector<CaptureMode> &modes)
+{
+    struct v4l2_frmivalenum ival;
+
+    for (uint32_t idx = 0; ; ++idx) {
+
+        memset(&ival, 0, sizeof(ival));
+        ival.index          = idx;
+        ival.pixel_format   = mode.pixelformat;
+        ival.width          = mode.width;
+        ival.height         = mode.height;
+
+        int res = io.xioctl(VIDIOC_ENUM_FRAMEINTERVALS, &ival);
+        if (res == EINVAL)
+            break;
+        if (res)
+            return res;
+
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            mode.interval_num = ival.discrete.numerator;
+            mode.interval_den = ival.discrete.denominator;
+            modes.push_back(mode);
+            continue;
+        }
+
+        // stepwise/continuous: fastest and slowest are good enough
+        mode.interval_num = ival.stepwise.min.numerator;
+        mode.interval_den = ival.stepwise.min.denominator;
+        modes.push_back(mode);
+        mode.interval_num = ival.stepwise.max.numerator;
+        mode.interval_den = ival.stepwise.max.denominator;
+        modes.push_back(mode);
+        break;
+    }
+
+    return 0;
+}
+
+int enumerate_modes(DeviceIo &io, const uint32_t *formats, std::vector<CaptureMode> &modes)
+{
+    modes.clear();
+
+    struct v4l2_fmtdesc desc;
+
+    for (uint32_t fidx = 0; ; ++fidx) {
+
+        memset(&desc, 0, sizeof(desc));
+        desc.index  = fidx;
+        desc.type   = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+        int res = io.xioctl(VIDIOC_ENUM_FMT, &desc);
+        if (res == EINVAL)
+            break;
+        if (res)
+            return res;
+
+        if (!is_wanted(formats, desc.pixelformat))
+            continue;
+
+        struct v4l2_frmsizeenum size;
+
+        for (uint32_t sidx = 0; ; ++sidx) {
+
+            memset(&size, 0, sizeof(size));
+            size.index          = sidx;
+            size.pixel_format   = desc.pixelformat;
+
+            res = io.xioctl(VIDIOC_ENUM_FRAMESIZES, &size);
+            if (res == EINVAL)
+                break;
+            if (res)
+                return res;
+
+            CaptureMode mode;
+            memset(&mode, 0, sizeof(mode));
+            mode.pixelformat = desc.pixelformat;
+
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                mode.width  = size.discrete.width;
+                mode.height = size.discrete.height;
+                res = enumerate_intervals(io, mode, modes);
+                if (res)
+                    return res;
+                continue;
+            }
+
+            mode.width  = size.stepwise.max_width;
+            mode.height = size.stepwise.max_height;
+            res = enumerate_intervals(io, mode, modes);
+            if (res)
+                return res;
+
+            mode.width  = size.stepwise.min_width;
+            mode.height = size.stepwise.min_height;
+            res = enumerate_intervals(io, mode, modes);
+            if (res)
+                return res;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+void get_default_negotiator_config(NegotiatorConfig &config)
+{
+    config.bus_budget       = 6000.0 * g_uframes_per_sec;
+    config.bus_reserved     = 8.0 * 1024 * 1024;
+    config.min_fps          = 10.0;
+    config.target_fps       = 30.0;
+    config.min_width        = 320;
+    config.max_width        = 800;
+    config.mjpeg_ratio      = 6.0;
+    config.mjpeg_penalty    = 0.8;
+    config.min_efficiency   = 0.9;
+    config.allow_mjpeg      = true;
+}
+
+int ModeNegotiator::enumerate_device(const char *name, std::vector<CaptureMode> &modes) const
+{
+    const uint32_t formats[] = {
+        V4L2_PIX_FMT_YUYV,
+        m_config.allow_mjpeg ? V4L2_PIX_FMT_MJPEG : 0,
+        0
+    };
+
+    V4l2DeviceIo io;
+
+    int res = io.open_device(name);
+    if (res)
+        return res;
+
+    res = enumerate_modes(io, formats, modes);
+    if (res)
+        logger(LOG_ERROR, "%s mode enumeration failed res=%d", name, res);
+    return res;
+}
+
+ModeNegotiator::ModeNegotiator(const NegotiatorConfig &config)
+    :
+    m_config(config)
+{
+}
+
+double ModeNegotiator::get_bandwidth(const CaptureMode &mode) const
+{
+    double frame_bytes = (double) mode.width * mode.height * 2;
+
+    if (mode.pixelformat == V4L2_PIX_FMT_MJPEG)
+        frame_bytes /= m_config.mjpeg_ratio;
+    else if (mode.pixelformat != V4L2_PIX_FMT_YUYV)
+        return -1.0;
+
+    const double per_uframe = frame_bytes * mode.fps() / g_uframes_per_sec;
+
+    const int num_sizes = sizeof(g_alt_setting_sizes) / sizeof(g_alt_setting_sizes[0]);
+    for (int i = 0; i < num_sizes; ++i)
+        if (per_uframe <= g_alt_setting_sizes[i])
+            return g_alt_setting_sizes[i] * g_uframes_per_sec;
+
+    return -1.0;
+}
+
+double ModeNegotiator::get_efficiency(const CaptureMode &mode) const
+{
+    for (size_t i = 0; i < m_observations.size(); ++i)
+        if (m_observations[i].mode.same(mode))
+            return m_observations[i].efficiency;
+    return 1.0;
+}
+
+void ModeNegotiator::report_throughput(const CaptureMode &mode, double measured_fps)
+{
+    const double requested = mode.fps();
+    if (requested <= 0.0)
+        return;
+
+    double efficiency = measured_fps / requested;
+    if (efficiency > 1.0)
+        efficiency = 1.0;
+
+    for (size_t i = 0; i < m_observations.size(); ++i) {
+        Observation &obs = m_observations[i];
+        if (obs.mode.same(mode)) {
+            obs.efficiency = 0.5 * obs.efficiency + 0.5 * efficiency;
+            return;
+        }
+    }
+
+    Observation obs;
+    obs.mode = mode;
+    obs.efficiency = efficiency;
+    m_observations.push_back(obs);
+}
+
+double ModeNegotiator::get_score(const CaptureMode &mode) const
+{
+    const double efficiency = get_efficiency(mode);
+    double fps = mode.fps() * efficiency;
+
+    if (efficiency < m_config.min_efficiency)
+        fps *= efficiency;  // unreliable delivery, penalize twice
+    if (fps < m_config.min_fps)
+        return -1.0;
+    if (fps > m_config.target_fps)
+        fps = m_config.target_fps;
+
+    double score = (double) mode.width * mode.height * fps;
+    if (mode.pixelformat == V4L2_PIX_FMT_MJPEG)
+        score *= m_config.mjpeg_penalty;
+    return score;
+}
+
+int ModeNegotiator::negotiate(const std::vector<CaptureMode> &left,
+                              const std::vector<CaptureMode> &right,
+                              CaptureMode &result) const
+{
+    const double budget = m_config.bus_budget - m_config.bus_reserved;
+
+    double best_score = 0.0;
+    const CaptureMode *best = NULL;
+
+    for (size_t i = 0; i < left.size(); ++i) {
+
+        const CaptureMode &mode = left[i];
+
+        if (mode.width < m_config.min_width || mode.width > m_config.max_width)
+            continue;
+
+        // stereo wants identical geometry/timing on both sides
+        bool both = false;
+        for (size_t j = 0; j < right.size() && !both; ++j)
+            both = right[j].same(mode);
+        if (!both)
+            continue;
+
+        const double bandwidth = get_bandwidth(mode);
+        if (bandwidth <= 0.0 || 2 * bandwidth > budget)
+            continue;
+
+        const double score = get_score(mode);
+        if (score > best_score) {
+            best_score = score;
+            best = &mode;
+        }
+    }
+
+    if (!best)
+        return ENOENT;
+
+    result = *best;
+
+    logger(LOG_INFO, "ModeNegotiator %.4s %dx%d @ %.1f fps, bus %.1f of %.1f MB/s",
+        (const char *) &result.pixelformat, result.width, result.height, result.fps(),
+        2 * get_bandwidth(result) / (1024 * 1024), budget / (1024 * 1024));
+    return 0;
+}
+
+ThroughputMeter::ThroughputMeter()
+{
+    reset();
+}
+
+void ThroughputMeter::reset()
+{
+    m_started = false;
+    m_sequence = 0;
+    m_timestamp_usec = 0;
+}
+
+bool ThroughputMeter::update(uint32_t sequence, uint64_t timestamp_usec, uint64_t window_usec, double &fps)
+{
+    if (!m_started || timestamp_usec < m_timestamp_usec) {
+        m_started = true;
+        m_sequence = sequence;
+        m_timestamp_usec = timestamp_usec;
+        return false;
+    }
+
+    const uint64_t elapsed = timestamp_usec - m_timestamp_usec;
+    if (elapsed < window_usec)
+        return false;
+
+    fps = (double) (uint32_t) (sequence - m_sequence) * 1000000.0 / elapsed;
+
+    m_sequence = sequence;
+    m_timestamp_usec = timestamp_usec;
+    return true;
+}
+
+} // namespace robo
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __MODES__H__
+#define __MODES__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace robo {
+
+// ioctl indirection so mode enumeration can run against a fake device
+// in tests. Returns 0 or errno.
+class DeviceIo
+{
+public:
+    virtual ~DeviceIo() {}
+    virtual int xioctl(unsigned long request, void *arg) = 0;
+};
+
+class V4l2DeviceIo : public DeviceIo
+{
+public:
+    V4l2DeviceIo();
+    ~V4l2DeviceIo();
+
+    int open_device(const char *name);
+    void close_device();
+
+    int xioctl(unsigned long request, void *arg);
+
+private:
+    int     m_fd;
+};
+
+struct CaptureMode
+{
+    uint32_t    pixelformat;    // V4L2_PIX_FMT_*
+    int         width;
+    int         height;
+    uint32_t    interval_num;   // frame interval is num / den seconds
+    uint32_t    interval_den;
+
+    double fps() const { return interval_num ? (double) interval_den / interval_num : 0.0; }
+    bool same(const CaptureMode &other) const;
+};
+
+// Lists discrete (format, size, interval) triplets of the device. Only
+// formats in formats[] (zero terminated, NULL for all) are listed.
+// Stepwise sizes/intervals are sampled at their min/max.
+int enumerate_modes(DeviceIo &io, const uint32_t *formats, std::vector<CaptureMode> &modes);
+
+struct NegotiatorConfig
+{
+    // Periodic (isochronous) bytes/sec the hub can give to both cameras.
+    // USB 2.0 high speed allows 80% of a 125us microframe for periodic
+    // transfers, which is 6000 * 8000 bytes/sec.
+    double      bus_budget;
+    double      bus_reserved;       // eg. WiFi dongle on the same hub
+    double      min_fps;
+    double      target_fps;         // no extra score above this rate
+    int         min_width;
+    int         max_width;          // what the processing can keep up with
+    double      mjpeg_ratio;        // expected MJPEG compression ratio
+    double      mjpeg_penalty;      // score multiplier for decode cost
+    double      min_efficiency;     // measured/requested fps considered ok
+    bool        allow_mjpeg;
+};
+
+void get_default_negotiator_config(NegotiatorConfig &config);
+
+// Picks the best (format, size, fps) that both cameras support and that
+// fits on the shared bus. Measured throughput from report_throughput()
+// derates modes that under deliver in the next negotiate() call.
+class ModeNegotiator
+{
+public:
+    explicit ModeNegotiator(const NegotiatorConfig &config);
+
+    // Lists the modes of a device node in the formats we can capture.
+    int enumerate_device(const char *name, std::vector<CaptureMode> &modes) const;
+
+    // Bytes/sec reserved on the bus by one camera in this mode.
+    double get_bandwidth(const CaptureMode &mode) const;
+
+    // Returns ENOENT when no jointly feasible mode exists.
+    int negotiate(const std::vector<CaptureMode> &left,
+                  const std::vector<CaptureMode> &right,
+                  CaptureMode &result) const;
+
+    void report_throughput(const CaptureMode &mode, double measured_fps);
+    double get_efficiency(const CaptureMode &mode) const;
+
+private:
+    double get_score(const CaptureMode &mode) const;
+
+private:
+    struct Observation {
+        CaptureMode     mode;
+        double          efficiency;     // EWMA of measured/requested fps
+    };
+
+    NegotiatorConfig            m_config;
+    std::vector<Observation>    m_observations;
+};
+
+// Delivered frame rate of a stream from driver (sequence, timestamp)
+// pairs, so drops on the bus show up even when we poll slowly.
+class ThroughputMeter
+{
+public:
+    ThroughputMeter();
+
+    void reset();
+
+    // returns true and sets fps when window_usec worth of frames seen
+    bool update(uint32_t sequence, uint64_t timestamp_usec, uint64_t window_usec, double &fps);
+
+private:
+    bool        m_started;
+    uint32_t    m_sequence;
+    uint64_t    m_timestamp_usec;
+};
+
+} // namespace robo
+
+#endif // __MODES__H__
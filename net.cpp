@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "net.h"
+#include "common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace robo {
+
+int parse_endpoint(const char *endpoint, char *host, size_t host_size, int &port)
+{
+    if (!endpoint)
+        return EINVAL;
+
+    const char *colon = strrchr(endpoint, ':');
+    if (!colon || (size_t) (colon - endpoint) >= host_size)
+        return EINVAL;
+
+    char *end = NULL;
+    const long value = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end || value < 0 || value > 65535)
+        return EINVAL;
+
+    memcpy(host, endpoint, colon - endpoint);
+    host[colon - endpoint] = '\0';
+    port = (int) value;
+    return 0;
+}
+
+void tune_tcp_socket(int fd, int buffer_bytes)
+{
+    int on = 1;
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)))
+        logger(LOG_WARN, "TCP_NODELAY fd=%d failed %d %s", fd, errno, strerror(errno));
+
+    if (buffer_bytes <= 0)
+        return;
+    if (::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_bytes, sizeof(buffer_bytes)) ||
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_bytes, sizeof(buffer_bytes)))
+        logger(LOG_WARN, "socket buffers fd=%d failed %d %s", fd, errno, strerror(errno));
+}
+
+static int resolve(const char *host, int port, bool passive, struct sockaddr_in &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t) port);
+
+    if (!host || !*host) {
+        address.sin_addr.s_addr = htonl(passive ? INADDR_ANY : INADDR_LOOPBACK);
+        return 0;
+    }
+    if (inet_pton(AF_INET, host, &address.sin_addr) == 1)
+        return 0;
+
+    struct addrinfo hints;
+    struct addrinfo *info = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    const int rc = ::getaddrinfo(host, NULL, &hints, &info);
+    if (rc || !info) {
+        logger(LOG_ERROR, "cannot resolve %s: %s", host, gai_strerror(rc));
+        return EHOSTUNREACH;
+    }
+
+    address.sin_addr = ((struct sockaddr_in *) info->ai_addr)->sin_addr;
+    ::freeaddrinfo(info);
+    return 0;
+}
+
+int tcp_listen(const char *host, int port, int backlog, int &fd, int &bound_port)
+{
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    int on = 1;
+
+    fd = -1;
+    int rc = resolve(host, port, true, address);
+    if (rc)
+        return rc;
+
+    fd = ::socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        goto fail;
+
+    // accepted sockets inherit the buffers, they must be set before the
+    // handshake for the window scale to cover them
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    tune_tcp_socket(fd, TCP_BUFFER_BYTES);
+
+    rc = ::bind(fd, (struct sockaddr *)&address, address_length);
+    if (rc)
+        goto fail;
+
+    rc = ::listen(fd, backlog);
+    if (rc)
+        goto fail;
+
+    rc = ::getsockname(fd, (struct sockaddr *)&address, &address_length);
+    if (rc)
+        goto fail;
+
+    bound_port = ntohs(address.sin_port);
+    return 0;
+
+fail:
+    rc = errno;
+    if (fd != -1)
+        HANDLE_EINTR(::close(fd));
+    fd = -1;
+    return rc ? rc : EFAULT;
+}
+
+int resolve_endpoint(const char *host, int port, struct sockaddr_in &address)
+{
+    return resolve(host, port, false, address);
+}
+
+int tcp_connect_start(const struct sockaddr_in &address, int &fd)
+{
+    int flags = 0;
+
+    fd = ::socket(PF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        goto fail;
+
+    tune_tcp_socket(fd, TCP_BUFFER_BYTES);
+
+    flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+        goto fail;
+
+    if (::connect(fd, (const struct sockaddr *)&address, sizeof(address))) {
+        if (errno == EINPROGRESS)
+            return EINPROGRESS;
+        goto fail;
+    }
+
+    if (::fcntl(fd, F_SETFL, flags))
+        goto fail;
+    return 0;
+
+fail:
+    const int rc = errno;
+    if (fd != -1)
+        HANDLE_EINTR(::close(fd));
+    fd = -1;
+    return rc ? rc : EFAULT;
+}
+
+int tcp_connect_poll(int fd, int msec)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    int rc = HANDLE_EINTR(::poll(&pfd, 1, msec));
+    if (rc < 0)
+        return errno;
+    if (rc == 0)
+        return EINPROGRESS;
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (::getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length))
+        return errno;
+    if (error)
+        return error;
+
+    const int flags = ::fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || ::fcntl(fd, F_SETFL, flags & ~O_NONBLOCK))
+        return errno;
+    return 0;
+}
+
+int tcp_connect(const char *host, int port, int timeout_msec, int &fd)
+{
+    struct sockaddr_in address;
+
+    fd = -1;
+    int rc = resolve(host, port, false, address);
+    if (rc)
+        return rc;
+
+    rc = tcp_connect_start(address, fd);
+    if (rc == EINPROGRESS) {
+        rc = tcp_connect_poll(fd, timeout_msec);
+        rc = rc == EINPROGRESS ? ETIMEDOUT : rc;
+        if (rc) {
+            HANDLE_EINTR(::close(fd));
+            fd = -1;
+        }
+    }
+    return rc;
+}
+
+int set_recv_timeout(int fd, int msec)
+{
+    struct timeval tv;
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+
+    if (::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)))
+        return errno;
+    return 0;
+}
+
+int set_send_timeout(int fd, int msec)
+{
+    struct timeval tv;
+    tv.tv_sec = msec / 1000;
+    tv.tv_usec = (msec % 1000) * 1000;
+
+    if (::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)))
+        return errno;
+    return 0;
+}
+
+int send_iov(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov     = iov;
+        msg.msg_iovlen  = count < IOV_MAX ? count : IOV_MAX;
+
+        ssize_t rc = HANDLE_EINTR(::sendmsg(fd, &msg, MSG_NOSIGNAL));
+        if (rc < 0)
+            return errno;
+
+        size_t sent = (size_t) rc;
+        while (count > 0 && sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+int recv_all(int fd, void *buf, size_t len)
+{
+    char *ptr = (char *) buf;
+    size_t idx = 0;
+
+    while (idx < len) {
+        ssize_t rc = HANDLE_EINTR(::recv(fd, ptr + idx, len - idx, 0));
+        if (rc < 0)
+            return errno;
+        if (rc == 0)
+            return ENOTCONN;
+        idx += (size_t) rc;
+    }
+    return 0;
+}
+
+} // namespace robo
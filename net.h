@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __NET__H__
+#define __NET__H__
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+struct iovec;
+
+namespace robo {
+
+// Socket helpers shared by the client server and the strip offload.
+// All return 0 or an errno.
+
+// Frames are a few hundred KB, the default buffers would make every
+// send wait for the peer to drain. The kernel may clamp this to
+// net.core.[rw]mem_max.
+enum { TCP_BUFFER_BYTES = 1 << 20 };
+
+// "host:port", an empty host is any address. host_size includes the nul.
+int parse_endpoint(const char *endpoint, char *host, size_t host_size, int &port);
+
+// TCP_NODELAY, responses are single writes we want on the wire at once,
+// and buffer_bytes send/receive buffers.
+void tune_tcp_socket(int fd, int buffer_bytes);
+
+// Listening socket on host:port (NULL or "" any), port 0 picks a free
+// one, bound_port is the one picked.
+int tcp_listen(const char *host, int port, int backlog, int &fd, int &bound_port);
+
+// Connects with a timeout, a dead host would otherwise block for the
+// whole SYN retry sequence.
+int tcp_connect(const char *host, int port, int timeout_msec, int &fd);
+
+// Address of host:port, NULL or "" is the loopback. A name may block on
+// DNS (and allocates), resolve once up front.
+int resolve_endpoint(const char *host, int port, struct sockaddr_in &address);
+
+// The two halves of tcp_connect() for callers that must not wait.
+// tcp_connect_start() returns 0 with fd connected, EINPROGRESS with fd
+// pending or an errno with fd -1. tcp_connect_poll() waits up to msec (0
+// only looks) on a pending fd: 0 once connected (fd is blocking again),
+// EINPROGRESS while pending, else the connect's errno. It never closes fd.
+int tcp_connect_start(const struct sockaddr_in &address, int &fd);
+int tcp_connect_poll(int fd, int msec);
+
+// recv gives up with EAGAIN after msec, 0 waits forever.
+int set_recv_timeout(int fd, int msec);
+// send gives up with EAGAIN after msec without progress, 0 waits forever.
+int set_send_timeout(int fd, int msec);
+
+// Sends all iovecs, handles partial writes by advancing iov in place.
+int send_iov(int fd, struct iovec *iov, int count);
+
+// ENOTCONN if the peer closed before len bytes arrived.
+int recv_all(int fd, void *buf, size_t len);
+
+} // namespace robo
+
+#endif // __NET__H__
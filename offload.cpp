@@ -0,0 +1,547 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "offload.h"
+#include "common.h"
+#include "net.h"
+#include "proto.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace robo {
+
+static StereoConfig get_worker_config()
+{
+    StereoConfig config;
+    get_default_stereo_config(config);
+    return config;
+}
+
+static bool same_config(const StereoConfig &a, const StereoConfig &b)
+{
+    return a.num_disparities == b.num_disparities && a.block_size == b.block_size &&
+        a.uniqueness_ratio == b.uniqueness_ratio && a.lr_max_diff == b.lr_max_diff &&
+        a.subpixel == b.subpixel;
+}
+
+// Adds an iovec per row of rows [y0, y1), one for all of them when they
+// are contiguous.
+static void add_rows(std::vector<struct iovec> &iov, const ImageView &view, int y0, int y1)
+{
+    const size_t row_bytes = view.row_bytes();
+    struct iovec part;
+
+    if ((size_t) view.stride == row_bytes) {
+        part.iov_base = view.row(y0);
+        part.iov_len  = row_bytes * (y1 - y0);
+        iov.push_back(part);
+        return;
+    }
+    for (int y = y0; y < y1; ++y) {
+        part.iov_base = view.row(y);
+        part.iov_len  = row_bytes;
+        iov.push_back(part);
+    }
+}
+
+static int recv_rows(int fd, const ImageView &view, int y0, int y1)
+{
+    const size_t row_bytes = view.row_bytes();
+
+    if ((size_t) view.stride == row_bytes)
+        return recv_all(fd, view.row(y0), row_bytes * (y1 - y0));
+
+    for (int y = y0; y < y1; ++y) {
+        int rc = recv_all(fd, view.row(y), row_bytes);
+        if (rc)
+            return rc;
+    }
+    return 0;
+}
+
+StripWorker::StripWorker()
+    :
+    m_listen_fd(-1),
+    m_port(0),
+    m_client_fd(-1),
+    m_stop(false),
+    m_matcher(get_worker_config())
+{
+}
+
+StripWorker::~StripWorker()
+{
+    stop();
+    if (m_listen_fd != -1)
+        HANDLE_EINTR(::close(m_listen_fd));
+}
+
+int StripWorker::initialize(const char *host, int port)
+{
+    if (m_listen_fd != -1)
+        return EINVAL;
+
+    int rc = tcp_listen(host, port, 1, m_listen_fd, m_port);
+    if (rc) {
+        logger(LOG_ERROR, "StripWorker::initialize failed %d %s", rc, strerror(rc));
+        return rc;
+    }
+
+    logger(LOG_INFO, "StripWorker::initialize fd=%d on %s:%d", m_listen_fd, host ? host : "*", m_port);
+    return 0;
+}
+
+void StripWorker::stop()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    m_stop = true;
+    if (m_listen_fd != -1)
+        ::shutdown(m_listen_fd, SHUT_RDWR);
+    if (m_client_fd != -1)
+        ::shutdown(m_client_fd, SHUT_RDWR);
+}
+
+int StripWorker::run()
+{
+    if (m_listen_fd == -1)
+        return EINVAL;
+
+    while (!m_stop) {
+
+        int fd = HANDLE_EINTR(::accept(m_listen_fd, NULL, NULL));
+        if (fd < 0) {
+            const int rc = errno;
+            if (m_stop)
+                break;
+            logger(LOG_ERROR, "StripWorker::run accept failed %d %s", rc, strerror(rc));
+            return rc;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            if (m_stop) {
+                HANDLE_EINTR(::close(fd));
+                break;
+            }
+            m_client_fd = fd;
+        }
+
+        tune_tcp_socket(fd, TCP_BUFFER_BYTES);
+        logger(LOG_INFO, "StripWorker capture node connected fd=%d", fd);
+
+        const int rc = serve(fd);
+        if (rc != ENOTCONN && !m_stop)
+            logger(LOG_WARN, "StripWorker::serve failed %d %s", rc, strerror(rc));
+
+        std::lock_guard<std::mutex> guard(m_lock);
+        HANDLE_EINTR(::close(fd));
+        m_client_fd = -1;
+    }
+
+    logger(LOG_INFO, "StripWorker stopped");
+    return 0;
+}
+
+// Any error drops the connection, the capture node recomputes the strip.
+int StripWorker::serve(int fd)
+{
+    for (;;) {
+
+        proto::StripRequest request;
+        int rc = recv_all(fd, &request, sizeof(request));
+        if (rc)
+            return rc;
+
+        const uint64_t start = get_time_usec();
+
+        const int w = request.width;
+        const int h = request.height;
+        if (!w || !h || request.first + request.rows > h)
+            return EPROTO;
+
+        StereoConfig config;
+        config.num_disparities  = request.num_disparities;
+        config.block_size       = request.block_size;
+        config.uniqueness_ratio = request.uniqueness_ratio;
+        config.lr_max_diff      = request.lr_max_diff;
+        config.subpixel         = request.subpixel != 0;
+
+        if (config.num_disparities <= 0 || config.block_size <= 0 || !(config.block_size & 1))
+            return EPROTO;
+        if (!same_config(config, m_matcher.config()))
+            m_matcher = BlockMatcher(config);
+
+        // strips vary by a grain from frame to frame, keep the largest
+        if (m_left.width() != w || m_left.height() < h) {
+            int res = m_left.allocate(w, h, PIX_FMT_GRAY8);
+            res = res || m_right.allocate(w, h, PIX_FMT_GRAY8);
+            res = res || m_disp.allocate(w, h, PIX_FMT_DISP16);
+            res = res || m_confidence.allocate(w, h, PIX_FMT_GRAY8);
+            if (res)
+                return ENOMEM;
+        }
+
+        const ImageView left = m_left.view().sub_rows(0, h);
+        const ImageView right = m_right.view().sub_rows(0, h);
+        const ImageView disp = m_disp.view().sub_rows(0, h);
+        const ImageView confidence = m_confidence.view().sub_rows(0, h);
+
+        rc = recv_rows(fd, left, 0, h);
+        rc = rc ? rc : recv_rows(fd, right, 0, h);
+        if (rc)
+            return rc;
+
+        const int y0 = request.first;
+        const int y1 = request.first + request.rows;
+
+        proto::StripResponse response;
+        memset(&response, 0, sizeof(response));
+        response.frame  = request.frame;
+        response.width  = w;
+        response.rows   = request.rows;
+        response.result = m_matcher.compute_rows(left, right, disp, y0, y1, &confidence);
+
+        m_iov.clear();
+        struct iovec header = { &response, sizeof(response) };
+        m_iov.push_back(header);
+        if (!response.result && y1 > y0) {
+            add_rows(m_iov, disp, y0, y1);
+            add_rows(m_iov, confidence, y0, y1);
+        }
+
+        response.service_usec = get_time_usec() - start;
+
+        rc = send_iov(fd, &m_iov[0], (int) m_iov.size());
+        if (rc)
+            return rc;
+    }
+}
+
+void get_default_offload_config(OffloadConfig &config)
+{
+    config.grain_rows   = 8;
+    config.timeout_msec = 200;
+    config.retry_msec   = 2000;
+    config.smoothing    = 0.25f;
+}
+
+void assign_strips(const double *rate, int n, int height, int grain, int *rows)
+{
+    assert(n > 0 && grain > 0);
+
+    double total = 0.0;
+    for (int i = 0; i < n; ++i)
+        total += rate[i] > 0.0 ? rate[i] : 0.0;
+
+    int left = height;
+    for (int i = 0; i < n - 1; ++i) {
+        const double share = total > 0.0 ? (rate[i] > 0.0 ? rate[i] : 0.0) / total : 1.0 / n;
+
+        // everyone after this one still needs a grain
+        const int most = left - (n - 1 - i) * grain;
+        int count = (int) (share * height / grain + 0.5) * grain;
+        if (count < grain)
+            count = grain;
+        if (count > most)
+            count = most > 0 ? most : 0;
+
+        rows[i] = count;
+        left -= count;
+    }
+    rows[n - 1] = left;
+}
+
+StripScheduler::StripScheduler(const OffloadConfig &config, BlockMatcher &local)
+    :
+    m_remote_fraction(0.0),
+    m_fallbacks(0),
+    m_config(config),
+    m_local(local),
+    m_local_rate(0.0),
+    m_frame(0)
+{
+    assert(config.grain_rows > 0);
+}
+
+StripScheduler::~StripScheduler()
+{
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        if (m_workers[i].fd != -1)
+            HANDLE_EINTR(::close(m_workers[i].fd));
+    }
+}
+
+int StripScheduler::add_workers(const char *endpoints)
+{
+    if (!endpoints)
+        return EINVAL;
+
+    std::string list(endpoints);
+    size_t pos = 0;
+
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos)
+            end = list.size();
+
+        const std::string endpoint = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (endpoint.empty())
+            continue;
+
+        char host[256];
+        Worker worker;
+        if (parse_endpoint(endpoint.c_str(), host, sizeof(host), worker.port) || !worker.port) {
+            logger(LOG_ERROR, "bad offload worker %s, want host:port", endpoint.c_str());
+            return EINVAL;
+        }
+
+        // getaddrinfo() blocks and allocates, not something for the frame path
+        const int rc = resolve_endpoint(host, worker.port, worker.address);
+        if (rc)
+            return rc;
+
+        worker.host         = host;
+        worker.fd           = -1;
+        worker.connecting   = false;
+        worker.retry_usec   = 0;
+        worker.rate         = 0.0;
+        worker.y0           = 0;
+        worker.y1           = 0;
+        worker.busy         = false;
+        m_workers.push_back(worker);
+    }
+    return 0;
+}
+
+int StripScheduler::connected() const
+{
+    int count = 0;
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        count += m_workers[i].fd != -1 && !m_workers[i].connecting;
+    return count;
+}
+
+void StripScheduler::drop(Worker &worker, int err)
+{
+    logger(LOG_WARN, "offload worker %s:%d dropped %d %s, retry in %d msec",
+        worker.host.c_str(), worker.port, err, strerror(err), m_config.retry_msec);
+
+    if (worker.fd != -1)
+        HANDLE_EINTR(::close(worker.fd));
+
+    worker.fd           = -1;
+    worker.connecting   = false;
+    worker.busy         = false;
+    worker.retry_usec   = get_time_usec() + (uint64_t) m_config.retry_msec * 1000;
+}
+
+// A connect is started when the retry is due and only looked at on the
+// frames after, a worker coming back never holds up a frame.
+void StripScheduler::reconnect(Worker &worker, uint64_t now)
+{
+    int rc = 0;
+
+    if (worker.fd == -1) {
+        if (now < worker.retry_usec)
+            return;
+        rc = tcp_connect_start(worker.address, worker.fd);
+        if (rc == EINPROGRESS) {
+            worker.connecting = true;
+            worker.retry_usec = now + (uint64_t) m_config.timeout_msec * 1000;
+            return;
+        }
+    }
+    else if (worker.connecting) {
+        rc = tcp_connect_poll(worker.fd, 0);
+        if (rc == EINPROGRESS) {
+            if (now < worker.retry_usec)
+                return;
+            rc = ETIMEDOUT;
+        }
+    }
+    else {
+        return;
+    }
+
+    rc = rc ? rc : set_recv_timeout(worker.fd, m_config.timeout_msec);
+    if (rc) {
+        drop(worker, rc);
+        return;
+    }
+
+    worker.connecting = false;
+    logger(LOG_INFO, "offload worker %s:%d connected", worker.host.c_str(), worker.port);
+}
+
+void StripScheduler::update_rate(double &rate, int rows, uint64_t usec) const
+{
+    const double now = (double) rows / (usec ? usec : 1);
+    rate = rate > 0.0 ? rate + m_config.smoothing * (now - rate) : now;
+}
+
+int StripScheduler::send_strip(Worker &worker, const ImageView &left, const ImageView &right)
+{
+    const StereoConfig &config = m_local.config();
+    const int r = config.block_size / 2;
+    const int c0 = worker.y0 - r > 0 ? worker.y0 - r : 0;
+    const int c1 = worker.y1 + r < left.height ? worker.y1 + r : left.height;
+
+    proto::StripRequest request;
+    memset(&request, 0, sizeof(request));
+    request.frame               = m_frame;
+    request.width               = left.width;
+    request.height              = c1 - c0;
+    request.first               = worker.y0 - c0;
+    request.rows                = worker.y1 - worker.y0;
+    request.num_disparities     = config.num_disparities;
+    request.block_size          = config.block_size;
+    request.uniqueness_ratio    = config.uniqueness_ratio;
+    request.lr_max_diff         = config.lr_max_diff;
+    request.subpixel            = config.subpixel;
+
+    m_iov.clear();
+    struct iovec header = { &request, sizeof(request) };
+    m_iov.push_back(header);
+    add_rows(m_iov, left, c0, c1);
+    add_rows(m_iov, right, c0, c1);
+
+    return send_iov(worker.fd, &m_iov[0], (int) m_iov.size());
+}
+
+int StripScheduler::recv_strip(Worker &worker, const ImageView &disp, const ImageView *confidence)
+{
+    proto::StripResponse response;
+    int rc = recv_all(worker.fd, &response, sizeof(response));
+    if (rc)
+        return rc;
+
+    if (response.frame != m_frame || response.width != disp.width ||
+        response.rows != worker.y1 - worker.y0)
+        return EPROTO;
+    if (response.result)
+        return response.result;
+
+    rc = recv_rows(worker.fd, disp, worker.y0, worker.y1);
+    if (rc)
+        return rc;
+
+    if (confidence) {
+        rc = recv_rows(worker.fd, *confidence, worker.y0, worker.y1);
+    }
+    else {
+        m_discard.resize((size_t) disp.width * response.rows);
+        rc = recv_all(worker.fd, &m_discard[0], m_discard.size());
+    }
+    if (rc)
+        return rc;
+
+    update_rate(worker.rate, response.rows, response.service_usec);
+    return 0;
+}
+
+int StripScheduler::compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                            const ImageView *confidence)
+{
+    if (left.format != PIX_FMT_GRAY8 || right.format != PIX_FMT_GRAY8 ||
+        disp.format != PIX_FMT_DISP16 || left.empty() ||
+        !left.same_size(right) || !left.same_size(disp))
+        return EINVAL;
+
+    const int h = left.height;
+    const uint64_t now = get_time_usec();
+
+    m_active.clear();
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        Worker &worker = m_workers[i];
+
+        reconnect(worker, now);
+        if (worker.fd != -1 && !worker.connecting)
+            m_active.push_back(&worker);
+    }
+
+    // unknown throughput is taken as the average of the known ones
+    const int n = (int) m_active.size() + 1;
+    m_rates.resize(n);
+    m_rows.resize(n);
+
+    double known = 0.0;
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        m_rates[i] = i + 1 < n ? m_active[i]->rate : m_local_rate;
+        if (m_rates[i] > 0.0) {
+            known += m_rates[i];
+            ++count;
+        }
+    }
+    for (int i = 0; i < n; ++i) {
+        if (m_rates[i] <= 0.0)
+            m_rates[i] = count ? known / count : 1.0;
+    }
+
+    assign_strips(&m_rates[0], n, h, m_config.grain_rows, &m_rows[0]);
+
+    ++m_frame;
+    int y = 0;
+    for (int i = 0; i + 1 < n; ++i) {
+        Worker &worker = *m_active[i];
+        worker.y0 = y;
+        worker.y1 = y + m_rows[i];
+        y = worker.y1;
+
+        worker.busy = worker.y1 > worker.y0;
+        if (!worker.busy)
+            continue;
+
+        const int rc = send_strip(worker, left, right);
+        if (rc) {
+            drop(worker, rc);
+            ++m_fallbacks;
+            m_local.compute_rows(left, right, disp, worker.y0, worker.y1, confidence);
+        }
+    }
+
+    // our own share while the workers are at theirs, a frame nobody else
+    // works on (eg. while workers connect) says nothing about the split
+    bool shared = false;
+    for (size_t i = 0; i < m_active.size(); ++i)
+        shared = shared || m_active[i]->busy;
+
+    const uint64_t start = get_time_usec();
+    int res = m_local.compute_rows(left, right, disp, y, h, confidence);
+    if (res)
+        return res;
+    if (h > y && shared)
+        update_rate(m_local_rate, h - y, get_time_usec() - start);
+
+    int remote = 0;
+    for (size_t i = 0; i < m_active.size(); ++i) {
+        Worker &worker = *m_active[i];
+        if (!worker.busy)
+            continue;
+
+        const int rc = recv_strip(worker, disp, confidence);
+        worker.busy = false;
+        if (rc) {
+            drop(worker, rc);
+            ++m_fallbacks;
+            res = m_local.compute_rows(left, right, disp, worker.y0, worker.y1, confidence);
+            if (res)
+                return res;
+            continue;
+        }
+        remote += worker.y1 - worker.y0;
+    }
+
+    m_remote_fraction = (double) remote / h;
+    return 0;
+}
+
+} // namespace robo
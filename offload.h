@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __OFFLOAD__H__
+#define __OFFLOAD__H__
+
+#include "image.h"
+#include "stereo.h"
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace robo {
+
+// Worker side of the disparity strip offload: serves one capture node at
+// a time over TCP, matching every proto::StripRequest with the capture
+// node's settings and answering with the strip's disparity and
+// confidence rows.
+class StripWorker
+{
+public:
+    StripWorker();
+    ~StripWorker();
+
+    // port 0 picks a free one, see port()
+    int initialize(const char *host, int port);
+    int port() const { return m_port; }
+
+    // Serves until stop(), a capture node going away just means waiting
+    // for the next one.
+    int run();
+
+    // callable from any thread, run() returns soon after
+    void stop();
+
+private:
+    int serve(int fd);
+
+private:
+    int                 m_listen_fd;
+    int                 m_port;
+    std::mutex          m_lock;         // m_client_fd against stop()
+    int                 m_client_fd;
+    std::atomic<bool>   m_stop;
+    BlockMatcher        m_matcher;
+    Image               m_left;         // sized for the largest strip yet
+    Image               m_right;
+    Image               m_disp;
+    Image               m_confidence;
+    std::vector<struct iovec>   m_iov;
+};
+
+struct OffloadConfig
+{
+    int     grain_rows;         // strips are multiples of this
+    int     timeout_msec;       // worker answering later is dropped
+    int     retry_msec;         // before reconnecting a dropped worker
+    float   smoothing;          // weight of the last frame's throughput
+};
+
+void get_default_offload_config(OffloadConfig &config);
+
+// Splits height rows into n contiguous strips sized by rate (rows per
+// usec), every strip gets at least grain rows while there are enough
+// and all but the last are multiples of grain.
+void assign_strips(const double *rate, int n, int height, int grain, int *rows);
+
+// Capture node side: splits each frame into row strips across the
+// connected workers and the local matcher, sized by each one's measured
+// throughput, and reassembles the disparity map. Strips of a worker that
+// fails or times out are computed locally and the worker is retried
+// after retry_msec, the map is the same as BlockMatcher::compute()'s
+// either way. Reconnects are non-blocking connects looked at on the
+// frames after, workers join when the connect completed.
+//
+// Workers get their strips first, the local share is computed while
+// they work. A worker's throughput is its own service time for the
+// strip, a capture node busy with its share would otherwise inflate it.
+class StripScheduler
+{
+public:
+    StripScheduler(const OffloadConfig &config, BlockMatcher &local);
+    ~StripScheduler();
+
+    // "host:port" or a comma separated list of them, resolved here
+    // (EHOSTUNREACH if one is not)
+    int add_workers(const char *endpoints);
+
+    // configured workers, connected or not
+    int size() const { return (int) m_workers.size(); }
+    int connected() const;
+
+    // same contract as BlockMatcher::compute()
+    int compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                const ImageView *confidence = NULL);
+
+public:
+    double      m_remote_fraction;      // rows computed remotely, last frame
+    uint64_t    m_fallbacks;            // strips recomputed locally
+
+private:
+    struct Worker
+    {
+        std::string host;
+        int         port;
+        struct sockaddr_in  address;    // resolved once, in add_workers()
+        int         fd;
+        bool        connecting;     // fd's connect still in progress
+        uint64_t    retry_usec;     // next connect attempt, or its deadline
+        double      rate;           // rows per usec, 0 unknown
+        int         y0;             // this frame's strip
+        int         y1;
+        bool        busy;
+    };
+
+    void drop(Worker &worker, int err);
+    void reconnect(Worker &worker, uint64_t now);
+    int send_strip(Worker &worker, const ImageView &left, const ImageView &right);
+    int recv_strip(Worker &worker, const ImageView &disp, const ImageView *confidence);
+    void update_rate(double &rate, int rows, uint64_t usec) const;
+
+private:
+    OffloadConfig           m_config;
+    BlockMatcher            &m_local;
+    std::vector<Worker>     m_workers;
+    double                  m_local_rate;
+    uint32_t                m_frame;
+
+    std::vector<Worker *>   m_active;
+    std::vector<double>     m_rates;
+    std::vector<int>        m_rows;
+    std::vector<struct iovec>   m_iov;
+    std::vector<uint8_t>    m_discard;  // confidence rows nobody asked for
+};
+
+} // namespace robo
+
+#endif // __OFFLOAD__H__
@@ -0,0 +1,497 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "parallel.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace robo {
+
+static const int g_max_chunks = 8;
+
+// deque slots per worker, a full deque runs the task in place
+static const int g_queue_size = 256;
+
+int get_max_chunks()
+{
+    static const int chunks = [] {
+        const int n = (int) std::thread::hardware_concurrency();
+        return n < 1 ? 1 : (n > g_max_chunks ? g_max_chunks : n);
+    }();
+    return chunks;
+}
+
+void get_default_pool_config(PoolConfig &config)
+{
+    config.pin_workers      = true;
+    config.spin_usec        = 200;
+    config.cpu_mask         = 0;
+    config.fifo_priority    = 0;
+}
+
+static PoolConfig g_config = { true, 200, 0, 0 };
+
+// cpu of worker i (1 based), -1 unpinned
+static int get_worker_cpu(const PoolConfig &config, int i)
+{
+    const int cpus = (int) std::thread::hardware_concurrency();
+    if (!config.pin_workers)
+        return -1;
+
+    // worker i on cpu i, cpu 0 is left to the calling thread. Where that
+    // one is pinned elsewhere apply_runtime_profile() sets a mask without
+    // its cpu.
+    if (!config.cpu_mask)
+        return cpus > 1 ? i % cpus : -1;
+
+    const int count = __builtin_popcount(config.cpu_mask);
+    int nth = (i - 1) % count;
+    for (int cpu = 0; cpu < 32; ++cpu) {
+        if ((config.cpu_mask & (1u << cpu)) && !nth--)
+            return cpu;
+    }
+    return -1;
+}
+
+void configure_pool(const PoolConfig &config)
+{
+    g_config = config;
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+namespace {
+
+struct Task
+{
+    void                (*run)(void *ctx, int chunk, int begin, int end);
+    void                *ctx;
+    int                 chunk;
+    int                 begin;
+    int                 end;
+    std::atomic<int>    *pending;   // decremented once run, may be NULL
+};
+
+// Bounded deque, the owner works the back, thieves take the front. A
+// plain lock is cheap here: a handful of tasks per kernel, and contention
+// only when somebody is stealing anyway.
+struct Queue
+{
+    std::mutex  lock;
+    Task        tasks[g_queue_size];
+    int         head;
+    int         count;
+
+    Queue() : head(0), count(0) {}
+
+    bool push(const Task &task)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (count == g_queue_size)
+            return false;
+        tasks[(head + count) % g_queue_size] = task;
+        ++count;
+        return true;
+    }
+
+    bool pop_back(Task &task)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!count)
+            return false;
+        --count;
+        task = tasks[(head + count) % g_queue_size];
+        return true;
+    }
+
+    bool pop_front(Task &task)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!count)
+            return false;
+        task = tasks[head];
+        head = (head + 1) % g_queue_size;
+        --count;
+        return true;
+    }
+};
+
+// Queue 0 belongs to threads outside the pool, queue i to worker i.
+class ThreadPool
+{
+public:
+    static ThreadPool &instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    void submit(const Task &task);
+
+    // runs one queued task if there is any
+    bool run_one();
+
+    // runs queued tasks until pending drops to zero
+    void wait(std::atomic<int> &pending);
+
+    void get_stats(PoolStats &stats) const
+    {
+        stats.tasks     = m_tasks.load(std::memory_order_relaxed);
+        stats.steals    = m_steals.load(std::memory_order_relaxed);
+        stats.parks     = m_parks.load(std::memory_order_relaxed);
+    }
+
+private:
+    ThreadPool();
+    ~ThreadPool();
+
+    void worker_main(int index);
+    bool take(int self, Task &task);
+    void execute(const Task &task);
+
+private:
+    PoolConfig                  m_config;
+    int                         m_workers;
+    std::unique_ptr<Queue[]>    m_queues;
+    std::vector<std::thread>    m_threads;
+    std::atomic<int>            m_queued;
+    std::atomic<int>            m_sleepers;
+    std::atomic<unsigned>       m_next;     // round robin for outside submits
+    std::mutex                  m_park_lock;
+    std::condition_variable     m_park;
+    bool                        m_stop;
+
+    std::atomic<uint64_t>       m_tasks;
+    std::atomic<uint64_t>       m_steals;
+    std::atomic<uint64_t>       m_parks;
+};
+
+// worker index of this thread, 0 outside the pool
+static thread_local int t_worker = 0;
+
+ThreadPool::ThreadPool()
+    :
+    m_config(g_config),
+    m_workers(get_max_chunks() - 1),
+    m_queues(new Queue[get_max_chunks()]),
+    m_queued(0),
+    m_sleepers(0),
+    m_next(0),
+    m_stop(false),
+    m_tasks(0),
+    m_steals(0),
+    m_parks(0)
+{
+    const int cpus = (int) std::thread::hardware_concurrency();
+
+    for (int i = 1; i <= m_workers; ++i) {
+        m_threads.push_back(std::thread(&ThreadPool::worker_main, this, i));
+        const pthread_t thread = m_threads.back().native_handle();
+
+        // unpinned workers may run anywhere, even if their creator may not
+        const int cpu = get_worker_cpu(m_config, i);
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (cpu >= 0)
+            CPU_SET(cpu, &set);
+        for (int k = 0; cpu < 0 && k < cpus; ++k)
+            CPU_SET(k, &set);
+        int res = pthread_setaffinity_np(thread, sizeof(set), &set);
+        if (res)
+            logger(LOG_WARN, "ThreadPool pinning worker %d failed %d %s", i, res, strerror(res));
+
+        // set either way, a SCHED_FIFO creator is inherited otherwise
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = m_config.fifo_priority;
+        const int policy = m_config.fifo_priority > 0 ? SCHED_FIFO : SCHED_OTHER;
+        res = pthread_setschedparam(thread, policy, &param);
+        if (res)
+            logger(LOG_WARN, "ThreadPool worker %d policy %d failed %d %s", i, policy, res, strerror(res));
+    }
+
+    logger(LOG_INFO, "ThreadPool %d workers pinned=%d cpus=0x%x fifo=%d", m_workers,
+        m_config.pin_workers, m_config.cpu_mask, m_config.fifo_priority);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_park_lock);
+        m_stop = true;
+    }
+    m_park.notify_all();
+
+    for (size_t i = 0; i < m_threads.size(); ++i)
+        m_threads[i].join();
+}
+
+void ThreadPool::submit(const Task &task)
+{
+    int index = t_worker;
+    if (!index && m_workers)
+        index = 1 + (int) (m_next.fetch_add(1, std::memory_order_relaxed) % m_workers);
+
+    if (!m_queues[index].push(task)) {
+        execute(task);
+        return;
+    }
+
+    // pairs with the sleeper count a parking worker publishes before it
+    // looks at m_queued the last time
+    m_queued.fetch_add(1);
+    if (m_sleepers.load()) {
+        std::lock_guard<std::mutex> guard(m_park_lock);
+        m_park.notify_one();
+    }
+}
+
+bool ThreadPool::take(int self, Task &task)
+{
+    if (m_queues[self].pop_back(task))
+        return true;
+
+    const int queues = m_workers + 1;
+    for (int i = 1; i < queues; ++i) {
+        if (m_queues[(self + i) % queues].pop_front(task)) {
+            m_steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::execute(const Task &task)
+{
+    task.run(task.ctx, task.chunk, task.begin, task.end);
+    m_tasks.fetch_add(1, std::memory_order_relaxed);
+    if (task.pending)
+        task.pending->fetch_sub(1, std::memory_order_acq_rel);
+}
+
+bool ThreadPool::run_one()
+{
+    Task task;
+    if (!take(t_worker, task))
+        return false;
+
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    execute(task);
+    return true;
+}
+
+void ThreadPool::wait(std::atomic<int> &pending)
+{
+    int idle = 0;
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (run_one()) {
+            idle = 0;
+            continue;
+        }
+        // the rest is running elsewhere, usually a few usec away
+        if (++idle < 1000)
+            cpu_relax();
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::worker_main(int index)
+{
+    t_worker = index;
+
+    for (;;) {
+        if (run_one())
+            continue;
+
+        const uint64_t spin_until = get_time_usec() + m_config.spin_usec;
+        while (!m_queued.load(std::memory_order_relaxed) && get_time_usec() < spin_until)
+            cpu_relax();
+        if (m_queued.load(std::memory_order_relaxed))
+            continue;
+
+        std::unique_lock<std::mutex> guard(m_park_lock);
+        m_sleepers.fetch_add(1);
+        if (!m_stop && !m_queued.load()) {
+            m_parks.fetch_add(1, std::memory_order_relaxed);
+            m_park.wait(guard);
+        }
+        m_sleepers.fetch_sub(1);
+
+        if (m_stop)
+            return;
+    }
+}
+
+} // namespace
+
+void get_pool_stats(PoolStats &stats)
+{
+    ThreadPool::instance().get_stats(stats);
+}
+
+void parallel_for(int count, int grain, RangeRun run, void *ctx)
+{
+    if (count <= 0)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    int chunks = (count + grain - 1) / grain;
+    if (chunks > get_max_chunks())
+        chunks = get_max_chunks();
+
+    if (chunks == 1) {
+        run(ctx, 0, 0, count);
+        return;
+    }
+
+    ThreadPool &pool = ThreadPool::instance();
+    std::atomic<int> pending(chunks - 1);
+
+    for (int i = chunks - 1; i >= 1; --i) {
+        Task task;
+        task.run        = run;
+        task.ctx        = ctx;
+        task.chunk      = i;
+        task.begin      = (int) ((long long) count * i / chunks);
+        task.end        = (int) ((long long) count * (i + 1) / chunks);
+        task.pending    = &pending;
+        pool.submit(task);
+    }
+
+    run(ctx, 0, 0, (int) ((long long) count / chunks));
+
+    pool.wait(pending);
+}
+
+TaskGraph::TaskGraph()
+    :
+    m_capacity(0),
+    m_remaining(0),
+    m_checked(false)
+{
+}
+
+int TaskGraph::add(const Func &fn)
+{
+    Node node;
+    node.fn = fn;
+    node.deps = 0;
+    m_nodes.push_back(node);
+    m_checked = false;
+    return (int) m_nodes.size() - 1;
+}
+
+void TaskGraph::depend(int node, int on)
+{
+    assert(node >= 0 && node < size() && on >= 0 && on < size() && node != on);
+
+    m_nodes[on].next.push_back(node);
+    ++m_nodes[node].deps;
+    m_checked = false;
+}
+
+void TaskGraph::clear()
+{
+    m_nodes.clear();
+    m_checked = false;
+}
+
+void TaskGraph::run_node(void *ctx, int node, int, int)
+{
+    TaskGraph *graph = (TaskGraph *) ctx;
+    const Node &n = graph->m_nodes[node];
+
+    n.fn();
+
+    for (size_t i = 0; i < n.next.size(); ++i) {
+        const int next = n.next[i];
+        if (graph->m_pending[next].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Task task;
+            memset(&task, 0, sizeof(task));
+            task.run        = run_node;
+            task.ctx        = graph;
+            task.chunk      = next;
+            task.pending    = &graph->m_remaining;
+            ThreadPool::instance().submit(task);
+        }
+    }
+}
+
+int TaskGraph::run()
+{
+    const int count = size();
+    if (!count)
+        return 0;
+
+    if (count > m_capacity) {
+        m_pending.reset(new std::atomic<int>[count]);
+        m_capacity = count;
+    }
+
+    // Kahn once per shape, a cycle would never finish
+    if (!m_checked) {
+        std::vector<int> deps(count);
+        std::vector<int> ready;
+        for (int i = 0; i < count; ++i) {
+            deps[i] = m_nodes[i].deps;
+            if (!deps[i])
+                ready.push_back(i);
+        }
+        int seen = 0;
+        while (!ready.empty()) {
+            const int i = ready.back();
+            ready.pop_back();
+            ++seen;
+            for (size_t k = 0; k < m_nodes[i].next.size(); ++k) {
+                if (!--deps[m_nodes[i].next[k]])
+                    ready.push_back(m_nodes[i].next[k]);
+            }
+        }
+        if (seen != count)
+            return EINVAL;
+        m_checked = true;
+    }
+
+    for (int i = 0; i < count; ++i)
+        m_pending[i].store(m_nodes[i].deps, std::memory_order_relaxed);
+    m_remaining.store(count, std::memory_order_release);
+
+    ThreadPool &pool = ThreadPool::instance();
+    for (int i = 0; i < count; ++i) {
+        if (m_nodes[i].deps)
+            continue;
+
+        Task task;
+        memset(&task, 0, sizeof(task));
+        task.run        = run_node;
+        task.ctx        = this;
+        task.chunk      = i;
+        task.pending    = &m_remaining;
+        pool.submit(task);
+    }
+
+    pool.wait(m_remaining);
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __PARALLEL__H__
+#define __PARALLEL__H__
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace robo {
+
+// run(ctx, chunk, begin, end), chunk is in [0, get_max_chunks()) and
+// unique within one parallel_for(), use it to pick per chunk scratch. Two
+// calls running at once (eg. two TaskGraph nodes) need their own scratch.
+// Chunks are numbered in range order, chunk 0 starts at 0.
+typedef void (*RangeRun)(void *ctx, int chunk, int begin, int end);
+
+struct PoolConfig
+{
+    bool        pin_workers;    // each worker runs on one cpu, worker i on cpu i
+                                // unless cpu_mask is set
+    int         spin_usec;      // idle worker spins this long before parking
+    uint32_t    cpu_mask;       // pinned workers round robin over these, 0 all
+    int         fifo_priority;  // SCHED_FIFO for the workers, 0 SCHED_OTHER
+};
+
+void get_default_pool_config(PoolConfig &config);
+
+// Takes effect if called before the first parallel_for()/TaskGraph::run().
+void configure_pool(const PoolConfig &config);
+
+int get_max_chunks();
+
+// Splits [0, count) into contiguous chunks of at least grain items and
+// runs them on the pool, the first chunk on the calling thread. Returns
+// once all chunks are done, the caller runs queued work meanwhile, so
+// nesting (eg. inside a TaskGraph node) is fine.
+//
+// The pool has get_max_chunks() - 1 workers, each with its own deque:
+// owners take their newest task, idle workers steal the oldest from the
+// others. Idle workers spin for spin_usec and then park on a condition
+// variable, an idle pipeline costs no CPU.
+void parallel_for(int count, int grain, RangeRun run, void *ctx);
+
+// fn(chunk, begin, end), usually a lambda. Called by reference, a
+// std::function would allocate per call for captures beyond two
+// pointers and per frame kernels allocate nothing.
+template <typename Func>
+inline void parallel_for(int count, int grain, const Func &fn)
+{
+    struct Call
+    {
+        static void run(void *ctx, int chunk, int begin, int end)
+        {
+            (*(const Func *) ctx)(chunk, begin, end);
+        }
+    };
+
+    parallel_for(count, grain, &Call::run, (void *) &fn);
+}
+
+struct PoolStats
+{
+    uint64_t    tasks;          // queued tasks run, by workers or waiting callers
+    uint64_t    steals;         // taken from another worker's deque
+    uint64_t    parks;          // times a worker went to sleep
+};
+
+void get_pool_stats(PoolStats &stats);
+
+// Per frame dependency graph. Nodes run on the pool as soon as every
+// node they depend on is done, eg. matching of a row band can start once
+// the bands it reads are converted while the rest is still converting.
+// Build once and run() every frame, run() allocates nothing.
+class TaskGraph
+{
+public:
+    typedef std::function<void ()> Func;
+
+    TaskGraph();
+
+    // returns the node id
+    int add(const Func &fn);
+
+    // node runs after on
+    void depend(int node, int on);
+
+    // Runs every node once and returns when all are done. EINVAL if the
+    // dependencies have a cycle.
+    int run();
+
+    void clear();
+    int size() const { return (int) m_nodes.size(); }
+
+private:
+    struct Node
+    {
+        Func                fn;
+        std::vector<int>    next;
+        int                 deps;
+    };
+
+    static void run_node(void *ctx, int node, int, int);
+
+private:
+    std::vector<Node>                   m_nodes;
+    std::unique_ptr<std::atomic<int>[]> m_pending;  // per node, deps not done
+    int                                 m_capacity;
+    std::atomic<int>                    m_remaining;
+    bool                                m_checked;  // no cycle
+};
+
+} // namespace robo
+
+#endif // __PARALLEL__H__
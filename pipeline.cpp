@@ -0,0 +1,396 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "pipeline.h"
+#include "common.h"
+#include "realtime.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace robo {
+
+void get_default_pipeline_config(PipelineConfig &config)
+{
+    get_default_stereo_config(config.stereo);
+
+    config.incremental      = true;
+    get_default_tile_config(config.tiles);
+
+    config.temporal         = true;
+    get_default_prior_config(config.prior);
+
+    config.workers          = NULL;
+    get_default_offload_config(config.offload);
+
+    config.calibration_path = "calibration.txt";
+    config.baseline_mm      = 100.0;
+    config.max_depth_mm     = 10000.0;
+
+    get_default_voxel_config(config.voxel);
+    config.voxel_point_stride   = 2;
+    config.max_voxels           = 65536;
+    config.max_grid_cells       = 256;
+
+    get_default_scan_config(config.scan);
+
+    get_default_ground_config(config.ground);
+    config.camera_height_mm     = 200.0f;
+
+    get_default_sparse_config(config.sparse);
+    get_default_speckle_config(config.speckle);
+    get_default_anytime_config(config.anytime);
+}
+
+Pipeline::Pipeline(const PipelineConfig &config)
+    :
+    m_stereo_usec(0),
+    m_reproject_usec(0),
+    m_ground_usec(0),
+    m_map_usec(0),
+    m_scan_usec(0),
+    m_encode_usec(0),
+    m_encoded_ratio(0.0),
+    m_dense_usec(0),
+    m_sparse_usec(0),
+    m_tiles_recomputed(0.0),
+    m_search_range(0.0),
+    m_speckle_removed(0),
+    m_config(config),
+    m_matcher(config.stereo),
+    m_offload(config.offload, m_matcher),
+    m_tracker(config.tiles, config.stereo.num_disparities, config.stereo.block_size,
+              config.stereo.lr_max_diff >= 0),
+    m_prior(config.prior),
+    m_confidence_out(&m_confidence),
+    m_anytime(config.anytime, m_matcher),
+    m_quality(proto::QUALITY_NONE),
+    m_coarse_only(false),
+    m_reset_tiles(false),
+    m_refined(0.0),
+    m_speckle(config.speckle),
+    m_map(config.voxel),
+    m_scan(config.scan),
+    m_ground(config.ground),
+    m_sparse(config.sparse, config.stereo.num_disparities),
+    m_voxels(config.max_voxels),
+    m_grid((size_t) config.max_grid_cells * config.max_grid_cells)
+{
+    memset(m_quality_frames, 0, sizeof(m_quality_frames));
+    memset(&m_calibration, 0, sizeof(m_calibration));
+    memset(&m_voxel_header, 0, sizeof(m_voxel_header));
+    memset(&m_grid_header, 0, sizeof(m_grid_header));
+    get_level_plane(config.camera_height_mm, m_level);
+    m_reprojector.set_max_depth(config.max_depth_mm);
+
+    if (config.workers)
+        m_offload.add_workers(config.workers);
+}
+
+int Pipeline::initialize(int width, int height)
+{
+    StereoCalibration calib;
+
+    int res = m_config.calibration_path ? load_calibration(m_config.calibration_path, calib) : ENOENT;
+    res = res || scale_calibration(calib, width, height, m_calibration);
+    if (res) {
+        if (m_config.calibration_path)
+            logger(LOG_WARN, "no usable calibration in %s, using defaults", m_config.calibration_path);
+        get_default_calibration(width, height, m_config.baseline_mm, m_calibration);
+    }
+
+    const int tile = m_config.tiles.tile_px;
+    const size_t tiles = (size_t) ((width + tile - 1) / tile) * ((height + tile - 1) / tile);
+
+    m_all_tiles.assign(tiles, 1);
+    m_retry.assign(tiles, 0);
+    m_prior.invalidate();
+
+    int ares = m_raw.allocate(width, height, PIX_FMT_DISP16);
+    ares = ares || m_disparity.allocate(width, height, PIX_FMT_DISP16);
+    ares = ares || m_confidence.allocate(width, height, PIX_FMT_GRAY8);
+    ares = ares || m_tiered.allocate(width, height, PIX_FMT_DISP16);
+    ares = ares || m_tiered_confidence.allocate(width, height, PIX_FMT_GRAY8);
+    return ares ? ENOMEM : 0;
+}
+
+void Pipeline::prefault()
+{
+    const Image *images[5] = { &m_raw, &m_disparity, &m_confidence, &m_tiered, &m_tiered_confidence };
+    for (int i = 0; i < 5; ++i)
+        robo::prefault(images[i]->data(), images[i]->view().size());
+}
+
+void Pipeline::set_range_percent(int percent)
+{
+    // whole vectors of disparities, at least one
+    int nd = (m_config.stereo.num_disparities * percent / 100) & ~7;
+    nd = nd < 8 ? 8 : nd;
+    if (nd == m_matcher.config().num_disparities)
+        return;
+
+    m_matcher.set_num_disparities(nd);
+    m_anytime.set_num_disparities(nd);
+    m_prior.invalidate();
+    m_reset_tiles = true;
+}
+
+int Pipeline::compute_disparity(const ImageView &left, const ImageView &right)
+{
+    const int nd = m_matcher.config().num_disparities;
+    const int tiles = (int) m_all_tiles.size();
+
+    // workers get whole strips, the shortcuts below are for a single node
+    if (m_offload.size()) {
+        m_tiles_recomputed = 1.0;
+        m_tiles_stat.add(m_tiles_recomputed);
+        m_search_range = nd;
+        m_search_stat.add(m_search_range);
+        return m_offload.compute(left, right, m_raw.view(), &m_confidence.view());
+    }
+
+    // most of an indoor scene does not move between two frames
+    int dirty = tiles;
+    const uint8_t *mask = &m_all_tiles[0];
+    if (m_reset_tiles) {
+        // every tile holds the old range's matches
+        if (m_config.incremental)
+            m_tracker.reset(left, right);
+        m_reset_tiles = false;
+    }
+    else if (m_config.incremental && !m_tracker.update(left, right, dirty)) {
+        mask = m_tracker.dirty();
+    }
+    else {
+        dirty = tiles;
+    }
+
+    m_tiles_recomputed = (double) dirty / tiles;
+    m_tiles_stat.add(m_tiles_recomputed);
+
+    // and what did move is mostly at the depth it was a frame ago
+    const bool narrow = m_config.temporal &&
+        !m_prior.build(m_raw.view(), m_config.tiles.tile_px, nd);
+
+    int res = 0;
+    if (!narrow) {
+        res = dirty == tiles ?
+            m_matcher.compute(left, right, m_raw.view(), &m_confidence.view()) :
+            m_matcher.compute_tiles(left, right, m_raw.view(), mask, m_config.tiles.tile_px,
+                                    &m_confidence.view());
+
+        m_search_range = dirty ? nd : 0.0;
+        m_search_stat.add(m_search_range);
+        return res;
+    }
+
+    TileJob job;
+    job.dirty             = mask;
+    job.tile              = m_config.tiles.tile_px;
+    job.d_min             = m_prior.d_min();
+    job.d_max             = m_prior.d_max();
+    job.retry             = &m_retry[0];
+    job.max_edge_fraction = m_config.prior.max_edge_fraction;
+    job.confidence        = &m_confidence.view();
+
+    res = m_matcher.compute_tiles(left, right, m_raw.view(), job);
+    if (res)
+        return res;
+
+    uint64_t searched = 0;
+    int retries = 0;
+    for (int i = 0; i < tiles; ++i) {
+        if (!mask[i])
+            continue;
+        searched += job.d_max[i] - job.d_min[i];
+        if (m_retry[i]) {
+            searched += nd;
+            ++retries;
+        }
+    }
+
+    // the surface left the narrowed range, search those again in full
+    if (retries)
+        res = m_matcher.compute_tiles(left, right, m_raw.view(), &m_retry[0], job.tile,
+                                      &m_confidence.view());
+
+    m_search_range = dirty ? (double) searched / dirty : 0.0;
+    m_search_stat.add(m_search_range);
+    return res;
+}
+
+// Whether compute_disparity() is expected to end post_usec before the
+// deadline. Until it ran once, a full resolution row's cost stands in.
+bool Pipeline::fits_full(uint64_t deadline_usec, double post_usec) const
+{
+    const double margin = m_config.anytime.margin;
+    double full = m_full_stat.mean() + margin * m_full_stat.stddev();
+
+    if (!m_full_stat.count()) {
+        full = m_anytime.row_usec() * m_disparity.height();
+        if (full <= 0.0)
+            return false;
+    }
+    return get_time_usec() + full + post_usec <= deadline_usec;
+}
+
+int Pipeline::process(const ImageView &left, const ImageView &right, uint64_t deadline_usec)
+{
+    if (!left.same_size(m_disparity.view()))
+        return EINVAL;
+
+    const uint64_t begin = get_time_usec();
+    uint64_t start = begin;
+
+    const double post = m_post_stat.mean() + m_config.anytime.margin * m_post_stat.stddev();
+    const bool full = !m_coarse_only && (!deadline_usec || fits_full(deadline_usec, post));
+
+    int res = 0;
+    const Image *disp = &m_raw;
+
+    if (full) {
+        res = compute_disparity(left, right);
+        if (res)
+            m_prior.invalidate();
+        else
+            m_full_stat.add((double) (get_time_usec() - start));
+
+        m_quality = proto::QUALITY_FULL;
+        m_refined = 1.0;
+        m_confidence_out = &m_confidence;
+    }
+    else {
+        // m_raw, the tiles and the prior stay with the last full frame
+        const uint64_t stop = !m_coarse_only && deadline_usec > post ?
+            deadline_usec - (uint64_t) post : 0;
+        res = m_anytime.compute(left, right, m_tiered.view(), m_tiered_confidence.view(), stop);
+        disp = &m_tiered;
+
+        m_refined = m_anytime.refined();
+        m_quality = m_refined >= 1.0 ? proto::QUALITY_FULL :
+            (m_refined > 0.0 ? proto::QUALITY_PARTIAL : proto::QUALITY_COARSE);
+        m_confidence_out = &m_tiered_confidence;
+    }
+
+    const uint64_t post_start = get_time_usec();
+
+    // the raw map is what the next frame's tiles and prior build on
+    res = res ? res : m_speckle.apply(disp->view(), m_disparity.view(), m_speckle_removed);
+
+    uint64_t now = get_time_usec();
+    m_stereo_usec = now - start;
+    if (res) {
+        m_quality = proto::QUALITY_NONE;
+        return res;
+    }
+
+    start = now;
+    res = m_reprojector.reproject(m_disparity.view(), m_calibration);
+    now = get_time_usec();
+    m_reproject_usec = now - start;
+    if (res)
+        return res;
+
+    // floor is most of the valid pixels, nobody downstream wants it
+    start = now;
+    if (!m_ground.fit(m_reprojector))
+        m_reprojector.remove_below(m_ground.plane(), m_config.ground.floor_mm);
+    now = get_time_usec();
+    m_ground_usec = now - start;
+
+    start = now;
+    for (int i = 0; i < m_reprojector.num_bands(); ++i) {
+        uint32_t count = 0;
+        const int16_t *points = m_reprojector.get_band(i, count);
+        m_map.integrate(points, count, m_config.voxel_point_stride);
+    }
+    m_map.end_frame();
+    now = get_time_usec();
+    m_map_usec = now - start;
+    m_post_stat.add((double) (now - post_start));
+    ++m_quality_frames[m_quality];
+
+    m_dense_usec = now - begin;
+    m_dense_stat.add(m_dense_usec);
+    return 0;
+}
+
+int Pipeline::process_sparse(const ImageView &left, const ImageView &right)
+{
+    const uint64_t start = get_time_usec();
+    const int res = m_sparse.compute(left, right);
+    m_sparse_usec = get_time_usec() - start;
+    m_sparse_stat.add(m_sparse_usec);
+    return res;
+}
+
+int Pipeline::query_voxels(const VoxelBox &box, struct iovec *iov)
+{
+    const size_t count = m_map.query(box, &m_voxels[0], m_voxels.size());
+
+    m_voxel_header.voxel_mm = m_config.voxel.voxel_mm;
+    m_voxel_header.count = count;
+
+    iov[0].iov_base = &m_voxel_header;
+    iov[0].iov_len  = sizeof(m_voxel_header);
+    iov[1].iov_base = &m_voxels[0];
+    iov[1].iov_len  = count * sizeof(VoxelCoord);
+    return 2;
+}
+
+int Pipeline::project_occupancy(const VoxelBox &box, struct iovec *iov)
+{
+    const int cell = m_config.voxel.voxel_mm;
+
+    int width = (box.max[0] - box.min[0] + cell - 1) / cell;
+    int depth = (box.max[2] - box.min[2] + cell - 1) / cell;
+    if (width <= 0 || depth <= 0 || box.max[1] <= box.min[1])
+        return 0;
+
+    if (width > m_config.max_grid_cells)
+        width = m_config.max_grid_cells;
+    if (depth > m_config.max_grid_cells)
+        depth = m_config.max_grid_cells;
+
+    m_map.project(box.min[0], box.min[2], width, depth, box.min[1], box.max[1], &m_grid[0]);
+
+    m_grid_header.width     = width;
+    m_grid_header.depth     = depth;
+    m_grid_header.cell_mm   = cell;
+    m_grid_header.reserved  = 0;
+    m_grid_header.x0        = box.min[0];
+    m_grid_header.z0        = box.min[2];
+
+    iov[0].iov_base = &m_grid_header;
+    iov[0].iov_len  = sizeof(m_grid_header);
+    iov[1].iov_base = &m_grid[0];
+    iov[1].iov_len  = (size_t) width * depth;
+    return 2;
+}
+
+int Pipeline::compute_scan(struct iovec *iov)
+{
+    const uint64_t start = get_time_usec();
+    int res = m_scan.compute(m_disparity.view(), m_calibration, floor());
+    m_scan_usec = get_time_usec() - start;
+
+    return res ? 0 : m_scan.get_payload(iov);
+}
+
+int Pipeline::encode_disparity(struct iovec *iov)
+{
+    const ImageView &disp = m_disparity.view();
+
+    const uint64_t start = get_time_usec();
+    const int count = m_encoder.encode(disp, iov);
+    m_encode_usec = get_time_usec() - start;
+
+    m_encoded_ratio = (double) m_encoder.size() / (disp.row_bytes() * disp.height);
+    return count;
+}
+
+} // namespace robo
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __PIPELINE__H__
+#define __PIPELINE__H__
+
+#include "image.h"
+#include "stereo.h"
+#include "reproject.h"
+#include "voxel.h"
+#include "scan.h"
+#include "ground.h"
+#include "tiles.h"
+#include "prior.h"
+#include "sparse.h"
+#include "speckle.h"
+#include "offload.h"
+#include "codec.h"
+#include "stats.h"
+#include "anytime.h"
+
+#include <stdint.h>
+#include <vector>
+
+struct iovec;
+
+namespace robo {
+
+struct PipelineConfig
+{
+    StereoConfig    stereo;
+    SpeckleConfig   speckle;
+
+    // recompute disparity only for tiles whose luma changed
+    bool            incremental;
+    TileConfig      tiles;
+
+    // narrow each tile's disparity search around the previous frame's
+    bool            temporal;
+    PriorConfig     prior;
+
+    // "host:port,..." of StripWorkers sharing the disparity, NULL none.
+    // Frames are then matched whole, tiles and the prior are not used.
+    const char      *workers;
+    OffloadConfig   offload;
+
+    // calibration file (see load_calibration()), NULL or missing file
+    // falls back to get_default_calibration() with baseline_mm.
+    const char      *calibration_path;
+    double          baseline_mm;
+    double          max_depth_mm;
+
+    VoxelConfig     voxel;
+    int             voxel_point_stride;     // every n'th point goes to the map
+    int             max_voxels;             // per PAYLOAD_VOXELS response
+    int             max_grid_cells;         // per side, PAYLOAD_OCCUPANCY
+
+    ScanConfig      scan;
+
+    GroundConfig    ground;
+    float           camera_height_mm;   // level floor until a plane is fit
+
+    SparseConfig    sparse;
+
+    // quality tiers of process() under a deadline
+    AnytimeConfig   anytime;
+};
+
+void get_default_pipeline_config(PipelineConfig &config);
+
+// Per frame processing of a luma pair into the CMD_GET_MAP products.
+// process() runs the stages every frame needs (disparity, point cloud,
+// floor fit and removal, voxel map update), query products are computed
+// on demand from the last processed frame.
+//
+// TODO: luma is not rectified yet, needs the calibration maps.
+class Pipeline
+{
+public:
+    explicit Pipeline(const PipelineConfig &config);
+
+    // luma geometry, allocates everything process() needs.
+    int initialize(int width, int height);
+
+    // touches the per frame images, see robo::prefault()
+    void prefault();
+
+    // With a deadline (get_time_usec(), 0 none) the full disparity is
+    // only computed if it is expected to fit, the quality tiers of
+    // AnytimeMatcher otherwise, see quality(). What follows the disparity
+    // is not cut short, its expected cost is kept free.
+    int process(const ImageView &left, const ImageView &right, uint64_t deadline_usec = 0);
+
+    // proto::STEREO_SPARSE: corner matches only, nothing else is updated
+    int process_sparse(const ImageView &left, const ImageView &right);
+
+    // the last process() frame is too old to predict the next one from,
+    // eg. after a stretch of sparse frames
+    void invalidate_prior() { m_prior.invalidate(); }
+
+    // speckle filtered disparity and the matcher's confidence (GRAY8)
+    const ImageView &disparity() const { return m_disparity.view(); }
+    const ImageView &confidence() const { return m_confidence_out->view(); }
+    const Reprojector &points() const { return m_reprojector; }
+    const VoxelMap &map() const { return m_map; }
+    const GroundPlane &ground() const { return m_ground; }
+    const SparseMatcher &features() const { return m_sparse; }
+    const StripScheduler &offload() const { return m_offload; }
+
+    // fitted plane, or the level camera guess
+    const Plane &floor() const { return m_ground.valid() ? m_ground.plane() : m_level; }
+
+    // proto::VoxelList/OccupancyGrid payload for box (mm), iov[0] gets
+    // the header, iov[1] the data. Returns the iovec count.
+    int query_voxels(const VoxelBox &box, struct iovec *iov);
+    int project_occupancy(const VoxelBox &box, struct iovec *iov);
+
+    // proto::LaserScan payload from the last disparity map
+    int compute_scan(struct iovec *iov);
+
+    // proto::EncodedDisparity payload (ENCODING_DELTA_RLE) of disparity()
+    int encode_disparity(struct iovec *iov);
+
+    // proto::FeatureList payload from the last process_sparse()
+    int get_features(struct iovec *iov) const { return m_sparse.get_payload(iov); }
+
+    const StereoCalibration &calibration() const { return m_calibration; }
+
+    // Governor knobs. The disparity range is a percentage of the
+    // configured one, coarse limits process() to AnytimeMatcher's coarse
+    // tier.
+    void set_range_percent(int percent);
+    void set_coarse_only(bool coarse) { m_coarse_only = coarse; }
+
+    // proto::QUALITY_* of the last process(), and its rows at full
+    // resolution (0..1)
+    int quality() const { return m_quality; }
+    double refined() const { return m_refined; }
+
+public:
+    // last frame's stage durations
+    uint64_t    m_stereo_usec;
+    uint64_t    m_reproject_usec;
+    uint64_t    m_ground_usec;
+    uint64_t    m_map_usec;
+    uint64_t    m_scan_usec;
+    uint64_t    m_encode_usec;
+
+    // last encode_disparity() size per raw disparity size
+    double      m_encoded_ratio;
+
+    // whole process() and process_sparse() durations, last and mean
+    uint64_t    m_dense_usec;
+    RunningStat m_dense_stat;
+    uint64_t    m_sparse_usec;
+    RunningStat m_sparse_stat;
+
+    // last frame's recomputed fraction of disparity tiles, and its mean
+    double      m_tiles_recomputed;
+    RunningStat m_tiles_stat;
+
+    // last frame's mean disparities searched per recomputed tile, and
+    // its mean over the frames
+    double      m_search_range;
+    RunningStat m_search_stat;
+
+    // pixels the speckle filter removed last frame
+    int         m_speckle_removed;
+
+    // process() frames by proto::QUALITY_*
+    uint64_t    m_quality_frames[proto::QUALITY_FULL + 1];
+
+private:
+    int compute_disparity(const ImageView &left, const ImageView &right);
+    bool fits_full(uint64_t deadline_usec, double post_usec) const;
+
+private:
+    PipelineConfig      m_config;
+    BlockMatcher        m_matcher;
+    StripScheduler      m_offload;
+    TileTracker         m_tracker;
+    TemporalPrior       m_prior;
+    Reprojector         m_reprojector;
+    StereoCalibration   m_calibration;
+    Image               m_raw;          // matcher output, incrementally updated
+    Image               m_disparity;
+    Image               m_confidence;
+    Image               m_tiered;       // AnytimeMatcher output
+    Image               m_tiered_confidence;
+    const Image         *m_confidence_out;  // of the last process()
+    AnytimeMatcher      m_anytime;
+    int                 m_quality;
+    bool                m_coarse_only;
+    bool                m_reset_tiles;  // m_raw holds another range's matches
+    double              m_refined;
+    RunningStat         m_full_stat;    // compute_disparity() usec
+    RunningStat         m_post_stat;    // speckle filter to map update usec
+    SpeckleFilter       m_speckle;
+    VoxelMap            m_map;
+    VirtualScan         m_scan;
+    GroundPlane         m_ground;
+    Plane               m_level;
+    SparseMatcher       m_sparse;
+    DisparityEncoder    m_encoder;
+
+    std::vector<uint8_t>    m_all_tiles;
+    std::vector<uint8_t>    m_retry;
+
+    proto::VoxelList            m_voxel_header;
+    std::vector<VoxelCoord>     m_voxels;
+    proto::OccupancyGrid        m_grid_header;
+    std::vector<uint8_t>        m_grid;
+};
+
+} // namespace robo
+
+#endif // __PIPELINE__H__
@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "preview.h"
+#include "alloc.h"
+#include "stereo.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace robo {
+
+void get_default_preview_config(PreviewConfig &config)
+{
+    memset(&config, 0, sizeof(config));
+    config.max_fps          = 10.0;
+    config.cpu_mask         = 0;
+    config.max_depth_mm     = 5000.0;
+    config.depth_step_mm    = 500.0;
+    config.snapshot_path    = NULL;
+    config.snapshot_usec    = 1000000;
+}
+
+static uint8_t clamp_color(double v)
+{
+    return v <= 0.0 ? 0 : v >= 1.0 ? 255 : (uint8_t) (v * 255.0 + 0.5);
+}
+
+static int copy_view(const ImageView &src, Image &dst)
+{
+    if (src.empty()) {
+        dst.release();
+        return 0;
+    }
+
+    const int res = dst.allocate(src.width, src.height, src.format);
+    if (res)
+        return res;
+
+    const ImageView &view = dst.view();
+    for (int y = 0; y < src.height; ++y)
+        memcpy(view.row(y), src.row(y), src.row_bytes());
+    return 0;
+}
+
+// panel x, y of a 2x2 composite
+static ImageView get_panel(const ImageView &bgr, int x, int y)
+{
+    const int w = bgr.width / 2;
+    const int h = bgr.height / 2;
+    return ImageView(bgr.row(y * h) + x * w * 3, w, h, bgr.stride, PIX_FMT_BGR24);
+}
+
+static void gray_to_bgr(const ImageView &gray, const ImageView &bgr)
+{
+    for (int y = 0; y < gray.height; ++y) {
+        const uint8_t *src = gray.row(y);
+        uint8_t *dst = bgr.row(y);
+        for (int x = 0; x < gray.width; ++x, dst += 3)
+            dst[0] = dst[1] = dst[2] = src[x];
+    }
+}
+
+static void clear_bgr(const ImageView &bgr)
+{
+    for (int y = 0; y < bgr.height; ++y)
+        memset(bgr.row(y), 0, bgr.row_bytes());
+}
+
+// depth of a DISP16 value, 0 if invalid or behind the rig
+static inline double get_depth(const StereoCalibration &calib, int16_t d)
+{
+    if (d <= 0)
+        return 0.0;
+
+    const double w = calib.Q[14] * d / DISP_SCALE + calib.Q[15];
+    const double z = w != 0.0 ? calib.Q[11] / w : 0.0;
+    return z > 0.0 ? z : 0.0;
+}
+
+Preview::Preview(const PreviewConfig &config)
+    :
+    m_published(0),
+    m_rendered(0),
+    m_render_usec(0),
+    m_config(config),
+    m_sink(NULL),
+    m_ctx(NULL),
+    m_stop(false),
+    m_quit(false),
+    m_interval_usec(config.max_fps > 0.0 ? (uint64_t) (1000000.0 / config.max_fps) : 1000000),
+    m_last_publish_usec(0),
+    m_last_snapshot_usec(0)
+{
+    // blue (far, low) to red (near, high)
+    for (int i = 0; i < 256; ++i) {
+        const double t = i / 255.0;
+        m_colors[i][0] = clamp_color(1.5 - fabs(4.0 * t - 1.0));
+        m_colors[i][1] = clamp_color(1.5 - fabs(4.0 * t - 2.0));
+        m_colors[i][2] = clamp_color(1.5 - fabs(4.0 * t - 3.0));
+    }
+}
+
+Preview::~Preview()
+{
+    stop();
+}
+
+int Preview::start(PreviewSink sink, void *ctx)
+{
+    if (m_thread.joinable())
+        return EINVAL;
+
+    m_sink = sink;
+    m_ctx = ctx;
+    m_stop = false;
+    m_quit = false;
+    m_thread = std::thread(&Preview::run, this);
+    return 0;
+}
+
+void Preview::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    m_stop = true;
+    m_thread.join();
+
+    logger(LOG_INFO, "Preview %llu frames published, %llu rendered",
+        (unsigned long long) m_published, (unsigned long long) m_rendered);
+}
+
+bool Preview::publish(const ImageView &left, const ImageView &right, const ImageView &disparity,
+                      const StereoCalibration &calib, uint32_t sequence, uint64_t timestamp_usec,
+                      uint64_t now_usec)
+{
+    if (!m_thread.joinable() || left.format != PIX_FMT_GRAY8 ||
+        (m_last_publish_usec && now_usec - m_last_publish_usec < m_interval_usec))
+        return false;
+
+    PreviewFrame &frame = m_slot.back();
+
+    // only a new geometry allocates
+    int res = copy_view(left, frame.left);
+    res = res || copy_view(right, frame.right);
+    res = res || copy_view(disparity.same_size(left) ? disparity : ImageView(), frame.disparity);
+    if (res)
+        return false;
+
+    frame.calib             = calib;
+    frame.sequence          = sequence;
+    frame.timestamp_usec    = timestamp_usec;
+
+    m_slot.publish();
+    m_last_publish_usec = now_usec;
+    ++m_published;
+    return true;
+}
+
+int Preview::render(const PreviewFrame &frame, Image &bgr) const
+{
+    const ImageView &left = frame.left.view();
+    if (left.empty() || left.format != PIX_FMT_GRAY8)
+        return EINVAL;
+
+    int res = bgr.allocate(left.width * 2, left.height * 2, PIX_FMT_BGR24);
+    if (res)
+        return res;
+
+    const ImageView &out = bgr.view();
+    const ImageView disp_panel = get_panel(out, 0, 1);
+    const ImageView depth_panel = get_panel(out, 1, 1);
+
+    gray_to_bgr(left, get_panel(out, 0, 0));
+    if (frame.right.view().same_size(left))
+        gray_to_bgr(frame.right.view(), get_panel(out, 1, 0));
+    else
+        clear_bgr(get_panel(out, 1, 0));
+
+    const ImageView &disp = frame.disparity.view();
+    if (disp.empty()) {
+        clear_bgr(disp_panel);
+        gray_to_bgr(left, depth_panel);
+        return 0;
+    }
+
+    // false colour over the frame's own range
+    int max_d = 1;
+    for (int y = 0; y < disp.height; ++y) {
+        const int16_t *d = disp.row_as<int16_t>(y);
+        for (int x = 0; x < disp.width; ++x)
+            if (d[x] > max_d)
+                max_d = d[x];
+    }
+
+    const double max_depth = m_config.max_depth_mm;
+    const double step = m_config.depth_step_mm;
+
+    for (int y = 0; y < disp.height; ++y) {
+        const int16_t *d = disp.row_as<int16_t>(y);
+        const int16_t *above = y ? disp.row_as<int16_t>(y - 1) : d;
+        const uint8_t *gray = left.row(y);
+        uint8_t *dp = disp_panel.row(y);
+        uint8_t *zp = depth_panel.row(y);
+
+        for (int x = 0; x < disp.width; ++x, dp += 3, zp += 3) {
+
+            if (d[x] > 0) {
+                memcpy(dp, m_colors[d[x] * 255 / max_d], 3);
+            }
+            else {
+                dp[0] = dp[1] = dp[2] = 0;
+            }
+
+            const double z = get_depth(frame.calib, d[x]);
+            if (z <= 0.0 || z > max_depth) {
+                zp[0] = zp[1] = zp[2] = gray[x];
+                continue;
+            }
+
+            // iso-depth line where the band changes to the left or above
+            if (step > 0.0 && x && y) {
+                const int band = (int) (z / step);
+                const double zl = get_depth(frame.calib, d[x - 1]);
+                const double za = get_depth(frame.calib, above[x]);
+                if ((zl > 0.0 && (int) (zl / step) != band) || (za > 0.0 && (int) (za / step) != band)) {
+                    zp[0] = zp[1] = zp[2] = 255;
+                    continue;
+                }
+            }
+
+            // near is hot, half luma half colour
+            const uint8_t *color = m_colors[255 - (int) (z * 255.0 / max_depth)];
+            zp[0] = (uint8_t) ((gray[x] + color[0]) / 2);
+            zp[1] = (uint8_t) ((gray[x] + color[1]) / 2);
+            zp[2] = (uint8_t) ((gray[x] + color[2]) / 2);
+        }
+    }
+
+    return 0;
+}
+
+// open/write, not stdio: nothing here may allocate while the loop is
+// mid frame
+int Preview::write_ppm(const char *path, const ImageView &bgr)
+{
+    assert(path);
+
+    if (bgr.empty() || bgr.format != PIX_FMT_BGR24)
+        return EINVAL;
+
+    char tmp[PATH_MAX];
+    int len = snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if (len <= 0 || len >= (int) sizeof(tmp))
+        return ENAMETOOLONG;
+
+    const int fd = HANDLE_EINTR(::open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd == -1)
+        return errno;
+
+    char header[64];
+    len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", bgr.width, bgr.height);
+
+    int res = 0;
+    if (HANDLE_EINTR(::write(fd, header, len)) != len)
+        res = errno ? errno : EIO;
+
+    // PPM is RGB
+    uint8_t rgb[3 * 1024];
+    for (int y = 0; !res && y < bgr.height; ++y) {
+        const uint8_t *src = bgr.row(y);
+        for (int x = 0; !res && x < bgr.width; ) {
+            const int n = bgr.width - x < 1024 ? bgr.width - x : 1024;
+            for (int i = 0; i < n; ++i, src += 3) {
+                rgb[i * 3 + 0] = src[2];
+                rgb[i * 3 + 1] = src[1];
+                rgb[i * 3 + 2] = src[0];
+            }
+            if (HANDLE_EINTR(::write(fd, rgb, n * 3)) != n * 3)
+                res = errno ? errno : EIO;
+            x += n;
+        }
+    }
+
+    if (HANDLE_EINTR(::close(fd)) && !res)
+        res = errno;
+    if (!res && ::rename(tmp, path))
+        res = errno;
+    if (res)
+        ::unlink(tmp);
+    return res;
+}
+
+void Preview::render_frame(bool snapshot)
+{
+    const uint64_t start = get_time_usec();
+
+    if (render(m_slot.front(), m_bgr))
+        return;
+
+    m_render_usec = get_time_usec() - start;
+    ++m_rendered;
+
+    if (m_sink && !m_sink(m_ctx, m_bgr.view()))
+        m_quit = true;
+
+    if (snapshot && m_config.snapshot_path) {
+        const int res = write_ppm(m_config.snapshot_path, m_bgr.view());
+        if (res)
+            logger(LOG_WARN, "Preview snapshot %s failed %d %s", m_config.snapshot_path, res, strerror(res));
+        m_last_snapshot_usec = get_time_usec();
+    }
+}
+
+void Preview::run()
+{
+    pin_thread_alloc_stage(ALLOC_STAGE_OTHER);
+
+    // leftover cycles only, whatever the creator's policy and cpus were
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int res = pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    if (res)
+        logger(LOG_WARN, "Preview SCHED_IDLE failed %d %s", res, strerror(res));
+
+    const int cpus = (int) std::thread::hardware_concurrency();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int k = 0; k < cpus && k < 32; ++k)
+        if (!m_config.cpu_mask || (m_config.cpu_mask & (1u << k)))
+            CPU_SET(k, &set);
+    res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (res)
+        logger(LOG_WARN, "Preview cpus 0x%x failed %d %s", m_config.cpu_mask, res, strerror(res));
+
+    while (!m_stop.load(std::memory_order_relaxed)) {
+        usleep(m_interval_usec);
+
+        if (!m_slot.acquire())
+            continue;
+
+        const uint64_t now = get_time_usec();
+        render_frame(now - m_last_snapshot_usec >= m_config.snapshot_usec);
+    }
+
+    // the last frame always makes it to the snapshot
+    if (m_slot.acquire() || m_rendered)
+        render_frame(true);
+
+    if (m_sink)
+        m_sink(m_ctx, ImageView());
+}
+
+} // namespace robo
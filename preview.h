@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __PREVIEW__H__
+#define __PREVIEW__H__
+
+#include "image.h"
+#include "reproject.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+namespace robo {
+
+// Latest value slot for one producer and one consumer, wait free for
+// both (triple buffering). The producer fills back() and publish()es it,
+// the consumer's acquire() takes the newest one published into front().
+// Neither ever touches the buffer the other one holds, values in between
+// are dropped.
+template <typename T>
+class LatestSlot
+{
+public:
+    LatestSlot() : m_state(1), m_back(0), m_front(2) {}
+
+    T &back() { return m_items[m_back]; }
+    const T &front() const { return m_items[m_front]; }
+
+    void publish()
+    {
+        m_back = m_state.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // true if front() is a new value
+    bool acquire()
+    {
+        if (!(m_state.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        m_front = m_state.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+private:
+    LatestSlot(const LatestSlot &);
+    LatestSlot &operator=(const LatestSlot &);
+
+    enum { INDEX = 3, FRESH = 4 };
+
+    T                   m_items[3];
+    std::atomic<int>    m_state;    // index of the middle item | FRESH
+    int                 m_back;
+    int                 m_front;
+};
+
+// What the loop hands over, copies so the loop can go on.
+struct PreviewFrame
+{
+    Image               left;       // GRAY8 luma
+    Image               right;
+    Image               disparity;  // DISP16 of left, empty without one
+    StereoCalibration   calib;      // of the disparity
+    uint32_t            sequence;
+    uint64_t            timestamp_usec;
+};
+
+// Gets the rendered BGR24 composite on the preview thread, returns
+// false to ask the loop to stop (eg. ESC in a window). Called once more
+// with an empty view before the thread exits, to release what it made
+// on that thread.
+typedef bool (*PreviewSink)(void *ctx, const ImageView &bgr);
+
+struct PreviewConfig
+{
+    double      max_fps;            // frames taken and rendered at most
+    uint32_t    cpu_mask;           // cpus the thread runs on, 0 any
+
+    // depth overlay colours span [0, max_depth_mm], a contour line
+    // every depth_step_mm (0 none)
+    double      max_depth_mm;
+    double      depth_step_mm;
+
+    // PPM of the composite, rewritten at most every snapshot_usec and
+    // when the preview stops, NULL none
+    const char  *snapshot_path;
+    uint64_t    snapshot_usec;
+};
+
+void get_default_preview_config(PreviewConfig &config);
+
+// Debug view off the request loop. The loop publish()es its luma pair
+// and disparity, at most max_fps times a second, the copy is the only
+// cost on the loop. A SCHED_IDLE thread renders the latest one as a 2x2
+// composite: left, right, disparity in false colour and the left luma
+// tinted by depth with iso-depth contours. The composite goes to the
+// sink (a window) and/or a snapshot file.
+//
+// Allocations of the thread count as ALLOC_STAGE_OTHER.
+class Preview
+{
+public:
+    explicit Preview(const PreviewConfig &config);
+    ~Preview();
+
+    int start(PreviewSink sink, void *ctx);
+    // renders the last frame published (and snapshots it) before it
+    // returns
+    void stop();
+    bool is_running() const { return m_thread.joinable(); }
+
+    // Loop side. Returns false without copying if the preview is not
+    // running or took a frame less than 1 / max_fps ago.
+    bool publish(const ImageView &left, const ImageView &right, const ImageView &disparity,
+                 const StereoCalibration &calib, uint32_t sequence, uint64_t timestamp_usec,
+                 uint64_t now_usec);
+
+    // a sink asked to stop
+    bool quit_requested() const { return m_quit.load(std::memory_order_relaxed); }
+
+    // Renders frame into bgr (allocated to 2x the luma size), exposed
+    // for tests.
+    int render(const PreviewFrame &frame, Image &bgr) const;
+
+    // P6 PPM of a BGR24 view, replaced atomically (written next to it,
+    // then renamed).
+    static int write_ppm(const char *path, const ImageView &bgr);
+
+    uint64_t    m_published;
+    uint64_t    m_rendered;
+    uint64_t    m_render_usec;      // last render
+
+private:
+    void run();
+    void render_frame(bool snapshot);
+
+    PreviewConfig               m_config;
+    LatestSlot<PreviewFrame>    m_slot;
+    Image                       m_bgr;
+    PreviewSink                 m_sink;
+    void                        *m_ctx;
+    std::thread                 m_thread;
+    std::atomic<bool>           m_stop;
+    std::atomic<bool>           m_quit;
+    uint64_t                    m_interval_usec;
+    uint64_t                    m_last_publish_usec;
+    uint64_t                    m_last_snapshot_usec;
+    uint8_t                     m_colors[256][3];  // false colour ramp, BGR
+};
+
+} // namespace robo
+
+#endif // __PREVIEW__H__
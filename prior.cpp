@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "prior.h"
+#include "stereo.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+
+namespace robo {
+
+void get_default_prior_config(PriorConfig &config)
+{
+    config.margin_px            = 4;
+    config.min_valid_fraction   = 0.25f;
+    config.max_edge_fraction    = 0.1f;
+    config.refresh_frames       = 30;   // 2s at 15 fps
+}
+
+TemporalPrior::TemporalPrior(const PriorConfig &config)
+    :
+    m_config(config),
+    m_valid(false),
+    m_frames(0),
+    m_tile(0),
+    m_tiles_x(0),
+    m_tiles_y(0)
+{
+}
+
+int TemporalPrior::build(const ImageView &disp, int tile, int num_disparities)
+{
+    if (disp.format != PIX_FMT_DISP16 || disp.empty() || tile <= 0)
+        return EINVAL;
+
+    // ranges are stored in bytes
+    assert(num_disparities > 0 && num_disparities <= UINT8_MAX);
+
+    const int tiles_x = (disp.width + tile - 1) / tile;
+    const int tiles_y = (disp.height + tile - 1) / tile;
+
+    if (tile != m_tile || tiles_x != m_tiles_x || tiles_y != m_tiles_y) {
+        m_tile = tile;
+        m_tiles_x = tiles_x;
+        m_tiles_y = tiles_y;
+        m_min.assign(tiles_x * tiles_y, 0);
+        m_max.assign(tiles_x * tiles_y, num_disparities);
+        m_low.resize(tiles_x * tiles_y);
+        m_high.resize(tiles_x * tiles_y);
+        m_usable.resize(tiles_x * tiles_y);
+        m_valid = false;
+    }
+
+    const bool refresh = m_config.refresh_frames > 0 && ++m_frames >= m_config.refresh_frames;
+    if (!m_valid || refresh) {
+        m_valid = true;
+        m_frames = 0;
+        return EAGAIN;
+    }
+
+    // valid disparity span of every tile
+    parallel_for(tiles_y, 1, [&](int, int ty0, int ty1) {
+        for (int ty = ty0; ty < ty1; ++ty) {
+            const int y0 = ty * tile;
+            const int y1 = y0 + tile < disp.height ? y0 + tile : disp.height;
+
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                const int x0 = tx * tile;
+                const int x1 = x0 + tile < disp.width ? x0 + tile : disp.width;
+
+                int low = INT16_MAX;
+                int high = 0;
+                int valid = 0;
+
+                for (int y = y0; y < y1; ++y) {
+                    const int16_t *row = (const int16_t *) disp.row(y);
+                    for (int x = x0; x < x1; ++x) {
+                        const int d = row[x];
+                        if (d < 0)
+                            continue;
+                        low = d < low ? d : low;
+                        high = d > high ? d : high;
+                        ++valid;
+                    }
+                }
+
+                const int i = ty * tiles_x + tx;
+                m_usable[i] = valid > 0 && valid >= m_config.min_valid_fraction * (x1 - x0) * (y1 - y0);
+                m_low[i] = valid ? low >> DISP_SHIFT : 0;
+                m_high[i] = valid ? (high + DISP_SCALE - 1) >> DISP_SHIFT : 0;
+            }
+        }
+    });
+
+    const int margin = m_config.margin_px;
+
+    for (int ty = 0; ty < tiles_y; ++ty) {
+        for (int tx = 0; tx < tiles_x; ++tx) {
+            const int i = ty * tiles_x + tx;
+
+            int low = 0;
+            int high = num_disparities - 1;
+
+            if (m_usable[i]) {
+                low = m_low[i];
+                high = m_high[i];
+
+                for (int ny = ty - 1; ny <= ty + 1; ++ny) {
+                    for (int nx = tx - 1; nx <= tx + 1; ++nx) {
+                        if (ny < 0 || ny >= tiles_y || nx < 0 || nx >= tiles_x)
+                            continue;
+                        const int n = ny * tiles_x + nx;
+                        if (!m_usable[n])
+                            continue;
+                        low = m_low[n] < low ? m_low[n] : low;
+                        high = m_high[n] > high ? m_high[n] : high;
+                    }
+                }
+
+                low = low > margin ? low - margin : 0;
+                high = high + margin < num_disparities ? high + margin : num_disparities - 1;
+            }
+
+            m_min[i] = (uint8_t) low;
+            m_max[i] = (uint8_t) (high + 1);
+        }
+    }
+
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __PRIOR__H__
+#define __PRIOR__H__
+
+#include "image.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+struct PriorConfig
+{
+    int     margin_px;              // added on both sides of the previous range
+    float   min_valid_fraction;     // of a tile's pixels, below searches full range
+    float   max_edge_fraction;      // of the pixels matching on a narrowed edge, see TileJob
+    int     refresh_frames;         // full range search every n frames, 0 never
+};
+
+void get_default_prior_config(PriorConfig &config);
+
+// Per tile disparity search ranges from the previous frame's map. A
+// tile searches [min - margin, max + margin] of the valid disparities in
+// its 3x3 tile neighbourhood, so a surface moving a few pixels between
+// frames or across a tile border is still inside. Tiles with too few
+// valid pixels search the full range.
+//
+// TODO: no ego-motion compensation, needs odometry.
+class TemporalPrior
+{
+public:
+    explicit TemporalPrior(const PriorConfig &config);
+
+    const PriorConfig &config() const { return m_config; }
+
+    // Ranges for the frame after disp. EAGAIN when this frame should
+    // search the full range instead (first frame, after invalidate(),
+    // geometry change or refresh), the next call uses it as the prior.
+    int build(const ImageView &disp, int tile, int num_disparities);
+
+    // the previous map can not be trusted, eg. its computation failed
+    void invalidate() { m_valid = false; }
+
+    const uint8_t *d_min() const { return &m_min[0]; }
+    const uint8_t *d_max() const { return &m_max[0]; }
+
+private:
+    PriorConfig             m_config;
+    bool                    m_valid;
+    int                     m_frames;
+    int                     m_tile;
+    int                     m_tiles_x;
+    int                     m_tiles_y;
+    std::vector<uint8_t>    m_min;      // [d_min, d_max) per tile
+    std::vector<uint8_t>    m_max;
+    std::vector<uint8_t>    m_low;      // per tile min/max of disp
+    std::vector<uint8_t>    m_high;
+    std::vector<uint8_t>    m_usable;
+};
+
+} // namespace robo
+
+#endif // __PRIOR__H__
@@ -8,7 +8,8 @@ namespace robo {
 //
 // We keep it simple here. No endian translation, no bitpacking,
 // no serialization, no versioning. Our server/client are on
-// the same machine. We simply disable padding and send/recv
+// the same machine, or over TCP on machines of the same
+// architecture. We simply disable padding and send/recv
 // specific size structs.
 //
 namespace proto {
@@ -17,12 +18,70 @@ enum {
     CMD_GET_MAP = 0x01,
     CMD_PING    = 0x02,
     CMD_EXIT    = 0x03,
+    CMD_STATS   = 0x04,     // responds with PAYLOAD_STATS
+    CMD_SET_ENCODING = 0x05,    // see ENCODINGS
 } COMMANDS;
 
+// Optional payload attached to a response, requested per Request.
+enum {
+    PAYLOAD_NONE    = 0x00,
+    PAYLOAD_GRAY8   = 0x01,     // left camera luma, width x height bytes
+    PAYLOAD_STATS   = 0x02,     // proto::Stats
+    PAYLOAD_DISP16  = 0x03,     // int16_t disparity, 1/16 pixel, -1 invalid
+    PAYLOAD_POINTS  = 0x04,     // proto::PointCloud
+    PAYLOAD_VOXELS  = 0x05,     // proto::VoxelList
+    PAYLOAD_OCCUPANCY = 0x06,   // proto::OccupancyGrid
+    PAYLOAD_SCAN    = 0x07,     // proto::LaserScan
+    PAYLOAD_FEATURES = 0x08,    // proto::FeatureList
+    PAYLOAD_CONFIDENCE = 0x09,  // disparity confidence, width x height bytes
+} PAYLOADS;
+
+// How CMD_GET_MAP computes depth. Sparse only matches corners, it is a
+// small fraction of the dense CPU cost and only PAYLOAD_GRAY8 and
+// PAYLOAD_FEATURES are served in it, the map is not updated.
+enum {
+    STEREO_DENSE    = 0x00,
+    STEREO_SPARSE   = 0x01,
+} STEREO_MODES;
+
+// Payload encodings. CMD_SET_ENCODING offers Request.encodings (a bit
+// per ENCODING_* the client decodes), the response's payload_encoding
+// is the one the server picked. It holds until the client disconnects,
+// a new connection starts out raw.
+enum {
+    ENCODING_RAW        = 0x00,
+    ENCODING_DELTA_RLE  = 0x01,     // PAYLOAD_DISP16 as proto::EncodedDisparity
+} ENCODINGS;
+
+// Quality a dense CMD_GET_MAP was computed at. Under a deadline the
+// disparity is matched at half resolution first and refined in full
+// resolution strips while time allows, see Response.refined_permille.
+enum {
+    QUALITY_NONE    = 0x00,     // no dense map (sparse mode, or failed)
+    QUALITY_COARSE  = 0x01,     // half resolution disparity, upscaled
+    QUALITY_PARTIAL = 0x02,     // coarse with some rows at full resolution
+    QUALITY_FULL    = 0x03,
+} QUALITIES;
+
 struct Request
 {
     uint32_t trx_id;
     uint32_t cmd;
+    uint32_t payload;           // PAYLOAD_* wanted in the response
+
+    // Region of interest for PAYLOAD_VOXELS/PAYLOAD_OCCUPANCY, mm in the
+    // map frame, min inclusive max exclusive. All zero means the whole
+    // map (voxels) or the default grid (occupancy).
+    int32_t roi_min[3];
+    int32_t roi_max[3];
+
+    uint32_t stereo_mode;       // STEREO_*
+    uint32_t encodings;         // CMD_SET_ENCODING, 1 << ENCODING_* bits
+
+    // CMD_GET_MAP is answered within this many usec of the server
+    // reading the request, with the best quality done by then. 0 none,
+    // the map is then always QUALITY_FULL.
+    uint32_t deadline_usec;
 } __attribute__((packed));;
 
 struct Response
@@ -32,6 +91,247 @@ struct Response
 
     // TODO: we do not yet know our response data type/content
     uint64_t data;
+
+    // payload_size bytes of payload_type follow the response on the
+    // wire. Image payloads are sent row by row without row padding,
+    // unless payload_encoding (ENCODING_*) says otherwise.
+    uint16_t payload_type;
+    uint16_t payload_width;
+    uint16_t payload_height;
+    uint16_t payload_encoding;
+    uint32_t payload_size;
+
+    // Driver capture time (CLOCK_MONOTONIC usec) and sequence of the
+    // frames the response was computed from, zero when no frames were
+    // involved. age_usec is stamped by the server right before send,
+    // it is the time since the older of the two frames was captured.
+    uint64_t left_timestamp_usec;
+    uint64_t right_timestamp_usec;
+    uint32_t left_sequence;
+    uint32_t right_sequence;
+    uint32_t age_usec;
+
+    // Floor plane in the left camera frame (CMD_GET_MAP), n . p + d = 0
+    // with n pointing up and d the camera height in mm. All zero until a
+    // plane was fit, pitch and roll follow from n.
+    float    floor_normal[3];
+    float    floor_distance;
+
+    // STEREO_* the frame was processed with, and what it cost
+    uint32_t stereo_mode;
+    uint32_t process_usec;
+
+    // QUALITY_* of the map, and its rows at full resolution in 1/1000
+    uint16_t quality;
+    uint16_t refined_permille;
+} __attribute__((packed));;
+
+// Point cloud in the left rectified camera frame (x right, y down, z
+// forward), int16_t millimetres per axis. The header is followed by the
+// validity mask, height rows of (width + 7) / 8 bytes with bit (x & 7)
+// of byte (x >> 3) set for a valid pixel, then count int16_t[3] points
+// in mask order (row major).
+struct PointCloud
+{
+    uint16_t width;
+    uint16_t height;
+    uint32_t count;
+} __attribute__((packed));;
+
+// Occupied voxels, count int16_t[3] voxel indices follow. Voxel i spans
+// [i * voxel_mm, (i + 1) * voxel_mm) mm on each axis.
+struct VoxelList
+{
+    uint16_t voxel_mm;
+    uint16_t reserved;
+    uint32_t count;
+} __attribute__((packed));;
+
+// Map projected onto the floor: width x depth cells of cell_mm starting
+// at (x0, z0) mm, row major with z rows, one byte per cell. 0 is free or
+// unknown, 1..255 occupancy confidence.
+struct OccupancyGrid
+{
+    uint16_t width;
+    uint16_t depth;
+    uint16_t cell_mm;
+    uint16_t reserved;
+    int32_t  x0;
+    int32_t  z0;
+} __attribute__((packed));;
+
+// Nearest obstacle per column band, count uint16_t depths in mm follow
+// (0 nothing seen), left to right. Band i covers image columns
+// [i * band_px, (i + 1) * band_px), its bearing is atan((x - cx) / focal)
+// for the band's center column x.
+struct LaserScan
+{
+    uint16_t count;
+    uint16_t band_px;
+    float    focal;
+    float    cx;
+} __attribute__((packed));;
+
+// Sparse stereo matches, count proto::Feature follow in row major order
+// of the left camera luma (width x height).
+struct FeatureList
+{
+    uint16_t width;
+    uint16_t height;
+    uint32_t count;
+} __attribute__((packed));;
+
+struct Feature
+{
+    uint16_t x;                 // left luma pixel
+    uint16_t y;
+    int16_t  disparity;         // 1/16 pixel like PAYLOAD_DISP16
+    uint8_t  confidence;        // 0..255, how much the match beat the runner up
+    uint8_t  reserved;
+} __attribute__((packed));;
+
+struct Stats
+{
+    uint64_t frames;                // CMD_GET_MAP responses
+
+    // capture to send age of CMD_GET_MAP responses
+    uint64_t latency_count;
+    uint32_t latency_mean_usec;
+    uint32_t latency_min_usec;
+    uint32_t latency_max_usec;
+    uint32_t latency_p50_usec;
+    uint32_t latency_p99_usec;
+    uint32_t latency_p999_usec;
+
+    // time to first frame, 0 until both cameras delivered one
+    uint32_t startup_usec;          // process start to first frame pair
+    uint32_t first_frame_usec;      // last bring-up/resume, slower camera
+
+    uint32_t voxels;                // voxels in the map
+    uint32_t voxels_dropped;        // inserts dropped, no stale voxel to evict
+
+    // disparity tiles recomputed, last frame and mean, 1/1000
+    uint32_t tiles_recomputed_permille;
+    uint32_t tiles_recomputed_mean_permille;
+
+    // disparities searched per recomputed tile, last frame and mean, 1/10 px
+    uint32_t search_range_decipx;
+    uint32_t search_range_mean_decipx;
+
+    // per frame processing cost by stereo mode, last and mean
+    uint32_t dense_usec;
+    uint32_t dense_mean_usec;
+    uint32_t sparse_usec;
+    uint32_t sparse_mean_usec;
+    uint32_t sparse_features;       // last sparse frame
+
+    uint32_t speckle_removed;       // disparity pixels, last dense frame
+
+    // worker pool totals since start
+    uint64_t pool_tasks;
+    uint64_t pool_steals;
+    uint64_t pool_parks;
+
+    // disparity strip offload (see offload.h)
+    uint32_t offload_workers;           // connected
+    uint32_t offload_remote_permille;   // rows computed remotely, last frame
+    uint64_t offload_fallbacks;         // strips recomputed locally
+
+    // last encoded PAYLOAD_DISP16, encoded size per raw size in 1/1000
+    uint32_t encode_usec;
+    uint32_t encoded_permille;
+
+    // CMD_GET_MAP with a deadline_usec, and those answered after it
+    uint64_t deadline_requests;
+    uint64_t deadline_missed;
+
+    // dense frames by QUALITY_*
+    uint64_t quality_frames[4];
+
+    // load governor (see governor.h), level 0 is full processing
+    uint32_t governor_level;
+    uint32_t governor_load_permille;    // last frame's busy time per frame interval
+    uint64_t governor_changes;
+    uint64_t governor_skipped;          // CMD_GET_MAP answered from the last map
+    int32_t  temperature_mdeg;          // 0 unknown
+
+    // heap allocations (see alloc.h) by stage: other, capture, process,
+    // send. A frame past its warm up should not allocate at all.
+    uint64_t allocs[4];
+    uint64_t alloc_bytes;
+    uint64_t main_thread_allocs;        // of those, by the main loop thread
+    uint32_t alloc_threads;             // threads that allocated
+    uint32_t frame_allocs;              // last frame, capture to response
+    uint64_t steady_alloc_frames;       // frames past their warm up that allocated
+
+    // page faults of the last frame and of the process so far
+    uint32_t frame_minor_faults;
+    uint32_t frame_major_faults;
+    uint64_t minor_faults;
+    uint64_t major_faults;
+
+    // process CPU time (user + system, every thread) and peak resident
+    // set so far, per frame CPU is the difference of two over frames
+    uint64_t cpu_usec;
+    uint32_t max_rss_kb;
+    uint32_t clients;                   // connected now
+} __attribute__((packed));;
+
+// ENCODING_DELTA_RLE disparity. mask_size bytes of validity mask and
+// value_size bytes of values follow.
+//
+// Mask: per row, LEB128 run lengths alternating between invalid and
+// valid pixels, starting with invalid (may be 0), adding up to width.
+//
+// Values: valid pixels only, row major. Each is coded as the zigzag of
+// its difference to the pixel above, where invalid pixels (and the row
+// above the first) take the value of the pixel above them (0 above the
+// first row), in byte tokens:
+//   0x00..0x3f          run of token + 1 zeros
+//   0x40..0x7f          two zigzags, (token - 0x40) >> 3 and & 7, of the
+//                       same valid run
+//   0x80..0xbf          zigzag token - 0x7f (1..64)
+//   0xc0..0xfe, b       zigzag ((token - 0xc0) << 8 | b) + 65
+//   0xff, lo, hi        zigzag as is
+struct EncodedDisparity
+{
+    uint16_t width;
+    uint16_t height;
+    uint32_t mask_size;
+    uint32_t value_size;
+} __attribute__((packed));;
+
+// Disparity strip offload, capture node to worker. The request is
+// followed by height x width left luma then as much right luma, the
+// rows [first, first + rows) of it are matched, the rest is the block
+// window's context.
+struct StripRequest
+{
+    uint32_t frame;
+    uint16_t width;
+    uint16_t height;
+    uint16_t first;
+    uint16_t rows;
+
+    // matcher settings, the worker follows the capture node's
+    uint16_t num_disparities;
+    uint16_t block_size;
+    int16_t  uniqueness_ratio;
+    int16_t  lr_max_diff;
+    uint8_t  subpixel;
+    uint8_t  reserved[3];
+} __attribute__((packed));;
+
+// Worker to capture node. Unless result (an errno) is set, rows x width
+// int16_t disparity (PAYLOAD_DISP16) and rows x width confidence bytes
+// (PAYLOAD_CONFIDENCE) follow.
+struct StripResponse
+{
+    uint32_t frame;
+    uint16_t width;
+    uint16_t rows;
+    int32_t  result;
+    uint32_t service_usec;      // request header in to response out
 } __attribute__((packed));;
 
 } // namespace proto
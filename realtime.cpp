@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "realtime.h"
+#include "parallel.h"
+#include "common.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <thread>
+
+namespace robo {
+
+static const int g_max_cpus = 32;
+
+// deepest stack the main loop is expected to need
+static const size_t g_stack_prefault = 256 * 1024;
+
+void get_default_runtime_profile(RuntimeProfile &profile)
+{
+    profile.main_cpu        = -1;
+    profile.worker_cpus     = 0;
+    profile.fifo_priority   = 0;
+    profile.worker_priority = 0;
+    profile.lock_memory     = false;
+    profile.prefault        = false;
+}
+
+int parse_cpu_list(const char *list, uint32_t &mask)
+{
+    mask = 0;
+    if (!list || !*list)
+        return EINVAL;
+
+    const char *p = list;
+    for (;;) {
+        char *end = NULL;
+        const long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= g_max_cpus)
+            return EINVAL;
+
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= g_max_cpus)
+                return EINVAL;
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu)
+            mask |= 1u << cpu;
+
+        if (!*p)
+            return 0;
+        if (*p++ != ',')
+            return EINVAL;
+    }
+}
+
+static size_t page_size()
+{
+    static const size_t size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+void prefault(void *data, size_t size)
+{
+    volatile uint8_t *p = (volatile uint8_t *) data;
+    const size_t page = page_size();
+
+    for (size_t i = 0; i < size; i += page)
+        p[i] = p[i];
+    if (size)
+        p[size - 1] = p[size - 1];
+}
+
+void prefault_read(const void *data, size_t size)
+{
+    const volatile uint8_t *p = (const volatile uint8_t *) data;
+    const size_t page = page_size();
+
+    for (size_t i = 0; i < size; i += page)
+        (void) p[i];
+}
+
+uint32_t get_worker_cpus(const RuntimeProfile &profile, int cpus)
+{
+    if (profile.worker_cpus || profile.main_cpu < 0 || profile.main_cpu >= g_max_cpus || cpus < 2)
+        return profile.worker_cpus;
+
+    const uint32_t all = cpus >= g_max_cpus ? ~0u : (1u << cpus) - 1;
+    return all & ~(1u << profile.main_cpu);
+}
+
+// grows the stack to its working size while we can still afford the faults
+static void __attribute__((noinline)) prefault_stack()
+{
+    volatile uint8_t stack[g_stack_prefault];
+    const size_t page = page_size();
+
+    for (size_t i = 0; i < sizeof(stack); i += page)
+        stack[i] = 0;
+}
+
+int apply_runtime_profile(const RuntimeProfile &profile)
+{
+    int res = 0;
+    int first = 0;
+    bool locked = false;
+
+    PoolConfig pool;
+    get_default_pool_config(pool);
+    pool.cpu_mask       = get_worker_cpus(profile, (int) std::thread::hardware_concurrency());
+    pool.fifo_priority  = profile.worker_priority;
+    configure_pool(pool);
+
+    if (profile.main_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(profile.main_cpu, &set);
+        res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (res)
+            logger(LOG_WARN, "pinning main loop to cpu %d failed %d %s",
+                profile.main_cpu, res, strerror(res));
+        first = first ? first : res;
+    }
+
+    if (profile.fifo_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = profile.fifo_priority;
+        res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (res)
+            logger(LOG_WARN, "SCHED_FIFO priority %d failed %d %s",
+                profile.fifo_priority, res, strerror(res));
+        first = first ? first : res;
+    }
+
+    if (profile.lock_memory) {
+        // freed memory stays in the heap, trimming and mmap()ed chunks
+        // would fault again on the next allocation
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+
+        res = mlockall(MCL_CURRENT | MCL_FUTURE) ? errno : 0;
+        if (res)
+            logger(LOG_WARN, "mlockall failed %d %s", res, strerror(res));
+        first = first ? first : res;
+        locked = !res;
+    }
+
+    if (profile.prefault)
+        prefault_stack();
+
+    logger(LOG_INFO, "runtime profile main_cpu=%d worker_cpus=0x%x fifo=%d/%d locked=%d prefault=%d",
+        profile.main_cpu, profile.worker_cpus, profile.fifo_priority, profile.worker_priority,
+        locked, profile.prefault);
+    return first;
+}
+
+// first line of a sysfs file, "" if there is none
+static void read_line(const char *path, char *line, size_t size)
+{
+    line[0] = 0;
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return;
+    if (fgets(line, (int) size, fp))
+        line[strcspn(line, "\n")] = 0;
+    fclose(fp);
+}
+
+static void log_limit(const char *name, int resource)
+{
+    struct rlimit limit;
+    if (getrlimit(resource, &limit))
+        return;
+
+    if (limit.rlim_cur == RLIM_INFINITY)
+        logger(LOG_INFO, "topology %s unlimited", name);
+    else
+        logger(LOG_INFO, "topology %s %llu", name, (unsigned long long) limit.rlim_cur);
+}
+
+void log_topology()
+{
+    char online[64];
+    char isolated[64];
+    read_line("/sys/devices/system/cpu/online", online, sizeof(online));
+    read_line("/sys/devices/system/cpu/isolated", isolated, sizeof(isolated));
+
+    logger(LOG_INFO, "topology cpus online=%s isolated=%s configured=%ld",
+        online[0] ? online : "?", isolated[0] ? isolated : "none", sysconf(_SC_NPROCESSORS_CONF));
+
+    const int cpus = (int) sysconf(_SC_NPROCESSORS_CONF);
+    for (int cpu = 0; cpu < cpus && cpu < g_max_cpus; ++cpu) {
+        char path[128];
+        char core[16];
+        char package[16];
+        char governor[32];
+        char max_khz[16];
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        read_line(path, core, sizeof(core));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        read_line(path, package, sizeof(package));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", cpu);
+        read_line(path, governor, sizeof(governor));
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+        read_line(path, max_khz, sizeof(max_khz));
+
+        logger(LOG_INFO, "topology cpu%d core=%s package=%s governor=%s max_khz=%s", cpu,
+            core[0] ? core : "?", package[0] ? package : "?",
+            governor[0] ? governor : "?", max_khz[0] ? max_khz : "?");
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (!sched_getaffinity(0, sizeof(set), &set)) {
+        char allowed[256] = "";
+        size_t used = 0;
+        for (int cpu = 0; cpu < CPU_SETSIZE && used < sizeof(allowed) - 8; ++cpu) {
+            if (CPU_ISSET(cpu, &set))
+                used += snprintf(allowed + used, sizeof(allowed) - used, "%s%d", used ? "," : "", cpu);
+        }
+        logger(LOG_INFO, "topology allowed cpus %s", allowed);
+    }
+
+    log_limit("RLIMIT_RTPRIO", RLIMIT_RTPRIO);
+    log_limit("RLIMIT_MEMLOCK", RLIMIT_MEMLOCK);
+}
+
+} // namespace robo
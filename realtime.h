@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __REALTIME__H__
+#define __REALTIME__H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace robo {
+
+// Where and how the module runs. Capture, serving and the first chunk of
+// every parallel_for() share the main loop thread, the rest of the
+// processing runs on the pool workers.
+struct RuntimeProfile
+{
+    int         main_cpu;       // main loop runs on this cpu only, -1 anywhere
+    uint32_t    worker_cpus;    // pool workers round robin over these, 0 every
+                                // cpu but main_cpu (must not include it)
+    int         fifo_priority;  // SCHED_FIFO priority of the main loop, 0 SCHED_OTHER
+    int         worker_priority;// same for the pool workers
+    bool        lock_memory;    // mlockall() current and future pages
+    bool        prefault;       // touch frame buffers and stack up front
+};
+
+void get_default_runtime_profile(RuntimeProfile &profile);
+
+// "1-3,5" into a cpu bit mask, EINVAL if malformed or a cpu is >= 32.
+int parse_cpu_list(const char *list, uint32_t &mask);
+
+// The pool's cpu mask for profile on a machine with cpus cpus. A SCHED_OTHER
+// worker sharing a SCHED_FIFO main loop's cpu would never get to finish
+// the chunk it took, so without worker_cpus they go everywhere but
+// main_cpu. 0 (PoolConfig's own placement) if there is no other cpu.
+uint32_t get_worker_cpus(const RuntimeProfile &profile, int cpus);
+
+// Applies the profile to the calling (main loop) thread and the process,
+// and configures the pool accordingly, so call it before the first
+// parallel_for(). A step that fails (eg. no CAP_SYS_NICE or a low
+// RLIMIT_MEMLOCK) is logged and the rest still applied, the first error
+// is returned.
+int apply_runtime_profile(const RuntimeProfile &profile);
+
+// Logs the cpus online/isolated, core and package of each, the cpufreq
+// governor, the cpus we may run on and the RT/memlock limits.
+void log_topology();
+
+// Writes every page of [data, data + size) in place, so the first frame
+// does not take the page faults. Contents are kept.
+void prefault(void *data, size_t size);
+
+// Reads every page, for buffers somebody else (eg. a driver) writes.
+void prefault_read(const void *data, size_t size);
+
+} // namespace robo
+
+#endif // __REALTIME__H__
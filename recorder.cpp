@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "recorder.h"
+#include "realtime.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <algorithm>
+
+namespace robo {
+
+static_assert(sizeof(FlightHeader) == 64, "FlightHeader size");
+static_assert(sizeof(FlightRecord) == 128, "FlightRecord size");
+
+static bool valid_header(const FlightHeader &header)
+{
+    return !memcmp(header.magic, FLIGHT_MAGIC, sizeof(header.magic)) &&
+        header.version == FLIGHT_VERSION &&
+        header.record_size == sizeof(FlightRecord) &&
+        header.capacity > 0;
+}
+
+// a slot holds a whole record of its own lap
+static bool valid_slot(const FlightRecord &record, uint32_t index, uint32_t capacity)
+{
+    return record.seq && (record.seq - 1) % capacity == index;
+}
+
+FlightRecorder::FlightRecorder()
+    :
+    m_fd(-1),
+    m_map(NULL),
+    m_size(0),
+    m_ring(NULL),
+    m_capacity(0),
+    m_seq(1),
+    m_first(true)
+{
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    close();
+}
+
+int FlightRecorder::open(const char *path, int capacity)
+{
+    assert(path);
+
+    if (m_ring || capacity <= 0)
+        return EINVAL;
+
+    const size_t size = sizeof(FlightHeader) + (size_t) capacity * sizeof(FlightRecord);
+    int res = 0;
+
+    // the file may be truncated below: never through a symlink, and
+    // only a regular file of our own
+    m_fd = HANDLE_EINTR(::open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644));
+    if (m_fd == -1) {
+        res = errno;
+        logger(LOG_ERROR, "FlightRecorder open %s errno=%d", path, res);
+        return res;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st)) {
+        res = errno;
+        logger(LOG_ERROR, "FlightRecorder fstat %s errno=%d", path, res);
+        close();
+        return res;
+    }
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+        logger(LOG_ERROR, "FlightRecorder %s is not a regular file owned by uid %d", path,
+            (int) geteuid());
+        close();
+        return EPERM;
+    }
+
+    // same geometry keeps the records, anything else starts over
+    FlightHeader old;
+    const bool reuse = (size_t) st.st_size == size &&
+        HANDLE_EINTR(::pread(m_fd, &old, sizeof(old), 0)) == (ssize_t) sizeof(old) &&
+        valid_header(old) && old.capacity == (uint32_t) capacity;
+
+    if (!reuse && (ftruncate(m_fd, 0) || ftruncate(m_fd, size))) {
+        res = errno;
+        logger(LOG_ERROR, "FlightRecorder ftruncate %s errno=%d", path, res);
+        close();
+        return res;
+    }
+
+    void *map = ::mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED) {
+        res = errno;
+        logger(LOG_ERROR, "FlightRecorder mmap %s errno=%d", path, res);
+        close();
+        return res;
+    }
+
+    m_map = (uint8_t *) map;
+    m_size = size;
+    m_ring = (FlightRecord *) (m_map + sizeof(FlightHeader));
+    m_capacity = capacity;
+    m_seq = 1;
+    m_first = true;
+
+    // the first frames should not take the faults
+    prefault(m_map, m_size);
+
+    for (uint32_t i = 0; reuse && i < m_capacity; ++i) {
+        if (valid_slot(m_ring[i], i, m_capacity) && m_ring[i].seq >= m_seq)
+            m_seq = m_ring[i].seq + 1;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    FlightHeader *header = (FlightHeader *) m_map;
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, FLIGHT_MAGIC, sizeof(header->magic));
+    header->version         = FLIGHT_VERSION;
+    header->record_size     = sizeof(FlightRecord);
+    header->capacity        = m_capacity;
+    header->start_usec      = get_time_usec();
+    header->start_wall_usec = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+    logger(LOG_INFO, "FlightRecorder %s %u records, next %llu", path, m_capacity,
+        (unsigned long long) m_seq);
+    return 0;
+}
+
+void FlightRecorder::close()
+{
+    if (m_map)
+        ::munmap(m_map, m_size);
+    if (m_fd != -1)
+        ::close(m_fd);
+
+    m_fd = -1;
+    m_map = NULL;
+    m_size = 0;
+    m_ring = NULL;
+    m_capacity = 0;
+}
+
+void FlightRecorder::write(FlightRecord &record)
+{
+    if (!m_ring)
+        return;
+
+    FlightRecord *slot = &m_ring[(m_seq - 1) % m_capacity];
+
+    record.seq = m_seq++;
+    if (m_first)
+        record.flags |= FLIGHT_FIRST;
+    m_first = false;
+
+    // seq last, a crash in between leaves an empty slot, not a mix of
+    // two records
+    __atomic_store_n(&slot->seq, (uint64_t) 0, __ATOMIC_RELEASE);
+    memcpy((uint8_t *) slot + sizeof(slot->seq), (const uint8_t *) &record + sizeof(record.seq),
+           sizeof(record) - sizeof(record.seq));
+    __atomic_store_n(&slot->seq, record.seq, __ATOMIC_RELEASE);
+}
+
+int load_flight_records(const char *path, FlightHeader &header, std::vector<FlightRecord> &records)
+{
+    records.clear();
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return errno;
+
+    int res = 0;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || !valid_header(header)) {
+        res = EINVAL;
+    }
+    else {
+        FlightRecord record;
+        for (uint32_t i = 0; i < header.capacity && fread(&record, sizeof(record), 1, fp) == 1; ++i) {
+            if (valid_slot(record, i, header.capacity))
+                records.push_back(record);
+        }
+    }
+    fclose(fp);
+
+    std::sort(records.begin(), records.end(), [](const FlightRecord &a, const FlightRecord &b) {
+        return a.seq < b.seq;
+    });
+    return res;
+}
+
+void write_flight_csv(FILE *fp, const FlightHeader &header, const std::vector<FlightRecord> &records)
+{
+    fprintf(fp, "seq,wall_usec,time_usec,left_timestamp_usec,right_timestamp_usec,left_sequence,"
+        "right_sequence,trx_id,wait_usec,luma_usec,process_usec,stereo_usec,reproject_usec,"
+        "ground_usec,map_usec,send_usec,busy_usec,skipped,payload_size,frame_allocs,minor_faults,"
+        "clients,queued,payload,stereo_mode,quality,governor_level,flags,result\n");
+
+    const int64_t wall_offset = (int64_t) header.start_wall_usec - (int64_t) header.start_usec;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const FlightRecord &r = records[i];
+        fprintf(fp, "%llu,%lld,%llu,%llu,%llu,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,"
+            "%u,%u,%u,%u,%u,0x%02x,%u\n",
+            (unsigned long long) r.seq, (long long) (r.time_usec + wall_offset),
+            (unsigned long long) r.time_usec, (unsigned long long) r.left_timestamp_usec,
+            (unsigned long long) r.right_timestamp_usec, r.left_sequence, r.right_sequence,
+            r.trx_id, r.wait_usec, r.luma_usec, r.process_usec, r.stereo_usec, r.reproject_usec,
+            r.ground_usec, r.map_usec, r.send_usec, r.busy_usec, r.skipped, r.payload_size,
+            r.frame_allocs, r.minor_faults, r.clients, r.queued, r.payload, r.stereo_mode,
+            r.quality, r.governor_level, r.flags, r.result);
+    }
+}
+
+} // namespace robo
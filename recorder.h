@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __RECORDER__H__
+#define __RECORDER__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+
+namespace robo {
+
+#define FLIGHT_MAGIC "ROBOFLT1"
+
+const uint32_t FLIGHT_VERSION = 1;
+
+// FlightRecord::flags
+enum {
+    FLIGHT_FIRST    = 0x01,     // first record of a run
+    FLIGHT_REUSED   = 0x02,     // answered from the last map (governor)
+    FLIGHT_DEADLINE = 0x04,     // request had a deadline
+    FLIGHT_MISSED   = 0x08,     // and it was answered after it
+    FLIGHT_RESTART  = 0x10,     // cameras restarted before this frame
+};
+
+// File layout: the header, then capacity records. Host byte order, the
+// decoder runs on the robot or on a machine of the same endianness.
+struct FlightHeader
+{
+    char        magic[8];           // FLIGHT_MAGIC
+    uint32_t    version;
+    uint32_t    record_size;
+    uint32_t    capacity;           // records
+    uint32_t    reserved0;
+    uint64_t    start_usec;         // get_time_usec() when the last run opened it
+    uint64_t    start_wall_usec;    // gettimeofday() at the same time
+    uint8_t     reserved[24];
+} __attribute__((packed));
+
+// One CMD_GET_MAP. Durations are usec, times get_time_usec()
+// (CLOCK_MONOTONIC, comparable across runs until a reboot).
+struct FlightRecord
+{
+    uint64_t    seq;                // 1 based across runs, 0 empty slot
+    uint64_t    time_usec;          // response sent
+    uint64_t    left_timestamp_usec;
+    uint64_t    right_timestamp_usec;
+    uint32_t    left_sequence;
+    uint32_t    right_sequence;
+    uint32_t    trx_id;
+    uint32_t    wait_usec;          // blocked for the frame pair
+    uint32_t    luma_usec;          // decode or conversion to luma
+    uint32_t    process_usec;       // Pipeline::process*() as a whole
+    uint32_t    stereo_usec;        // and its stages
+    uint32_t    reproject_usec;
+    uint32_t    ground_usec;
+    uint32_t    map_usec;
+    uint32_t    send_usec;          // payload preparation and send
+    uint32_t    busy_usec;          // frame ready to response sent
+    uint32_t    skipped;            // stale frames both cameras dropped, so far
+    uint32_t    payload_size;       // bytes after the response header
+    uint32_t    frame_allocs;
+    uint32_t    minor_faults;
+    uint32_t    clients;            // connections accepted so far
+    uint16_t    queued;             // requests waiting behind this one
+    uint8_t     payload;            // proto::PAYLOAD_* asked for
+    uint8_t     stereo_mode;
+    uint8_t     quality;            // proto::QUALITY_*
+    uint8_t     governor_level;
+    uint8_t     flags;              // FLIGHT_*
+    uint8_t     result;             // processing errno, 0 fine, 255 beyond
+    uint8_t     reserved[20];
+} __attribute__((packed));
+
+// Always on binary log of the frame loop. The ring is an mmap()ed file,
+// a record is a copy into the page cache (a few dozen ns, pages are
+// prefaulted at open) and survives the process crashing. A reopened file
+// of the same geometry continues after its newest record, a crash's
+// records stay until the ring wraps over them.
+//
+// Records are not synced to disk, a power loss loses what the kernel
+// did not write back yet.
+class FlightRecorder
+{
+public:
+    FlightRecorder();
+    ~FlightRecorder();
+
+    // ELOOP for a symlink, EPERM for anything but a regular file owned
+    // by the effective uid, those are never truncated.
+    int open(const char *path, int capacity);
+    void close();
+    bool is_open() const { return m_ring != NULL; }
+
+    // record.seq is filled in. A slot's seq is cleared while it is
+    // written, a record torn by a crash is skipped by the decoder.
+    void write(FlightRecord &record);
+
+    // next record's seq
+    uint64_t next_seq() const { return m_seq; }
+
+private:
+    FlightRecorder(const FlightRecorder &);
+    FlightRecorder &operator=(const FlightRecorder &);
+
+    int             m_fd;
+    uint8_t         *m_map;
+    size_t          m_size;
+    FlightRecord    *m_ring;
+    uint32_t        m_capacity;
+    uint64_t        m_seq;
+    bool            m_first;
+};
+
+// Reads a flight recorder file, records come back oldest first. EINVAL
+// if it is not one.
+int load_flight_records(const char *path, FlightHeader &header, std::vector<FlightRecord> &records);
+
+// CSV of the records, header line first. Wall clock times are derived
+// from the header, only exact for the last run before a reboot.
+void write_flight_csv(FILE *fp, const FlightHeader &header, const std::vector<FlightRecord> &records);
+
+} // namespace robo
+
+#endif // __RECORDER__H__
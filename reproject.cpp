@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "reproject.h"
+#include "stereo.h"
+#include "parallel.h"
+#include "ground.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace robo {
+
+void get_default_calibration(int width, int height, double baseline_mm, StereoCalibration &calib)
+{
+    assert(baseline_mm > 0.0);
+
+    const double focal = (width / 2.0) / tan(35.0 * M_PI / 180.0);
+
+    memset(&calib, 0, sizeof(calib));
+
+    calib.width = width;
+    calib.height = height;
+    calib.Q[0]  = 1.0;
+    calib.Q[3]  = -(width - 1) / 2.0;
+    calib.Q[5]  = 1.0;
+    calib.Q[7]  = -(height - 1) / 2.0;
+    calib.Q[11] = focal;
+    calib.Q[14] = 1.0 / baseline_mm;
+}
+
+int load_calibration(const char *path, StereoCalibration &calib)
+{
+    assert(path);
+
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+        return errno;
+
+    int res = 0;
+    if (fscanf(fp, "%d %d", &calib.width, &calib.height) != 2 ||
+        calib.width <= 0 || calib.height <= 0)
+        res = EINVAL;
+
+    for (int i = 0; i < 16 && !res; ++i)
+        if (fscanf(fp, "%lf", &calib.Q[i]) != 1)
+            res = EINVAL;
+
+    fclose(fp);
+
+    if (res)
+        logger(LOG_ERROR, "%s is not a calibration file", path);
+    return res;
+}
+
+int scale_calibration(const StereoCalibration &calib, int width, int height,
+                      StereoCalibration &scaled)
+{
+    if (width <= 0 || height <= 0 ||
+        (int64_t) calib.width * height != (int64_t) calib.height * width)
+        return EINVAL;
+
+    // x = s * x', y = s * y', d = s * d': scale the first three columns
+    const double s = (double) calib.width / width;
+
+    scaled = calib;
+    scaled.width = width;
+    scaled.height = height;
+
+    for (int row = 0; row < 4; ++row)
+        for (int col = 0; col < 3; ++col)
+            scaled.Q[row * 4 + col] *= s;
+
+    return 0;
+}
+
+Reprojector::Reprojector()
+    :
+    m_max_depth(10000.0)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+void Reprojector::reproject_rows(Band &band, const ImageView &disp, const StereoCalibration &calib,
+                                 int y0, int y1)
+{
+    const int w = disp.width;
+    const int mask_stride = (w + 7) / 8;
+
+    band.count = 0;
+    band.y0 = y0;
+    band.y1 = y1;
+    band.points.resize((size_t) (y1 - y0) * w * 3);
+    band.xyz.resize((size_t) w * 3);
+
+    float *xs = &band.xyz[0];
+    float *ys = xs + w;
+    float *zs = ys + w;
+    int16_t *out = &band.points[0];
+
+    const double *q = calib.Q;
+    const float inv_scale = 1.0f / DISP_SCALE;
+    const float max_depth = (float) m_max_depth;
+    const float limit = INT16_MAX;
+
+    for (int y = y0; y < y1; ++y) {
+
+        const int16_t *d = disp.row_as<int16_t>(y);
+        uint8_t *mask = &m_mask[(size_t) y * mask_stride];
+
+        // constant part of Q * [x y d 1] for this row
+        const float cx = (float) (q[1] * y + q[3]);
+        const float cy = (float) (q[5] * y + q[7]);
+        const float cz = (float) (q[9] * y + q[11]);
+        const float cw = (float) (q[13] * y + q[15]);
+
+        const float qx0 = q[0], qx2 = q[2];
+        const float qy0 = q[4], qy2 = q[6];
+        const float qz0 = q[8], qz2 = q[10];
+        const float qw0 = q[12], qw2 = q[14];
+
+        // branch free over the whole row so it vectorizes, invalid
+        // pixels are thrown away below.
+        for (int x = 0; x < w; ++x) {
+            const float fd = d[x] * inv_scale;
+            const float iw = 1.0f / (qw0 * x + qw2 * fd + cw);
+            xs[x] = (qx0 * x + qx2 * fd + cx) * iw;
+            ys[x] = (qy0 * x + qy2 * fd + cy) * iw;
+            zs[x] = (qz0 * x + qz2 * fd + cz) * iw;
+        }
+
+        memset(mask, 0, mask_stride);
+
+        for (int x = 0; x < w; ++x) {
+            if (d[x] <= 0 || !(zs[x] > 0.0f && zs[x] <= max_depth) ||
+                fabsf(xs[x]) > limit || fabsf(ys[x]) > limit)
+                continue;
+
+            mask[x >> 3] |= (uint8_t) (1 << (x & 7));
+            out[0] = (int16_t) lrintf(xs[x]);
+            out[1] = (int16_t) lrintf(ys[x]);
+            out[2] = (int16_t) lrintf(zs[x]);
+            out += 3;
+        }
+    }
+
+    band.count = (uint32_t) ((out - &band.points[0]) / 3);
+}
+
+int Reprojector::reproject(const ImageView &disp, const StereoCalibration &calib)
+{
+    if (disp.format != PIX_FMT_DISP16 || disp.empty())
+        return EINVAL;
+    if (disp.width > UINT16_MAX || disp.height > UINT16_MAX)
+        return EINVAL;
+
+    m_header.width = disp.width;
+    m_header.height = disp.height;
+    m_header.count = 0;
+
+    m_mask.resize((size_t) mask_stride() * disp.height);
+    m_bands.resize(get_max_chunks());
+
+    for (size_t i = 0; i < m_bands.size(); ++i) {
+        m_bands[i].count = 0;
+        m_bands[i].y0 = m_bands[i].y1 = 0;
+    }
+
+    parallel_for(disp.height, 32, [&](int chunk, int y0, int y1) {
+        reproject_rows(m_bands[chunk], disp, calib, y0, y1);
+    });
+
+    for (size_t i = 0; i < m_bands.size(); ++i)
+        m_header.count += m_bands[i].count;
+
+    return 0;
+}
+
+void Reprojector::remove_rows(Band &band, const Plane &plane, float min_height)
+{
+    const int w = m_header.width;
+    const int mask_stride = (w + 7) / 8;
+
+    const int16_t *in = band.count ? &band.points[0] : NULL;
+    int16_t *out = band.count ? &band.points[0] : NULL;
+    uint32_t removed = 0;
+
+    // points are in mask order, walk the set bits and compact in place
+    for (int y = band.y0; y < band.y1; ++y) {
+        uint8_t *mask = &m_mask[(size_t) y * mask_stride];
+
+        for (int x = 0; x < w; ++x) {
+            if (!(mask[x >> 3] & (1 << (x & 7))))
+                continue;
+
+            if (plane.distance(in[0], in[1], in[2]) < min_height) {
+                mask[x >> 3] &= (uint8_t) ~(1 << (x & 7));
+                ++removed;
+            }
+            else {
+                out[0] = in[0];
+                out[1] = in[1];
+                out[2] = in[2];
+                out += 3;
+            }
+            in += 3;
+        }
+    }
+
+    band.count -= removed;
+}
+
+uint32_t Reprojector::remove_below(const Plane &plane, float min_height)
+{
+    parallel_for((int) m_bands.size(), 1, [&](int, int b0, int b1) {
+        for (int b = b0; b < b1; ++b)
+            remove_rows(m_bands[b], plane, min_height);
+    });
+
+    const uint32_t before = m_header.count;
+
+    m_header.count = 0;
+    for (size_t i = 0; i < m_bands.size(); ++i)
+        m_header.count += m_bands[i].count;
+
+    return before - m_header.count;
+}
+
+int Reprojector::get_payload(struct iovec *iov, int max_count) const
+{
+    if (max_count < 2 + (int) m_bands.size() || m_mask.empty())
+        return 0;
+
+    int n = 0;
+
+    iov[n].iov_base = (void *) &m_header;
+    iov[n].iov_len  = sizeof(m_header);
+    ++n;
+
+    iov[n].iov_base = (void *) &m_mask[0];
+    iov[n].iov_len  = m_mask.size();
+    ++n;
+
+    for (size_t i = 0; i < m_bands.size(); ++i) {
+        if (!m_bands[i].count)
+            continue;
+        iov[n].iov_base = (void *) &m_bands[i].points[0];
+        iov[n].iov_len  = m_bands[i].count * 3 * sizeof(int16_t);
+        ++n;
+    }
+
+    return n;
+}
+
+} // namespace robo
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __REPROJECT__H__
+#define __REPROJECT__H__
+
+#include "image.h"
+#include "proto.h"
+
+#include <stdint.h>
+#include <vector>
+
+struct iovec;
+
+namespace robo {
+
+struct Plane;
+
+// 4x4 row major disparity-to-depth matrix as cv::stereoRectify() writes
+// it, [X Y Z W] = Q * [x y d 1], for width x height images. Calibrate with
+// the board in millimetres, points come out in whatever unit Q was built
+// with.
+struct StereoCalibration
+{
+    int     width;
+    int     height;
+    double  Q[16];
+};
+
+// Pinhole guess for the C920 pair (~70 deg horizontal FOV) baseline_mm
+// apart, until the rig is calibrated.
+void get_default_calibration(int width, int height, double baseline_mm, StereoCalibration &calib);
+
+// "width height" followed by 16 whitespace separated numbers, row major.
+int load_calibration(const char *path, StereoCalibration &calib);
+
+// Same calibration for images downscaled to width x height (eg. 1/2 luma).
+int scale_calibration(const StereoCalibration &calib, int width, int height,
+                      StereoCalibration &scaled);
+
+// Turns a DISP16 map into the compact proto::PointCloud payload. Rows
+// are split across threads, each thread writes its own point array so
+// the payload is sent gathered, never copied together.
+class Reprojector
+{
+public:
+    Reprojector();
+
+    // points further than max_depth_mm (or out of int16_t range) are dropped
+    void set_max_depth(double max_depth_mm) { m_max_depth = max_depth_mm; }
+
+    int reproject(const ImageView &disp, const StereoCalibration &calib);
+
+    uint32_t count() const { return m_header.count; }
+
+    // Drops points less than min_height above plane (floor and below)
+    // from the cloud and the mask, returns how many were dropped.
+    uint32_t remove_below(const Plane &plane, float min_height);
+
+    // xyz triplets of row band i, bands are in row order
+    int num_bands() const { return (int) m_bands.size(); }
+    const int16_t *get_band(int i, uint32_t &count) const
+    {
+        count = m_bands[i].count;
+        return count ? &m_bands[i].points[0] : NULL;
+    }
+
+    // header, mask and point arrays. Returns number of iovecs filled.
+    int get_payload(struct iovec *iov, int max_count) const;
+
+    // valid pixel mask, row y starts at y * mask_stride()
+    const uint8_t *mask() const { return m_mask.empty() ? NULL : &m_mask[0]; }
+    int mask_stride() const { return (m_header.width + 7) / 8; }
+
+private:
+    struct Band
+    {
+        std::vector<int16_t>    points;     // xyz triplets
+        std::vector<float>      xyz;        // one row, x/y/z planes
+        uint32_t                count;
+        int                     y0;
+        int                     y1;
+    };
+
+    void reproject_rows(Band &band, const ImageView &disp, const StereoCalibration &calib,
+                        int y0, int y1);
+    void remove_rows(Band &band, const Plane &plane, float min_height);
+
+private:
+    double              m_max_depth;
+    proto::PointCloud   m_header;
+    std::vector<uint8_t> m_mask;
+    std::vector<Band>   m_bands;    // one per parallel_for chunk
+};
+
+} // namespace robo
+
+#endif // __REPROJECT__H__
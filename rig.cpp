@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "rig.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+namespace robo {
+
+#define CONTROL_BIT(x) (1u << Camera::x)
+
+static const uint32_t g_lock_mask =
+    CONTROL_BIT(CONTROL_EXPOSURE_AUTO) |
+    CONTROL_BIT(CONTROL_EXPOSURE_AUTO_PRIORITY) |
+    CONTROL_BIT(CONTROL_EXPOSURE_ABSOLUTE) |
+    CONTROL_BIT(CONTROL_GAIN) |
+    CONTROL_BIT(CONTROL_FOCUS_AUTO) |
+    CONTROL_BIT(CONTROL_FOCUS_ABSOLUTE) |
+    CONTROL_BIT(CONTROL_WHITE_BALANCE_AUTO) |
+    CONTROL_BIT(CONTROL_WHITE_BALANCE_TEMPERATURE) |
+    CONTROL_BIT(CONTROL_POWER_LINE_FREQUENCY);
+
+void get_default_rig_lock_config(RigLockConfig &config)
+{
+    config.exposure_absolute            = -1;
+    config.gain                         = -1;
+    config.focus_absolute               = 0;    // infinity, see README
+    config.white_balance_temperature    = -1;
+    config.power_line_frequency         = V4L2_CID_POWER_LINE_FREQUENCY_50HZ;
+    config.max_exposure_fraction        = 0.8;
+}
+
+RigControl::RigControl(const RigLockConfig &config)
+    :
+    m_config(config),
+    m_locked(false),
+    m_pending_lock(false),
+    m_pending_unlock(false)
+{
+}
+
+static int32_t pick(int configured, int32_t current)
+{
+    return configured >= 0 ? configured : current;
+}
+
+void RigControl::get_lock_controls(const Camera::Controls &current, double fps,
+                                   Camera::Controls &locked) const
+{
+    memset(&locked, 0, sizeof(locked));
+    locked.mask = g_lock_mask;
+
+    const int32_t *v = current.values;
+
+    locked.values[Camera::CONTROL_EXPOSURE_AUTO]            = V4L2_EXPOSURE_MANUAL;
+    locked.values[Camera::CONTROL_EXPOSURE_AUTO_PRIORITY]   = 0;
+    locked.values[Camera::CONTROL_FOCUS_AUTO]               = 0;
+    locked.values[Camera::CONTROL_WHITE_BALANCE_AUTO]       = 0;
+
+    int32_t exposure = pick(m_config.exposure_absolute, v[Camera::CONTROL_EXPOSURE_ABSOLUTE]);
+
+    // auto exposure in a dim room happily goes beyond the frame interval,
+    // that is exactly what halves the frame rate. Cap it.
+    if (fps > 0.0) {
+        const int32_t max_exposure = (int32_t) (m_config.max_exposure_fraction * 10000.0 / fps);
+        if (exposure > max_exposure)
+            exposure = max_exposure;
+    }
+
+    locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] = exposure;
+    locked.values[Camera::CONTROL_GAIN] = pick(m_config.gain, v[Camera::CONTROL_GAIN]);
+    locked.values[Camera::CONTROL_FOCUS_ABSOLUTE] =
+        pick(m_config.focus_absolute, v[Camera::CONTROL_FOCUS_ABSOLUTE]);
+    locked.values[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE] =
+        pick(m_config.white_balance_temperature, v[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE]);
+    locked.values[Camera::CONTROL_POWER_LINE_FREQUENCY] =
+        pick(m_config.power_line_frequency, v[Camera::CONTROL_POWER_LINE_FREQUENCY]);
+}
+
+int RigControl::lock(Camera &c1, Camera &c2, double fps)
+{
+    Camera::Controls current;
+    memset(&current, 0, sizeof(current));
+    current.mask = g_lock_mask;
+
+    int res = c1.getControls(current);
+    if (res)
+        return res;
+
+    Camera::Controls locked;
+    get_lock_controls(current, fps, locked);
+
+    res = c1.setControls(locked);
+    if (res)
+        return res;
+    res = c2.setControls(locked);
+    if (res)
+        return res;
+
+    // both sides must read back the same, otherwise the pair is not
+    // really locked (eg. different ranges/firmware)
+    Camera::Controls r1;
+    Camera::Controls r2;
+    memset(&r1, 0, sizeof(r1));
+    memset(&r2, 0, sizeof(r2));
+    r1.mask = r2.mask = g_lock_mask;
+
+    res = c1.getControls(r1);
+    res = res ? res : c2.getControls(r2);
+    if (res)
+        return res;
+
+    for (int i = 0; i < Camera::CONTROL_MAX; ++i) {
+        if (!(r1.mask & r2.mask & (1u << i)))
+            continue;
+        if (r1.values[i] != r2.values[i])
+            logger(LOG_WARN, "RigControl %s differs %d vs %d",
+                c1.getControlInfo((Camera::ControlType) i).tag, r1.values[i], r2.values[i]);
+    }
+
+    logger(LOG_INFO, "RigControl locked exposure=%d gain=%d focus=%d wb=%d",
+        r1.values[Camera::CONTROL_EXPOSURE_ABSOLUTE], r1.values[Camera::CONTROL_GAIN],
+        r1.values[Camera::CONTROL_FOCUS_ABSOLUTE], r1.values[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE]);
+
+    m_locked = true;
+    return 0;
+}
+
+int RigControl::unlock(Camera &c1, Camera &c2)
+{
+    Camera::Controls autos;
+    memset(&autos, 0, sizeof(autos));
+
+    autos.mask =
+        CONTROL_BIT(CONTROL_EXPOSURE_AUTO) |
+        CONTROL_BIT(CONTROL_FOCUS_AUTO) |
+        CONTROL_BIT(CONTROL_WHITE_BALANCE_AUTO);
+
+    autos.values[Camera::CONTROL_EXPOSURE_AUTO]         = V4L2_EXPOSURE_APERTURE_PRIORITY;
+    autos.values[Camera::CONTROL_FOCUS_AUTO]            = 1;
+    autos.values[Camera::CONTROL_WHITE_BALANCE_AUTO]    = 1;
+
+    int res = c1.setControls(autos);
+    res = res ? res : c2.setControls(autos);
+    if (res)
+        return res;
+
+    logger(LOG_INFO, "RigControl unlocked");
+    m_locked = false;
+    return 0;
+}
+
+int RigControl::apply(Camera &c1, Camera &c2, double fps)
+{
+    int res = 0;
+
+    if (m_pending_unlock) {
+        m_pending_unlock = false;
+        m_pending_lock = false;
+        res = unlock(c1, c2);
+    }
+    else if (m_pending_lock) {
+        m_pending_lock = false;
+        res = lock(c1, c2, fps);
+    }
+
+    if (res)
+        logger(LOG_ERROR, "RigControl apply failed res=%d", res);
+    return res;
+}
+
+} // namespace robo
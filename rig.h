@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __RIG__H__
+#define __RIG__H__
+
+#include "camera.h"
+
+namespace robo {
+
+struct RigLockConfig
+{
+    // Values below zero mean "take over what the left camera's auto
+    // algorithms settled on", everything else is written as is.
+    int     exposure_absolute;      // 100 usec units
+    int     gain;
+    int     focus_absolute;
+    int     white_balance_temperature;
+    int     power_line_frequency;   // V4L2_CID_POWER_LINE_FREQUENCY_*
+
+    // fraction of the frame interval exposure may use, leaves room for
+    // readout so the camera never has to stretch the frame.
+    double  max_exposure_fraction;
+};
+
+void get_default_rig_lock_config(RigLockConfig &config);
+
+// Keeps the stereo pair on identical manual exposure/focus/gain/white
+// balance. Changes are queued with request_*() and written by apply()
+// between two frames, streaming is never restarted.
+class RigControl
+{
+public:
+    explicit RigControl(const RigLockConfig &config);
+
+    bool is_locked() const { return m_locked; }
+
+    void request_lock() { m_pending_lock = true; }
+    void request_unlock() { m_pending_unlock = true; }
+
+    // no-op unless something is pending. fps is the streaming rate.
+    int apply(Camera &c1, Camera &c2, double fps);
+
+    // Builds the locked control set from the current (auto) values.
+    void get_lock_controls(const Camera::Controls &current, double fps,
+                           Camera::Controls &locked) const;
+
+private:
+    int lock(Camera &c1, Camera &c2, double fps);
+    int unlock(Camera &c1, Camera &c2);
+
+private:
+    RigLockConfig   m_config;
+    bool            m_locked;
+    bool            m_pending_lock;
+    bool            m_pending_unlock;
+};
+
+} // namespace robo
+
+#endif // __RIG__H__
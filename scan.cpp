@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "scan.h"
+#include "stereo.h"
+#include "parallel.h"
+#include "ground.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <sys/uio.h>
+
+namespace robo {
+
+typedef int16_t v8s16 __attribute__((vector_size(16)));
+
+static const int g_lanes = 8;
+
+void get_default_scan_config(ScanConfig &config)
+{
+    config.band_px          = 8;
+    config.floor_margin_mm  = 40;
+    config.max_height_mm    = 500;
+}
+
+VirtualScan::VirtualScan(const ScanConfig &config)
+    :
+    m_config(config)
+{
+    assert(config.band_px > 0);
+    assert(config.floor_margin_mm >= 0);
+    assert(config.max_height_mm > 0);
+
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+static inline v8s16 load(const int16_t *p)
+{
+    v8s16 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void VirtualScan::compute_columns(const ImageView &disp, int x0, int x1)
+{
+    const v8s16 invalid = { DISP_INVALID, DISP_INVALID, DISP_INVALID, DISP_INVALID,
+                            DISP_INVALID, DISP_INVALID, DISP_INVALID, DISP_INVALID };
+
+    for (int x = x0; x < x1; x += g_lanes) {
+
+        // three largest so far, a0 >= a1 >= a2
+        v8s16 a0 = invalid;
+        v8s16 a1 = invalid;
+        v8s16 a2 = invalid;
+
+        for (int y = 0; y < disp.height; ++y) {
+            const v8s16 d = load(disp.row_as<int16_t>(y) + x);
+            const int16_t t = m_row_min[y];
+            const v8s16 limit = { t, t, t, t, t, t, t, t };
+
+            const v8s16 v = d > limit ? d : invalid;
+
+            const v8s16 lo0 = a0 < v ? a0 : v;
+            a0 = a0 > v ? a0 : v;
+            const v8s16 lo1 = a1 < lo0 ? a1 : lo0;
+            a1 = a1 > lo0 ? a1 : lo0;
+            a2 = a2 > lo1 ? a2 : lo1;
+        }
+
+        memcpy(&m_column[x], &a2, sizeof(a2));
+    }
+}
+
+int VirtualScan::compute(const ImageView &disp, const StereoCalibration &calib, const Plane &floor)
+{
+    if (disp.format != PIX_FMT_DISP16 || disp.empty())
+        return EINVAL;
+
+    const int w = disp.width;
+    const int h = disp.height;
+    const int padded = (w + g_lanes - 1) / g_lanes * g_lanes;
+
+    // vectors read up to the padded width, Image strides allow that
+    if (disp.stride < padded * (int) sizeof(int16_t))
+        return EINVAL;
+
+    const double *q = calib.Q;
+    const double focal = q[11];
+    const double cy = -q[7];
+    const double baseline = q[14] != 0.0 ? 1.0 / q[14] : 0.0;
+    if (focal <= 0.0 || baseline <= 0.0 || floor.d <= m_config.floor_margin_mm)
+        return EINVAL;
+
+    // A pixel at row y and disparity D is P = (x - cx, y - cy, focal) *
+    // baseline / D, its height above the floor n . P + d = baseline * k / D
+    // + d with k = n . (0, y - cy, focal). Rows looking down (k < 0) reach
+    // the floor margin at D = baseline * -k / (d - margin), rows looking
+    // up reach the height limit at D = baseline * k / max_height, anything
+    // closer is in range.
+    const double floor_limit = floor.d - m_config.floor_margin_mm;
+
+    m_row_min.resize(h);
+    for (int y = 0; y < h; ++y) {
+        const double k = floor.n[1] * (y - cy) + floor.n[2] * focal;
+        const double limit = k < 0.0 ? floor_limit : m_config.max_height_mm;
+        const double t = ceil(fabs(k) * baseline / limit * DISP_SCALE);
+        m_row_min[y] = (int16_t) (t > INT16_MAX ? INT16_MAX : t);
+    }
+
+    m_column.resize(padded);
+
+    const int vectors = padded / g_lanes;
+    parallel_for(vectors, 8, [&](int, int v0, int v1) {
+        compute_columns(disp, v0 * g_lanes, v1 * g_lanes);
+    });
+
+    const int band = m_config.band_px;
+    const int count = (w + band - 1) / band;
+
+    m_depths.resize(count);
+
+    for (int i = 0; i < count; ++i) {
+        const int x0 = i * band;
+        const int x1 = x0 + band < w ? x0 + band : w;
+
+        int best = DISP_INVALID;
+        int second = DISP_INVALID;
+        for (int x = x0; x < x1; ++x) {
+            const int v = m_column[x];
+            if (v > best) {
+                second = best;
+                best = v;
+            }
+            else if (v > second) {
+                second = v;
+            }
+        }
+
+        const int d = x1 - x0 > 1 ? second : best;
+        double z = d > 0 ? focal / (q[14] * d / DISP_SCALE + q[15]) : 0.0;
+        m_depths[i] = (uint16_t) (z > 0.0 && z < UINT16_MAX ? lrint(z) : 0);
+    }
+
+    m_header.count      = count;
+    m_header.band_px    = band;
+    m_header.focal      = (float) focal;
+    m_header.cx         = (float) -q[3];
+
+    return 0;
+}
+
+int VirtualScan::get_payload(struct iovec *iov) const
+{
+    if (m_depths.empty())
+        return 0;
+
+    iov[0].iov_base = (void *) &m_header;
+    iov[0].iov_len  = sizeof(m_header);
+    iov[1].iov_base = (void *) &m_depths[0];
+    iov[1].iov_len  = m_depths.size() * sizeof(uint16_t);
+    return 2;
+}
+
+} // namespace robo
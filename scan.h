@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __SCAN__H__
+#define __SCAN__H__
+
+#include "image.h"
+#include "proto.h"
+#include "reproject.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+struct Plane;
+
+struct ScanConfig
+{
+    int     band_px;            // columns per scan entry
+    int     floor_margin_mm;    // ignore anything lower than this above floor
+    int     max_height_mm;      // ignore anything higher above the camera
+};
+
+void get_default_scan_config(ScanConfig &config);
+
+// "Virtual laser scan": nearest obstacle depth per column band, straight
+// from the disparity map. A pixel counts if it is between floor_margin_mm
+// above the floor and max_height_mm above the camera, which in disparity
+// space is one minimum disparity per row (taken at the center column,
+// camera roll is ignored). Every column keeps its three
+// largest disparities in a single pass over the rows (branch free, 8
+// columns per vector op), the third one is the column's value so up to
+// two stray pixels per column are ignored. A band reports the second
+// nearest of its columns for the same reason.
+class VirtualScan
+{
+public:
+    explicit VirtualScan(const ScanConfig &config);
+
+    int compute(const ImageView &disp, const StereoCalibration &calib, const Plane &floor);
+
+    // header and count uint16_t depths in mm (0 nothing seen), left to right
+    int get_payload(struct iovec *iov) const;
+
+    const proto::LaserScan &header() const { return m_header; }
+    const uint16_t *depths() const { return m_depths.empty() ? NULL : &m_depths[0]; }
+
+private:
+    void compute_columns(const ImageView &disp, int x0, int x1);
+
+private:
+    ScanConfig              m_config;
+    proto::LaserScan        m_header;
+    std::vector<int16_t>    m_row_min;  // per row, DISP16
+    std::vector<int16_t>    m_column;   // per column, DISP16
+    std::vector<uint16_t>   m_depths;
+};
+
+} // namespace robo
+
+#endif // __SCAN__H__
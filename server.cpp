@@ -5,6 +5,7 @@
  */
 #include "server.h"
 #include "common.h"
+#include "net.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -13,14 +14,26 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <stdint.h>
 
 namespace robo {
 
 Server::Server()
     :
     m_uds_path(NULL),
+    m_tcp(false),
     m_server_fd(-1),
-    m_client_fd(-1)
+    m_count(0),
+    m_current(-1),
+    m_next(0),
+    m_client_timeout(CLIENT_TIMEOUT_MSEC),
+    m_idle_handler(NULL),
+    m_idle_ctx(NULL),
+    m_accepted(0),
+    m_sent_payload(0)
 {
 }
 
@@ -59,7 +72,7 @@ int Server::initialize(const char *uds_path)
     if (rc)
         goto fail;
 
-    rc = ::listen(m_server_fd, 1);
+    rc = ::listen(m_server_fd, MAX_CLIENTS);
     if (rc)
         goto fail;
 
@@ -73,25 +86,73 @@ fail:
     return rc ? rc : EFAULT;
 }
 
-void Server::close_client()
+int Server::initialize_tcp(const char *host, int port)
 {
-    if (m_client_fd != -1) {
-        HANDLE_EINTR(::close(m_client_fd));
-        m_client_fd = -1;
+    if (m_server_fd != -1)
+        return EINVAL;
+
+    int bound = 0;
+    int rc = tcp_listen(host, port, MAX_CLIENTS, m_server_fd, bound);
+    if (rc) {
+        logger(LOG_ERROR, "Server::initialize_tcp failed %d %s", rc, strerror(rc));
+        return rc;
     }
+
+    m_tcp = true;
+    logger(LOG_INFO, "Server::initialize_tcp fd=%d on %s:%d", m_server_fd, host ? host : "*", bound);
+    return 0;
+}
+
+void Server::set_idle_handler(IdleHandler handler, void *ctx)
+{
+    m_idle_handler = handler;
+    m_idle_ctx = ctx;
+}
+
+// the last client takes the closed one's place
+void Server::close_client(int index)
+{
+    assert(index >= 0 && index < m_count);
+
+    HANDLE_EINTR(::close(m_clients[index].fd));
+
+    --m_count;
+    m_clients[index] = m_clients[m_count];
+    m_current = -1;
+    if (m_next >= m_count)
+        m_next = 0;
+}
+
+void Server::close_clients()
+{
+    while (m_count)
+        close_client(m_count - 1);
+}
+
+void Server::set_encoding(uint16_t encoding)
+{
+    if (m_current != -1)
+        m_clients[m_current].encoding = encoding;
+}
+
+uint16_t Server::get_encoding() const
+{
+    return m_current != -1 ? m_clients[m_current].encoding : (uint16_t) proto::ENCODING_RAW;
 }
 
 int Server::accept_client()
 {
-    if (m_server_fd == -1)
+    if (m_server_fd == -1 || m_count == MAX_CLIENTS)
         return EINVAL;
 
     int rc = 0;
-    struct sockaddr_un address;
+    struct sockaddr_storage address;
     socklen_t address_length = sizeof(address);
 
     memset(&address, 0, sizeof(address));
-    close_client();
+
+    if (!m_count && m_idle_handler)
+        m_idle_handler(m_idle_ctx);
 
     rc = HANDLE_EINTR(::accept(m_server_fd, (struct sockaddr *)&address, &address_length));
     if (rc < 0) {
@@ -99,7 +160,17 @@ int Server::accept_client()
         goto fail;
     }
 
-    m_client_fd = rc;
+    m_clients[m_count].fd = rc;
+    m_clients[m_count].encoding = proto::ENCODING_RAW;
+    if (m_tcp)
+        tune_tcp_socket(rc, TCP_BUFFER_BYTES);
+
+    // a stalled client fails its recv/send with EAGAIN and is closed
+    set_recv_timeout(rc, m_client_timeout);
+    set_send_timeout(rc, m_client_timeout);
+
+    ++m_count;
+    ++m_accepted;
     return 0;
 
 fail:
@@ -111,7 +182,7 @@ void Server::shutdown()
 {
     logger(LOG_INFO, "Server::shutdown fd=%d", m_server_fd);
 
-    close_client();
+    close_clients();
 
     if (m_server_fd != -1)
         HANDLE_EINTR(::close(m_server_fd));
@@ -120,66 +191,245 @@ void Server::shutdown()
 
     m_server_fd = -1;
     m_uds_path = NULL;
+    m_tcp = false;
 }
 
-int Server::get_request(proto::Request &request)
+int Server::get_queued() const
 {
-    if (m_client_fd == -1) {
-        int ret = accept_client();
-        if (ret < 0)
-            return ret;
+    int queued = 0;
+    for (int i = 0; i < m_count; ++i) {
+        int bytes = 0;
+        if (!ioctl(m_clients[i].fd, FIONREAD, &bytes))
+            queued += bytes / (int) sizeof(proto::Request);
     }
+    return queued;
+}
 
-    // WARNING: not even memcpy here, we direcly pass request addr to kernel
-    char *buf = (char *) &request;
-    size_t idx = 0;
+// Blocks until a client has something to read (a request, or its
+// close), accepting new clients on the way. The first such client from
+// m_next on is picked so a busy client cannot starve the others.
+int Server::wait_client(int &index)
+{
+    for (;;) {
 
-    while (idx < sizeof(buf)) {
+        if (!m_count) {
+            int rc = accept_client();
+            if (rc)
+                return rc;
+        }
 
-        ssize_t rc = HANDLE_EINTR(::recv(m_client_fd, buf + idx, sizeof(request) - idx, 0));
-        if (rc <= 0) {
+        struct pollfd fds[MAX_CLIENTS + 1];
+        for (int i = 0; i < m_count; ++i) {
+            fds[i].fd       = m_clients[i].fd;
+            fds[i].events   = POLLIN;
+            fds[i].revents  = 0;
+        }
 
-            if (rc < 0) {
-                rc = errno;
-                logger(LOG_ERROR, "Server::get_request recv failed %d %s", rc, strerror(rc));
-            }
-            else {
-                logger(LOG_ERROR, "Server::get_request connection closed");
+        // full, new clients wait in the backlog
+        int nfds = m_count;
+        if (m_count < MAX_CLIENTS) {
+            fds[nfds].fd        = m_server_fd;
+            fds[nfds].events    = POLLIN;
+            fds[nfds].revents   = 0;
+            ++nfds;
+        }
+
+        int rc = HANDLE_EINTR(::poll(fds, nfds, -1));
+        if (rc < 0) {
+            rc = errno;
+            logger(LOG_ERROR, "Server::get_request poll failed %d %s", rc, strerror(rc));
+            return rc;
+        }
+
+        const int count = m_count;
+        for (int n = 0; n < count; ++n) {
+            const int i = (m_next + n) % count;
+            if (fds[i].revents) {
+                index = i;
+                return 0;
             }
+        }
 
+        if (nfds > count && fds[count].revents) {
             rc = accept_client();
-            if (rc < 0)
+            if (rc)
                 return rc;
+        }
+    }
+}
+
+int Server::get_request(proto::Request &request)
+{
+    m_current = -1;
+
+    for (;;) {
+
+        int index = -1;
+        int rc = wait_client(index);
+        if (rc)
+            return rc;
+
+        // WARNING: not even memcpy here, we direcly pass request addr to kernel
+        char *buf = (char *) &request;
+        size_t idx = 0;
 
-            // reset our state and go back to listening.
-            idx = 0;
-            continue;
+        while (idx < sizeof(request)) {
+            rc = HANDLE_EINTR(::recv(m_clients[index].fd, buf + idx, sizeof(request) - idx, 0));
+            if (rc <= 0)
+                break;
+            idx += (size_t) rc;
         }
 
-        idx += (size_t) rc;
-    }
+        if (idx == sizeof(request)) {
+            m_current = index;
+            m_next = (index + 1) % m_count;
+            return 0;
+        }
 
-    return 0;
+        if (rc < 0) {
+            rc = errno;
+            if (rc == EAGAIN || rc == EWOULDBLOCK)
+                logger(LOG_ERROR, "Server::get_request client timed out mid request");
+            else
+                logger(LOG_ERROR, "Server::get_request recv failed %d %s", rc, strerror(rc));
+        }
+        else {
+            logger(LOG_ERROR, "Server::get_request connection closed");
+        }
+
+        // drop this one and go back to the others (or listening)
+        close_client(index);
+    }
 }
 
-int Server::send_response(const proto::Response &response)
+int Server::send_response(const proto::Response &response, const ImageView *payload)
 {
-    if (m_client_fd == -1)
+    if (m_current == -1)
         return ENOTCONN;
 
-    // WARNING: not even memcpy here, no copy
-    const char *buf = (const char *) &response;
-    size_t idx = 0;
+    // one header copy to fill in payload fields, payload rows go to
+    // the kernel straight from the image memory.
+    proto::Response hdr = response;
 
-    while (idx < sizeof(buf)) {
-        ssize_t rc = HANDLE_EINTR(::send(m_client_fd, buf + idx, sizeof(response) - idx, 0));
-        if (rc < 0) {
-            rc = errno;
-            logger(LOG_ERROR, "Server::send_response send failed %d %s", rc, strerror(rc));
-            close_client();
-            return rc;
+    const int max_rows = 1024;
+    struct iovec iov[max_rows + 1];
+    int count = 1;
+
+    if (payload && !payload->empty()) {
+
+        if ((payload->format != PIX_FMT_GRAY8 && payload->format != PIX_FMT_DISP16) ||
+            payload->height > max_rows)
+            return EINVAL;
+
+        const size_t row_bytes = payload->row_bytes();
+
+        if ((size_t) payload->stride == row_bytes) {
+            iov[count].iov_base = payload->data;
+            iov[count].iov_len  = row_bytes * payload->height;
+            ++count;
         }
-        idx += (size_t) rc;
+        else {
+            for (int y = 0; y < payload->height; ++y, ++count) {
+                iov[count].iov_base = payload->row(y);
+                iov[count].iov_len  = row_bytes;
+            }
+        }
+
+        hdr.payload_width   = payload->width;
+        hdr.payload_height  = payload->height;
+    }
+    else {
+        hdr.payload_type    = proto::PAYLOAD_NONE;
+    }
+
+    return send_iovs(hdr, iov, count);
+}
+
+int Server::send_response(const proto::Response &response, const void *payload, size_t size)
+{
+    if (m_current == -1)
+        return ENOTCONN;
+
+    proto::Response hdr = response;
+
+    struct iovec iov[2];
+    int count = 1;
+
+    if (payload && size) {
+        iov[count].iov_base = (void *) payload;
+        iov[count].iov_len  = size;
+        ++count;
+    }
+    else {
+        hdr.payload_type    = proto::PAYLOAD_NONE;
+    }
+
+    hdr.payload_width   = 0;
+    hdr.payload_height  = 0;
+
+    return send_iovs(hdr, iov, count);
+}
+
+int Server::send_response(const proto::Response &response, const struct iovec *payload, int count)
+{
+    if (m_current == -1)
+        return ENOTCONN;
+    if (count < 0 || count > MAX_PAYLOAD_PARTS)
+        return EINVAL;
+
+    proto::Response hdr = response;
+
+    struct iovec iov[MAX_PAYLOAD_PARTS + 1];
+    int total = 1;
+
+    for (int i = 0; i < count; ++i)
+        if (payload[i].iov_len)
+            iov[total++] = payload[i];
+
+    if (total == 1)
+        hdr.payload_type    = proto::PAYLOAD_NONE;
+
+    hdr.payload_width   = 0;
+    hdr.payload_height  = 0;
+
+    return send_iovs(hdr, iov, total);
+}
+
+// iov[0] is reserved for hdr, the rest is payload.
+int Server::send_iovs(proto::Response &hdr, struct iovec *iov, int count)
+{
+    size_t payload_size = 0;
+    for (int i = 1; i < count; ++i)
+        payload_size += iov[i].iov_len;
+
+    if (payload_size == 0) {
+        hdr.payload_width   = 0;
+        hdr.payload_height  = 0;
+    }
+    hdr.payload_size        = payload_size;
+    m_sent_payload          = payload_size;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len  = sizeof(hdr);
+
+    // age of the older frame, as late as we can take it
+    uint64_t captured = hdr.left_timestamp_usec;
+    if (!captured || (hdr.right_timestamp_usec && hdr.right_timestamp_usec < captured))
+        captured = hdr.right_timestamp_usec;
+
+    hdr.age_usec = 0;
+    if (captured) {
+        const uint64_t now = get_time_usec();
+        const uint64_t age = now > captured ? now - captured : 0;
+        hdr.age_usec = age > UINT32_MAX ? UINT32_MAX : (uint32_t) age;
+        m_latency.record(age);
+    }
+
+    int rc = send_iov(m_clients[m_current].fd, iov, count);
+    if (rc) {
+        logger(LOG_ERROR, "Server::send_response send failed %d %s", rc, strerror(rc));
+        close_client(m_current);
+        return rc;
     }
 
     return 0;
@@ -7,17 +7,23 @@
 #define __SERVER__H__
 
 #include <proto.h>
+#include <image.h>
+#include <stats.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct iovec;
 
 namespace robo {
 
-// We currently only support/use unix domain socket (SOCK_STREAM)
-// due to performance/isolation. This is a fully blocking server
-// and there are no timeouts. Concurrency is limited to one connected
-// client only.
-//
-// TODO: Consider non-UDS approach for easier testing (across
-// network, or distributing processing across more raspberries.)
-//
+// Unix domain socket (SOCK_STREAM) by default for performance and
+// isolation, TCP for clients on another machine. The server blocks
+// waiting for requests, but a client that stalls half way through a
+// request or stops reading its responses is closed after the client
+// timeout so it cannot hold up the others. Up to MAX_CLIENTS clients
+// stay connected, requests are read from the ones that have any round
+// robin and each response goes to the client of the last request.
 class Server
 {
     public:
@@ -25,21 +31,80 @@ class Server
         ~Server();
 
         int initialize(const char *uds_path);
+        // host NULL listens on every address, see net.h for the socket options
+        int initialize_tcp(const char *host, int port);
         void shutdown();
 
+        // Called right before blocking on a new client with none
+        // connected, nobody asks for frames until one connects (eg. to
+        // pause the cameras).
+        typedef void (*IdleHandler)(void *ctx);
+        void set_idle_handler(IdleHandler handler, void *ctx);
+
         int get_request(proto::Request &request);
-        int send_response(const proto::Response &response);
+        // payload (optional) is sent right after the response header,
+        // payload_* fields of the response are filled in from the view.
+        int send_response(const proto::Response &response, const ImageView *payload = NULL);
+        int send_response(const proto::Response &response, const void *payload, size_t size);
+        // payload gathered from count buffers, at most MAX_PAYLOAD_PARTS
+        int send_response(const proto::Response &response, const struct iovec *payload, int count);
+
+        enum { MAX_PAYLOAD_PARTS = 64 };
+        enum { MAX_CLIENTS = 8 };
+        enum { CLIENT_TIMEOUT_MSEC = 1000 };
+
+        // Limit on reading the rest of a started request and on sending
+        // a response, for clients accepted from now on. 0 never times out.
+        void set_client_timeout(int msec) { m_client_timeout = msec; }
+
+        // proto::ENCODING_* the last request's client agreed to, raw for
+        // every new client
+        void set_encoding(uint16_t encoding);
+        uint16_t get_encoding() const;
+
+        // capture to send age of every response that carries frame
+        // timestamps, see proto::Response::age_usec
+        const Histogram &get_latency() const { return m_latency; }
+
+        // whole requests the clients sent that were not read yet
+        int get_queued() const;
+
+        // clients connected now, accepted so far, and the last
+        // response's payload bytes
+        int get_clients() const { return m_count; }
+        uint64_t get_accepted() const { return m_accepted; }
+        size_t get_sent_payload() const { return m_sent_payload; }
+        void reset_latency() { m_latency.reset(); }
 
     private:
 
+        struct Connection
+        {
+            int         fd;
+            uint16_t    encoding;
+        };
+
         int accept_client();
-        void close_client();
+        void close_client(int index);
+        void close_clients();
+        int wait_client(int &index);
+        int send_iovs(proto::Response &hdr, struct iovec *iov, int count);
 
     private:
 
         const char      *m_uds_path;
+        bool            m_tcp;
         int             m_server_fd;
-        int             m_client_fd;
+        Connection      m_clients[MAX_CLIENTS];
+        int             m_count;
+        int             m_current;      // client of the last request, -1 none
+        int             m_next;         // where the round robin resumes
+        int             m_client_timeout;
+        IdleHandler     m_idle_handler;
+        void            *m_idle_ctx;
+        Histogram       m_latency;
+        uint64_t        m_accepted;
+        size_t          m_sent_payload;
 };
 
 } // namespace robo
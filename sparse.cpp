@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "sparse.h"
+#include "stereo.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+
+namespace robo {
+
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+
+static const int g_lanes = 16;
+
+// BRIEF samples lie within g_patch of the corner, on the smoothed image
+// which is valid one pixel in from the border.
+static const int g_patch = 12;
+static const int g_border = g_patch + 1;
+static const int g_bits = 256;
+static const int g_words = g_bits / 64;
+
+// detection rows per chunk at least
+static const int g_grain = 16;
+
+// larger than any Hamming distance
+static const int g_no_match = g_bits + 1;
+
+// FAST radius 3 circle, clockwise from the top, compass points at 0, 4, 8, 12
+static const int g_circle[16][2] = {
+    {  0, -3 }, {  1, -3 }, {  2, -2 }, {  3, -1 },
+    {  3,  0 }, {  3,  1 }, {  2,  2 }, {  1,  3 },
+    {  0,  3 }, { -1,  3 }, { -2,  2 }, { -3,  1 },
+    { -3,  0 }, { -3, -1 }, { -2, -2 }, { -1, -3 },
+};
+
+void get_default_sparse_config(SparseConfig &config)
+{
+    config.fast_threshold   = 20;
+    config.max_features     = 1000;
+    config.max_distance     = 64;
+    config.ratio_percent    = 80;
+    config.row_tolerance    = 1;
+}
+
+SparseMatcher::SparseMatcher(const SparseConfig &config, int num_disparities)
+    :
+    m_config(config),
+    m_num_disparities(num_disparities),
+    m_pattern_xy(4 * g_bits),
+    m_pattern(2 * g_bits),
+    m_pattern_stride(0)
+{
+    assert(config.fast_threshold > 0 && config.fast_threshold < 256);
+    assert(config.max_features > 0);
+    assert(num_disparities > 1);
+
+    memset(&m_header, 0, sizeof(m_header));
+
+    // fixed pseudo random pattern, uniform over the patch
+    uint32_t state = 0x2545f491;
+    for (size_t i = 0; i < m_pattern_xy.size(); ++i) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        m_pattern_xy[i] = (int8_t) ((int) (state % (2 * g_patch + 1)) - g_patch);
+    }
+
+    Side *sides[2] = { &m_left, &m_right };
+    for (int i = 0; i < 2; ++i) {
+        Side *side = sides[i];
+        side->chunk_corners.resize(get_max_chunks());
+        side->luma = NULL;
+        m_detect.add([this, side]() { detect(*side); });
+    }
+
+    m_matches.reserve(config.max_features);
+    m_matched.reserve(config.max_features);
+    m_features.reserve(config.max_features);
+}
+
+// Score of a FAST-9 corner at p (sum of the arc's differences beyond the
+// threshold) or 0.
+// bits has 9 or more consecutive set bits, circularly over 16
+static inline bool has_arc(unsigned bits)
+{
+    const unsigned m = bits | bits << 16;
+    unsigned a = m;
+    for (int k = 1; k < 9; ++k)
+        a &= m >> k;
+    return a & 0xffff;
+}
+
+static inline uint16_t fast_score(const uint8_t *p, int stride, int threshold)
+{
+    const int c = *p;
+    unsigned bright = 0;
+    unsigned dark = 0;
+    int diff[16];
+
+    for (int i = 0; i < 16; ++i) {
+        const int v = p[g_circle[i][1] * stride + g_circle[i][0]];
+        diff[i] = v - c;
+        bright |= (unsigned) (diff[i] > threshold) << i;
+        dark |= (unsigned) (diff[i] < -threshold) << i;
+    }
+
+    const unsigned set = has_arc(bright) ? bright : (has_arc(dark) ? dark : 0);
+    if (!set)
+        return 0;
+
+    int score = 0;
+    for (int i = 0; i < 16; ++i) {
+        if (set & (1u << i))
+            score += (diff[i] < 0 ? -diff[i] : diff[i]) - threshold;
+    }
+    return score < 1 ? 1 : (score > UINT16_MAX ? UINT16_MAX : (uint16_t) score);
+}
+
+static inline v16u8 load(const uint8_t *p)
+{
+    v16u8 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void SparseMatcher::detect_rows(const ImageView &luma, Side &side, int y0, int y1) const
+{
+    const int w = luma.width;
+    const int h = luma.height;
+    const int s = luma.stride;
+    const int t = m_config.fast_threshold;
+
+    // 3x3 box, 7282 / 65536 ~ 1 / 9
+    const ImageView &smooth = side.smooth.view();
+    for (int y = y0 > 1 ? y0 : 1; y < y1 && y < h - 1; ++y) {
+        const uint8_t *a = luma.row(y - 1);
+        const uint8_t *b = luma.row(y);
+        const uint8_t *c = luma.row(y + 1);
+        uint8_t *out = smooth.row(y);
+        for (int x = 1; x < w - 1; ++x) {
+            const unsigned sum = a[x - 1] + a[x] + a[x + 1] + b[x - 1] + b[x] + b[x + 1] +
+                                 c[x - 1] + c[x] + c[x + 1];
+            out[x] = (uint8_t) ((sum * 7282) >> 16);
+        }
+    }
+
+    const v16u8 threshold = { (uint8_t) t, (uint8_t) t, (uint8_t) t, (uint8_t) t,
+                              (uint8_t) t, (uint8_t) t, (uint8_t) t, (uint8_t) t,
+                              (uint8_t) t, (uint8_t) t, (uint8_t) t, (uint8_t) t,
+                              (uint8_t) t, (uint8_t) t, (uint8_t) t, (uint8_t) t };
+    const v16u8 zero = { 0 };
+    const v16u8 full = zero - 1;
+
+    const int first = y0 > g_border ? y0 : g_border;
+    const int last = y1 < h - g_border ? y1 : h - g_border;
+    const int x1 = w - g_border;
+
+    for (int y = first; y < last; ++y) {
+        const uint8_t *row = luma.row(y);
+        uint16_t *score = &side.score[(size_t) y * w];
+
+        int x = g_border;
+
+        // an arc of 9 covers two neighbouring compass points, most
+        // pixels fail that on 16 lanes at once
+        for (; x + g_lanes <= x1; x += g_lanes) {
+            const v16u8 c = load(row + x);
+
+            v16u8 hi = c + threshold;
+            hi = hi < c ? full : hi;
+            v16u8 lo = c - threshold;
+            lo = lo > c ? zero : lo;
+
+            const v16u8 n = load(row + x - 3 * s);
+            const v16u8 e = load(row + x + 3);
+            const v16u8 so = load(row + x + 3 * s);
+            const v16u8 we = load(row + x - 3);
+
+            const v16u8 bn = n > hi, be = e > hi, bs = so > hi, bw = we > hi;
+            const v16u8 dn = n < lo, de = e < lo, ds = so < lo, dw = we < lo;
+
+            const v16u8 pass = (bn & be) | (be & bs) | (bs & bw) | (bw & bn) |
+                               (dn & de) | (de & ds) | (ds & dw) | (dw & dn);
+
+            uint8_t lanes[g_lanes];
+            memcpy(lanes, &pass, sizeof(lanes));
+
+            for (int i = 0; i < g_lanes; ++i)
+                score[x + i] = lanes[i] ? fast_score(row + x + i, s, t) : 0;
+        }
+
+        for (; x < x1; ++x)
+            score[x] = fast_score(row + x, s, t);
+    }
+}
+
+int SparseMatcher::prepare(Side &side, int width, int height)
+{
+    if (side.smooth.allocate(width, height, PIX_FMT_GRAY8))
+        return ENOMEM;
+    if (side.score.size() != (size_t) width * height) {
+        side.score.assign((size_t) width * height, 0);
+
+        // Suppression leaves at most every other pixel of every other
+        // row. Reserved up front, per frame growth would allocate
+        // whenever a frame has more corners than any before.
+        const size_t per_row = width / 2 + 1;
+        const int max_chunks = get_max_chunks();
+        const int chunks = (height + g_grain - 1) / g_grain < max_chunks ?
+            (height + g_grain - 1) / g_grain : max_chunks;
+        const int chunk_rows = (height + chunks - 1) / chunks;
+
+        for (size_t i = 0; i < side.chunk_corners.size(); ++i)
+            side.chunk_corners[i].reserve(per_row * (chunk_rows / 2 + 1));
+        side.corners.reserve(per_row * (height / 2 + 1));
+        side.descriptors.reserve((size_t) m_config.max_features * g_words);
+        side.row_start.reserve(height + 1);
+    }
+
+    const int stride = side.smooth.stride();
+    if (stride != m_pattern_stride) {
+        for (size_t i = 0; i < m_pattern.size(); ++i)
+            m_pattern[i] = m_pattern_xy[2 * i + 1] * stride + m_pattern_xy[2 * i];
+        m_pattern_stride = stride;
+    }
+    return 0;
+}
+
+void SparseMatcher::detect(Side &side)
+{
+    const ImageView &luma = *side.luma;
+    const int w = luma.width;
+    const int h = luma.height;
+
+    parallel_for(h, g_grain, [&](int, int y0, int y1) {
+        detect_rows(luma, side, y0, y1);
+    });
+
+    // non maximum suppression over 3x3, ties go to the later pixel
+    for (size_t i = 0; i < side.chunk_corners.size(); ++i)
+        side.chunk_corners[i].clear();
+
+    parallel_for(h, g_grain, [&](int chunk, int y0, int y1) {
+        std::vector<Corner> &out = side.chunk_corners[chunk];
+        const int first = y0 > g_border ? y0 : g_border;
+        const int last = y1 < h - g_border ? y1 : h - g_border;
+
+        for (int y = first; y < last; ++y) {
+            const uint16_t *a = &side.score[(size_t) (y - 1) * w];
+            const uint16_t *b = a + w;
+            const uint16_t *c = b + w;
+
+            for (int x = g_border; x < w - g_border; ++x) {
+                const uint16_t v = b[x];
+                if (!v)
+                    continue;
+                if (v <= a[x - 1] || v <= a[x] || v <= a[x + 1] || v <= b[x - 1] ||
+                    v < b[x + 1] || v < c[x - 1] || v < c[x] || v < c[x + 1])
+                    continue;
+
+                Corner corner = { (int16_t) x, (int16_t) y, v };
+                out.push_back(corner);
+            }
+        }
+    });
+
+    // chunks are in range order, so is the concatenation
+    side.corners.clear();
+    for (size_t i = 0; i < side.chunk_corners.size(); ++i)
+        side.corners.insert(side.corners.end(), side.chunk_corners[i].begin(),
+                            side.chunk_corners[i].end());
+
+    if ((int) side.corners.size() > m_config.max_features) {
+        std::nth_element(side.corners.begin(), side.corners.begin() + m_config.max_features,
+            side.corners.end(), [](const Corner &a, const Corner &b) { return a.score > b.score; });
+        side.corners.resize(m_config.max_features);
+        std::sort(side.corners.begin(), side.corners.end(), [](const Corner &a, const Corner &b) {
+            return a.y != b.y ? a.y < b.y : a.x < b.x;
+        });
+    }
+
+    side.row_start.assign(h + 1, 0);
+    for (size_t i = 0; i < side.corners.size(); ++i)
+        ++side.row_start[side.corners[i].y + 1];
+    for (int y = 0; y < h; ++y)
+        side.row_start[y + 1] += side.row_start[y];
+
+    describe(side);
+}
+
+void SparseMatcher::describe(Side &side) const
+{
+    const ImageView &smooth = side.smooth.view();
+    const int count = (int) side.corners.size();
+
+    side.descriptors.resize((size_t) count * g_words);
+
+    parallel_for(count, 64, [&](int, int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const Corner &corner = side.corners[i];
+            const uint8_t *p = smooth.row(corner.y) + corner.x;
+            uint64_t *desc = &side.descriptors[(size_t) i * g_words];
+
+            for (int word = 0; word < g_words; ++word) {
+                const int *pattern = &m_pattern[word * 128];
+                uint64_t bits = 0;
+                for (int bit = 0; bit < 64; ++bit)
+                    bits |= (uint64_t) (p[pattern[2 * bit]] < p[pattern[2 * bit + 1]]) << bit;
+                desc[word] = bits;
+            }
+        }
+    });
+}
+
+static inline int hamming(const uint64_t *a, const uint64_t *b)
+{
+    int d = 0;
+    for (int i = 0; i < g_words; ++i)
+        d += __builtin_popcountll(a[i] ^ b[i]);
+    return d;
+}
+
+// 5x5 SAD on the smoothed images
+static inline int block_sad(const ImageView &l, const ImageView &r, int xl, int yl, int xr, int yr)
+{
+    int sad = 0;
+    for (int dy = -2; dy <= 2; ++dy) {
+        const uint8_t *a = l.row(yl + dy) + xl;
+        const uint8_t *b = r.row(yr + dy) + xr;
+        for (int dx = -2; dx <= 2; ++dx)
+            sad += a[dx] > b[dx] ? a[dx] - b[dx] : b[dx] - a[dx];
+    }
+    return sad;
+}
+
+bool SparseMatcher::match(int index, proto::Feature &feature) const
+{
+    const Corner &corner = m_left.corners[index];
+    const uint64_t *desc = &m_left.descriptors[(size_t) index * g_words];
+    const int h = (int) m_right.row_start.size() - 1;
+
+    int best = g_no_match;
+    int second = g_no_match;
+    int best_index = -1;
+
+    const int xr0 = corner.x - m_num_disparities + 1;
+    for (int y = corner.y - m_config.row_tolerance; y <= corner.y + m_config.row_tolerance; ++y) {
+        if (y < 0 || y >= h)
+            continue;
+        for (int j = m_right.row_start[y]; j < m_right.row_start[y + 1]; ++j) {
+            const Corner &candidate = m_right.corners[j];
+            if (candidate.x < xr0)
+                continue;
+            if (candidate.x > corner.x)
+                break;
+
+            const int d = hamming(desc, &m_right.descriptors[(size_t) j * g_words]);
+            if (d < best) {
+                second = best;
+                best = d;
+                best_index = j;
+            }
+            else if (d < second) {
+                second = d;
+            }
+        }
+    }
+
+    if (best_index < 0 || best > m_config.max_distance || best * 100 >= second * m_config.ratio_percent)
+        return false;
+
+    const Corner &right = m_right.corners[best_index];
+    const int d = corner.x - right.x;
+    int disparity = d * DISP_SCALE;
+
+    // parabola through the neighbouring disparities' SAD
+    const ImageView &l = m_left.smooth.view();
+    const ImageView &r = m_right.smooth.view();
+    const int c0 = block_sad(l, r, corner.x, corner.y, right.x, right.y);
+    if (d > 0 && d + 1 < m_num_disparities) {
+        const int cm = block_sad(l, r, corner.x, corner.y, right.x + 1, right.y);
+        const int cp = block_sad(l, r, corner.x, corner.y, right.x - 1, right.y);
+        const int denom = 2 * (cm + cp - 2 * c0);
+        const int num = DISP_SCALE * (cm - cp);
+        if (c0 <= cm && c0 <= cp && denom > 0)
+            disparity += (num + (num < 0 ? -denom : denom) / 2) / denom;
+    }
+
+    feature.x           = corner.x;
+    feature.y           = corner.y;
+    feature.disparity   = (int16_t) disparity;
+    feature.confidence  = (uint8_t) (255 * (second - best) / second);
+    feature.reserved    = 0;
+    return true;
+}
+
+int SparseMatcher::compute(const ImageView &left, const ImageView &right)
+{
+    if (left.format != PIX_FMT_GRAY8 || right.format != PIX_FMT_GRAY8)
+        return EINVAL;
+    if (left.empty() || !left.same_size(right) || left.stride != right.stride)
+        return EINVAL;
+
+    m_features.clear();
+    m_header.width = left.width;
+    m_header.height = left.height;
+    m_header.count = 0;
+
+    // equal strides, both smoothed copies share the pattern offsets
+    int res = prepare(m_left, left.width, left.height);
+    res = res ? res : prepare(m_right, right.width, right.height);
+    if (res)
+        return res;
+
+    m_left.luma = &left;
+    m_right.luma = &right;
+    res = m_detect.run();
+    if (res)
+        return res;
+
+    const int count = (int) m_left.corners.size();
+    m_matches.resize(count);
+    m_matched.resize(count);
+
+    parallel_for(count, 64, [&](int, int begin, int end) {
+        for (int i = begin; i < end; ++i)
+            m_matched[i] = match(i, m_matches[i]);
+    });
+
+    for (int i = 0; i < count; ++i) {
+        if (m_matched[i])
+            m_features.push_back(m_matches[i]);
+    }
+
+    m_header.count = m_features.size();
+    return 0;
+}
+
+int SparseMatcher::get_payload(struct iovec *iov) const
+{
+    iov[0].iov_base = (void *) &m_header;
+    iov[0].iov_len  = sizeof(m_header);
+    iov[1].iov_base = (void *) features();
+    iov[1].iov_len  = m_features.size() * sizeof(proto::Feature);
+    return 2;
+}
+
+} // namespace robo
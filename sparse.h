@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __SPARSE__H__
+#define __SPARSE__H__
+
+#include "image.h"
+#include "proto.h"
+#include "parallel.h"
+
+#include <stdint.h>
+#include <vector>
+
+struct iovec;
+
+namespace robo {
+
+struct SparseConfig
+{
+    int     fast_threshold;     // luma difference of a FAST circle pixel
+    int     max_features;       // strongest corners kept per image
+    int     max_distance;       // Hamming distance of a match, of 256 bits
+    int     ratio_percent;      // best must be below this percent of second best
+    int     row_tolerance;      // rows searched above/below, luma is not rectified
+};
+
+void get_default_sparse_config(SparseConfig &config);
+
+// Low power stereo: FAST-9 corners on both lumas, 256 bit BRIEF
+// descriptors on a 3x3 box smoothed copy, and Hamming matching of every
+// left corner against the right corners of the same row(s) within the
+// disparity range. Matches are refined to DISP_SCALE with a parabola
+// through the SAD of the neighbouring disparities.
+//
+// The FAST pre-test (4 compass pixels) runs on 16 pixels per vector op,
+// the full circle test only on what passes it. Cost is a few passes
+// over the pixels plus O(features) instead of O(pixels x disparities).
+class SparseMatcher
+{
+public:
+    SparseMatcher(const SparseConfig &config, int num_disparities);
+
+    const SparseConfig &config() const { return m_config; }
+
+    int compute(const ImageView &left, const ImageView &right);
+
+    // header and count proto::Feature, left camera coordinates
+    int get_payload(struct iovec *iov) const;
+
+    size_t count() const { return m_features.size(); }
+    const proto::Feature *features() const { return m_features.empty() ? NULL : &m_features[0]; }
+
+private:
+    struct Corner
+    {
+        int16_t     x;
+        int16_t     y;
+        uint16_t    score;
+    };
+
+    struct Side
+    {
+        Image                       smooth;
+        std::vector<uint16_t>       score;      // width x height
+        std::vector<Corner>         corners;    // row major
+        std::vector<uint64_t>       descriptors;
+        std::vector<int>            row_start;  // height + 1, into corners
+
+        // per parallel_for chunk, both sides are detected concurrently
+        std::vector<std::vector<Corner> >   chunk_corners;
+
+        const ImageView             *luma;     // input of the running compute()
+    };
+
+    int prepare(Side &side, int width, int height);
+    void detect(Side &side);
+    void detect_rows(const ImageView &luma, Side &side, int y0, int y1) const;
+    void describe(Side &side) const;
+    bool match(int index, proto::Feature &feature) const;
+
+private:
+    SparseConfig                        m_config;
+    int                                 m_num_disparities;
+    std::vector<int8_t>                 m_pattern_xy;   // dx, dy, 2 points per bit
+    std::vector<int>                    m_pattern;      // the same as offsets
+    int                                 m_pattern_stride;
+    Side                                m_left;
+    Side                                m_right;
+    TaskGraph                           m_detect;   // left and right at once
+    std::vector<proto::Feature>         m_matches;  // one per left corner
+    std::vector<uint8_t>                m_matched;
+    std::vector<proto::Feature>         m_features;
+    proto::FeatureList                  m_header;
+};
+
+} // namespace robo
+
+#endif // __SPARSE__H__
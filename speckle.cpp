@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "speckle.h"
+#include "stereo.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+namespace robo {
+
+void get_default_speckle_config(SpeckleConfig &config)
+{
+    config.max_size = 100;
+    config.max_diff = DISP_SCALE;
+}
+
+SpeckleFilter::SpeckleFilter(const SpeckleConfig &config)
+    :
+    m_config(config)
+{
+    assert(config.max_size >= 0);
+    assert(config.max_diff >= 0);
+}
+
+// read only, safe while other bands only write their own pixels
+int SpeckleFilter::find(int i) const
+{
+    while (m_parent[i] != i)
+        i = m_parent[i];
+    return i;
+}
+
+int SpeckleFilter::find_compress(int i)
+{
+    while (m_parent[i] != i) {
+        m_parent[i] = m_parent[m_parent[i]];
+        i = m_parent[i];
+    }
+    return i;
+}
+
+// the lower index becomes the root, so a band's roots stay in the band
+// or above it
+void SpeckleFilter::unite(int a, int b)
+{
+    a = find_compress(a);
+    b = find_compress(b);
+    if (a < b)
+        m_parent[b] = a;
+    else if (b < a)
+        m_parent[a] = b;
+}
+
+static inline bool connected(int a, int b, int max_diff)
+{
+    return a >= 0 && b >= 0 && (a > b ? a - b : b - a) <= max_diff;
+}
+
+int SpeckleFilter::apply(const ImageView &src, const ImageView &dst, int &removed)
+{
+    removed = 0;
+
+    if (src.format != PIX_FMT_DISP16 || dst.format != PIX_FMT_DISP16)
+        return EINVAL;
+    if (src.empty() || !src.same_size(dst))
+        return EINVAL;
+
+    const int w = src.width;
+    const int h = src.height;
+
+    if (!m_config.max_size) {
+        if (src.data != dst.data) {
+            for (int y = 0; y < h; ++y)
+                memcpy(dst.row(y), src.row(y), src.row_bytes());
+        }
+        return 0;
+    }
+
+    m_parent.resize((size_t) w * h);
+    m_root.resize((size_t) w * h);
+    m_size.resize((size_t) w * h);
+    m_band_start.assign(get_max_chunks(), -1);
+    m_removed.assign(get_max_chunks(), 0);
+
+    const int max_diff = m_config.max_diff;
+    const int grain = 16;
+
+    // label each band on its own, unions never leave the band
+    parallel_for(h, grain, [&](int chunk, int y0, int y1) {
+        m_band_start[chunk] = y0;
+
+        for (int y = y0; y < y1; ++y) {
+            const int16_t *row = src.row_as<int16_t>(y);
+            const int16_t *up = y > y0 ? src.row_as<int16_t>(y - 1) : NULL;
+
+            for (int x = 0; x < w; ++x) {
+                const int i = y * w + x;
+                m_size[i] = 0;
+                m_parent[i] = row[x] >= 0 ? i : -1;
+                if (m_parent[i] < 0)
+                    continue;
+
+                if (x > 0 && connected(row[x], row[x - 1], max_diff))
+                    unite(i, i - 1);
+                if (up && connected(row[x], up[x], max_diff))
+                    unite(i, i - w);
+            }
+        }
+    });
+
+    // join the seams, one row per band
+    for (size_t chunk = 1; chunk < m_band_start.size(); ++chunk) {
+        const int y = m_band_start[chunk];
+        if (y <= 0)
+            continue;
+
+        const int16_t *row = src.row_as<int16_t>(y);
+        const int16_t *up = src.row_as<int16_t>(y - 1);
+        for (int x = 0; x < w; ++x) {
+            if (connected(row[x], up[x], max_diff))
+                unite(y * w + x, (y - 1) * w + x);
+        }
+    }
+
+    // finds only read from here on, every band counts into the roots
+    parallel_for(h, grain, [&](int, int y0, int y1) {
+        for (int i = y0 * w; i < y1 * w; ++i) {
+            if (m_parent[i] < 0)
+                continue;
+            m_root[i] = find(i);
+            __atomic_fetch_add(&m_size[m_root[i]], 1, __ATOMIC_RELAXED);
+        }
+    });
+
+    parallel_for(h, grain, [&](int chunk, int y0, int y1) {
+        int count = 0;
+        for (int y = y0; y < y1; ++y) {
+            const int16_t *in = src.row_as<int16_t>(y);
+            int16_t *out = dst.row_as<int16_t>(y);
+            const int32_t *parent = &m_parent[(size_t) y * w];
+            const int32_t *root = &m_root[(size_t) y * w];
+
+            for (int x = 0; x < w; ++x) {
+                const bool speckle = parent[x] >= 0 && m_size[root[x]] <= m_config.max_size;
+                out[x] = speckle ? (int16_t) DISP_INVALID : in[x];
+                count += speckle;
+            }
+        }
+        m_removed[chunk] = count;
+    });
+
+    for (size_t i = 0; i < m_removed.size(); ++i)
+        removed += m_removed[i];
+    return 0;
+}
+
+} // namespace robo
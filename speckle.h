@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __SPECKLE__H__
+#define __SPECKLE__H__
+
+#include "image.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+struct SpeckleConfig
+{
+    int     max_size;           // regions up to this many pixels are removed, 0 off
+    int     max_diff;           // DISP16 step still connecting two neighbours
+};
+
+void get_default_speckle_config(SpeckleConfig &config);
+
+// Removes small disconnected regions of a disparity map (OpenCV's
+// filterSpeckles, with union-find instead of a flood fill). Row bands
+// are labelled concurrently, each touching only its own pixels, then the
+// band seams are joined on one thread and the region sizes counted and
+// applied in bands again. Scratch is kept across calls.
+class SpeckleFilter
+{
+public:
+    explicit SpeckleFilter(const SpeckleConfig &config);
+
+    const SpeckleConfig &config() const { return m_config; }
+
+    // dst gets src with the speckles DISP_INVALID, both DISP16 of the
+    // same geometry. removed is the number of pixels invalidated.
+    int apply(const ImageView &src, const ImageView &dst, int &removed);
+
+private:
+    int find(int i) const;
+    int find_compress(int i);
+    void unite(int a, int b);
+
+private:
+    SpeckleConfig           m_config;
+    std::vector<int32_t>    m_parent;   // per pixel, -1 invalid
+    std::vector<int32_t>    m_root;     // per pixel, after the seams joined
+    std::vector<int32_t>    m_size;     // per region root
+    std::vector<int>        m_band_start;   // per chunk, first row
+    std::vector<int>        m_removed;      // per chunk
+};
+
+} // namespace robo
+
+#endif // __SPECKLE__H__
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "stats.h"
+
+#include <math.h>
+#include <string.h>
+
+namespace robo {
+
+RunningStat::RunningStat()
+{
+    reset();
+}
+
+void RunningStat::reset()
+{
+    m_count = 0;
+    m_mean = 0.0;
+    m_m2 = 0.0;
+    m_min = 0.0;
+    m_max = 0.0;
+}
+
+void RunningStat::add(double v)
+{
+    if (!m_count || v < m_min)
+        m_min = v;
+    if (!m_count || v > m_max)
+        m_max = v;
+
+    ++m_count;
+    const double delta = v - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (v - m_mean);
+}
+
+double RunningStat::stddev() const
+{
+    return m_count > 1 ? sqrt(m_m2 / (m_count - 1)) : 0.0;
+}
+
+Histogram::Histogram()
+{
+    reset();
+}
+
+void Histogram::reset()
+{
+    m_count = 0;
+    m_sum = 0;
+    m_min = UINT64_MAX;
+    m_max = 0;
+    memset(m_buckets, 0, sizeof(m_buckets));
+}
+
+int Histogram::get_index(uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return (int) v;
+
+    const int msb = 63 - __builtin_clzll(v);
+    if (msb >= MAX_BITS)
+        return NUM_BUCKETS - 1;
+
+    const int shift = msb - SUB_BITS;
+    return (shift + 1) * SUB_COUNT + (int) ((v >> shift) & (SUB_COUNT - 1));
+}
+
+// lowest value of the bucket
+uint64_t Histogram::get_value(int index)
+{
+    if (index < SUB_COUNT)
+        return index;
+
+    const int shift = index / SUB_COUNT - 1;
+    const uint64_t sub = index % SUB_COUNT;
+    return (SUB_COUNT + sub) << shift;
+}
+
+void Histogram::record(uint64_t v)
+{
+    record(v, 1);
+}
+
+void Histogram::record(uint64_t v, uint64_t count)
+{
+    if (!count)
+        return;
+
+    m_buckets[get_index(v)] += count;
+    m_count += count;
+    m_sum += v * count;
+    if (v < m_min)
+        m_min = v;
+    if (v > m_max)
+        m_max = v;
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (int i = 0; i < NUM_BUCKETS; ++i)
+        m_buckets[i] += other.m_buckets[i];
+
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    if (other.m_min < m_min)
+        m_min = other.m_min;
+    if (other.m_max > m_max)
+        m_max = other.m_max;
+}
+
+uint64_t Histogram::percentile(double p) const
+{
+    if (!m_count)
+        return 0;
+
+    uint64_t rank = (uint64_t) ceil(p / 100.0 * m_count);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            // report the bucket's upper edge, never beyond what we saw
+            const uint64_t v = i + 1 < NUM_BUCKETS ? get_value(i + 1) - 1 : m_max;
+            return v < m_max ? (v > m_min ? v : m_min) : m_max;
+        }
+    }
+    return m_max;
+}
+
+} // namespace robo
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __STATS__H__
+#define __STATS__H__
+
+#include <stdint.h>
+
+namespace robo {
+
+// Running mean/min/max/stddev (Welford), O(1) per sample.
+class RunningStat
+{
+public:
+    RunningStat();
+
+    void reset();
+    void add(double v);
+
+    uint64_t count() const { return m_count; }
+    double mean() const { return m_mean; }
+    double min() const { return m_min; }
+    double max() const { return m_max; }
+    double stddev() const;
+
+private:
+    uint64_t    m_count;
+    double      m_mean;
+    double      m_m2;
+    double      m_min;
+    double      m_max;
+};
+
+// Log-linear histogram (HdrHistogram style), 16 sub buckets per power
+// of two which bounds the error of any percentile to ~6%. Fixed size,
+// no allocation, record() is a handful of instructions.
+class Histogram
+{
+public:
+    enum {
+        SUB_BITS    = 4,
+        SUB_COUNT   = 1 << SUB_BITS,
+        MAX_BITS    = 40,
+        NUM_BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_COUNT,
+    };
+
+    Histogram();
+
+    void reset();
+    void record(uint64_t v);
+    void record(uint64_t v, uint64_t count);
+    void merge(const Histogram &other);
+
+    uint64_t count() const { return m_count; }
+    uint64_t min() const { return m_count ? m_min : 0; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? (double) m_sum / m_count : 0.0; }
+
+    // p in [0, 100]
+    uint64_t percentile(double p) const;
+
+private:
+    static int get_index(uint64_t v);
+    static uint64_t get_value(int index);
+
+private:
+    uint64_t    m_count;
+    uint64_t    m_sum;
+    uint64_t    m_min;
+    uint64_t    m_max;
+    uint64_t    m_buckets[NUM_BUCKETS];
+};
+
+} // namespace robo
+
+#endif // __STATS__H__
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "stereo.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+namespace robo {
+
+void get_default_stereo_config(StereoConfig &config)
+{
+    config.num_disparities  = 64;
+    config.block_size       = 9;
+    config.uniqueness_ratio = 10;
+    config.lr_max_diff      = 1;
+    config.subpixel         = true;
+}
+
+BlockMatcher::BlockMatcher(const StereoConfig &config)
+    :
+    m_config(config)
+{
+    assert(config.num_disparities > 0);
+    assert(config.block_size > 0 && (config.block_size & 1));
+}
+
+void BlockMatcher::set_num_disparities(int num_disparities)
+{
+    assert(num_disparities > 0);
+    m_config.num_disparities = num_disparities;
+}
+
+// colsum[x] += sign * |l[x] - r[x - d]| for x in [begin, end), begin >= d
+static inline void accumulate_row(uint16_t *colsum, const uint8_t *l, const uint8_t *r,
+                                  int d, int begin, int end, int sign)
+{
+    for (int x = begin; x < end; ++x) {
+        const int diff = (int) l[x] - (int) r[x - d];
+        colsum[x] += (uint16_t) (sign * (diff < 0 ? -diff : diff));
+    }
+}
+
+static inline int abs_diff(int a, int b)
+{
+    return a > b ? a - b : b - a;
+}
+
+// Lowest SAD per right image pixel (x - d) seen so far, the right view's
+// own winner for the left-right check.
+template <bool LR>
+static inline void scan_row(const uint16_t *cs, int d, int x0, int x1, int r,
+                            uint16_t *best, uint16_t *second, int16_t *best_d,
+                            uint16_t *right_best, int16_t *right_d)
+{
+    unsigned sad = 0;
+    for (int x = x0 - r; x <= x0 + r; ++x)
+        sad += cs[x];
+
+    for (int x = x0; x < x1; ++x) {
+        if (x > x0)
+            sad += cs[x + r] - cs[x - r - 1];
+
+        // second best ignores the best's direct neighbours, they
+        // are the same minimum seen at the next integer step.
+        if (sad < best[x]) {
+            if (best_d[x] + 1 != d)
+                second[x] = best[x];
+            best[x] = (uint16_t) sad;
+            best_d[x] = d;
+        }
+        else if (sad < second[x] && best_d[x] + 1 != d) {
+            second[x] = (uint16_t) sad;
+        }
+
+        if (LR && sad < right_best[x - d]) {
+            right_best[x - d] = (uint16_t) sad;
+            right_d[x - d] = d;
+        }
+    }
+}
+
+// window sum of a column sum row at x
+static inline int window_sad(const uint16_t *cs, int x, int r)
+{
+    int sad = 0;
+    for (int i = x - r; i <= x + r; ++i)
+        sad += cs[i];
+    return sad;
+}
+
+int BlockMatcher::compute_rect(Scratch &s, const ImageView &left, const ImageView &right,
+                               const ImageView &disp, const ImageView *confidence,
+                               int y0, int y1, int xa, int xb, int d0, int d1, int &pixels) const
+{
+    const int w = left.width;
+    const int h = left.height;
+    const int nd = m_config.num_disparities;
+    const int r = m_config.block_size / 2;
+    const int x0 = xa > nd - 1 + r ? xa : nd - 1 + r;
+    const int x1 = xb < w - r ? xb : w - r;
+
+    for (int y = y0; y < y1; ++y) {
+        int16_t *out = disp.row_as<int16_t>(y);
+        for (int x = xa; x < xb; ++x)
+            out[x] = DISP_INVALID;
+        if (confidence)
+            memset(confidence->row(y) + xa, 0, xb - xa);
+    }
+
+    const int first = y0 > r ? y0 : r;
+    const int last = y1 < h - r ? y1 : h - r;
+    pixels = 0;
+    if (first >= last || x0 >= x1)
+        return 0;
+    pixels = (last - first) * (x1 - x0);
+
+    assert(d0 >= 0 && d0 < d1 && d1 <= nd);
+    int edge_hits = 0;
+
+    // The left-right check needs every left pixel competing for the
+    // right pixels of [x0, x1), that is span more columns on both sides.
+    const bool lr = m_config.lr_max_diff >= 0;
+    const int span = lr ? d1 - 1 - d0 : 0;
+    const int xe0 = x0 - span > nd - 1 + r ? x0 - span : nd - 1 + r;
+    const int xe1 = x1 + span < w - r ? x1 + span : w - r;
+
+    // column sums are needed for the window around [xe0, xe1) only
+    const int c0 = xe0 - r;
+    const int c1 = xe1 + r;
+
+    s.colsum.resize((size_t) nd * w);
+    s.best.resize(w);
+    s.second.resize(w);
+    s.best_d.resize(w);
+    s.right_best.resize(w);
+    s.right_d.resize(w);
+
+    for (int d = d0; d < d1; ++d) {
+        uint16_t *cs = &s.colsum[(size_t) d * w];
+        memset(cs + c0, 0, (c1 - c0) * sizeof(*cs));
+        for (int yy = first - r; yy <= first + r; ++yy)
+            accumulate_row(cs, left.row(yy), right.row(yy), d, c0, c1, 1);
+    }
+
+    for (int y = first; y < last; ++y) {
+
+        if (y > first) {
+            const uint8_t *l_in = left.row(y + r);
+            const uint8_t *r_in = right.row(y + r);
+            const uint8_t *l_out = left.row(y - r - 1);
+            const uint8_t *r_out = right.row(y - r - 1);
+
+            for (int d = d0; d < d1; ++d) {
+                uint16_t *cs = &s.colsum[(size_t) d * w];
+                accumulate_row(cs, l_in, r_in, d, c0, c1, 1);
+                accumulate_row(cs, l_out, r_out, d, c0, c1, -1);
+            }
+        }
+
+        uint16_t *best = &s.best[0];
+        uint16_t *second = &s.second[0];
+        int16_t *best_d = &s.best_d[0];
+        uint16_t *right_best = &s.right_best[0];
+        int16_t *right_d = &s.right_d[0];
+
+        for (int x = xe0; x < xe1; ++x) {
+            best[x] = UINT16_MAX;
+            second[x] = UINT16_MAX;
+            best_d[x] = d0;
+        }
+
+        if (lr) {
+            for (int x = xe0 - (d1 - 1); x < xe1 - d0; ++x) {
+                right_best[x] = UINT16_MAX;
+                right_d[x] = DISP_INVALID;
+            }
+            for (int d = d0; d < d1; ++d)
+                scan_row<true>(&s.colsum[(size_t) d * w], d, xe0, xe1, r, best, second, best_d,
+                               right_best, right_d);
+        }
+        else {
+            for (int d = d0; d < d1; ++d)
+                scan_row<false>(&s.colsum[(size_t) d * w], d, x0, x1, r, best, second, best_d,
+                                right_best, right_d);
+        }
+
+        int16_t *out = disp.row_as<int16_t>(y);
+        uint8_t *conf = confidence ? confidence->row(y) : NULL;
+        const unsigned ratio = 100 + m_config.uniqueness_ratio;
+
+        for (int x = x0; x < x1; ++x) {
+            const int d = best_d[x];
+
+            bool valid = (unsigned) second[x] * 100 > (unsigned) best[x] * ratio;
+            if (lr)
+                valid = valid && abs_diff(right_d[x - d], d) <= m_config.lr_max_diff;
+            if (!valid)
+                continue;
+
+            // parabola through the neighbouring disparities' SAD, they
+            // are still in the column sums of this row
+            int value = d << DISP_SHIFT;
+            if (m_config.subpixel && d > d0 && d + 1 < d1) {
+                const int sm = window_sad(&s.colsum[(size_t) (d - 1) * w], x, r);
+                const int sp = window_sad(&s.colsum[(size_t) (d + 1) * w], x, r);
+                const int denom = 2 * (sm + sp - 2 * best[x]);
+                const int num = DISP_SCALE * (sm - sp);
+                if (denom > 0)
+                    value += (num + (num < 0 ? -denom : denom) / 2) / denom;
+            }
+            out[x] = (int16_t) value;
+
+            // how much the runner up lost by, 0 is a tie
+            if (conf)
+                conf[x] = (uint8_t) (255u * (second[x] - best[x]) / (second[x] ? second[x] : 1));
+        }
+
+        // a best match on a narrowed range's edge may really lie beyond it
+        if (d0 > 0 || d1 < nd) {
+            for (int x = x0; x < x1; ++x)
+                edge_hits += (d0 > 0 && best_d[x] == d0) || (d1 < nd && best_d[x] == d1 - 1);
+        }
+    }
+
+    return edge_hits;
+}
+
+// confidence is optional, GRAY8 of the disparity's geometry
+static bool check_views(const ImageView &left, const ImageView &right, const ImageView &disp,
+                        const ImageView *confidence)
+{
+    if (left.format != PIX_FMT_GRAY8 || right.format != PIX_FMT_GRAY8 ||
+        disp.format != PIX_FMT_DISP16)
+        return false;
+    if (left.empty() || !left.same_size(right) || !left.same_size(disp))
+        return false;
+    if (confidence && (confidence->format != PIX_FMT_GRAY8 || !confidence->same_size(disp)))
+        return false;
+    return true;
+}
+
+int BlockMatcher::compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                          const ImageView *confidence)
+{
+    return compute_rows(left, right, disp, 0, left.height, confidence);
+}
+
+int BlockMatcher::compute_rows(const ImageView &left, const ImageView &right, const ImageView &disp,
+                               int y0, int y1, const ImageView *confidence)
+{
+    if (!check_views(left, right, disp, confidence))
+        return EINVAL;
+    if (y0 < 0 || y1 > left.height || y0 > y1)
+        return EINVAL;
+    if (m_config.block_size * 255 * m_config.block_size > UINT16_MAX)
+        return EINVAL;
+
+    // the window needs block_size rows of context on both sides, a band
+    // much smaller than that mostly recomputes its neighbours' sums.
+    const int grain = 4 * m_config.block_size;
+    m_scratch.resize(get_max_chunks());
+
+    parallel_for(y1 - y0, grain, [&](int chunk, int begin, int end) {
+        int pixels = 0;
+        compute_rect(m_scratch[chunk], left, right, disp, confidence, y0 + begin, y0 + end,
+                     0, left.width, 0, m_config.num_disparities, pixels);
+    });
+
+    return 0;
+}
+
+int BlockMatcher::compute_tiles(const ImageView &left, const ImageView &right, const ImageView &disp,
+                                const uint8_t *dirty, int tile, const ImageView *confidence)
+{
+    TileJob job;
+    memset(&job, 0, sizeof(job));
+    job.dirty = dirty;
+    job.tile = tile;
+    job.confidence = confidence;
+
+    return compute_tiles(left, right, disp, job);
+}
+
+int BlockMatcher::compute_tiles(const ImageView &left, const ImageView &right, const ImageView &disp,
+                                const TileJob &job)
+{
+    if (!check_views(left, right, disp, job.confidence) || job.tile <= 0)
+        return EINVAL;
+
+    const int tile = job.tile;
+    const int tiles_x = (left.width + tile - 1) / tile;
+    const int tiles_y = (left.height + tile - 1) / tile;
+    const int nd = m_config.num_disparities;
+
+    m_scratch.resize(get_max_chunks());
+
+    // every run of dirty tiles with the same search range in a tile row is
+    // one rectangle, the window context around it is recomputed by
+    // compute_rect() itself.
+    parallel_for(tiles_y, 1, [&](int chunk, int ty0, int ty1) {
+        for (int ty = ty0; ty < ty1; ++ty) {
+            const int base = ty * tiles_x;
+            const uint8_t *row = job.dirty + base;
+            const int y0 = ty * tile;
+            const int y1 = y0 + tile < left.height ? y0 + tile : left.height;
+
+            if (job.retry)
+                memset(job.retry + base, 0, tiles_x);
+
+            for (int tx = 0; tx < tiles_x; ++tx) {
+                if (!row[tx])
+                    continue;
+
+                const int d0 = job.d_min ? job.d_min[base + tx] : 0;
+                const int d1 = job.d_max ? job.d_max[base + tx] : nd;
+
+                int end = tx + 1;
+                while (end < tiles_x && row[end] &&
+                       (!job.d_min || (job.d_min[base + end] == d0 && job.d_max[base + end] == d1)))
+                    ++end;
+
+                const int x1 = end * tile < left.width ? end * tile : left.width;
+                int pixels = 0;
+                const int hits = compute_rect(m_scratch[chunk], left, right, disp, job.confidence,
+                                              y0, y1, tx * tile, x1, d0, d1, pixels);
+
+                // flags the whole run, hits are not tracked per tile
+                if (job.retry && hits > job.max_edge_fraction * pixels) {
+                    for (int i = tx; i < end; ++i)
+                        job.retry[base + i] = 1;
+                }
+
+                tx = end - 1;
+            }
+        }
+    });
+
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __STEREO__H__
+#define __STEREO__H__
+
+#include "image.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+// Disparities are fixed point with DISP_SCALE steps per pixel (same as
+// OpenCV's StereoBM), DISP_INVALID where no reliable match was found.
+enum {
+    DISP_SHIFT      = 4,
+    DISP_SCALE      = 1 << DISP_SHIFT,
+    DISP_INVALID    = -1,
+};
+
+struct StereoConfig
+{
+    int     num_disparities;    // search range [0, num_disparities) pixels
+    int     block_size;         // odd SAD window size
+    int     uniqueness_ratio;   // percent the best must win by
+    int     lr_max_diff;        // left-right check tolerance in pixels, -1 off
+    bool    subpixel;           // refine to 1/DISP_SCALE pixels
+};
+
+void get_default_stereo_config(StereoConfig &config);
+
+// Tile recompute request, all arrays are row major with one byte per
+// tile. d_min/d_max narrow the search of each tile to [d_min, d_max),
+// NULL searches the full range. Tiles where more than max_edge_fraction
+// of the pixels matched on a narrowed edge are flagged in retry.
+struct TileJob
+{
+    const uint8_t  *dirty;
+    int             tile;
+    const uint8_t  *d_min;
+    const uint8_t  *d_max;
+    uint8_t        *retry;          // optional output
+    float           max_edge_fraction;
+    const ImageView *confidence;    // optional output, see BlockMatcher
+};
+
+// SAD block matcher on rectified GRAY8 pairs. Column sums are updated
+// incrementally from row to row, so the cost per pixel and disparity is
+// a few adds regardless of block_size. Rows are split across threads.
+// Pixels closer than num_disparities + block_size / 2 to the left
+// border and block_size / 2 to any other border are DISP_INVALID.
+//
+// Post processing is fused into the same pass while the row's costs
+// are at hand: the left-right check compares against the right view's
+// winner collected from the same SADs, subpixel fits a parabola through
+// the neighbouring disparities, and the optional GRAY8 confidence map
+// gets 255 * (second - best) / second (0 where invalid).
+class BlockMatcher
+{
+public:
+    explicit BlockMatcher(const StereoConfig &config);
+
+    const StereoConfig &config() const { return m_config; }
+
+    // takes effect with the next compute*()
+    void set_num_disparities(int num_disparities);
+
+    // disp is PIX_FMT_DISP16 with the geometry of left/right.
+    int compute(const ImageView &left, const ImageView &right, const ImageView &disp,
+                const ImageView *confidence = NULL);
+
+    // Rows [y0, y1) only, the rest of disp is left as it is. The rows
+    // around are read as window context, so a strip with block_size / 2
+    // rows of context on both sides matches like the whole image.
+    int compute_rows(const ImageView &left, const ImageView &right, const ImageView &disp,
+                     int y0, int y1, const ImageView *confidence = NULL);
+
+    // Recomputes only tile x tile blocks flagged in dirty (row major,
+    // one byte per tile), the rest of disp is left as it is.
+    int compute_tiles(const ImageView &left, const ImageView &right, const ImageView &disp,
+                      const uint8_t *dirty, int tile, const ImageView *confidence = NULL);
+    int compute_tiles(const ImageView &left, const ImageView &right, const ImageView &disp,
+                      const TileJob &job);
+
+private:
+    struct Scratch
+    {
+        std::vector<uint16_t>   colsum;     // num_disparities x width
+        std::vector<uint16_t>   best;
+        std::vector<uint16_t>   second;
+        std::vector<int16_t>    best_d;
+        std::vector<uint16_t>   right_best; // per right image pixel
+        std::vector<int16_t>    right_d;
+    };
+
+    // disparities of [xa, xb) x [y0, y1) searched in [d0, d1), returns
+    // how many pixels matched on a narrowed edge of the range, pixels
+    // is how many were matched at all.
+    int compute_rect(Scratch &scratch, const ImageView &left, const ImageView &right,
+                     const ImageView &disp, const ImageView *confidence,
+                     int y0, int y1, int xa, int xb, int d0, int d1, int &pixels) const;
+
+private:
+    StereoConfig            m_config;
+    std::vector<Scratch>    m_scratch;  // one per parallel_for chunk
+};
+
+} // namespace robo
+
+#endif // __STEREO__H__
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "synthetic.h"
+
+#include <errno.h>
+#include <string.h>
+
+namespace robo {
+
+// pan range, px, even so the texture blocks stay put
+static const int g_pan = 64;
+
+// 2x2 px blocks so the texture survives half scale luma
+static void fill_texture(const ImageView &dst, uint32_t seed)
+{
+    uint32_t state = seed;
+    for (int y = 0; y < dst.height; y += 2) {
+        uint8_t *row = dst.row(y);
+        for (int x = 0; x < dst.width; x += 2) {
+            state = state * 1103515245u + 12345u;
+            row[x] = (uint8_t) (state >> 16);
+            if (x + 1 < dst.width)
+                row[x + 1] = row[x];
+        }
+        if (y + 1 < dst.height)
+            memcpy(dst.row(y + 1), row, dst.width);
+    }
+}
+
+SyntheticScene::SyntheticScene()
+    :
+    m_width(0),
+    m_height(0)
+{
+}
+
+int SyntheticScene::initialize(int width, int height)
+{
+    if (width < 2 || height < 2)
+        return EINVAL;
+    if (width == m_width && height == m_height)
+        return 0;
+
+    release();
+
+    const int w = width + g_pan;
+    const int tw = w + SYNTHETIC_NEAR_DISP;
+
+    // the wall and the box, in left view coordinates
+    Image wall;
+    Image box;
+    int res = wall.allocate(tw, height, PIX_FMT_GRAY8);
+    res = res || box.allocate(tw, height, PIX_FMT_GRAY8);
+    res = res || m_views[0].allocate(w, height, PIX_FMT_GRAY8);
+    res = res || m_views[1].allocate(w, height, PIX_FMT_GRAY8);
+    if (res) {
+        release();
+        return ENOMEM;
+    }
+
+    fill_texture(wall.view(), 1);
+    fill_texture(box.view(), 2);
+
+    const int box_x0 = w * 3 / 8;
+    const int box_x1 = w * 5 / 8;
+    const int box_y0 = height / 4;
+    const int box_y1 = height * 3 / 4;
+
+    for (int y = 0; y < height; ++y) {
+        const bool box_row = y >= box_y0 && y < box_y1;
+        const uint8_t *wall_row = wall.view().row(y);
+        const uint8_t *box_row_px = box.view().row(y);
+        uint8_t *left = m_views[0].view().row(y);
+        uint8_t *right = m_views[1].view().row(y);
+
+        for (int x = 0; x < w; ++x) {
+            const bool in_box = box_row && x >= box_x0 && x < box_x1;
+            left[x] = in_box ? box_row_px[x] : wall_row[x];
+
+            // the right camera sees left x + d, the box hides the wall
+            const int bx = x + SYNTHETIC_NEAR_DISP;
+            const bool sees_box = box_row && bx >= box_x0 && bx < box_x1;
+            right[x] = sees_box ? box_row_px[bx] : wall_row[x + SYNTHETIC_FAR_DISP];
+        }
+    }
+
+    m_width = width;
+    m_height = height;
+    return 0;
+}
+
+void SyntheticScene::release()
+{
+    m_views[0].release();
+    m_views[1].release();
+    m_width = 0;
+    m_height = 0;
+}
+
+int SyntheticScene::get_pan(uint32_t frame) const
+{
+    const int k = (int) ((frame * 2u) % (2 * g_pan));
+    return k < g_pan ? k : 2 * g_pan - k;
+}
+
+int SyntheticScene::render_gray(int camera, uint32_t frame, const ImageView &dst) const
+{
+    if (empty() || camera < 0 || camera > 1 || dst.format != PIX_FMT_GRAY8 ||
+        dst.width != m_width || dst.height != m_height)
+        return EINVAL;
+
+    const ImageView &view = m_views[camera].view();
+    const int pan = get_pan(frame);
+
+    for (int y = 0; y < m_height; ++y)
+        memcpy(dst.row(y), view.row(y) + pan, m_width);
+    return 0;
+}
+
+int SyntheticScene::render_yuyv(int camera, uint32_t frame, const ImageView &dst) const
+{
+    if (empty() || camera < 0 || camera > 1 || dst.format != PIX_FMT_YUYV ||
+        dst.width != m_width || dst.height != m_height)
+        return EINVAL;
+
+    const ImageView &view = m_views[camera].view();
+    const int pan = get_pan(frame);
+
+    // grey chroma
+    for (int y = 0; y < m_height; ++y) {
+        const uint8_t *src = view.row(y) + pan;
+        uint8_t *out = dst.row(y);
+        for (int x = 0; x < m_width; ++x) {
+            out[2 * x]      = src[x];
+            out[2 * x + 1]  = 128;
+        }
+    }
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __SYNTHETIC__H__
+#define __SYNTHETIC__H__
+
+#include "image.h"
+
+#include <stdint.h>
+
+namespace robo {
+
+// disparities (px) of the synthetic scene's wall and box
+const int SYNTHETIC_FAR_DISP  = 8;
+const int SYNTHETIC_NEAR_DISP = 24;
+
+// Stand-in for the camera pair when there is no hardware (tests,
+// benchmarks, CI): a random 2x2 px texture seen by two rectified
+// cameras, a wall at SYNTHETIC_FAR_DISP with a box in the middle at
+// SYNTHETIC_NEAR_DISP. The scene pans sideways a pixel pair per frame
+// and back, so consecutive frames differ like a slowly turning robot.
+//
+// initialize() allocates both views once, rendering a frame is a row
+// copy and allocates nothing.
+class SyntheticScene
+{
+public:
+    SyntheticScene();
+
+    int initialize(int width, int height);
+    void release();
+
+    bool empty() const { return m_views[0].empty(); }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // camera 0 is the left one, 1 the right one. dst has the scene size.
+    int render_gray(int camera, uint32_t frame, const ImageView &dst) const;
+    int render_yuyv(int camera, uint32_t frame, const ImageView &dst) const;
+
+private:
+    int get_pan(uint32_t frame) const;
+
+private:
+    Image   m_views[2];     // GRAY8, width plus the pan range
+    int     m_width;
+    int     m_height;
+};
+
+} // namespace robo
+
+#endif // __SYNTHETIC__H__
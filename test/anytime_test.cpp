@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "anytime.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+
+// 2 px blocks of texture so it survives the half scale, the top half 12
+// pixels away and the bottom 30
+static void make_pair(Image &left, Image &right)
+{
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+
+    srand(1);
+    for (int y = 0; y < H; y += 2) {
+        uint8_t *l = left.view().row(y);
+        for (int x = 0; x < W; x += 2)
+            l[x] = l[x + 1] = rand() & 255;
+        memcpy(left.view().row(y + 1), l, W);
+    }
+    for (int y = 0; y < H; ++y) {
+        const uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        const int shift = y < H / 2 ? 12 : 30;
+        for (int x = 0; x < W; ++x)
+            r[x] = x + shift < W ? l[x + shift] : 0;
+    }
+}
+
+static bool same_rows(const ImageView &a, const ImageView &b, int y0, int y1)
+{
+    for (int y = y0; y < y1; ++y) {
+        if (memcmp(a.row(y), b.row(y), a.row_bytes()))
+            return false;
+    }
+    return true;
+}
+
+static void test_scale()
+{
+    printf("test_scale\n");
+
+    Image src;
+    Image half;
+    assert(!src.allocate(5, 4, PIX_FMT_GRAY8));
+    assert(!half.allocate(2, 2, PIX_FMT_GRAY8));
+
+    for (int y = 0; y < 4; ++y)
+        for (int x = 0; x < 5; ++x)
+            src.view().row(y)[x] = (uint8_t) (10 * y + x);
+
+    assert(!half_scale(src.view(), half.view()));
+    assert(half.view().row(0)[0] == (0 + 1 + 10 + 11 + 2) / 4);
+    assert(half.view().row(1)[1] == (22 + 23 + 32 + 33 + 2) / 4);
+
+    Image wrong;
+    assert(!wrong.allocate(3, 2, PIX_FMT_GRAY8));
+    assert(half_scale(src.view(), wrong.view()) == EINVAL);
+
+    // disparity doubles, invalid stays, odd sizes repeat the last column
+    Image disp;
+    Image full;
+    assert(!disp.allocate(2, 2, PIX_FMT_DISP16));
+    assert(!full.allocate(5, 4, PIX_FMT_DISP16));
+    disp.view().row_as<int16_t>(0)[0] = 5 * DISP_SCALE;
+    disp.view().row_as<int16_t>(0)[1] = DISP_INVALID;
+    disp.view().row_as<int16_t>(1)[0] = 7;
+    disp.view().row_as<int16_t>(1)[1] = 9;
+
+    assert(!upscale_double(disp.view(), full.view()));
+    assert(full.view().row_as<int16_t>(1)[1] == 10 * DISP_SCALE);
+    assert(full.view().row_as<int16_t>(0)[3] == DISP_INVALID);
+    assert(full.view().row_as<int16_t>(3)[0] == 14);
+    assert(full.view().row_as<int16_t>(3)[4] == 18);
+}
+
+static void test_tiers()
+{
+    printf("test_tiers\n");
+
+    Image left;
+    Image right;
+    make_pair(left, right);
+
+    StereoConfig stereo;
+    get_default_stereo_config(stereo);
+
+    Image expected;
+    Image expected_conf;
+    assert(!expected.allocate(W, H, PIX_FMT_DISP16));
+    assert(!expected_conf.allocate(W, H, PIX_FMT_GRAY8));
+
+    BlockMatcher full(stereo);
+    assert(!full.compute(left.view(), right.view(), expected.view(), &expected_conf.view()));
+
+    AnytimeConfig config;
+    get_default_anytime_config(config);
+    AnytimeMatcher anytime(config, full);
+
+    Image disp;
+    Image conf;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    assert(!conf.allocate(W, H, PIX_FMT_GRAY8));
+
+    // no time at all, coarse only but close to the full map
+    uint64_t start = get_time_usec();
+    assert(!anytime.compute(left.view(), right.view(), disp.view(), conf.view(), 0));
+    const uint64_t coarse_usec = get_time_usec() - start;
+    assert(anytime.refined() == 0.0);
+
+    int valid = 0;
+    int close = 0;
+    for (int y = 0; y < H; ++y) {
+        const int16_t *d = disp.view().row_as<int16_t>(y);
+        const int16_t *e = expected.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            if (e[x] < 0)
+                continue;
+            ++valid;
+            close += d[x] >= 0 && abs(d[x] - e[x]) <= 2 * DISP_SCALE;
+        }
+    }
+    assert(valid > W * H / 2);
+    assert(close > valid * 8 / 10);
+
+    // all the time it takes, the full map
+    start = get_time_usec();
+    assert(!anytime.compute(left.view(), right.view(), disp.view(), conf.view(), ~(uint64_t) 0));
+    const uint64_t full_usec = get_time_usec() - start;
+    assert(anytime.refined() == 1.0);
+    assert(same_rows(disp.view(), expected.view(), 0, H));
+    assert(same_rows(conf.view(), expected_conf.view(), 0, H));
+
+    // some of it, whatever got refined is the full map's
+    assert(!anytime.compute(left.view(), right.view(), disp.view(), conf.view(),
+                            get_time_usec() + anytime.coarse_usec() + anytime.row_usec() * H / 2));
+    const int refined = (int) (anytime.refined() * H + 0.5);
+    assert(same_rows(disp.view(), expected.view(), H - refined, H));
+
+    printf("coarse %llu usec full %llu usec, half the time refines %d of %d rows\n",
+        (unsigned long long) coarse_usec, (unsigned long long) full_usec, refined, H);
+
+    // a narrowed range narrows the coarse tier too
+    assert(anytime.coarse_config().num_disparities == stereo.num_disparities / 2);
+    full.set_num_disparities(stereo.num_disparities / 2);
+    anytime.set_num_disparities(stereo.num_disparities / 2);
+    assert(anytime.coarse_config().num_disparities == stereo.num_disparities / 4);
+    assert(!anytime.compute(left.view(), right.view(), disp.view(), conf.view(), 0));
+}
+
+int main()
+{
+    test_scale();
+    test_tiers();
+
+    printf("anytime_test OK\n");
+    return 0;
+}
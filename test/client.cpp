@@ -5,6 +5,7 @@
  */
 #include "client.h"
 #include "common.h"
+#include "net.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -61,6 +62,14 @@ fail:
     return rc ? rc : EFAULT;
 }
 
+int Client::initialize_tcp(const char *host, int port)
+{
+    if (m_server_fd != -1)
+        return EINVAL;
+
+    return tcp_connect(host, port, 2000, m_server_fd);
+}
+
 void Client::shutdown()
 {
     if (m_server_fd != -1)
@@ -68,18 +77,22 @@ void Client::shutdown()
     m_server_fd = -1;
 }
 
-int Client::get_response(proto::Response &response)
+int Client::set_timeout(int msec)
 {
     if (m_server_fd == -1)
         return ENOTCONN;
 
-    // WARNING: not even memcpy here, we direcly pass response addr to kernel
-    char *buf = (char *) &response;
+    return set_recv_timeout(m_server_fd, msec);
+}
+
+int Client::recv_all(void *buf, size_t len)
+{
+    char *ptr = (char *) buf;
     size_t idx = 0;
 
-    while (idx < sizeof(buf)) {
+    while (idx < len) {
 
-        ssize_t rc = HANDLE_EINTR(::recv(m_server_fd, buf + idx, sizeof(response) - idx, 0));
+        ssize_t rc = HANDLE_EINTR(::recv(m_server_fd, ptr + idx, len - idx, 0));
         if (rc <= 0) {
             if (rc < 0) {
                 rc = errno;
@@ -94,6 +107,36 @@ int Client::get_response(proto::Response &response)
     return 0;
 }
 
+int Client::get_response(proto::Response &response, void *payload, size_t capacity)
+{
+    if (m_server_fd == -1)
+        return ENOTCONN;
+
+    // WARNING: not even memcpy here, we direcly pass response addr to kernel
+    int rc = recv_all(&response, sizeof(response));
+    if (rc)
+        return rc;
+
+    if (!response.payload_size)
+        return 0;
+
+    if (payload && response.payload_size <= capacity)
+        return recv_all(payload, response.payload_size);
+
+    char scratch[4096];
+    size_t left = response.payload_size;
+
+    while (left) {
+        const size_t len = left < sizeof(scratch) ? left : sizeof(scratch);
+        rc = recv_all(scratch, len);
+        if (rc)
+            return rc;
+        left -= len;
+    }
+
+    return ENOBUFS;
+}
+
 int Client::send_request(const proto::Request &request)
 {
     if (m_server_fd == -1)
@@ -103,7 +146,7 @@ int Client::send_request(const proto::Request &request)
     const char *buf = (const char *) &request;
     size_t idx = 0;
 
-    while (idx < sizeof(buf)) {
+    while (idx < sizeof(request)) {
         ssize_t rc = HANDLE_EINTR(::send(m_server_fd, buf + idx, sizeof(request) - idx, 0));
         if (rc < 0) {
             rc = errno;
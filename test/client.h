@@ -8,6 +8,8 @@
 
 #include <proto.h>
 
+#include <stddef.h>
+
 namespace robo {
 
 // Simple test client
@@ -18,10 +20,20 @@ class Client
         ~Client();
 
         int initialize(const char *uds_path);
+        int initialize_tcp(const char *host, int port);
         void shutdown();
 
+        // get_response() fails with EAGAIN after msec without data, 0
+        // blocks forever
+        int set_timeout(int msec);
+
         int send_request(const proto::Request &request);
-        int get_response(proto::Response &response);
+        // response payload is copied into payload when it fits in
+        // capacity, otherwise it is drained and ENOBUFS returned.
+        int get_response(proto::Response &response, void *payload = NULL, size_t capacity = 0);
+
+    private:
+        int recv_all(void *buf, size_t len);
 
     private:
         int             m_server_fd;
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "codec.h"
+#include "stereo.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <vector>
+
+using namespace robo;
+
+static const int W = 640;
+static const int H = 480;
+
+// payload as the client receives it
+static void flatten(const struct iovec *iov, int count, std::vector<uint8_t> &out)
+{
+    out.clear();
+    for (int i = 0; i < count; ++i) {
+        const uint8_t *p = (const uint8_t *) iov[i].iov_base;
+        out.insert(out.end(), p, p + iov[i].iov_len);
+    }
+}
+
+static bool same_rows(const ImageView &a, const ImageView &b)
+{
+    if (!a.same_size(b))
+        return false;
+    for (int y = 0; y < a.height; ++y) {
+        if (memcmp(a.row(y), b.row(y), a.row_bytes()))
+            return false;
+    }
+    return true;
+}
+
+static void round_trip(const ImageView &disp, size_t *encoded = NULL)
+{
+    DisparityEncoder encoder;
+    struct iovec iov[3];
+    const int count = encoder.encode(disp, iov);
+    assert(count == 3);
+
+    std::vector<uint8_t> payload;
+    flatten(iov, count, payload);
+    assert(payload.size() == encoder.size());
+
+    Image decoded;
+    assert(!decode_disparity(&payload[0], payload.size(), decoded));
+    assert(same_rows(decoded.view(), disp));
+
+    if (encoded)
+        *encoded = payload.size();
+}
+
+// A floor plane, two boxes, the left border band and speckle holes
+// invalid, and +-1/16 px subpixel noise.
+static void make_scene(Image &disp)
+{
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+
+    srand(3);
+    for (int y = 0; y < H; ++y) {
+        int16_t *d = disp.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            int v = y > H / 2 ? 16 * (y - H / 2) / 4 + 64 : 64;
+            if (x > 100 && x < 250 && y > 150 && y < 350)
+                v = 40 * DISP_SCALE;
+            if (x > 400 && x < 500 && y > 100 && y < 300)
+                v = 25 * DISP_SCALE + (x - 400) / 8;
+            v += rand() % 3 - 1;
+            d[x] = (int16_t) v;
+
+            if (x < 68 || (rand() % 200) == 0)
+                d[x] = DISP_INVALID;
+        }
+    }
+}
+
+static void test_round_trip()
+{
+    printf("test_round_trip\n");
+
+    Image disp;
+    make_scene(disp);
+    round_trip(disp.view());
+
+    // all invalid, all equal, odd widths, values needing every token size
+    const int widths[] = { 1, 7, 8, 9, 333 };
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); ++i) {
+        Image img;
+        assert(!img.allocate(widths[i], 5, PIX_FMT_DISP16));
+
+        for (int y = 0; y < 5; ++y)
+            for (int x = 0; x < widths[i]; ++x)
+                img.view().row_as<int16_t>(y)[x] = DISP_INVALID;
+        round_trip(img.view());
+
+        for (int y = 0; y < 5; ++y)
+            for (int x = 0; x < widths[i]; ++x)
+                img.view().row_as<int16_t>(y)[x] = 100;
+        round_trip(img.view());
+
+        for (int y = 0; y < 5; ++y)
+            for (int x = 0; x < widths[i]; ++x)
+                img.view().row_as<int16_t>(y)[x] = (int16_t) ((x * 7919 + y * 104729) & 0x7fff);
+        round_trip(img.view());
+    }
+}
+
+static void test_malformed()
+{
+    printf("test_malformed\n");
+
+    Image disp;
+    make_scene(disp);
+
+    DisparityEncoder encoder;
+    struct iovec iov[3];
+    std::vector<uint8_t> payload;
+    flatten(iov, encoder.encode(disp.view(), iov), payload);
+
+    Image decoded;
+    assert(decode_disparity(&payload[0], 4, decoded) == EPROTO);
+    assert(decode_disparity(&payload[0], payload.size() - 1, decoded) == EPROTO);
+
+    // values cut short but the sizes agreeing
+    proto::EncodedDisparity header;
+    memcpy(&header, &payload[0], sizeof(header));
+    header.value_size -= 16;
+    memcpy(&payload[0], &header, sizeof(header));
+    assert(decode_disparity(&payload[0], payload.size() - 16, decoded) == EPROTO);
+
+    Image gray;
+    assert(!gray.allocate(8, 8, PIX_FMT_GRAY8));
+    assert(encoder.encode(gray.view(), iov) == 0);
+}
+
+// ratio and throughput on a synthetic scene and a matcher output
+static void test_benchmark()
+{
+    printf("test_benchmark\n");
+
+    Image scene;
+    make_scene(scene);
+
+    Image left;
+    Image right;
+    Image matched;
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!matched.allocate(W, H, PIX_FMT_DISP16));
+
+    // 4 px blocks of texture, the lower half closer
+    srand(1);
+    for (int y = 0; y < H; ++y) {
+        uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        for (int x = 0; x < W; ++x)
+            l[x] = (uint8_t) ((x / 4 * 2654435761u ^ y / 4 * 40503u) >> 8);
+        const int shift = y < H / 2 ? 10 : 20;
+        for (int x = 0; x < W; ++x)
+            r[x] = x + shift < W ? l[x + shift] : 0;
+    }
+
+    StereoConfig config;
+    get_default_stereo_config(config);
+    BlockMatcher matcher(config);
+    assert(!matcher.compute(left.view(), right.view(), matched.view()));
+
+    const Image *maps[2] = { &scene, &matched };
+    const char *names[2] = { "scene", "matched" };
+    const int runs = 20;
+
+    for (int i = 0; i < 2; ++i) {
+        const ImageView &disp = maps[i]->view();
+        const double raw = (double) disp.row_bytes() * disp.height;
+
+        size_t size = 0;
+        round_trip(disp, &size);
+
+        DisparityEncoder encoder;
+        struct iovec iov[3];
+        std::vector<uint8_t> payload;
+
+        uint64_t start = get_time_usec();
+        for (int k = 0; k < runs; ++k)
+            flatten(iov, encoder.encode(disp, iov), payload);
+        const uint64_t encode_usec = (get_time_usec() - start) / runs;
+
+        Image decoded;
+        start = get_time_usec();
+        for (int k = 0; k < runs; ++k)
+            assert(!decode_disparity(&payload[0], payload.size(), decoded));
+        const uint64_t decode_usec = (get_time_usec() - start) / runs;
+
+        printf("%s %.1fx (%zu of %.0f bytes) encode %.0f MB/s decode %.0f MB/s\n",
+            names[i], raw / size, size, raw,
+            raw / (encode_usec ? encode_usec : 1), raw / (decode_usec ? decode_usec : 1));
+
+        // a 15 fps VGA map must fit a WiFi link with room to spare
+        assert(raw / size > 3.0);
+    }
+}
+
+int main()
+{
+    test_round_trip();
+    test_malformed();
+    test_benchmark();
+
+    printf("codec_test OK\n");
+    return 0;
+}
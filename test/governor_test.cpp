@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "governor.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace robo;
+
+static const double INTERVAL = 66666.0;     // 15 fps
+static const uint64_t FRAME = 66666;
+
+static void get_test_config(GovernorConfig &config)
+{
+    get_default_governor_config(config);
+    config.thermal_path         = NULL;
+    config.thermal_period_msec  = 0;
+    config.down_frames          = 3;
+    config.up_frames            = 5;
+    config.settle_frames        = 2;
+}
+
+// feeds frames taking busy usec until the level changes, returns how many
+static int run_until_change(Governor &governor, uint64_t &now, uint64_t busy, int queued, int max_frames)
+{
+    for (int i = 1; i <= max_frames; ++i) {
+        now += FRAME;
+        if (governor.update(now, busy, INTERVAL, queued))
+            return i;
+    }
+    return 0;
+}
+
+static void test_steps()
+{
+    printf("test_steps\n");
+
+    // the range only follows the luma, the nearest depth is kept
+    for (int i = 0; i < get_governor_levels(); ++i) {
+        const GovernorStep &step = get_governor_step(i);
+        assert(step.range_percent * step.luma_scale == 100);
+    }
+
+    // every level is cheaper than the one before
+    for (int i = 1; i < get_governor_levels(); ++i) {
+        const GovernorStep &a = get_governor_step(i - 1);
+        const GovernorStep &b = get_governor_step(i);
+        assert(b.luma_scale >= a.luma_scale && b.range_percent <= a.range_percent);
+        assert(b.process_every >= a.process_every && (b.coarse || !a.coarse));
+        assert(memcmp(&a, &b, sizeof(a)));
+    }
+}
+
+static void test_load()
+{
+    printf("test_load\n");
+
+    GovernorConfig config;
+    get_test_config(config);
+    Governor governor(config);
+    uint64_t now = 0;
+
+    // a single slow frame is not enough, down_frames in a row are
+    assert(!governor.update(now += FRAME, 2 * FRAME, INTERVAL, 0));
+    assert(!governor.update(now += FRAME, FRAME / 2, INTERVAL, 0));
+    assert(run_until_change(governor, now, 2 * FRAME, 0, 10) == 3);
+    assert(governor.level() == 1 && governor.m_changes == 1);
+    assert(governor.load() > 1.9);
+
+    // settles before the next step down
+    assert(run_until_change(governor, now, 2 * FRAME, 0, 10) == 3);
+    assert(governor.level() == 2);
+
+    // in between loads hold the level
+    assert(!run_until_change(governor, now, FRAME * 3 / 4, 0, 100));
+    assert(governor.level() == 2);
+
+    // level 1 was measured too slow, headroom alone does not bring it back
+    assert(!run_until_change(governor, now, FRAME / 4, 0, 100));
+    assert(governor.level() == 2);
+
+    // until retry_usec passed
+    now += config.retry_usec;
+    assert(run_until_change(governor, now, FRAME / 4, 0, 10) == 1);
+    assert(governor.level() == 1);
+
+    // a queue building up steps down even with fast frames
+    assert(run_until_change(governor, now, FRAME / 4, 3, 10) == 3);
+    assert(governor.level() == 2);
+
+    // a step the caller could not apply goes back, then settles
+    const uint64_t changes = governor.m_changes;
+    governor.revert(1);
+    assert(governor.level() == 1 && governor.m_changes == changes + 1);
+    assert(!governor.update(now += FRAME, 2 * FRAME, INTERVAL, 0));
+    governor.revert(1);
+    assert(governor.m_changes == changes + 1);
+}
+
+static void test_skip()
+{
+    printf("test_skip\n");
+
+    GovernorConfig config;
+    get_test_config(config);
+    Governor governor(config);
+    uint64_t now = 0;
+
+    while (get_governor_step(governor.level()).process_every == 1)
+        assert(run_until_change(governor, now, 10 * FRAME, 0, 10));
+    assert(get_governor_step(governor.level()).process_every == 2);
+
+    // every other request, the first after a change is processed
+    assert(governor.process_next());
+    assert(!governor.process_next());
+    assert(governor.process_next());
+    assert(!governor.process_next());
+    assert(governor.m_skipped == 2);
+
+    // the processed frame has two intervals
+    governor.update(now += FRAME, FRAME * 3 / 2, INTERVAL, 0);
+    assert(governor.load() < 0.8);
+
+    // never below the last level
+    while (governor.level() + 1 < get_governor_levels())
+        assert(run_until_change(governor, now, 10 * FRAME, 0, 10));
+    assert(!run_until_change(governor, now, 10 * FRAME, 0, 20));
+}
+
+static void write_temperature(const char *path, int mdeg)
+{
+    FILE *fp = fopen(path, "w");
+    assert(fp);
+    fprintf(fp, "%d\n", mdeg);
+    fclose(fp);
+}
+
+static void test_thermal()
+{
+    printf("test_thermal\n");
+
+    char path[] = "/tmp/governor_test.XXXXXX";
+    const int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    GovernorConfig config;
+    get_test_config(config);
+    config.thermal_path = path;
+    Governor governor(config);
+    uint64_t now = 0;
+
+    // hot throttles with plenty of time per frame
+    write_temperature(path, 80000);
+    assert(run_until_change(governor, now, FRAME / 10, 0, 10) == 3);
+    assert(governor.level() == 1 && governor.temperature_mdeg() == 80000);
+
+    // between cool and hot holds, below cool steps back up
+    write_temperature(path, 72000);
+    assert(!run_until_change(governor, now, FRAME / 10, 0, 50));
+    write_temperature(path, 60000);
+    assert(run_until_change(governor, now, FRAME / 10, 0, 10));
+    assert(governor.level() == 0);
+
+    // unreadable reads as unknown, load alone decides
+    FILE *fp = fopen(path, "w");
+    assert(fp);
+    fputs("n/a\n", fp);
+    fclose(fp);
+    assert(!run_until_change(governor, now, FRAME / 10, 0, 20));
+    assert(governor.temperature_mdeg() == 0);
+
+    // so does a zone that is not there, until it shows up
+    unlink(path);
+    Governor missing(config);
+    assert(!run_until_change(missing, now, FRAME / 10, 0, 20));
+    assert(missing.temperature_mdeg() == 0);
+    write_temperature(path, 80000);
+    assert(run_until_change(missing, now, FRAME / 10, 0, 10));
+    assert(missing.level() == 1 && missing.temperature_mdeg() == 80000);
+    unlink(path);
+}
+
+int main()
+{
+    test_steps();
+    test_load();
+    test_skip();
+    test_thermal();
+
+    printf("governor_test OK\n");
+    return 0;
+}
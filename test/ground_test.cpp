@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "ground.h"
+#include "reproject.h"
+#include "stereo.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const double BASELINE = 100.0;
+
+// floor seen by a camera height mm up, pitched down by pitch_deg, and a
+// box in front of it.
+static void make_scene(const StereoCalibration &calib, float height, float pitch_deg,
+                       Plane &floor, Image &disp)
+{
+    const float pitch = pitch_deg * (float) M_PI / 180.0f;
+
+    // up in camera coordinates once the camera looks down
+    floor.n[0] = 0.0f;
+    floor.n[1] = -cosf(pitch);
+    floor.n[2] = -sinf(pitch);
+    floor.d = height;
+
+    const double focal = calib.Q[11];
+    const double cx = -calib.Q[3];
+    const double cy = -calib.Q[7];
+
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+
+    for (int y = 0; y < H; ++y) {
+        int16_t *d = disp.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            d[x] = DISP_INVALID;
+
+            // P = t * r hits the floor at t = -d / (n . r)
+            const double r[3] = { x - cx, y - cy, focal };
+            const double nr = floor.n[0] * r[0] + floor.n[1] * r[1] + floor.n[2] * r[2];
+            if (nr < 0.0) {
+                const double z = -floor.d / nr * focal;
+                const double disparity = focal * BASELINE / z;
+                if (disparity >= 1.0)
+                    d[x] = (int16_t) lrint(disparity * DISP_SCALE);
+            }
+
+            if (x >= 140 && x < 180 && y >= 60 && y < 120)
+                d[x] = 40 * DISP_SCALE;
+        }
+    }
+}
+
+static void test_fit(float height, float pitch_deg, GroundPlane &ground)
+{
+    printf("test_fit height=%.0f pitch=%.0f\n", height, pitch_deg);
+
+    StereoCalibration calib;
+    get_default_calibration(W, H, BASELINE, calib);
+
+    Plane truth;
+    Image disp;
+    make_scene(calib, height, pitch_deg, truth, disp);
+
+    Reprojector points;
+    assert(!points.reproject(disp.view(), calib));
+    const uint32_t total = points.count();
+
+    assert(!ground.fit(points));
+    assert(ground.valid());
+
+    const Plane &plane = ground.plane();
+    const float dot = plane.n[0] * truth.n[0] + plane.n[1] * truth.n[1] + plane.n[2] * truth.n[2];
+    assert(dot > cosf(1.0f * (float) M_PI / 180.0f));
+    assert(fabsf(plane.d - truth.d) < 10.0f);
+
+    // box is 40 x 60 pixels and clearly above the floor, all of it stays
+    GroundConfig config;
+    get_default_ground_config(config);
+
+    const uint32_t removed = points.remove_below(plane, config.floor_mm);
+    assert(points.count() == total - removed);
+    assert(points.count() >= 40 * 60 && points.count() < 40 * 60 + 200);
+
+    // mask agrees with the compacted cloud
+    uint32_t bits = 0;
+    for (int y = 0; y < H; ++y)
+        for (int x = 0; x < W; ++x)
+            bits += (points.mask()[y * points.mask_stride() + (x >> 3)] >> (x & 7)) & 1;
+    assert(bits == points.count());
+}
+
+int main()
+{
+    GroundConfig config;
+    get_default_ground_config(config);
+
+    GroundPlane ground(config);
+
+    test_fit(200.0f, 0.0f, ground);
+    assert(ground.iterations() == config.max_iterations);
+
+    // seeded from the last frame, only a few rounds
+    test_fit(205.0f, 1.0f, ground);
+    assert(ground.iterations() == config.seeded_iterations);
+
+    ground.reset();
+    test_fit(300.0f, 20.0f, ground);
+    assert(ground.iterations() == config.max_iterations);
+
+    printf("ground_test OK\n");
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "jpeg.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+using namespace robo;
+
+static const int W = 640;
+static const int H = 480;
+
+// Encodes a synthetic YCbCr 4:2:2 frame the way a UVC camera would.
+static size_t encode_frame(unsigned char **out)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned long size = 0;
+    *out = NULL;
+    jpeg_mem_dest(&cinfo, out, &size);
+
+    cinfo.image_width = W;
+    cinfo.image_height = H;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 90, TRUE);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    unsigned char row[W * 3];
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const int y = cinfo.next_scanline;
+        for (int x = 0; x < W; ++x) {
+            row[3 * x + 0] = (x * 255) / W;
+            row[3 * x + 1] = (y * 255) / H;
+            row[3 * x + 2] = ((x / 40 + y / 40) & 1) ? 200 : 30;
+        }
+        JSAMPROW ptr = row;
+        jpeg_write_scanlines(&cinfo, &ptr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return size;
+}
+
+// Drops DHT segments, UVC MJPEG frames come without them.
+static size_t strip_dht(unsigned char *data, size_t size)
+{
+    size_t in = 2;
+    size_t out = 2;
+
+    while (in + 4 <= size && data[in] == 0xff && data[in + 1] != 0xda) {
+        const size_t len = 2 + ((data[in + 2] << 8) | data[in + 3]);
+        if (data[in + 1] != 0xc4) {
+            memmove(data + out, data + in, len);
+            out += len;
+        }
+        in += len;
+    }
+
+    memmove(data + out, data + in, size - in);
+    return out + size - in;
+}
+
+static void test_luma(const unsigned char *data, size_t size, int scale, Image &reference)
+{
+    int sw = 0;
+    int sh = 0;
+    JpegDecoder::get_scaled_size(W, H, scale, sw, sh);
+
+    Image luma;
+    assert(!luma.allocate(sw, sh, PIX_FMT_GRAY8));
+
+    JpegDecoder decoder;
+    assert(!decoder.initialize());
+    assert(!decoder.decode_luma(data, size, scale, luma.view()));
+
+    if (reference.empty()) {
+        assert(!reference.allocate(sw, sh, PIX_FMT_GRAY8));
+        for (int y = 0; y < sh; ++y)
+            memcpy(reference.view().row(y), luma.view().row(y), sw);
+        return;
+    }
+
+    for (int y = 0; y < sh; ++y)
+        assert(!memcmp(reference.view().row(y), luma.view().row(y), sw));
+}
+
+int main()
+{
+    unsigned char *data = NULL;
+    size_t size = encode_frame(&data);
+
+    Image refs[3];
+    const int scales[3] = { 1, 2, 4 };
+
+    for (int i = 0; i < 3; ++i) {
+        printf("test_luma 1/%d\n", scales[i]);
+        test_luma(data, size, scales[i], refs[i]);
+    }
+
+    size_t stripped = strip_dht(data, size);
+    assert(stripped < size);
+
+    for (int i = 0; i < 3; ++i) {
+        printf("test_luma 1/%d without DHT\n", scales[i]);
+        test_luma(data, stripped, scales[i], refs[i]);
+    }
+
+    // wrong geometry and garbage are errors, not crashes
+    Image small;
+    assert(!small.allocate(W / 2, H / 2, PIX_FMT_GRAY8));
+    JpegDecoder decoder;
+    assert(!decoder.initialize());
+    assert(decoder.decode_luma(data, stripped, 1, small.view()));
+    decoder.decode_luma(data, stripped / 2, 2, small.view()); // truncated, must not crash
+    data[0] = 0; // no SOI
+    assert(decoder.decode_luma(data, stripped, 2, small.view()));
+
+    free(data);
+    printf("jpeg_test OK\n");
+    return 0;
+}
@@ -0,0 +1,689 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "client.h"
+#include "server.h"
+#include "stats.h"
+#include "common.h"
+#include "net.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace robo;
+
+// Load generator for the vision module, run it against
+// `vision_module.out -S` on any box.
+//
+// Every connection has a sender and a receiver thread. The sender
+// follows a fixed schedule, request k of a connection is due at
+// start + k * connections / rate, and keeps up to depth requests in
+// flight. Latency is measured from the due time, not from the actual
+// send: when the server stalls and the pipeline is full, every request
+// that should have gone out meanwhile carries the stall, as it would for
+// a real client with a fixed rate (no coordinated omission). The time
+// from the actual send is reported as service time, the difference of
+// the two is what a closed loop benchmark would have hidden.
+//
+// The run ends on time however far behind the sender is. Requests that
+// were due but never sent are counted as unsent and go into the latency
+// with the time they waited so far, a lower bound.
+//
+// Rate 0 is closed loop: a request is sent whenever the pipeline has
+// room and both times are the same.
+//
+// One more connection takes CMD_STATS at the start and the end of the
+// measured window, for the server's frame rate, CPU per frame and peak
+// RSS. -o writes the results as key=value lines (tools/bench_e2e.sh).
+
+// these should goto config.json/yaml
+const char *UDS_PATH = "/tmp/robo.vision.s";
+
+enum {
+    MIX_PING,
+    MIX_MAP,
+    MIX_STATS,
+    MIX_MAX,
+};
+
+static const char *MIX_NAMES[MIX_MAX] = { "ping", "map", "stats" };
+static const uint32_t MIX_CMDS[MIX_MAX] = { proto::CMD_PING, proto::CMD_GET_MAP, proto::CMD_STATS };
+
+static const size_t PAYLOAD_BYTES = 4 << 20;
+
+struct LoadConfig
+{
+    const char  *endpoint;          // host:port, NULL for uds_path
+    const char  *uds_path;
+    int         connections;
+    int         depth;              // requests in flight per connection
+    double      rate;               // requests/sec over all connections, 0 closed loop
+    double      duration;           // sec, measured
+    double      warmup;             // sec before it, not measured
+    int         mix[MIX_MAX];       // weights
+    uint32_t    payload;            // proto::PAYLOAD_* of CMD_GET_MAP
+    uint32_t    stereo_mode;
+    uint32_t    deadline_usec;
+    int         timeout_msec;       // response timeout, a connection fails after it
+    bool        exit;               // CMD_EXIT the server at the end
+    const char  *results_path;      // key=value results, NULL none
+};
+
+static void get_default_load_config(LoadConfig &config)
+{
+    memset(&config, 0, sizeof(config));
+    config.connections      = 1;
+    config.depth            = 1;
+    config.rate             = 0;
+    config.duration         = 10;
+    config.warmup           = 1;
+    config.mix[MIX_PING]    = 1;
+    config.mix[MIX_MAP]     = 8;
+    config.mix[MIX_STATS]   = 1;
+    config.payload          = proto::PAYLOAD_SCAN;
+    config.stereo_mode      = proto::STEREO_DENSE;
+    config.timeout_msec     = 5000;
+    config.uds_path         = UDS_PATH;
+}
+
+struct Pending
+{
+    uint32_t    trx_id;
+    int         kind;               // MIX_*
+    uint64_t    due_usec;
+    uint64_t    sent_usec;
+};
+
+struct Connection
+{
+    Client                  client;
+    const LoadConfig        *config;
+    int                     index;
+    uint64_t                start_usec;
+    uint64_t                measure_usec;
+    uint64_t                end_usec;
+
+    std::mutex              lock;
+    std::condition_variable cond;
+    std::vector<Pending>    pending;        // ring of depth
+    int                     head;
+    int                     count;
+    bool                    sending_done;
+    bool                    failed;
+
+    // sender only
+    Histogram               unsent[MIX_MAX];    // due to the end, lower bound
+    uint64_t                sent;
+    uint64_t                send_errors;
+    uint64_t                late_max_usec;  // furthest behind the schedule
+
+    // receiver only
+    Histogram               latency[MIX_MAX];   // due to response
+    Histogram               service[MIX_MAX];   // sent to response
+    uint64_t                received;
+    uint64_t                measured;
+    uint64_t                recv_errors;
+    uint64_t                timeouts;
+    uint64_t                mismatches;
+    uint64_t                lost;           // in flight when it failed
+    uint64_t                quality[4];     // CMD_GET_MAP by proto::QUALITY_*
+    std::vector<char>       buffer;
+};
+
+static void reset_connection(Connection &conn, const LoadConfig &config, int index)
+{
+    conn.config         = &config;
+    conn.index          = index;
+    conn.pending.resize(config.depth);
+    conn.head           = 0;
+    conn.count          = 0;
+    conn.sending_done   = false;
+    conn.failed         = false;
+    conn.sent           = 0;
+    conn.send_errors    = 0;
+    conn.late_max_usec  = 0;
+    conn.received       = 0;
+    conn.measured       = 0;
+    conn.recv_errors    = 0;
+    conn.timeouts       = 0;
+    conn.mismatches     = 0;
+    conn.lost           = 0;
+    memset(conn.quality, 0, sizeof(conn.quality));
+    conn.buffer.resize(PAYLOAD_BYTES);
+}
+
+static void sleep_until(uint64_t usec)
+{
+    struct timespec ts;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// Smooth weighted round robin, the mix is spread evenly instead of
+// coming in runs of the same command.
+static int next_kind(const LoadConfig &config, int current[MIX_MAX])
+{
+    int total = 0;
+    int best = -1;
+    for (int i = 0; i < MIX_MAX; ++i) {
+        current[i] += config.mix[i];
+        total += config.mix[i];
+        if (config.mix[i] && (best == -1 || current[i] > current[best]))
+            best = i;
+    }
+    current[best] -= total;
+    return best;
+}
+
+static void run_sender(Connection &conn)
+{
+    const LoadConfig &config = *conn.config;
+
+    // connections are staggered over one interval
+    const double interval = config.rate > 0 ? 1e6 * config.connections / config.rate : 0;
+    const uint64_t offset = (uint64_t) (interval * conn.index / config.connections);
+
+    int current[MIX_MAX] = { 0 };
+
+    proto::Request request;
+    memset(&request, 0, sizeof(request));
+    request.payload         = config.payload;
+    request.stereo_mode     = config.stereo_mode;
+    request.deadline_usec   = config.deadline_usec;
+
+    for (uint64_t k = 0; ; ++k) {
+
+        uint64_t due = conn.start_usec + offset + (uint64_t) (interval * k);
+        if (due >= conn.end_usec)
+            break;
+        if (interval)
+            sleep_until(due);
+
+        {
+            std::unique_lock<std::mutex> guard(conn.lock);
+            conn.cond.wait(guard, [&conn, &config] { return conn.count < config.depth || conn.failed; });
+            if (conn.failed)
+                break;
+        }
+
+        const uint64_t now = get_time_usec();
+        if (!interval)
+            due = now;
+
+        if (now >= conn.end_usec) {
+            // the rest of the schedule, never sent
+            while (interval && due < conn.end_usec) {
+                const int kind = next_kind(config, current);
+                if (due >= conn.measure_usec)
+                    conn.unsent[kind].record(conn.end_usec - due);
+                due = conn.start_usec + offset + (uint64_t) (interval * ++k);
+            }
+            break;
+        }
+        if (now - due > conn.late_max_usec)
+            conn.late_max_usec = now - due;
+
+        Pending item;
+        item.trx_id     = (uint32_t) k + 1;
+        item.kind       = next_kind(config, current);
+        item.due_usec   = due;
+        item.sent_usec  = now;
+
+        request.trx_id  = item.trx_id;
+        request.cmd     = MIX_CMDS[item.kind];
+
+        {
+            std::lock_guard<std::mutex> guard(conn.lock);
+            conn.pending[(conn.head + conn.count) % config.depth] = item;
+            ++conn.count;
+        }
+        conn.cond.notify_all();
+
+        const int rc = conn.client.send_request(request);
+        if (rc) {
+            fprintf(stderr, "connection %d send failed %d %s\n", conn.index, rc, strerror(rc));
+            ++conn.send_errors;
+            break;
+        }
+        ++conn.sent;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(conn.lock);
+        conn.sending_done = true;
+    }
+    conn.cond.notify_all();
+}
+
+static void run_receiver(Connection &conn)
+{
+    const LoadConfig &config = *conn.config;
+
+    for (;;) {
+
+        Pending item;
+        {
+            std::unique_lock<std::mutex> guard(conn.lock);
+            conn.cond.wait(guard, [&conn] { return conn.count || conn.sending_done; });
+            if (!conn.count)
+                break;
+            item = conn.pending[conn.head];
+        }
+
+        proto::Response response;
+        int rc = conn.client.get_response(response, conn.buffer.data(), conn.buffer.size());
+        const uint64_t now = get_time_usec();
+
+        // drained, only the copy did not fit
+        if (rc == ENOBUFS)
+            rc = 0;
+
+        if (rc) {
+            if (rc == EAGAIN || rc == EWOULDBLOCK)
+                ++conn.timeouts;
+            else
+                ++conn.recv_errors;
+            fprintf(stderr, "connection %d receive failed %d %s\n", conn.index, rc, strerror(rc));
+
+            std::lock_guard<std::mutex> guard(conn.lock);
+            conn.lost = conn.count;
+            conn.failed = true;
+            break;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(conn.lock);
+            conn.head = (conn.head + 1) % config.depth;
+            --conn.count;
+        }
+        conn.cond.notify_all();
+
+        ++conn.received;
+        if (response.trx_id != item.trx_id || response.cmd != MIX_CMDS[item.kind]) {
+            ++conn.mismatches;
+            continue;
+        }
+
+        if (item.due_usec < conn.measure_usec)
+            continue;
+
+        ++conn.measured;
+        conn.latency[item.kind].record(now - item.due_usec);
+        conn.service[item.kind].record(now - item.sent_usec);
+        if (item.kind == MIX_MAP && response.quality < 4)
+            ++conn.quality[response.quality];
+    }
+
+    conn.cond.notify_all();
+}
+
+static int connect_client(Client &client, const LoadConfig &config)
+{
+    int rc = 0;
+    if (config.endpoint) {
+        char host[256];
+        int port = 0;
+        rc = parse_endpoint(config.endpoint, host, sizeof(host), port);
+        rc = rc ? rc : client.initialize_tcp(host, port);
+    }
+    else {
+        rc = client.initialize(config.uds_path);
+    }
+    return rc ? rc : client.set_timeout(config.timeout_msec);
+}
+
+// "ping:1,map:8,stats:1", missing ones are 0
+static int parse_mix(const char *str, int mix[MIX_MAX])
+{
+    memset(mix, 0, sizeof(int) * MIX_MAX);
+
+    int total = 0;
+    while (*str) {
+        const char *colon = strchr(str, ':');
+        if (!colon)
+            return EINVAL;
+
+        int kind = 0;
+        while (kind < MIX_MAX && (strlen(MIX_NAMES[kind]) != (size_t) (colon - str) ||
+               strncmp(str, MIX_NAMES[kind], colon - str)))
+            ++kind;
+        if (kind == MIX_MAX)
+            return EINVAL;
+
+        char *end = NULL;
+        const long weight = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || weight < 0 || weight > 1000 || (*end && *end != ','))
+            return EINVAL;
+
+        mix[kind] = (int) weight;
+        total += (int) weight;
+        str = *end ? end + 1 : end;
+    }
+
+    return total ? 0 : EINVAL;
+}
+
+static void print_histogram(const char *name, const Histogram &h)
+{
+    if (!h.count())
+        return;
+
+    printf("  %-6s %9llu %9.0f %9llu %9llu %9llu %9llu %9llu %9llu\n", name,
+        (unsigned long long) h.count(), h.mean(),
+        (unsigned long long) h.percentile(50), (unsigned long long) h.percentile(90),
+        (unsigned long long) h.percentile(99), (unsigned long long) h.percentile(99.9),
+        (unsigned long long) h.percentile(99.99), (unsigned long long) h.max());
+}
+
+static void print_histograms(const char *title, const Histogram all[MIX_MAX])
+{
+    Histogram total;
+    for (int i = 0; i < MIX_MAX; ++i)
+        total.merge(all[i]);
+
+    printf("%s, usec\n", title);
+    printf("  %-6s %9s %9s %9s %9s %9s %9s %9s %9s\n", "",
+        "count", "mean", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    print_histogram("all", total);
+    for (int i = 0; i < MIX_MAX; ++i)
+        print_histogram(MIX_NAMES[i], all[i]);
+}
+
+static int get_server_stats(Client &client, proto::Stats &stats, uint64_t &time_usec)
+{
+    proto::Request request;
+    memset(&request, 0, sizeof(request));
+    request.trx_id = UINT32_MAX;
+    request.cmd = proto::CMD_STATS;
+
+    proto::Response response;
+    int rc = client.send_request(request);
+    rc = rc ? rc : client.get_response(response, &stats, sizeof(stats));
+    if (!rc && (response.payload_type != proto::PAYLOAD_STATS || response.payload_size != sizeof(stats)))
+        rc = EPROTO;
+
+    time_usec = get_time_usec();
+    return rc;
+}
+
+// the server over the measured window
+struct ServerResult
+{
+    double      fps;
+    double      cpu_per_frame_usec;
+    uint32_t    max_rss_kb;
+};
+
+static void get_server_result(const proto::Stats &first, const proto::Stats &last, double window,
+                              ServerResult &result)
+{
+    const uint64_t frames = last.frames - first.frames;
+
+    result.fps                  = window > 0 ? frames / window : 0.0;
+    result.cpu_per_frame_usec   = frames ? (double) (last.cpu_usec - first.cpu_usec) / frames : 0.0;
+    result.max_rss_kb           = last.max_rss_kb;
+
+    printf("server: %llu frames in %.2f s: %.1f fps, %.0f cpu usec per frame, peak rss %u kB\n",
+        (unsigned long long) frames, window, result.fps, result.cpu_per_frame_usec,
+        result.max_rss_kb);
+    printf("server: age p50 %u p99 %u max %u usec, deadline missed %llu/%llu, "
+        "governor level %u skipped %llu\n",
+        last.latency_p50_usec, last.latency_p99_usec, last.latency_max_usec,
+        (unsigned long long) last.deadline_missed, (unsigned long long) last.deadline_requests,
+        last.governor_level, (unsigned long long) last.governor_skipped);
+}
+
+static int write_results(const char *path, double request_rate, const Histogram &latency,
+                         const Histogram &service, const ServerResult *server, uint64_t errors)
+{
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+        return errno;
+
+    fprintf(fp, "requests_per_sec=%.1f\n", request_rate);
+    fprintf(fp, "latency_mean_usec=%.0f\n", latency.mean());
+    fprintf(fp, "latency_p50_usec=%llu\n", (unsigned long long) latency.percentile(50));
+    fprintf(fp, "latency_p90_usec=%llu\n", (unsigned long long) latency.percentile(90));
+    fprintf(fp, "latency_p99_usec=%llu\n", (unsigned long long) latency.percentile(99));
+    fprintf(fp, "latency_p999_usec=%llu\n", (unsigned long long) latency.percentile(99.9));
+    fprintf(fp, "latency_max_usec=%llu\n", (unsigned long long) latency.max());
+    fprintf(fp, "service_p50_usec=%llu\n", (unsigned long long) service.percentile(50));
+    fprintf(fp, "service_p99_usec=%llu\n", (unsigned long long) service.percentile(99));
+    if (server) {
+        fprintf(fp, "frames_per_sec=%.1f\n", server->fps);
+        fprintf(fp, "cpu_usec_per_frame=%.0f\n", server->cpu_per_frame_usec);
+        fprintf(fp, "max_rss_kb=%u\n", server->max_rss_kb);
+    }
+    fprintf(fp, "errors=%llu\n", (unsigned long long) errors);
+
+    return fclose(fp) ? errno : 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c connections] [-d depth] [-r rate] [-t seconds] [-w warmup_seconds]\n"
+        "    [-m ping:1,map:8,stats:1] [-p payload] [-s stereo_mode] [-D deadline_usec]\n"
+        "    [-T timeout_msec] [-x] [-o results_path] [-U uds_path | host:port]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    LoadConfig config;
+    get_default_load_config(config);
+
+    int opt = 0;
+    while ((opt = getopt(argc, argv, "c:d:r:t:w:m:p:s:D:T:xo:U:")) != -1) {
+        switch (opt)
+        {
+            case 'c':
+                config.connections = atoi(optarg);
+                break;
+            case 'd':
+                config.depth = atoi(optarg);
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 't':
+                config.duration = atof(optarg);
+                break;
+            case 'w':
+                config.warmup = atof(optarg);
+                break;
+            case 'm':
+                if (parse_mix(optarg, config.mix)) {
+                    fprintf(stderr, "bad mix %s\n", optarg);
+                    return EINVAL;
+                }
+                break;
+            case 'p':
+                config.payload = atoi(optarg);
+                break;
+            case 's':
+                config.stereo_mode = atoi(optarg);
+                break;
+            case 'D':
+                config.deadline_usec = atoi(optarg);
+                break;
+            case 'T':
+                config.timeout_msec = atoi(optarg);
+                break;
+            case 'x':
+                config.exit = true;
+                break;
+            case 'o':
+                config.results_path = optarg;
+                break;
+            case 'U':
+                config.uds_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EINVAL;
+        }
+    }
+    if (optind < argc)
+        config.endpoint = argv[optind];
+
+    // more would wait in the server's backlog for the whole run, one
+    // is the control connection
+    if (config.connections < 1 || config.connections >= Server::MAX_CLIENTS ||
+        config.depth < 1 || config.rate < 0 || config.duration <= 0 || config.warmup < 0) {
+        usage(argv[0]);
+        return EINVAL;
+    }
+
+    std::vector<Connection> conns(config.connections);
+    for (int i = 0; i < config.connections; ++i) {
+        reset_connection(conns[i], config, i);
+        const int rc = connect_client(conns[i].client, config);
+        if (rc) {
+            fprintf(stderr, "connect failed %d %s\n", rc, strerror(rc));
+            return rc;
+        }
+    }
+
+    Client control;
+    int rc = connect_client(control, config);
+    if (rc) {
+        fprintf(stderr, "connect failed %d %s\n", rc, strerror(rc));
+        return rc;
+    }
+
+    printf("load: %d connections, depth %d, ", config.connections, config.depth);
+    if (config.rate > 0)
+        printf("%.1f req/s open loop, ", config.rate);
+    else
+        printf("closed loop, ");
+    printf("%.1f s + %.1f s warm-up, mix ping:%d map:%d stats:%d, payload %u\n",
+        config.duration, config.warmup, config.mix[MIX_PING], config.mix[MIX_MAP],
+        config.mix[MIX_STATS], config.payload);
+
+    // a moment for every thread to get going
+    const uint64_t start_usec = get_time_usec() + 10000;
+    const uint64_t measure_usec = start_usec + (uint64_t) (config.warmup * 1e6);
+    const uint64_t end_usec = measure_usec + (uint64_t) (config.duration * 1e6);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < config.connections; ++i) {
+        conns[i].start_usec     = start_usec;
+        conns[i].measure_usec   = measure_usec;
+        conns[i].end_usec       = end_usec;
+        threads.push_back(std::thread(run_receiver, std::ref(conns[i])));
+        threads.push_back(std::thread(run_sender, std::ref(conns[i])));
+    }
+
+    proto::Stats first;
+    proto::Stats last;
+    uint64_t first_usec = 0;
+    uint64_t last_usec = 0;
+
+    sleep_until(measure_usec);
+    int control_rc = get_server_stats(control, first, first_usec);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    // last response of the slowest connection, the drain is measured too
+    const double elapsed = (get_time_usec() - measure_usec) / 1e6;
+
+    if (!control_rc)
+        control_rc = get_server_stats(control, last, last_usec);
+    if (control_rc)
+        fprintf(stderr, "control connection failed %d %s\n", control_rc, strerror(control_rc));
+
+    Histogram latency[MIX_MAX];
+    Histogram service[MIX_MAX];
+    uint64_t sent = 0, received = 0, measured = 0, unsent = 0, late_max = 0;
+    uint64_t send_errors = 0, recv_errors = 0, timeouts = 0, mismatches = 0, lost = 0;
+    uint64_t quality[4] = { 0 };
+
+    for (int i = 0; i < config.connections; ++i) {
+        const Connection &conn = conns[i];
+        for (int k = 0; k < MIX_MAX; ++k) {
+            latency[k].merge(conn.latency[k]);
+            latency[k].merge(conn.unsent[k]);
+            service[k].merge(conn.service[k]);
+            unsent += conn.unsent[k].count();
+        }
+        for (int q = 0; q < 4; ++q)
+            quality[q] += conn.quality[q];
+        sent        += conn.sent;
+        received    += conn.received;
+        measured    += conn.measured;
+        send_errors += conn.send_errors;
+        recv_errors += conn.recv_errors;
+        timeouts    += conn.timeouts;
+        mismatches  += conn.mismatches;
+        lost        += conn.lost;
+        if (conn.late_max_usec > late_max)
+            late_max = conn.late_max_usec;
+    }
+
+    const uint64_t errors = send_errors + recv_errors + timeouts + mismatches + lost + (control_rc ? 1 : 0);
+
+    printf("sent %llu received %llu, measured %llu in %.2f s: %.1f req/s\n",
+        (unsigned long long) sent, (unsigned long long) received, (unsigned long long) measured,
+        elapsed, elapsed > 0 ? measured / elapsed : 0.0);
+    printf("errors %llu: send %llu receive %llu timeout %llu mismatch %llu lost %llu\n",
+        (unsigned long long) errors, (unsigned long long) send_errors,
+        (unsigned long long) recv_errors, (unsigned long long) timeouts,
+        (unsigned long long) mismatches, (unsigned long long) lost);
+    if (config.rate > 0)
+        printf("sender fell behind the schedule by up to %llu usec, %llu due requests unsent\n",
+            (unsigned long long) late_max, (unsigned long long) unsent);
+
+    print_histograms("latency from the scheduled send", latency);
+    print_histograms("service time from the actual send", service);
+
+    if (quality[0] + quality[1] + quality[2] + quality[3])
+        printf("map quality: none %llu coarse %llu partial %llu full %llu\n",
+            (unsigned long long) quality[proto::QUALITY_NONE],
+            (unsigned long long) quality[proto::QUALITY_COARSE],
+            (unsigned long long) quality[proto::QUALITY_PARTIAL],
+            (unsigned long long) quality[proto::QUALITY_FULL]);
+
+    ServerResult server;
+    if (!control_rc)
+        get_server_result(first, last, (last_usec - first_usec) / 1e6, server);
+
+    if (config.results_path) {
+        Histogram all_latency;
+        Histogram all_service;
+        for (int k = 0; k < MIX_MAX; ++k) {
+            all_latency.merge(latency[k]);
+            all_service.merge(service[k]);
+        }
+
+        rc = write_results(config.results_path, elapsed > 0 ? measured / elapsed : 0.0,
+            all_latency, all_service, control_rc ? NULL : &server, errors);
+        if (rc)
+            fprintf(stderr, "writing %s failed %d %s\n", config.results_path, rc, strerror(rc));
+    }
+
+    if (config.exit) {
+        proto::Request request;
+        memset(&request, 0, sizeof(request));
+        request.cmd = proto::CMD_EXIT;
+        control.send_request(request);
+    }
+
+    for (int i = 0; i < config.connections; ++i)
+        conns[i].client.shutdown();
+    control.shutdown();
+
+    return errors || rc ? EIO : 0;
+}
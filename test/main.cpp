@@ -3,6 +3,7 @@
  * CopyPolicy: Released under the terms of the GNU GPL v3.0.
  */
 #include "client.h"
+#include "net.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -14,18 +15,30 @@ using namespace robo;
 // these should goto config.json/yaml
 const char *UDS_PATH = "/tmp/robo.vision.s";
 
-int main() {
+// optional host:port argument connects over TCP (vision_module -t port)
+int main(int argc, char **argv) {
 
     int res = 0;
+    char host[256];
+    int port = 0;
 
     Client client;
 
-    res = client.initialize(UDS_PATH);
+    if (argc > 1) {
+        res = parse_endpoint(argv[1], host, sizeof(host), port);
+        res = res ? res : client.initialize_tcp(host, port);
+    }
+    else {
+        res = client.initialize(UDS_PATH);
+    }
     if (res)
         goto fail;
 
     proto::Request  request;
     proto::Response response;
+    proto::Stats    stats;
+
+    memset(&request, 0, sizeof(request));
 
     request.trx_id = 1;
     request.cmd = proto::CMD_PING;
@@ -44,6 +57,7 @@ int main() {
     assert(response.trx_id == 1);
     assert(response.cmd == proto::CMD_PING);
     assert(response.data == 0);
+    assert(response.payload_size == 0);
 
 
     request.trx_id = 2;
@@ -66,6 +80,47 @@ int main() {
 
 
     request.trx_id = 3;
+    request.cmd = proto::CMD_STATS;
+
+    res = client.send_request(request);
+    if (res)
+        goto fail;
+
+    printf("Sent stats request\n");
+    res = client.get_response(response, &stats, sizeof(stats));
+    if (res)
+        goto fail;
+
+    printf("Got stats frames=%llu latency p99=%u usec\n",
+        (unsigned long long) stats.frames, stats.latency_p99_usec);
+
+    assert(response.trx_id == 3);
+    assert(response.payload_type == proto::PAYLOAD_STATS);
+    assert(response.payload_size == sizeof(stats));
+    assert(response.age_usec == 0);
+
+
+    request.trx_id = 4;
+    request.cmd = proto::CMD_SET_ENCODING;
+    request.encodings = 1u << proto::ENCODING_DELTA_RLE;
+
+    res = client.send_request(request);
+    if (res)
+        goto fail;
+
+    printf("Sent encoding request\n");
+    res = client.get_response(response);
+    if (res)
+        goto fail;
+
+    printf("Got encoding %u\n", response.payload_encoding);
+
+    assert(response.trx_id == 4);
+    assert(response.payload_encoding == proto::ENCODING_DELTA_RLE);
+    assert(response.payload_size == 0);
+
+
+    request.trx_id = 5;
     request.cmd = proto::CMD_EXIT;
 
     printf("Sent exit\n");
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "modes.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+using namespace robo;
+
+// Fake C920-like device answering the enumeration ioctls from a table.
+class FakeDeviceIo : public DeviceIo
+{
+public:
+    struct Entry {
+        uint32_t    pixelformat;
+        int         width;
+        int         height;
+        uint32_t    fps[4];     // zero terminated
+    };
+
+    FakeDeviceIo(const Entry *entries, int count)
+        :
+        m_entries(entries),
+        m_count(count)
+    {
+    }
+
+    int xioctl(unsigned long request, void *arg)
+    {
+        if (request == VIDIOC_ENUM_FMT) {
+            struct v4l2_fmtdesc *desc = (struct v4l2_fmtdesc *) arg;
+            uint32_t format = get_format(desc->index);
+            if (!format)
+                return EINVAL;
+            desc->pixelformat = format;
+            return 0;
+        }
+
+        if (request == VIDIOC_ENUM_FRAMESIZES) {
+            struct v4l2_frmsizeenum *size = (struct v4l2_frmsizeenum *) arg;
+            const Entry *entry = get_entry(size->pixel_format, size->index);
+            if (!entry)
+                return EINVAL;
+            size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+            size->discrete.width = entry->width;
+            size->discrete.height = entry->height;
+            return 0;
+        }
+
+        if (request == VIDIOC_ENUM_FRAMEINTERVALS) {
+            struct v4l2_frmivalenum *ival = (struct v4l2_frmivalenum *) arg;
+            for (int i = 0; i < m_count; ++i) {
+                const Entry &e = m_entries[i];
+                if (e.pixelformat != ival->pixel_format ||
+                    e.width != (int) ival->width || e.height != (int) ival->height)
+                    continue;
+                if (ival->index >= 4 || !e.fps[ival->index])
+                    return EINVAL;
+                ival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+                ival->discrete.numerator = 1;
+                ival->discrete.denominator = e.fps[ival->index];
+                return 0;
+            }
+            return EINVAL;
+        }
+
+        return ENOTTY;
+    }
+
+private:
+    uint32_t get_format(uint32_t index) const
+    {
+        uint32_t seen[8];
+        uint32_t count = 0;
+        for (int i = 0; i < m_count && count < 8; ++i) {
+            bool dup = false;
+            for (uint32_t j = 0; j < count; ++j)
+                dup = dup || seen[j] == m_entries[i].pixelformat;
+            if (!dup)
+                seen[count++] = m_entries[i].pixelformat;
+        }
+        return index < count ? seen[index] : 0;
+    }
+
+    const Entry *get_entry(uint32_t format, uint32_t index) const
+    {
+        for (int i = 0; i < m_count; ++i)
+            if (m_entries[i].pixelformat == format && !index--)
+                return &m_entries[i];
+        return NULL;
+    }
+
+    const Entry     *m_entries;
+    int             m_count;
+};
+
+static const FakeDeviceIo::Entry g_c920[] = {
+    { V4L2_PIX_FMT_YUYV,  320, 240, { 30, 15, 0 } },
+    { V4L2_PIX_FMT_YUYV,  640, 480, { 30, 24, 15, 0 } },
+    { V4L2_PIX_FMT_YUYV,  800, 600, { 24, 15, 0 } },
+    { V4L2_PIX_FMT_YUYV, 1920, 1080, { 5, 0 } },
+    { V4L2_PIX_FMT_MJPEG, 640, 480, { 30, 15, 0 } },
+    { V4L2_PIX_FMT_MJPEG, 800, 600, { 30, 15, 0 } },
+};
+
+// same camera without 800x600
+static const FakeDeviceIo::Entry g_c920_small[] = {
+    { V4L2_PIX_FMT_YUYV,  320, 240, { 30, 15, 0 } },
+    { V4L2_PIX_FMT_YUYV,  640, 480, { 30, 24, 15, 0 } },
+};
+
+static const int g_c920_count = sizeof(g_c920) / sizeof(g_c920[0]);
+static const int g_c920_small_count = sizeof(g_c920_small) / sizeof(g_c920_small[0]);
+
+static void check_mode(const CaptureMode &mode, uint32_t format, int w, int h, double fps)
+{
+    printf("  got %.4s %dx%d @ %.1f\n", (const char *) &mode.pixelformat,
+        mode.width, mode.height, mode.fps());
+    assert(mode.pixelformat == format);
+    assert(mode.width == w);
+    assert(mode.height == h);
+    assert(mode.fps() > fps - 0.01 && mode.fps() < fps + 0.01);
+}
+
+static void test_enumerate()
+{
+    printf("test_enumerate\n");
+
+    FakeDeviceIo io(g_c920, g_c920_count);
+    std::vector<CaptureMode> modes;
+
+    const uint32_t yuyv[] = { V4L2_PIX_FMT_YUYV, 0 };
+
+    assert(!enumerate_modes(io, yuyv, modes));
+    assert(modes.size() == 8);
+
+    assert(!enumerate_modes(io, NULL, modes));
+    assert(modes.size() == 12);
+}
+
+static void test_negotiate()
+{
+    printf("test_negotiate\n");
+
+    FakeDeviceIo io0(g_c920, g_c920_count);
+    FakeDeviceIo io1(g_c920, g_c920_count);
+    FakeDeviceIo io_small(g_c920_small, g_c920_small_count);
+
+    std::vector<CaptureMode> left, right, small;
+    const uint32_t yuyv[] = { V4L2_PIX_FMT_YUYV, 0 };
+
+    assert(!enumerate_modes(io0, yuyv, left));
+    assert(!enumerate_modes(io1, yuyv, right));
+    assert(!enumerate_modes(io_small, yuyv, small));
+
+    NegotiatorConfig config;
+    get_default_negotiator_config(config);
+
+    CaptureMode mode;
+
+    // two YUYV 640x480@30 streams do not fit next to the WiFi dongle
+    ModeNegotiator negotiator(config);
+    assert(!negotiator.negotiate(left, right, mode));
+    check_mode(mode, V4L2_PIX_FMT_YUYV, 640, 480, 24);
+
+    // nothing in common above min_width
+    config.min_width = 800;
+    ModeNegotiator strict(config);
+    assert(strict.negotiate(left, small, mode) == ENOENT);
+
+    // all bus to ourselves
+    get_default_negotiator_config(config);
+    config.bus_reserved = 0;
+    ModeNegotiator greedy(config);
+    assert(!greedy.negotiate(left, right, mode));
+    check_mode(mode, V4L2_PIX_FMT_YUYV, 640, 480, 30);
+}
+
+static void test_feedback()
+{
+    printf("test_feedback\n");
+
+    FakeDeviceIo io(g_c920, g_c920_count);
+    std::vector<CaptureMode> modes;
+
+    assert(!enumerate_modes(io, NULL, modes));
+
+    NegotiatorConfig config;
+    get_default_negotiator_config(config);
+    config.allow_mjpeg = true;
+
+    ModeNegotiator negotiator(config);
+    CaptureMode mode;
+
+    assert(!negotiator.negotiate(modes, modes, mode));
+    check_mode(mode, V4L2_PIX_FMT_MJPEG, 800, 600, 30);
+
+    // MJPEG 800x600 only gives half the frames, fall back
+    negotiator.report_throughput(mode, 15.0);
+    assert(negotiator.get_efficiency(mode) < 0.6);
+
+    assert(!negotiator.negotiate(modes, modes, mode));
+    check_mode(mode, V4L2_PIX_FMT_YUYV, 640, 480, 24);
+}
+
+static void test_meter()
+{
+    printf("test_meter\n");
+
+    ThroughputMeter meter;
+    double fps = 0.0;
+
+    assert(!meter.update(100, 1000000, 1000000, fps));
+    assert(!meter.update(107, 1500000, 1000000, fps));
+    assert(meter.update(115, 2000000, 1000000, fps));
+    assert(fps > 14.99 && fps < 15.01);
+}
+
+int main()
+{
+    test_enumerate();
+    test_negotiate();
+    test_feedback();
+    test_meter();
+
+    printf("modes_test OK\n");
+    return 0;
+}
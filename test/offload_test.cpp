@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "offload.h"
+#include "net.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <thread>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const int WORKERS = 3;
+
+// random texture, the top half SHIFT pixels away and the bottom closer
+static void make_pair(Image &left, Image &right)
+{
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+
+    srand(1);
+    for (int y = 0; y < H; ++y) {
+        uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        const int shift = y < H / 2 ? 12 : 30;
+        for (int x = 0; x < W; ++x)
+            l[x] = rand() & 255;
+        for (int x = 0; x < W; ++x)
+            r[x] = x + shift < W ? l[x + shift] : 0;
+    }
+}
+
+static bool same_rows(const ImageView &a, const ImageView &b)
+{
+    for (int y = 0; y < a.height; ++y) {
+        if (memcmp(a.row(y), b.row(y), a.row_bytes()))
+            return false;
+    }
+    return true;
+}
+
+static void test_assign()
+{
+    printf("test_assign\n");
+
+    int rows[3];
+
+    const double even[2] = { 1.0, 1.0 };
+    assign_strips(even, 2, 480, 8, rows);
+    assert(rows[0] == 240 && rows[1] == 240);
+
+    const double skewed[2] = { 1.0, 3.0 };
+    assign_strips(skewed, 2, 480, 8, rows);
+    assert(rows[0] == 120 && rows[1] == 360);
+
+    // a slow one still gets a grain to measure it by
+    const double slow[3] = { 0.001, 1.0, 1.0 };
+    assign_strips(slow, 3, 480, 8, rows);
+    assert(rows[0] == 8 && rows[0] + rows[1] + rows[2] == 480);
+    assert(rows[1] % 8 == 0);
+
+    // fewer rows than grains
+    assign_strips(skewed, 2, 5, 8, rows);
+    assert(rows[0] == 0 && rows[1] == 5);
+}
+
+static void test_offload()
+{
+    printf("test_offload\n");
+
+    Image left;
+    Image right;
+    make_pair(left, right);
+
+    StereoConfig stereo;
+    get_default_stereo_config(stereo);
+
+    Image expected;
+    Image expected_conf;
+    assert(!expected.allocate(W, H, PIX_FMT_DISP16));
+    assert(!expected_conf.allocate(W, H, PIX_FMT_GRAY8));
+
+    BlockMatcher reference(stereo);
+    assert(!reference.compute(left.view(), right.view(), expected.view(), &expected_conf.view()));
+
+    StripWorker workers[WORKERS];
+    std::thread threads[WORKERS];
+    char endpoints[256] = "";
+
+    for (int i = 0; i < WORKERS; ++i) {
+        assert(!workers[i].initialize("127.0.0.1", 0));
+        threads[i] = std::thread([&workers, i]() { workers[i].run(); });
+
+        char endpoint[32];
+        snprintf(endpoint, sizeof(endpoint), "%s127.0.0.1:%d", i ? "," : "", workers[i].port());
+        strcat(endpoints, endpoint);
+    }
+
+    OffloadConfig config;
+    get_default_offload_config(config);
+    config.timeout_msec = 5000;
+
+    BlockMatcher local(stereo);
+    StripScheduler scheduler(config, local);
+    assert(!scheduler.add_workers(endpoints));
+    assert(scheduler.size() == WORKERS);
+    assert(scheduler.add_workers("nohost") == EINVAL);
+
+    Image disp;
+    Image conf;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    assert(!conf.allocate(W, H, PIX_FMT_GRAY8));
+
+    // connects complete on the frames after they were started, those
+    // frames are computed locally
+    for (int frame = 0; frame < 100 && scheduler.connected() < WORKERS; ++frame) {
+        assert(!scheduler.compute(left.view(), right.view(), disp.view(), &conf.view()));
+        assert(same_rows(disp.view(), expected.view()));
+        usleep(1000);
+    }
+    assert(scheduler.connected() == WORKERS);
+
+    // strips move around as throughput is learned, the map must not
+    for (int frame = 0; frame < 5; ++frame) {
+        memset(disp.data(), 0x55, (size_t) disp.view().stride * H);
+        assert(!scheduler.compute(left.view(), right.view(), disp.view(), &conf.view()));
+        assert(same_rows(disp.view(), expected.view()));
+        assert(same_rows(conf.view(), expected_conf.view()));
+        assert(scheduler.connected() == WORKERS);
+        assert(scheduler.m_remote_fraction > 0.5);
+    }
+    assert(scheduler.m_fallbacks == 0);
+
+    // a worker going away costs its strip a local recompute
+    workers[1].stop();
+    threads[1].join();
+
+    for (int frame = 0; frame < 3; ++frame) {
+        memset(disp.data(), 0x55, (size_t) disp.view().stride * H);
+        assert(!scheduler.compute(left.view(), right.view(), disp.view(), &conf.view()));
+        assert(same_rows(disp.view(), expected.view()));
+    }
+    assert(scheduler.m_fallbacks == 1);
+    assert(scheduler.connected() == WORKERS - 1);
+
+    // without confidence
+    memset(disp.data(), 0x55, (size_t) disp.view().stride * H);
+    assert(!scheduler.compute(left.view(), right.view(), disp.view()));
+    assert(same_rows(disp.view(), expected.view()));
+
+    for (int i = 0; i < WORKERS; ++i) {
+        workers[i].stop();
+        if (threads[i].joinable())
+            threads[i].join();
+    }
+}
+
+int main()
+{
+    test_assign();
+    test_offload();
+
+    printf("offload_test OK\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <vector>
+
+using namespace robo;
+
+static void test_parallel_for()
+{
+    printf("test_parallel_for\n");
+
+    const int count = 1000;
+    std::vector<int> hits(count, 0);
+    std::vector<int> begins(get_max_chunks(), -1);
+    std::vector<int> ends(get_max_chunks(), -1);
+
+    parallel_for(count, 10, [&](int chunk, int begin, int end) {
+        assert(chunk >= 0 && chunk < get_max_chunks());
+        assert(begins[chunk] == -1);
+        begins[chunk] = begin;
+        ends[chunk] = end;
+        for (int i = begin; i < end; ++i)
+            ++hits[i];
+    });
+
+    for (int i = 0; i < count; ++i)
+        assert(hits[i] == 1);
+
+    // contiguous and in range order
+    int next = 0;
+    for (size_t i = 0; i < begins.size() && begins[i] >= 0; ++i) {
+        assert(begins[i] == next);
+        next = ends[i];
+    }
+    assert(next == count);
+
+    // too small to split
+    int calls = 0;
+    parallel_for(5, 10, [&](int chunk, int begin, int end) {
+        assert(chunk == 0 && begin == 0 && end == 5);
+        ++calls;
+    });
+    assert(calls == 1);
+}
+
+static void test_nested()
+{
+    printf("test_nested\n");
+
+    std::atomic<int> sum(0);
+    parallel_for(8, 1, [&](int, int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            parallel_for(100, 1, [&](int, int b, int e) {
+                for (int k = b; k < e; ++k)
+                    sum.fetch_add(k);
+            });
+        }
+    });
+    assert(sum.load() == 8 * 4950);
+}
+
+// Bands of a frame: convert band k, then match band k once the bands it
+// reads (k - 1 .. k + 1) are converted.
+static void test_graph()
+{
+    printf("test_graph\n");
+
+    const int bands = 12;
+    std::vector<std::atomic<int> > converted(bands);
+    std::vector<int> matched(bands, 0);
+
+    TaskGraph graph;
+    std::vector<int> convert(bands);
+
+    for (int k = 0; k < bands; ++k) {
+        convert[k] = graph.add([&, k]() {
+            converted[k].fetch_add(1);
+        });
+    }
+    for (int k = 0; k < bands; ++k) {
+        const int node = graph.add([&, k]() {
+            for (int i = k - 1; i <= k + 1; ++i) {
+                if (i >= 0 && i < bands)
+                    assert(converted[i].load() == matched[k] + 1);
+            }
+            ++matched[k];
+        });
+        for (int i = k - 1; i <= k + 1; ++i) {
+            if (i >= 0 && i < bands)
+                graph.depend(node, convert[i]);
+        }
+    }
+
+    // the same graph every frame
+    for (int frame = 0; frame < 3; ++frame) {
+        for (int k = 0; k < bands; ++k)
+            converted[k].store(frame);
+        int res = graph.run();
+        assert(!res);
+        for (int k = 0; k < bands; ++k)
+            assert(matched[k] == frame + 1);
+    }
+
+    PoolStats stats;
+    get_pool_stats(stats);
+    assert(stats.tasks >= 3 * 2 * bands);
+}
+
+static void test_cycle()
+{
+    printf("test_cycle\n");
+
+    int runs = 0;
+    TaskGraph graph;
+    const int a = graph.add([&]() { ++runs; });
+    const int b = graph.add([&]() { ++runs; });
+    const int c = graph.add([&]() { ++runs; });
+    graph.depend(b, a);
+    graph.depend(c, b);
+    graph.depend(a, c);
+
+    assert(graph.run() == EINVAL);
+    assert(runs == 0);
+
+    graph.clear();
+    assert(graph.size() == 0);
+    assert(graph.run() == 0);
+}
+
+int main()
+{
+    test_parallel_for();
+    test_nested();
+    test_graph();
+    test_cycle();
+
+    printf("parallel_test OK\n");
+    return 0;
+}
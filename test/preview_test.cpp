@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "preview.h"
+#include "alloc.h"
+#include "stereo.h"
+#include "common.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace robo;
+
+static const int W = 64;
+static const int H = 48;
+
+struct Pair
+{
+    uint64_t    value;
+    uint64_t    check;      // ~value, a torn read would not match
+};
+
+static void test_slot()
+{
+    printf("test_slot\n");
+
+    LatestSlot<int> slot;
+    assert(!slot.acquire());
+
+    slot.back() = 1;
+    slot.publish();
+    assert(slot.acquire());
+    assert(slot.front() == 1);
+    assert(!slot.acquire());
+    assert(slot.front() == 1);
+
+    // only the newest one is seen
+    slot.back() = 2;
+    slot.publish();
+    slot.back() = 3;
+    slot.publish();
+    assert(slot.acquire());
+    assert(slot.front() == 3);
+
+    // one producer, one consumer: newer values only, never a torn one
+    LatestSlot<Pair> pairs;
+    const uint64_t count = 200000;
+
+    std::thread producer([&pairs, count]() {
+        for (uint64_t i = 1; i <= count; ++i) {
+            pairs.back().value = i;
+            pairs.back().check = ~i;
+            pairs.publish();
+        }
+    });
+
+    uint64_t last = 0;
+    uint64_t seen = 0;
+    while (last != count) {
+        if (!pairs.acquire())
+            continue;
+        const Pair &p = pairs.front();
+        assert(p.check == ~p.value);
+        assert(p.value > last);
+        last = p.value;
+        ++seen;
+    }
+    producer.join();
+
+    printf("%llu of %llu values seen\n", (unsigned long long) seen, (unsigned long long) count);
+}
+
+// gradient luma, a near box in the middle and invalid left columns
+static void make_frame(PreviewFrame &frame)
+{
+    assert(!frame.left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!frame.right.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!frame.disparity.allocate(W, H, PIX_FMT_DISP16));
+
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            frame.left.view().row(y)[x] = (uint8_t) (x * 4);
+            frame.right.view().row(y)[x] = (uint8_t) (y * 4);
+
+            int16_t d = 8 * DISP_SCALE;
+            if (x >= 24 && x < 40 && y >= 16 && y < 32)
+                d = 24 * DISP_SCALE;
+            if (x < 8)
+                d = DISP_INVALID;
+            frame.disparity.view().row_as<int16_t>(y)[x] = d;
+        }
+    }
+
+    // focal 100 px, 60 mm baseline: 8 px is 750 mm, 24 px 250 mm
+    memset(&frame.calib, 0, sizeof(frame.calib));
+    frame.calib.width   = W;
+    frame.calib.height  = H;
+    frame.calib.Q[0]    = 1.0;
+    frame.calib.Q[3]    = -(W - 1) / 2.0;
+    frame.calib.Q[5]    = 1.0;
+    frame.calib.Q[7]    = -(H - 1) / 2.0;
+    frame.calib.Q[11]   = 100.0;
+    frame.calib.Q[14]   = 1.0 / 60.0;
+    frame.sequence      = 7;
+    frame.timestamp_usec = 1;
+}
+
+static const uint8_t *pixel(const Image &bgr, int x, int y)
+{
+    return bgr.view().row(y) + x * 3;
+}
+
+static void test_render()
+{
+    printf("test_render\n");
+
+    PreviewConfig config;
+    get_default_preview_config(config);
+    config.max_depth_mm = 1000.0;
+    config.depth_step_mm = 0.0;
+
+    Preview preview(config);
+
+    PreviewFrame frame;
+    make_frame(frame);
+
+    Image bgr;
+    assert(!preview.render(frame, bgr));
+    assert(bgr.width() == 2 * W && bgr.height() == 2 * H && bgr.format() == PIX_FMT_BGR24);
+
+    // left, right as gray
+    const uint8_t *p = pixel(bgr, 10, 5);
+    assert(p[0] == 40 && p[1] == 40 && p[2] == 40);
+    p = pixel(bgr, W + 10, 5);
+    assert(p[0] == 20 && p[1] == 20 && p[2] == 20);
+
+    // disparity: invalid black, the box at the hot end, the wall cooler
+    p = pixel(bgr, 2, H + 20);
+    assert(!p[0] && !p[1] && !p[2]);
+    const uint8_t *box = pixel(bgr, 30, H + 20);
+    const uint8_t *wall = pixel(bgr, 50, H + 20);
+    assert(box[2] > box[0]);
+    assert(wall[0] > wall[2]);
+
+    // depth: invalid is the plain luma, valid ones are tinted
+    p = pixel(bgr, W + 2, H + 20);
+    assert(p[0] == 8 && p[1] == 8 && p[2] == 8);
+    p = pixel(bgr, W + 30, H + 20);
+    assert(p[0] != p[2]);
+
+    // contour lines between the box and the wall
+    config.depth_step_mm = 250.0;
+    Preview contours(config);
+    assert(!contours.render(frame, bgr));
+    p = pixel(bgr, W + 24, H + 20);
+    assert(p[0] == 255 && p[1] == 255 && p[2] == 255);
+
+    // no disparity: black panel, plain luma depth panel
+    frame.disparity.release();
+    assert(!preview.render(frame, bgr));
+    p = pixel(bgr, 30, H + 20);
+    assert(!p[0] && !p[1] && !p[2]);
+    p = pixel(bgr, W + 30, H + 20);
+    assert(p[0] == 120 && p[1] == 120 && p[2] == 120);
+
+    frame.left.release();
+    assert(preview.render(frame, bgr) == EINVAL);
+}
+
+static void test_ppm()
+{
+    printf("test_ppm\n");
+
+    Image bgr;
+    assert(!bgr.allocate(3, 2, PIX_FMT_BGR24));
+    for (int y = 0; y < 2; ++y)
+        for (int x = 0; x < 9; ++x)
+            bgr.view().row(y)[x] = (uint8_t) (y * 9 + x);
+
+    char path[] = "/tmp/preview_test.XXXXXX";
+    const int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    assert(!Preview::write_ppm(path, bgr.view()));
+
+    FILE *fp = fopen(path, "rb");
+    assert(fp);
+    char data[64];
+    const size_t len = fread(data, 1, sizeof(data), fp);
+    fclose(fp);
+
+    const char *header = "P6\n3 2\n255\n";
+    assert(len == strlen(header) + 18);
+    assert(!memcmp(data, header, strlen(header)));
+    const uint8_t *rgb = (const uint8_t *) data + strlen(header);
+    assert(rgb[0] == 2 && rgb[1] == 1 && rgb[2] == 0);
+    assert(rgb[15] == 17 && rgb[17] == 15);
+
+    assert(Preview::write_ppm(path, ImageView()) == EINVAL);
+    assert(Preview::write_ppm("/nonexistent/dir/x.ppm", bgr.view()) == ENOENT);
+    unlink(path);
+}
+
+struct SinkState
+{
+    std::atomic<int>    frames;
+    std::atomic<int>    width;
+    std::atomic<int>    closed;
+    bool                quit;
+};
+
+static bool count_sink(void *ctx, const ImageView &bgr)
+{
+    SinkState *state = (SinkState *) ctx;
+    if (bgr.empty()) {
+        ++state->closed;
+        return true;
+    }
+    state->width = bgr.width;
+    ++state->frames;
+    return !state->quit;
+}
+
+static uint64_t get_allocs()
+{
+    AllocCount count;
+    get_thread_alloc_count(count);
+    return count.allocs;
+}
+
+static void test_thread()
+{
+    printf("test_thread\n");
+
+    char path[] = "/tmp/preview_test.XXXXXX";
+    const int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+
+    PreviewConfig config;
+    get_default_preview_config(config);
+    config.max_fps = 100.0;
+    config.snapshot_path = path;
+
+    PreviewFrame frame;
+    make_frame(frame);
+
+    Preview preview(config);
+    SinkState state;
+    state.frames = 0;
+    state.width = 0;
+    state.closed = 0;
+    state.quit = false;
+
+    // not running, nothing taken
+    assert(!preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+        frame.calib, 1, 1, 1000));
+
+    assert(!preview.start(count_sink, &state));
+    assert(preview.start(count_sink, &state) == EINVAL);
+
+    // capped at max_fps
+    uint64_t now = get_time_usec();
+    assert(preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+        frame.calib, 1, 1, now));
+    assert(!preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+        frame.calib, 2, 2, now + 1000));
+
+    // the thread swaps the third buffer in with its first frame, once
+    // all three have the geometry copies do not allocate
+    uint32_t sequence = 2;
+    while (!state.frames) {
+        now += 20000;
+        assert(preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+            frame.calib, sequence, sequence, now));
+        ++sequence;
+        usleep(5000);
+    }
+    assert(state.width == 2 * W);
+
+    uint64_t allocs = 0;
+    for (int i = 0; i < 12; ++i) {
+        if (i == 2)
+            allocs = get_allocs();
+        now += 20000;
+        assert(preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+            frame.calib, sequence, sequence, now));
+        ++sequence;
+        usleep(2000);
+    }
+    assert(get_allocs() == allocs);
+    assert(!preview.quit_requested());
+
+    // a sink asks to stop
+    state.quit = true;
+    now += 20000;
+    assert(preview.publish(frame.left.view(), frame.right.view(), frame.disparity.view(),
+        frame.calib, sequence, sequence, now));
+    for (int i = 0; i < 100 && !preview.quit_requested(); ++i)
+        usleep(10000);
+    assert(preview.quit_requested());
+
+    assert(!state.closed);
+    preview.stop();
+    assert(!preview.is_running());
+    assert(state.closed == 1);
+    assert(preview.m_published == sequence);
+    assert(preview.m_rendered >= 2);
+
+    // stop leaves the last frame in the snapshot
+    FILE *fp = fopen(path, "rb");
+    assert(fp);
+    char header[16];
+    assert(fread(header, 1, 11, fp) == 11);
+    fclose(fp);
+    assert(!memcmp(header, "P6\n128 96\n", 10));
+    unlink(path);
+
+    printf("%llu published, %llu rendered, last render %llu usec\n",
+        (unsigned long long) preview.m_published, (unsigned long long) preview.m_rendered,
+        (unsigned long long) preview.m_render_usec);
+}
+
+int main()
+{
+    test_slot();
+    test_render();
+    test_ppm();
+    test_thread();
+
+    printf("preview_test OK\n");
+    return 0;
+}
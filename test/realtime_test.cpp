@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "realtime.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+using namespace robo;
+
+static void test_cpu_list()
+{
+    printf("test_cpu_list\n");
+
+    uint32_t mask = 0;
+    assert(!parse_cpu_list("0", mask) && mask == 0x1);
+    assert(!parse_cpu_list("1-3", mask) && mask == 0xe);
+    assert(!parse_cpu_list("1-3,5", mask) && mask == 0x2e);
+    assert(!parse_cpu_list("31", mask) && mask == 0x80000000u);
+
+    assert(parse_cpu_list("", mask) == EINVAL);
+    assert(parse_cpu_list("32", mask) == EINVAL);
+    assert(parse_cpu_list("3-1", mask) == EINVAL);
+    assert(parse_cpu_list("1,", mask) == EINVAL);
+    assert(parse_cpu_list("1;2", mask) == EINVAL);
+    assert(parse_cpu_list("-1", mask) == EINVAL);
+}
+
+static void test_prefault()
+{
+    printf("test_prefault\n");
+
+    const size_t size = 3 * 4096 + 17;
+    uint8_t *data = (uint8_t *) malloc(size);
+    for (size_t i = 0; i < size; ++i)
+        data[i] = (uint8_t) (i * 31);
+
+    prefault(data, size);
+    prefault_read(data, size);
+    for (size_t i = 0; i < size; ++i)
+        assert(data[i] == (uint8_t) (i * 31));
+
+    prefault(data, 0);
+    free(data);
+}
+
+static void test_worker_cpus()
+{
+    printf("test_worker_cpus\n");
+
+    RuntimeProfile profile;
+    get_default_runtime_profile(profile);
+    assert(get_worker_cpus(profile, 4) == 0);
+
+    // workers keep off a pinned main loop's cpu
+    profile.main_cpu = 2;
+    assert(get_worker_cpus(profile, 4) == 0xb);
+    assert(get_worker_cpus(profile, 32) == ~0x4u);
+    assert(get_worker_cpus(profile, 1) == 0);
+
+    // an explicit list is taken as it is
+    profile.worker_cpus = 0x3;
+    assert(get_worker_cpus(profile, 4) == 0x3);
+}
+
+// Main loop and every worker on cpu 0. Priorities and mlockall need
+// privileges the test may not have, those are left at their defaults.
+static void test_profile()
+{
+    printf("test_profile\n");
+
+    RuntimeProfile profile;
+    get_default_runtime_profile(profile);
+    profile.main_cpu    = 0;
+    profile.worker_cpus = 0x1;
+    profile.prefault    = true;
+    assert(!apply_runtime_profile(profile));
+
+    cpu_set_t set;
+    assert(!sched_getaffinity(0, sizeof(set), &set));
+    assert(CPU_COUNT(&set) == 1 && CPU_ISSET(0, &set));
+
+    std::atomic<int> off_cpu(0);
+    parallel_for(64, 1, [&](int, int, int) {
+        if (sched_getcpu() != 0)
+            off_cpu.fetch_add(1);
+    });
+    assert(!off_cpu.load());
+
+    log_topology();
+}
+
+int main()
+{
+    test_cpu_list();
+    test_worker_cpus();
+    test_prefault();
+    test_profile();
+
+    printf("realtime_test OK\n");
+    return 0;
+}
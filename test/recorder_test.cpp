@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "recorder.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace robo;
+
+static void make_path(char *path)
+{
+    const int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+}
+
+static void write_records(FlightRecorder &recorder, int count, uint32_t first_trx)
+{
+    for (int i = 0; i < count; ++i) {
+        FlightRecord record;
+        memset(&record, 0, sizeof(record));
+        record.trx_id = first_trx + i;
+        record.busy_usec = 1000 + i;
+        recorder.write(record);
+        assert(record.seq == recorder.next_seq() - 1);
+    }
+}
+
+static void test_ring()
+{
+    printf("test_ring\n");
+
+    char path[] = "/tmp/recorder_test.XXXXXX";
+    make_path(path);
+
+    FlightRecorder recorder;
+    assert(!recorder.open(path, 8));
+    assert(recorder.open(path, 8) == EINVAL);
+    write_records(recorder, 20, 100);
+
+    // the newest 8, oldest first
+    FlightHeader header;
+    std::vector<FlightRecord> records;
+    assert(!load_flight_records(path, header, records));
+    assert(header.capacity == 8 && header.record_size == sizeof(FlightRecord));
+    assert(records.size() == 8);
+    for (int i = 0; i < 8; ++i) {
+        assert(records[i].seq == (uint64_t) 13 + i);
+        assert(records[i].trx_id == (uint32_t) 112 + i);
+        assert(records[i].busy_usec == (uint32_t) 1012 + i);
+        assert(!(records[i].flags & FLIGHT_FIRST));
+    }
+
+    // a crash: the mapping is gone, the records are not
+    recorder.close();
+    assert(!load_flight_records(path, header, records));
+    assert(records.size() == 8);
+
+    // the next run continues after them, its first record is marked
+    assert(!recorder.open(path, 8));
+    assert(recorder.next_seq() == 21);
+    write_records(recorder, 2, 200);
+    assert(!load_flight_records(path, header, records));
+    assert(records.size() == 8 && records[0].seq == 15 && records[5].seq == 20);
+    assert(records[6].seq == 21 && (records[6].flags & FLIGHT_FIRST) && records[6].trx_id == 200);
+    assert(records[7].seq == 22 && !(records[7].flags & FLIGHT_FIRST));
+    recorder.close();
+
+    // another geometry starts over
+    assert(!recorder.open(path, 4));
+    assert(recorder.next_seq() == 1);
+    assert(!load_flight_records(path, header, records));
+    assert(records.empty());
+    recorder.close();
+
+    unlink(path);
+}
+
+static void test_torn()
+{
+    printf("test_torn\n");
+
+    char path[] = "/tmp/recorder_test.XXXXXX";
+    make_path(path);
+
+    FlightRecorder recorder;
+    assert(!recorder.open(path, 4));
+    write_records(recorder, 3, 1);
+    recorder.close();
+
+    // a record cleared mid write, and one from the wrong lap
+    const int fd = open(path, O_RDWR);
+    assert(fd != -1);
+    uint64_t seq = 0;
+    assert(pwrite(fd, &seq, sizeof(seq), sizeof(FlightHeader) + sizeof(FlightRecord)) == sizeof(seq));
+    seq = 7;
+    assert(pwrite(fd, &seq, sizeof(seq), sizeof(FlightHeader)) == sizeof(seq));
+    close(fd);
+
+    FlightHeader header;
+    std::vector<FlightRecord> records;
+    assert(!load_flight_records(path, header, records));
+    assert(records.size() == 1 && records[0].seq == 3);
+
+    // CSV: a header line and a line per record
+    char csv[] = "/tmp/recorder_test_csv.XXXXXX";
+    make_path(csv);
+    FILE *fp = fopen(csv, "w");
+    assert(fp);
+    write_flight_csv(fp, header, records);
+    fclose(fp);
+
+    fp = fopen(csv, "r");
+    assert(fp);
+    char line[1024];
+    int lines = 0;
+    while (fgets(line, sizeof(line), fp))
+        ++lines;
+    fclose(fp);
+    assert(lines == 2);
+    assert(!strncmp(line, "3,", 2));
+
+    // not a flight file
+    assert(load_flight_records(csv, header, records) == EINVAL);
+
+    unlink(csv);
+    unlink(path);
+}
+
+static void test_cost()
+{
+    printf("test_cost\n");
+
+    char path[] = "/tmp/recorder_test.XXXXXX";
+    make_path(path);
+
+    FlightRecorder recorder;
+    assert(!recorder.open(path, 4096));
+
+    FlightRecord record;
+    memset(&record, 0, sizeof(record));
+
+    const int count = 100000;
+    const uint64_t start = get_time_usec();
+    for (int i = 0; i < count; ++i) {
+        record.trx_id = i;
+        recorder.write(record);
+    }
+    const uint64_t usec = get_time_usec() - start;
+
+    printf("%.1f ns per record\n", usec * 1000.0 / count);
+
+    recorder.close();
+    unlink(path);
+}
+
+static void test_unsafe()
+{
+    printf("test_unsafe\n");
+
+    char target[] = "/tmp/recorder_test.XXXXXX";
+    make_path(target);
+    FILE *fp = fopen(target, "w");
+    assert(fp);
+    fputs("keep me", fp);
+    fclose(fp);
+
+    // a symlink is refused and its target left alone
+    char link[64];
+    snprintf(link, sizeof(link), "%s.link", target);
+    assert(!symlink(target, link));
+
+    FlightRecorder recorder;
+    assert(recorder.open(link, 8) == ELOOP);
+    assert(!recorder.is_open());
+
+    struct stat st;
+    assert(!stat(target, &st) && st.st_size == 7);
+    unlink(link);
+    unlink(target);
+
+    // so is anything but a regular file
+    assert(recorder.open("/dev/null", 8) == EPERM);
+    assert(!recorder.is_open());
+}
+
+int main()
+{
+    test_ring();
+    test_torn();
+    test_cost();
+    test_unsafe();
+
+    printf("recorder_test OK\n");
+    return 0;
+}
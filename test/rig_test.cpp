@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "rig.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+using namespace robo;
+
+// what a C920 in auto mode may read back in a dim room
+static void get_auto_controls(Camera::Controls &current)
+{
+    memset(&current, 0, sizeof(current));
+    current.mask = (1u << Camera::CONTROL_MAX) - 1;
+
+    int32_t *v = current.values;
+    v[Camera::CONTROL_EXPOSURE_AUTO]                = V4L2_EXPOSURE_APERTURE_PRIORITY;
+    v[Camera::CONTROL_EXPOSURE_AUTO_PRIORITY]       = 1;
+    v[Camera::CONTROL_EXPOSURE_ABSOLUTE]            = 500;
+    v[Camera::CONTROL_GAIN]                         = 120;
+    v[Camera::CONTROL_FOCUS_AUTO]                   = 1;
+    v[Camera::CONTROL_FOCUS_ABSOLUTE]               = 30;
+    v[Camera::CONTROL_WHITE_BALANCE_AUTO]           = 1;
+    v[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE]    = 4500;
+    v[Camera::CONTROL_POWER_LINE_FREQUENCY]         = V4L2_CID_POWER_LINE_FREQUENCY_60HZ;
+}
+
+static void test_autos_off()
+{
+    printf("test_autos_off\n");
+
+    RigLockConfig config;
+    get_default_rig_lock_config(config);
+    RigControl rig(config);
+
+    Camera::Controls current;
+    get_auto_controls(current);
+
+    Camera::Controls locked;
+    rig.get_lock_controls(current, 30.0, locked);
+
+    // every control is written, the auto ones all off
+    assert(locked.mask == (1u << Camera::CONTROL_MAX) - 1);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_AUTO] == V4L2_EXPOSURE_MANUAL);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_AUTO_PRIORITY] == 0);
+    assert(locked.values[Camera::CONTROL_FOCUS_AUTO] == 0);
+    assert(locked.values[Camera::CONTROL_WHITE_BALANCE_AUTO] == 0);
+}
+
+static void test_exposure_cap()
+{
+    printf("test_exposure_cap\n");
+
+    RigLockConfig config;
+    get_default_rig_lock_config(config);
+    RigControl rig(config);
+
+    Camera::Controls current;
+    get_auto_controls(current);
+    Camera::Controls locked;
+
+    // 0.8 of a 33.3 ms interval is 266 units of 100 usec
+    rig.get_lock_controls(current, 30.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 266);
+
+    // 533 at 15 fps, the 500 auto settled on fits
+    rig.get_lock_controls(current, 15.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 500);
+
+    // shorter ones are kept as they are
+    current.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] = 100;
+    rig.get_lock_controls(current, 30.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 100);
+
+    // unknown rate, no cap
+    current.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] = 5000;
+    rig.get_lock_controls(current, 0.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 5000);
+
+    // the fraction is configurable, a configured exposure is capped too
+    config.max_exposure_fraction = 0.5;
+    config.exposure_absolute = 300;
+    RigControl half(config);
+    half.get_lock_controls(current, 30.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 166);
+    half.get_lock_controls(current, 10.0, locked);
+    assert(locked.values[Camera::CONTROL_EXPOSURE_ABSOLUTE] == 300);
+}
+
+static void test_configured_or_current()
+{
+    printf("test_configured_or_current\n");
+
+    Camera::Controls current;
+    get_auto_controls(current);
+    Camera::Controls locked;
+
+    // defaults: gain and white balance from auto, focus at infinity,
+    // mains at 50 Hz
+    RigLockConfig config;
+    get_default_rig_lock_config(config);
+    RigControl rig(config);
+
+    rig.get_lock_controls(current, 30.0, locked);
+    assert(locked.values[Camera::CONTROL_GAIN] == 120);
+    assert(locked.values[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE] == 4500);
+    assert(locked.values[Camera::CONTROL_FOCUS_ABSOLUTE] == 0);
+    assert(locked.values[Camera::CONTROL_POWER_LINE_FREQUENCY] == V4L2_CID_POWER_LINE_FREQUENCY_50HZ);
+
+    // anything at or above zero wins over the current value
+    config.gain = 0;
+    config.white_balance_temperature = 5000;
+    config.focus_absolute = -1;
+    config.power_line_frequency = -1;
+    RigControl fixed(config);
+
+    fixed.get_lock_controls(current, 30.0, locked);
+    assert(locked.values[Camera::CONTROL_GAIN] == 0);
+    assert(locked.values[Camera::CONTROL_WHITE_BALANCE_TEMPERATURE] == 5000);
+    assert(locked.values[Camera::CONTROL_FOCUS_ABSOLUTE] == 30);
+    assert(locked.values[Camera::CONTROL_POWER_LINE_FREQUENCY] == V4L2_CID_POWER_LINE_FREQUENCY_60HZ);
+}
+
+int main()
+{
+    test_autos_off();
+    test_exposure_cap();
+    test_configured_or_current();
+
+    printf("rig_test OK\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "scan.h"
+#include "stereo.h"
+#include "ground.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <sys/uio.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const double BASELINE = 100.0;
+
+// floor everywhere below the horizon, a wall at WALL px disparity on the
+// left half and some stray matches that must not show up.
+static const int WALL = 10;
+static const float CAMERA_HEIGHT = 200.0f;
+
+static void make_disparity(const StereoCalibration &calib, Image &disp)
+{
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+
+    const double cy = -calib.Q[7];
+
+    for (int y = 0; y < H; ++y) {
+        int16_t *d = disp.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            d[x] = DISP_INVALID;
+            if (y > cy)
+                d[x] = (int16_t) ((y - cy) * BASELINE / CAMERA_HEIGHT * DISP_SCALE);
+            if (x < W / 2 && fabs(y - cy) < 20)
+                d[x] = WALL * DISP_SCALE;
+        }
+    }
+
+    // two spikes per column and one column with many
+    for (int x = 0; x < W; ++x) {
+        disp.view().row_as<int16_t>(10)[x] = 60 * DISP_SCALE;
+        disp.view().row_as<int16_t>(20)[x] = 60 * DISP_SCALE;
+    }
+    for (int y = 0; y < 10; ++y)
+        disp.view().row_as<int16_t>(y)[W - 3] = 60 * DISP_SCALE;
+}
+
+int main()
+{
+    printf("test_scan\n");
+
+    StereoCalibration calib;
+    get_default_calibration(W, H, BASELINE, calib);
+
+    ScanConfig config;
+    get_default_scan_config(config);
+
+    Image disp;
+    make_disparity(calib, disp);
+
+    Plane floor;
+    get_level_plane(CAMERA_HEIGHT, floor);
+
+    VirtualScan scan(config);
+    assert(!scan.compute(disp.view(), calib, floor));
+
+    struct iovec iov[2];
+    assert(scan.get_payload(iov) == 2);
+    assert(iov[1].iov_len == 40 * sizeof(uint16_t));
+
+    const proto::LaserScan &hdr = scan.header();
+    assert(hdr.count == W / config.band_px);
+    assert(hdr.band_px == config.band_px);
+
+    const uint16_t wall = (uint16_t) lrint(calib.Q[11] * BASELINE / WALL);
+
+    for (int i = 0; i < hdr.count; ++i) {
+        const uint16_t expected = i < hdr.count / 2 ? wall : 0;
+        assert(scan.depths()[i] == expected);
+    }
+
+    printf("scan_test OK\n");
+    return 0;
+}
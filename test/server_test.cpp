@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "server.h"
+#include "client.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using namespace robo;
+
+// Both ends run in this thread: clients queue requests in the socket
+// buffers, then the server reads them.
+
+static char g_path[64];
+
+static proto::Request make_request(uint32_t trx_id, uint32_t cmd = proto::CMD_PING)
+{
+    proto::Request request;
+    memset(&request, 0, sizeof(request));
+    request.trx_id  = trx_id;
+    request.cmd     = cmd;
+    return request;
+}
+
+// reads one request and answers it with the client's encoding in data
+static uint32_t serve(Server &srv)
+{
+    proto::Request request;
+    assert(!srv.get_request(request));
+
+    if (request.cmd == proto::CMD_SET_ENCODING)
+        srv.set_encoding((uint16_t) request.encodings);
+
+    proto::Response response;
+    memset(&response, 0, sizeof(response));
+    response.trx_id = request.trx_id;
+    response.cmd    = request.cmd;
+    response.data   = srv.get_encoding();
+    assert(!srv.send_response(response));
+    return request.trx_id;
+}
+
+static uint64_t expect(Client &client, uint32_t trx_id)
+{
+    proto::Response response;
+    assert(!client.get_response(response));
+    assert(response.trx_id == trx_id);
+    return response.data;
+}
+
+static void test_round_robin()
+{
+    printf("test_round_robin\n");
+
+    Server srv;
+    assert(!srv.initialize(g_path));
+
+    Client a;
+    Client b;
+    assert(!a.initialize(g_path));
+    assert(!b.initialize(g_path));
+
+    // clients are only accepted while none has a request ready
+    assert(!a.send_request(make_request(1)));
+    assert(serve(srv) == 1);
+    expect(a, 1);
+    assert(!b.send_request(make_request(11)));
+    assert(serve(srv) == 11);
+    expect(b, 11);
+    assert(srv.get_clients() == 2);
+
+    // a busy client does not starve the other one
+    for (uint32_t i = 2; i <= 4; ++i)
+        assert(!a.send_request(make_request(i)));
+    for (uint32_t i = 12; i <= 14; ++i)
+        assert(!b.send_request(make_request(i)));
+
+    const uint32_t order[] = { 2, 12, 3, 13, 4, 14 };
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); ++i)
+        assert(serve(srv) == order[i]);
+    for (uint32_t i = 2; i <= 4; ++i)
+        expect(a, i);
+    for (uint32_t i = 12; i <= 14; ++i)
+        expect(b, i);
+
+    // the encoding sticks to the connection that asked for it
+    proto::Request request = make_request(5, proto::CMD_SET_ENCODING);
+    request.encodings = proto::ENCODING_DELTA_RLE;
+    assert(!a.send_request(request));
+    assert(serve(srv) == 5);
+    assert(expect(a, 5) == proto::ENCODING_DELTA_RLE);
+
+    assert(!b.send_request(make_request(15)));
+    assert(serve(srv) == 15);
+    assert(expect(b, 15) == proto::ENCODING_RAW);
+
+    assert(!a.send_request(make_request(6)));
+    assert(serve(srv) == 6);
+    assert(expect(a, 6) == proto::ENCODING_DELTA_RLE);
+
+    // a new connection starts out raw
+    a.shutdown();
+    Client c;
+    assert(!c.initialize(g_path));
+    assert(!c.send_request(make_request(21)));
+    assert(serve(srv) == 21);
+    assert(expect(c, 21) == proto::ENCODING_RAW);
+    assert(srv.get_clients() == 2);
+
+    srv.shutdown();
+}
+
+static int raw_connect()
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, g_path, sizeof(address.sun_path) - 1);
+
+    const int fd = ::socket(PF_UNIX, SOCK_STREAM, 0);
+    assert(fd != -1);
+    assert(!::connect(fd, (struct sockaddr *) &address, sizeof(address)));
+    return fd;
+}
+
+static void test_stalled_request()
+{
+    printf("test_stalled_request\n");
+
+    Server srv;
+    srv.set_client_timeout(100);
+    assert(!srv.initialize(g_path));
+
+    // half a request and then nothing
+    const int stalled = raw_connect();
+    const proto::Request partial = make_request(99);
+    assert(::send(stalled, &partial, sizeof(partial) / 2, 0) == sizeof(partial) / 2);
+
+    Client b;
+    assert(!b.initialize(g_path));
+    assert(!b.send_request(make_request(1)));
+
+    const uint64_t start = get_time_usec();
+    assert(serve(srv) == 1);
+    const uint64_t elapsed = get_time_usec() - start;
+    expect(b, 1);
+
+    assert(srv.get_clients() == 1);
+    assert(srv.get_accepted() == 2);
+    assert(elapsed >= 90000 && elapsed < 2000000);
+
+    // the stalled one was closed
+    char byte;
+    assert(::recv(stalled, &byte, 1, 0) == 0);
+    ::close(stalled);
+
+    srv.shutdown();
+}
+
+static void test_stalled_reader()
+{
+    printf("test_stalled_reader\n");
+
+    Server srv;
+    srv.set_client_timeout(100);
+    assert(!srv.initialize(g_path));
+
+    Client a;
+    Client b;
+    assert(!a.initialize(g_path));
+    assert(!b.initialize(g_path));
+
+    // a asks for a payload far larger than the socket buffers and never
+    // reads it
+    assert(!a.send_request(make_request(1)));
+    proto::Request request;
+    assert(!srv.get_request(request));
+    assert(request.trx_id == 1);
+
+    static char payload[8 << 20];
+    proto::Response response;
+    memset(&response, 0, sizeof(response));
+    response.trx_id         = 1;
+    response.payload_type   = proto::PAYLOAD_GRAY8;
+    assert(srv.send_response(response, payload, sizeof(payload)) == EAGAIN);
+    assert(srv.get_clients() == 0);
+
+    // the server goes on with the next one
+    assert(!b.send_request(make_request(2)));
+    assert(serve(srv) == 2);
+    expect(b, 2);
+
+    srv.shutdown();
+}
+
+int main()
+{
+    snprintf(g_path, sizeof(g_path), "/tmp/server_test.%d", (int) getpid());
+
+    test_round_robin();
+    test_stalled_request();
+    test_stalled_reader();
+
+    unlink(g_path);
+    printf("server_test OK\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "sparse.h"
+#include "stereo.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const int SHIFT = 12;
+
+// blocky random texture (corners at block corners), right camera sees it
+// SHIFT pixels to the left
+static void make_pair(Image &left, Image &right)
+{
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+
+    srand(1);
+    uint8_t blocks[H / 4][W / 4];
+    for (int by = 0; by < H / 4; ++by)
+        for (int bx = 0; bx < W / 4; ++bx)
+            blocks[by][bx] = rand() & 255;
+
+    for (int y = 0; y < H; ++y) {
+        uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        for (int x = 0; x < W; ++x)
+            l[x] = blocks[y / 4][x / 4];
+        for (int x = 0; x < W; ++x)
+            r[x] = x + SHIFT < W ? l[x + SHIFT] : 0;
+    }
+}
+
+static void test_matches(const Image &left, const Image &right)
+{
+    printf("test_matches\n");
+
+    StereoConfig stereo;
+    get_default_stereo_config(stereo);
+
+    SparseConfig config;
+    get_default_sparse_config(config);
+
+    SparseMatcher matcher(config, stereo.num_disparities);
+    assert(!matcher.compute(left.view(), right.view()));
+
+    const size_t count = matcher.count();
+    assert(count > 100 && count <= (size_t) config.max_features);
+
+    size_t good = 0;
+    int last = -1;
+    for (size_t i = 0; i < count; ++i) {
+        const proto::Feature &f = matcher.features()[i];
+
+        // row major, inside the image
+        assert((int) (f.y * W + f.x) > last);
+        last = f.y * W + f.x;
+        assert(f.x < W && f.y < H);
+
+        const int error = f.disparity - SHIFT * DISP_SCALE;
+        good += error >= -DISP_SCALE / 2 && error <= DISP_SCALE / 2;
+    }
+    printf("%zu features, %zu at the right disparity\n", count, good);
+    assert(good * 100 >= count * 95);
+
+    struct iovec iov[2];
+    assert(matcher.get_payload(iov) == 2);
+    const proto::FeatureList *header = (const proto::FeatureList *) iov[0].iov_base;
+    assert(header->width == W && header->height == H && header->count == count);
+    assert(iov[1].iov_len == count * sizeof(proto::Feature));
+
+    // cost next to the dense matcher, for the record
+    Image disp;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    BlockMatcher dense(stereo);
+
+    uint64_t start = get_time_usec();
+    for (int i = 0; i < 10; ++i)
+        assert(!matcher.compute(left.view(), right.view()));
+    const uint64_t sparse_usec = (get_time_usec() - start) / 10;
+
+    start = get_time_usec();
+    for (int i = 0; i < 10; ++i)
+        assert(!dense.compute(left.view(), right.view(), disp.view()));
+    const uint64_t dense_usec = (get_time_usec() - start) / 10;
+
+    printf("sparse %llu usec dense %llu usec per frame\n",
+        (unsigned long long) sparse_usec, (unsigned long long) dense_usec);
+}
+
+static void test_flat()
+{
+    printf("test_flat\n");
+
+    Image left;
+    Image right;
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+    memset(left.data(), 128, left.view().size());
+    memset(right.data(), 128, right.view().size());
+
+    SparseConfig config;
+    get_default_sparse_config(config);
+
+    SparseMatcher matcher(config, 64);
+    assert(!matcher.compute(left.view(), right.view()));
+    assert(matcher.count() == 0);
+
+    // wrong format/geometry
+    Image small;
+    assert(!small.allocate(W / 2, H, PIX_FMT_GRAY8));
+    assert(matcher.compute(left.view(), small.view()) == EINVAL);
+}
+
+int main()
+{
+    Image left;
+    Image right;
+
+    make_pair(left, right);
+
+    test_matches(left, right);
+    test_flat();
+
+    printf("sparse_test OK\n");
+    return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "alloc.h"
+#include "pipeline.h"
+#include "synthetic.h"
+#include "common.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const int WARMUP = 5;
+static const int FRAMES = 30;
+
+// keeps the compiler from pairing up and dropping malloc/free
+static void *volatile g_sink[2];
+
+static uint64_t get_allocs()
+{
+    AllocCount counts[ALLOC_STAGE_MAX];
+    get_alloc_counts(counts);
+
+    uint64_t allocs = 0;
+    for (int i = 0; i < ALLOC_STAGE_MAX; ++i)
+        allocs += counts[i].allocs;
+    return allocs;
+}
+
+static void test_counts()
+{
+    printf("test_counts\n");
+
+    AllocCount before;
+    AllocCount after;
+    AllocCount stages[ALLOC_STAGE_MAX];
+
+    get_thread_alloc_count(before);
+    set_alloc_stage(ALLOC_STAGE_SEND);
+    g_sink[0] = malloc(100);
+    g_sink[0] = realloc(g_sink[0], 200);
+    g_sink[1] = new char[50];
+    free(g_sink[0]);
+    delete[] (char *) g_sink[1];
+    assert(set_alloc_stage(ALLOC_STAGE_OTHER) == ALLOC_STAGE_SEND);
+    get_thread_alloc_count(after);
+    get_alloc_counts(stages);
+
+    // malloc, new, realloc
+    assert(after.allocs - before.allocs == 3);
+    assert(after.frees - before.frees == 3);
+    assert(after.bytes - before.bytes >= 350);
+    assert(stages[ALLOC_STAGE_SEND].allocs == 3);
+
+    // back to other
+    g_sink[0] = malloc(1);
+    free(g_sink[0]);
+    get_alloc_counts(stages);
+    assert(stages[ALLOC_STAGE_SEND].allocs == 3);
+
+    FaultCount faults;
+    assert(!get_fault_count(faults));
+    assert(faults.minor > 0);
+    assert(get_alloc_threads() >= 1);
+}
+
+// Every per frame product of a frame from the second on allocates
+// nothing, with and without a deadline.
+static void test_steady()
+{
+    printf("test_steady\n");
+
+    SyntheticScene scene;
+    assert(!scene.initialize(W, H));
+
+    Image left;
+    Image right;
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+
+    PipelineConfig config;
+    get_default_pipeline_config(config);
+    Pipeline pipeline(config);
+    assert(!pipeline.initialize(W, H));
+
+    VoxelBox box;
+    box.min[0] = -4000; box.min[1] = -1500; box.min[2] = 0;
+    box.max[0] = 4000;  box.max[1] = 1500;  box.max[2] = 8000;
+
+    FrameProbe probe;
+    for (int frame = 0; frame < WARMUP + FRAMES; ++frame) {
+        assert(!scene.render_gray(0, frame, left.view()));
+        assert(!scene.render_gray(1, frame, right.view()));
+
+        const uint64_t deadline = frame & 1 ? get_time_usec() + 5000 : 0;
+
+        probe.begin();
+
+        set_alloc_stage(ALLOC_STAGE_PROCESS);
+        assert(!pipeline.process(left.view(), right.view(), deadline));
+        assert(!pipeline.process_sparse(left.view(), right.view()));
+
+        set_alloc_stage(ALLOC_STAGE_SEND);
+        struct iovec iov[16];
+        pipeline.encode_disparity(iov);
+        pipeline.compute_scan(iov);
+        pipeline.query_voxels(box, iov);
+        pipeline.project_occupancy(box, iov);
+        pipeline.points().get_payload(iov, 16);
+        pipeline.get_features(iov);
+
+        set_alloc_stage(ALLOC_STAGE_OTHER);
+        probe.end();
+
+        if (frame < WARMUP)
+            continue;
+
+        if (probe.allocs()) {
+            for (int i = 0; i < ALLOC_STAGE_MAX; ++i)
+                fprintf(stderr, "frame %d %s: %llu allocs %llu bytes\n", frame, get_alloc_stage_str(i),
+                    (unsigned long long) probe.stage(i).allocs, (unsigned long long) probe.stage(i).bytes);
+        }
+        assert(!probe.allocs());
+    }
+
+    // the box is where the scene put it
+    const int16_t d = pipeline.disparity().row_as<int16_t>(H / 2)[W / 2];
+    assert(abs(d - SYNTHETIC_NEAR_DISP * DISP_SCALE) <= DISP_SCALE);
+
+    printf("%d frames, %llu minor %llu major faults last frame\n", FRAMES,
+        (unsigned long long) probe.minor_faults(), (unsigned long long) probe.major_faults());
+}
+
+static void test_scene()
+{
+    printf("test_scene\n");
+
+    SyntheticScene scene;
+    assert(!scene.initialize(W, H));
+
+    Image a;
+    Image b;
+    Image yuyv;
+    assert(!a.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!b.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!yuyv.allocate(W, H, PIX_FMT_YUYV));
+
+    // the wall is SYNTHETIC_FAR_DISP away in the top rows
+    assert(!scene.render_gray(0, 3, a.view()));
+    assert(!scene.render_gray(1, 3, b.view()));
+    assert(!memcmp(a.view().row(2) + SYNTHETIC_FAR_DISP, b.view().row(2), W - SYNTHETIC_FAR_DISP));
+
+    // next frame pans a pixel pair
+    assert(!scene.render_gray(0, 4, b.view()));
+    assert(!memcmp(a.view().row(2) + 2, b.view().row(2), W - 2));
+
+    const uint64_t allocs = get_allocs();
+    assert(!scene.render_yuyv(0, 3, yuyv.view()));
+    assert(get_allocs() == allocs);
+    assert(yuyv.view().row(5)[8] == a.view().row(5)[4] && yuyv.view().row(5)[9] == 128);
+
+    assert(scene.render_gray(0, 0, yuyv.view()) == EINVAL);
+    assert(scene.render_gray(2, 0, a.view()) == EINVAL);
+}
+
+int main()
+{
+    test_counts();
+    test_scene();
+    test_steady();
+
+    printf("steady_test OK\n");
+    return 0;
+}
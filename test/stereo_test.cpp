@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "stereo.h"
+#include "reproject.h"
+#include "tiles.h"
+#include "prior.h"
+#include "speckle.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+using namespace robo;
+
+static const int W = 320;
+static const int H = 240;
+static const int SHIFT = 12;
+
+// random texture on the left, right camera sees it SHIFT pixels to the left
+static void make_pair(Image &left, Image &right)
+{
+    assert(!left.allocate(W, H, PIX_FMT_GRAY8));
+    assert(!right.allocate(W, H, PIX_FMT_GRAY8));
+
+    srand(1);
+    for (int y = 0; y < H; ++y) {
+        uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        for (int x = 0; x < W; ++x)
+            l[x] = rand() & 255;
+        for (int x = 0; x < W; ++x)
+            r[x] = x + SHIFT < W ? l[x + SHIFT] : 0;
+    }
+}
+
+static int test_block_matcher(const Image &left, const Image &right, Image &disp)
+{
+    printf("test_block_matcher\n");
+
+    StereoConfig config;
+    get_default_stereo_config(config);
+
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+
+    Image conf;
+    assert(!conf.allocate(W, H, PIX_FMT_GRAY8));
+
+    BlockMatcher matcher(config);
+    assert(!matcher.compute(left.view(), right.view(), disp.view(), &conf.view()));
+
+    // confidence is there exactly where the disparity is
+    for (int y = 0; y < H; ++y) {
+        const int16_t *d = disp.view().row_as<int16_t>(y);
+        const uint8_t *c = conf.view().row(y);
+        for (int x = 0; x < W; ++x)
+            assert((d[x] >= 0) == (c[x] > 0));
+    }
+
+    const int r = config.block_size / 2;
+    int valid = 0;
+
+    for (int y = 0; y < H; ++y) {
+        const int16_t *d = disp.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            const bool inside = y >= r && y < H - r &&
+                x >= config.num_disparities - 1 + r && x < W - r - SHIFT;
+            if (!inside)
+                continue;
+            // subpixel fit may move it by less than half a pixel
+            assert(abs(d[x] - SHIFT * DISP_SCALE) <= DISP_SCALE / 2);
+            ++valid;
+        }
+        for (int x = 0; x < config.num_disparities - 1 + r; ++x)
+            assert(d[x] == DISP_INVALID);
+    }
+
+    // wrong geometry/format
+    Image small;
+    assert(!small.allocate(W / 2, H, PIX_FMT_DISP16));
+    assert(matcher.compute(left.view(), right.view(), small.view()) == EINVAL);
+    assert(matcher.compute(left.view(), disp.view(), disp.view()) == EINVAL);
+
+    return valid;
+}
+
+static void test_reproject(const Image &disp, int valid)
+{
+    printf("test_reproject\n");
+
+    const double baseline = 100.0;
+
+    StereoCalibration calib;
+    get_default_calibration(W, H, baseline, calib);
+
+    Reprojector reprojector;
+    assert(!reprojector.reproject(disp.view(), calib));
+    assert(reprojector.count() >= (uint32_t) valid);
+
+    struct iovec iov[16];
+    const int n = reprojector.get_payload(iov, 16);
+    assert(n >= 3);
+    assert(iov[0].iov_len == sizeof(proto::PointCloud));
+    assert(iov[1].iov_len == (size_t) H * ((W + 7) / 8));
+
+    const proto::PointCloud *hdr = (const proto::PointCloud *) iov[0].iov_base;
+    assert(hdr->width == W && hdr->height == H);
+
+    size_t points = 0;
+    for (int i = 2; i < n; ++i)
+        points += iov[i].iov_len;
+    assert(points == hdr->count * 3 * sizeof(int16_t));
+
+    // every point is f * B / d away and the mask agrees with disparity
+    const double z = calib.Q[11] * baseline / SHIFT;
+    int first = 0;
+    for (int i = 0; i < W * H && first <= 0; ++i)
+        first = disp.view().row_as<int16_t>(i / W)[i % W];
+    const int16_t *p = (const int16_t *) iov[2].iov_base;
+    assert(fabs(p[2] - calib.Q[11] * baseline * DISP_SCALE / first) <= 1.0);
+
+    const uint8_t *mask = (const uint8_t *) iov[1].iov_base;
+    for (int y = 0; y < H; ++y) {
+        const int16_t *d = disp.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            const bool set = mask[y * ((W + 7) / 8) + (x >> 3)] & (1 << (x & 7));
+            assert(set == (d[x] > 0));
+        }
+    }
+
+    // half size luma sees half the disparity, depth must not change
+    StereoCalibration half;
+    assert(!scale_calibration(calib, W / 2, H / 2, half));
+    assert(fabs(half.Q[11] / (half.Q[14] * (SHIFT / 2)) - z) < 1e-6);
+    assert(scale_calibration(calib, W / 2, H, half) == EINVAL);
+}
+
+// Incremental recompute must match a full recompute of the new frame.
+static void test_tiles(Image &left, Image &right)
+{
+    printf("test_tiles\n");
+
+    StereoConfig config;
+    get_default_stereo_config(config);
+
+    TileConfig tiles;
+    get_default_tile_config(tiles);
+
+    BlockMatcher matcher(config);
+    TileTracker tracker(tiles, config.num_disparities, config.block_size,
+                        config.lr_max_diff >= 0);
+
+    Image disp;
+    Image full;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    assert(!full.allocate(W, H, PIX_FMT_DISP16));
+
+    int dirty = 0;
+    assert(!tracker.update(left.view(), right.view(), dirty));
+    assert(dirty == tracker.tiles());
+    assert(!matcher.compute(left.view(), right.view(), disp.view()));
+
+    // nothing moved
+    assert(!tracker.update(left.view(), right.view(), dirty));
+    assert(dirty == 0);
+
+    // something moves in both views around (200, 100)
+    for (int y = 90; y < 110; ++y) {
+        for (int x = 190; x < 210; ++x) {
+            left.view().row(y)[x] = 255 - left.view().row(y)[x];
+            right.view().row(y)[x - SHIFT] = left.view().row(y)[x];
+        }
+    }
+
+    assert(!tracker.update(left.view(), right.view(), dirty));
+    assert(dirty > 0 && dirty < tracker.tiles() / 2);
+
+    assert(!matcher.compute_tiles(left.view(), right.view(), disp.view(), tracker.dirty(), tracker.tile()));
+    assert(!matcher.compute(left.view(), right.view(), full.view()));
+
+    for (int y = 0; y < H; ++y)
+        assert(!memcmp(disp.view().row(y), full.view().row(y), W * sizeof(int16_t)));
+}
+
+// With the left-right check a left view change reaches the decisions up
+// to a search range away on both sides, through the right view winners.
+static void test_tiles_lr()
+{
+    printf("test_tiles_lr\n");
+
+    // a little noise so that no match is exact
+    Image left;
+    Image right;
+    make_pair(left, right);
+    srand(2);
+    for (int y = 0; y < H; ++y) {
+        uint8_t *r = right.view().row(y);
+        for (int x = 0; x < W; ++x) {
+            const int v = r[x] + (rand() % 5) - 2;
+            r[x] = (uint8_t) (v < 0 ? 0 : v > 255 ? 255 : v);
+        }
+    }
+
+    StereoConfig config;
+    get_default_stereo_config(config);
+    assert(config.lr_max_diff >= 0);
+
+    TileConfig tiles;
+    get_default_tile_config(tiles);
+
+    BlockMatcher matcher(config);
+    TileTracker tracker(tiles, config.num_disparities, config.block_size, true);
+
+    Image disp;
+    Image full;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    assert(!full.allocate(W, H, PIX_FMT_DISP16));
+
+    int dirty = 0;
+    assert(!tracker.update(left.view(), right.view(), dirty));
+    assert(!matcher.compute(left.view(), right.view(), disp.view()));
+
+    // One left tile column changes to an exact copy of the right view
+    // 60 pixels on. Those right pixels now prefer 60 to the true 12, the
+    // left pixels matching them at 12, two tiles to the left, fail the
+    // check.
+    const int tile = tiles.tile_px;
+    const int tx = 6;
+    const int far = 60;
+    assert(far < config.num_disparities);
+    for (int y = 90; y < 110; ++y)
+        for (int x = tx * tile; x < (tx + 1) * tile; ++x)
+            left.view().row(y)[x] = right.view().row(y)[x - far];
+
+    assert(!tracker.update(left.view(), right.view(), dirty));
+    assert(dirty > 0 && dirty < tracker.tiles());
+    assert(tracker.dirty()[(100 / tile) * tracker.tiles_x() + tx - 2]);
+
+    assert(!matcher.compute_tiles(left.view(), right.view(), disp.view(), tracker.dirty(), tile));
+    assert(!matcher.compute(left.view(), right.view(), full.view()));
+
+    for (int y = 0; y < H; ++y)
+        assert(!memcmp(disp.view().row(y), full.view().row(y), W * sizeof(int16_t)));
+}
+
+static void shift_pair(const Image &left, Image &right, int shift)
+{
+    for (int y = 0; y < H; ++y) {
+        const uint8_t *l = left.view().row(y);
+        uint8_t *r = right.view().row(y);
+        for (int x = 0; x < W; ++x)
+            r[x] = x + shift < W ? l[x + shift] : 0;
+    }
+}
+
+// Narrowed search must find what the full search finds, and fall back
+// to the full range where the scene left the prior.
+static void test_prior(const Image &left, Image &right)
+{
+    printf("test_prior\n");
+
+    StereoConfig config;
+    get_default_stereo_config(config);
+    const int nd = config.num_disparities;
+    const int r = config.block_size / 2;
+
+    PriorConfig prior_config;
+    get_default_prior_config(prior_config);
+
+    BlockMatcher matcher(config);
+    TemporalPrior prior(prior_config);
+
+    const int tile = 32;
+    const int tiles_x = (W + tile - 1) / tile;
+    const int tiles_y = (H + tile - 1) / tile;
+    std::vector<uint8_t> all(tiles_x * tiles_y, 1);
+    std::vector<uint8_t> retry(tiles_x * tiles_y, 0);
+
+    Image disp;
+    Image full;
+    assert(!disp.allocate(W, H, PIX_FMT_DISP16));
+    assert(!full.allocate(W, H, PIX_FMT_DISP16));
+
+    shift_pair(left, right, SHIFT);
+
+    // first frame has no prior
+    assert(prior.build(disp.view(), tile, nd) == EAGAIN);
+    assert(!matcher.compute(left.view(), right.view(), disp.view()));
+    assert(!prior.build(disp.view(), tile, nd));
+
+    // a tile well inside sees SHIFT +- margin only, give or take the
+    // subpixel part
+    const int center = (tiles_y / 2) * tiles_x + tiles_x / 2;
+    const int margin = prior_config.margin_px;
+    assert(prior.d_min()[center] >= SHIFT - margin - 1 && prior.d_min()[center] <= SHIFT - margin);
+    assert(prior.d_max()[center] >= SHIFT + margin + 1 && prior.d_max()[center] <= SHIFT + margin + 2);
+
+    // the left border has no valid pixels, it searches everything
+    assert(prior.d_min()[tiles_x] == 0 && prior.d_max()[tiles_x] == nd);
+
+    TileJob job;
+    memset(&job, 0, sizeof(job));
+    job.dirty = &all[0];
+    job.tile = tile;
+    job.d_min = prior.d_min();
+    job.d_max = prior.d_max();
+    job.retry = &retry[0];
+    job.max_edge_fraction = prior_config.max_edge_fraction;
+
+    for (int pass = 0; pass < 2; ++pass) {
+
+        // second pass: everything moves 20 pixels closer, out of the prior
+        const int shift = pass ? SHIFT + 20 : SHIFT;
+        shift_pair(left, right, shift);
+
+        int retries = 0;
+        assert(!matcher.compute_tiles(left.view(), right.view(), disp.view(), job));
+        for (size_t i = 0; i < retry.size(); ++i)
+            retries += retry[i];
+        assert(pass ? retries > 0 : retries == 0);
+
+        if (retries)
+            assert(!matcher.compute_tiles(left.view(), right.view(), disp.view(), &retry[0], tile));
+        assert(!matcher.compute(left.view(), right.view(), full.view()));
+
+        for (int y = r; y < H - r; ++y) {
+            const int16_t *d = disp.view().row_as<int16_t>(y);
+            const int16_t *f = full.view().row_as<int16_t>(y);
+            for (int x = nd - 1 + r; x < W - r - shift; ++x) {
+                assert(abs(f[x] - shift * DISP_SCALE) <= DISP_SCALE / 2);
+                assert(d[x] == f[x]);
+            }
+        }
+    }
+
+    // bad tile size
+    assert(prior.build(full.view(), 0, nd) == EINVAL);
+}
+
+static void fill(const Image &disp, int x0, int y0, int w, int h, int16_t value)
+{
+    for (int y = y0; y < y0 + h; ++y)
+        for (int x = x0; x < x0 + w; ++x)
+            disp.view().row_as<int16_t>(y)[x] = value;
+}
+
+static void test_speckle()
+{
+    printf("test_speckle\n");
+
+    SpeckleConfig config;
+    get_default_speckle_config(config);
+
+    Image src;
+    Image dst;
+    assert(!src.allocate(W, H, PIX_FMT_DISP16));
+    assert(!dst.allocate(W, H, PIX_FMT_DISP16));
+
+    fill(src, 0, 0, W, H, DISP_INVALID);
+    fill(src, 10, 10, 50, 50, 10 * DISP_SCALE);     // kept
+    fill(src, 100, 10, 5, 5, 20 * DISP_SCALE);      // speckle
+    fill(src, 120, 0, 3, H, 30 * DISP_SCALE);       // spans every band, kept
+    fill(src, 140, 0, 1, H / 2, 30 * DISP_SCALE);   // thin but not small, kept
+    fill(src, 160, 100, 1, 90, 30 * DISP_SCALE);    // crosses a band, speckle
+
+    // touching, but two pixels apart, so two speckles
+    fill(src, 200, 100, 8, 8, 40 * DISP_SCALE);
+    fill(src, 208, 100, 8, 8, 42 * DISP_SCALE);
+
+    SpeckleFilter filter(config);
+    int removed = 0;
+    assert(!filter.apply(src.view(), dst.view(), removed));
+    assert(removed == 25 + 90 + 128);
+
+    for (int y = 0; y < H; ++y) {
+        const int16_t *in = src.view().row_as<int16_t>(y);
+        const int16_t *out = dst.view().row_as<int16_t>(y);
+        for (int x = 0; x < W; ++x) {
+            const bool speckle = (x >= 100 && x < 105 && y >= 10 && y < 15) ||
+                (x == 160 && y >= 100 && y < 190) || (x >= 200 && x < 216 && y >= 100 && y < 108);
+            assert(out[x] == (speckle ? DISP_INVALID : in[x]));
+        }
+    }
+
+    // in place works too, and the result is stable
+    assert(!filter.apply(dst.view(), dst.view(), removed));
+    assert(removed == 0);
+
+    assert(filter.apply(src.view(), src.view().sub_rows(0, H / 2), removed) == EINVAL);
+}
+
+int main()
+{
+    Image left;
+    Image right;
+    Image disp;
+
+    make_pair(left, right);
+
+    const int valid = test_block_matcher(left, right, disp);
+    test_reproject(disp, valid);
+    test_tiles(left, right);
+    test_tiles_lr();
+    test_prior(left, right);
+    test_speckle();
+
+    printf("stereo_test OK\n");
+    return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "voxel.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace robo;
+
+static VoxelConfig get_config(int bits)
+{
+    VoxelConfig config;
+    get_default_voxel_config(config);
+    config.capacity_bits = bits;
+    config.sweep_slots = 1 << bits;     // full sweep every frame
+    return config;
+}
+
+static VoxelBox get_everything()
+{
+    VoxelBox box;
+    for (int i = 0; i < 3; ++i) {
+        box.min[i] = INT16_MIN * 100;
+        box.max[i] = INT16_MAX * 100;
+    }
+    return box;
+}
+
+// n distinct voxels along x, voxel i centered at (i * 50 + 25, -25, 1025)
+static void make_points(int n, std::vector<int16_t> &points)
+{
+    points.clear();
+    for (int i = 0; i < n; ++i) {
+        points.push_back(i * 50 + 25);
+        points.push_back(-25);
+        points.push_back(1025);
+    }
+}
+
+static void test_occupancy()
+{
+    printf("test_occupancy\n");
+
+    VoxelMap map(get_config(10));
+    std::vector<int16_t> points;
+    make_points(10, points);
+
+    // one frame is not enough, many hits on a voxel in one frame count once
+    for (int i = 0; i < 5; ++i)
+        map.integrate(&points[0], 10, 1);
+    map.end_frame();
+
+    VoxelCoord out[64];
+    assert(map.size() == 10);
+    assert(map.query(get_everything(), out, 64) == 0);
+
+    map.integrate(&points[0], 10, 1);
+    map.integrate(&points[0], 10, 1);
+    map.end_frame();
+    assert(map.query(get_everything(), out, 64) == 10);
+
+    // box on the first three voxel centers
+    VoxelBox box = get_everything();
+    box.min[0] = 0;
+    box.max[0] = 150;
+    assert(map.query(box, out, 64) == 3);
+    for (int i = 0; i < 3; ++i)
+        assert(out[i].y == -1 && out[i].z == 20 && out[i].x >= 0 && out[i].x < 3);
+
+    uint8_t grid[20 * 30];
+    map.project(0, 0, 20, 30, -1000, 1000, grid);
+    for (int z = 0; z < 30; ++z)
+        for (int x = 0; x < 20; ++x)
+            assert((grid[z * 20 + x] != 0) == (z == 20 && x < 10));
+
+    // outside the height band
+    map.project(0, 0, 20, 30, 0, 1000, grid);
+    for (int i = 0; i < 20 * 30; ++i)
+        assert(!grid[i]);
+}
+
+static void test_decay()
+{
+    printf("test_decay\n");
+
+    VoxelMap map(get_config(8));
+    std::vector<int16_t> points;
+    make_points(150, points);
+
+    map.integrate(&points[0], 150, 1);
+    map.end_frame();
+    assert(map.size() == 150);
+
+    // keep every other voxel alive, the rest decays out and its slots are
+    // backward shifted, the survivors must stay reachable.
+    for (int frame = 0; frame < 10; ++frame) {
+        map.integrate(&points[0], 150, 2);
+        map.end_frame();
+    }
+
+    assert(map.size() == 75);
+    assert(map.evicted() == 75);
+
+    VoxelCoord out[256];
+    assert(map.query(get_everything(), out, 256) == 75);
+    for (int i = 0; i < 75; ++i)
+        assert(!(out[i].x & 1));
+
+    // hitting them again must find the existing slots, not add new ones
+    map.integrate(&points[0], 150, 2);
+    map.end_frame();
+    assert(map.size() == 75);
+}
+
+static void test_capacity()
+{
+    printf("test_capacity\n");
+
+    VoxelMap map(get_config(6));
+    std::vector<int16_t> points;
+    make_points(100, points);
+
+    map.integrate(&points[0], 100, 1);
+    assert(map.size() == 48);
+    assert(map.dropped() == 52);
+    assert(map.capacity() == 64);
+}
+
+// A full table makes room for new voxels by evicting stale ones, what
+// is hit in the current frame stays.
+static void test_eviction()
+{
+    printf("test_eviction\n");
+
+    VoxelMap map(get_config(6));
+    std::vector<int16_t> old_points;
+    make_points(100, old_points);
+
+    map.integrate(&old_points[0], 100, 1);
+    map.end_frame();
+    assert(map.size() == 48);
+    assert(map.dropped() == 52);
+
+    // something new in front, at z 2025, seen for two frames
+    std::vector<int16_t> points;
+    for (int i = 0; i < 8; ++i) {
+        points.push_back(i * 50 + 25);
+        points.push_back(-25);
+        points.push_back(2025);
+    }
+
+    const uint64_t evicted = map.evicted();
+    for (int frame = 0; frame < 2; ++frame) {
+        map.integrate(&points[0], 8, 1);
+        map.end_frame();
+    }
+    assert(map.size() == 48);
+    assert(map.dropped() == 52);
+    assert(map.evicted() - evicted == 8);
+
+    VoxelBox box = get_everything();
+    box.min[2] = 2000;
+    box.max[2] = 2050;
+    VoxelCoord out[64];
+    assert(map.query(box, out, 64) == 8);
+
+    // the old ones are all older now, still nothing hit this frame goes
+    std::vector<int16_t> more;
+    make_points(48, more);
+    for (size_t i = 2; i < more.size(); i += 3)
+        more[i] = 3025;
+    map.integrate(&points[0], 8, 1);
+    map.integrate(&more[0], 48, 1);
+    assert(map.query(box, out, 64) == 8);
+}
+
+int main()
+{
+    test_occupancy();
+    test_decay();
+    test_capacity();
+    test_eviction();
+
+    printf("voxel_test OK\n");
+    return 0;
+}
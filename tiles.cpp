@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "tiles.h"
+#include "parallel.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+namespace robo {
+
+void get_default_tile_config(TileConfig &config)
+{
+    config.tile_px          = 32;
+    config.threshold        = 3;
+    config.refresh_frames   = 150;      // 10s at 15 fps
+}
+
+TileTracker::TileTracker(const TileConfig &config, int num_disparities, int block_size,
+                         bool lr_check)
+    :
+    m_config(config),
+    m_num_disparities(num_disparities),
+    m_block_size(block_size),
+    m_lr_check(lr_check),
+    m_tiles_x(0),
+    m_tiles_y(0),
+    m_frames(0)
+{
+    assert(config.tile_px > block_size / 2);
+}
+
+static void copy_tile(const ImageView &src, const ImageView &dst, int x0, int y0, int tile)
+{
+    const int x1 = x0 + tile < src.width ? x0 + tile : src.width;
+    const int y1 = y0 + tile < src.height ? y0 + tile : src.height;
+
+    for (int y = y0; y < y1; ++y)
+        memcpy(dst.row(y) + x0, src.row(y) + x0, x1 - x0);
+}
+
+int TileTracker::reset(const ImageView &left, const ImageView &right)
+{
+    if (left.format != PIX_FMT_GRAY8 || !left.same_size(right) || left.empty())
+        return EINVAL;
+
+    const int tile = m_config.tile_px;
+
+    m_tiles_x = (left.width + tile - 1) / tile;
+    m_tiles_y = (left.height + tile - 1) / tile;
+    m_frames = 0;
+
+    int res = m_left.allocate(left.width, left.height, PIX_FMT_GRAY8);
+    res = res || m_right.allocate(left.width, left.height, PIX_FMT_GRAY8);
+    if (res)
+        return ENOMEM;
+
+    for (int y = 0; y < left.height; ++y) {
+        memcpy(m_left.view().row(y), left.row(y), left.width);
+        memcpy(m_right.view().row(y), right.row(y), left.width);
+    }
+
+    m_changed_left.assign(tiles(), 1);
+    m_changed_right.assign(tiles(), 1);
+    m_dirty.assign(tiles(), 1);
+    return 0;
+}
+
+void TileTracker::detect(const ImageView &current, const ImageView &reference, uint8_t *changed,
+                         int ty0, int ty1)
+{
+    const int tile = m_config.tile_px;
+
+    for (int ty = ty0; ty < ty1; ++ty) {
+        const int y0 = ty * tile;
+        const int y1 = y0 + tile < current.height ? y0 + tile : current.height;
+
+        for (int tx = 0; tx < m_tiles_x; ++tx) {
+            const int x0 = tx * tile;
+            const int x1 = x0 + tile < current.width ? x0 + tile : current.width;
+
+            unsigned sad = 0;
+            for (int y = y0; y < y1; ++y) {
+                const uint8_t *a = current.row(y);
+                const uint8_t *b = reference.row(y);
+                for (int x = x0; x < x1; ++x)
+                    sad += a[x] > b[x] ? a[x] - b[x] : b[x] - a[x];
+            }
+
+            const unsigned limit = (unsigned) m_config.threshold * (x1 - x0) * (y1 - y0);
+            changed[ty * m_tiles_x + tx] = sad > limit;
+            if (sad > limit)
+                copy_tile(current, reference, x0, y0, tile);
+        }
+    }
+}
+
+int TileTracker::update(const ImageView &left, const ImageView &right, int &count)
+{
+    count = 0;
+
+    if (!left.same_size(m_left.view()) ||
+        (m_config.refresh_frames && ++m_frames >= m_config.refresh_frames)) {
+        int res = reset(left, right);
+        count = res ? 0 : tiles();
+        return res;
+    }
+
+    if (left.format != PIX_FMT_GRAY8 || right.format != PIX_FMT_GRAY8 || !left.same_size(right))
+        return EINVAL;
+
+    uint8_t *cl = &m_changed_left[0];
+    uint8_t *cr = &m_changed_right[0];
+
+    parallel_for(m_tiles_y, 1, [&](int, int ty0, int ty1) {
+        detect(left, m_left.view(), cl, ty0, ty1);
+        detect(right, m_right.view(), cr, ty0, ty1);
+    });
+
+    // left tile (x) needs right tiles covering [x - num_disparities - r, x + r],
+    // the left-right check left ones covering [x - num_disparities - r,
+    // x + num_disparities + r]: the right winners of those columns
+    const int tile = m_config.tile_px;
+    const int reach = (m_num_disparities + m_block_size / 2 + tile - 1) / tile;
+    const int left_reach = m_lr_check ? reach : 1;
+
+    for (int ty = 0; ty < m_tiles_y; ++ty) {
+        for (int tx = 0; tx < m_tiles_x; ++tx) {
+            bool dirty = false;
+
+            for (int y = ty - 1; y <= ty + 1 && !dirty; ++y) {
+                if (y < 0 || y >= m_tiles_y)
+                    continue;
+                const uint8_t *l = cl + y * m_tiles_x;
+                const uint8_t *r = cr + y * m_tiles_x;
+
+                for (int x = tx - reach; x <= tx + left_reach && !dirty; ++x) {
+                    if (x < 0 || x >= m_tiles_x)
+                        continue;
+                    dirty = (x <= tx + 1 && r[x]) || (x >= tx - left_reach && l[x]);
+                }
+            }
+
+            m_dirty[ty * m_tiles_x + tx] = dirty;
+            count += dirty;
+        }
+    }
+
+    return 0;
+}
+
+} // namespace robo
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __TILES__H__
+#define __TILES__H__
+
+#include "image.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace robo {
+
+struct TileConfig
+{
+    int     tile_px;            // square tiles
+    int     threshold;          // mean abs luma difference that counts as change
+    int     refresh_frames;     // full recompute every n frames, 0 never
+};
+
+void get_default_tile_config(TileConfig &config);
+
+// Decides which disparity tiles need recomputing. Each camera's luma is
+// compared per tile (SAD) against the luma the tile was last computed
+// from, so slow drifts add up and eventually trigger too. A disparity
+// tile depends on its left tile and on the right tiles its search range
+// covers, plus one tile of halo for the matching window. With the
+// left-right check it also depends on the left tiles the search range
+// covers on both sides, they compete for the same right pixels.
+class TileTracker
+{
+public:
+    TileTracker(const TileConfig &config, int num_disparities, int block_size, bool lr_check);
+
+    // Flags every tile dirty and takes left/right as the reference.
+    int reset(const ImageView &left, const ImageView &right);
+
+    // Flags tiles needing recompute, count is the number of dirty tiles.
+    // Changed tiles of the references are updated to left/right. Falls
+    // back to reset() on geometry change and every refresh_frames.
+    int update(const ImageView &left, const ImageView &right, int &count);
+
+    const uint8_t *dirty() const { return &m_dirty[0]; }
+    int tile() const { return m_config.tile_px; }
+    int tiles() const { return m_tiles_x * m_tiles_y; }
+    int tiles_x() const { return m_tiles_x; }
+
+private:
+    void detect(const ImageView &current, const ImageView &reference, uint8_t *changed, int y0, int y1);
+
+private:
+    TileConfig              m_config;
+    int                     m_num_disparities;
+    int                     m_block_size;
+    bool                    m_lr_check;
+    int                     m_tiles_x;
+    int                     m_tiles_y;
+    int                     m_frames;
+    Image                   m_left;
+    Image                   m_right;
+    std::vector<uint8_t>    m_changed_left;
+    std::vector<uint8_t>    m_changed_right;
+    std::vector<uint8_t>    m_dirty;
+};
+
+} // namespace robo
+
+#endif // __TILES__H__
@@ -0,0 +1,138 @@
+#!/bin/sh
+#
+# End to end benchmark, run by `make bench-e2e`.
+#
+# The whole module runs on synthetic cameras (no hardware), once free
+# running (-F, frames as fast as the loop takes them) and once paced at
+# the camera rate (-S). test/load_client drives it over its socket with
+# closed loop CMD_GET_MAP requests and reports throughput, the latency
+# distribution, CPU per frame and peak RSS. The governor and the flight
+# recorder are off so runs compare.
+#
+# The results are compared with BENCH_BASELINE: a metric more than
+# BENCH_TOLERANCE percent worse than its baseline fails the run (higher
+# is better for *_per_sec, lower for the rest), so does any error. p99.9
+# and max are a handful of samples, they are shown but not compared.
+# Baselines are per machine, BENCH_UPDATE=1 records a new one. A baseline
+# recorded on another architecture or cpu count is not compared against:
+# the run is skipped with exit status 77, neither a pass nor a failure.
+#
+# The module listens on a socket of its own under a temporary directory
+# (-U), a module already running on the box is left alone.
+#
+# Copyright (C) 2016 Tolga Ceylan
+#
+# CopyPolicy: Released under the terms of the GNU GPL v3.0.
+#
+
+MODULE=${BENCH_MODULE:-./vision_module.out}
+CLIENT=${BENCH_CLIENT:-test/load_client}
+BASELINE=${BENCH_BASELINE:-tools/bench_e2e.baseline}
+RESULTS=${BENCH_RESULTS:-bench_e2e.results}
+TOLERANCE=${BENCH_TOLERANCE:-25}
+DURATION=${BENCH_DURATION:-10}
+WARMUP=${BENCH_WARMUP:-2}
+PAYLOAD=${BENCH_PAYLOAD:-3}         # proto::PAYLOAD_DISP16
+UPDATE=${BENCH_UPDATE:-0}
+
+MACHINE="$(uname -m), $(nproc) cpus"
+
+if [ "$UPDATE" != 1 ] && [ -f "$BASELINE" ]; then
+    recorded=$(sed -n '1s/^# \([^,]*, [0-9]* cpus\),.*/\1/p' "$BASELINE")
+    if [ "$recorded" != "$MACHINE" ]; then
+        echo "bench-e2e: SKIPPED, $BASELINE is for ${recorded:-an unknown machine}, this is $MACHINE;" \
+            "record one here with BENCH_UPDATE=1"
+        exit 77
+    fi
+fi
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/bench_e2e.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT
+SOCKET=$TMP/vision.s
+
+# run_mode name module_flags...
+run_mode() {
+    name=$1
+    shift
+
+    "$MODULE" "$@" -U "$SOCKET" -g -R '' > "$TMP/$name.log" 2>&1 &
+    pid=$!
+
+    tries=0
+    while [ ! -S "$SOCKET" ]; do
+        tries=$((tries + 1))
+        if [ $tries -gt 100 ] || ! kill -0 $pid 2> /dev/null; then
+            echo "bench-e2e: $name: module did not start, see below" >&2
+            cat "$TMP/$name.log" >&2
+            kill $pid 2> /dev/null
+            return 1
+        fi
+        sleep 0.1
+    done
+
+    echo "== $name: $MODULE $* -g"
+    "$CLIENT" -U "$SOCKET" -c 1 -d 1 -m map:1 -p "$PAYLOAD" -t "$DURATION" -w "$WARMUP" -x -o "$TMP/$name"
+    rc=$?
+
+    # -x asked it to exit, give it a moment before insisting
+    tries=0
+    while kill -0 $pid 2> /dev/null && [ $tries -lt 50 ]; do
+        tries=$((tries + 1))
+        sleep 0.1
+    done
+    kill $pid 2> /dev/null
+    wait $pid 2> /dev/null
+
+    [ -f "$TMP/$name" ] && sed "s/^/$name./" "$TMP/$name" >> "$RESULTS"
+    return $rc
+}
+
+: > "$RESULTS"
+failed=0
+run_mode free -F || failed=1
+run_mode paced -S || failed=1
+
+if [ $failed -ne 0 ]; then
+    echo "bench-e2e: FAILED, the runs had errors"
+    exit 1
+fi
+
+if [ "$UPDATE" = 1 ]; then
+    {
+        echo "# $MACHINE, $(date +%Y-%m-%d), ${DURATION}s runs"
+        cat "$RESULTS"
+    } > "$BASELINE"
+    echo "bench-e2e: baseline $BASELINE updated"
+    exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+    echo "bench-e2e: no baseline $BASELINE, record one with BENCH_UPDATE=1"
+    exit 1
+fi
+
+echo "== against $BASELINE, tolerance $TOLERANCE%"
+awk -F= -v tolerance="$TOLERANCE" '
+    /^#/ { next }
+    NR == FNR { base[$1] = $2; next }
+    {
+        if (!($1 in base) || base[$1] <= 0 || $1 ~ /_(p999|max)_usec$/) {
+            printf "  %-30s %12s %12s\n", $1, ($1 in base) ? base[$1] : "-", $2
+            next
+        }
+        higher = $1 ~ /_per_sec$/
+        change = ($2 - base[$1]) * 100.0 / base[$1]
+        worse = higher ? -change : change
+        verdict = worse > tolerance ? "REGRESSED" : ""
+        if (verdict != "")
+            regressed++
+        printf "  %-30s %12s %12s %+7.1f%% %s\n", $1, base[$1], $2, change, verdict
+    }
+    END { exit regressed ? 1 : 0 }
+' "$BASELINE" "$RESULTS"
+
+if [ $? -ne 0 ]; then
+    echo "bench-e2e: FAILED, regressed more than $TOLERANCE%"
+    exit 1
+fi
+echo "bench-e2e: OK"
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "recorder.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace robo;
+
+// Dumps a flight recorder file (vision_module.out -R) as CSV on stdout,
+// oldest record first. With a count only the newest ones.
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s flight_file [last_count]\n", argv[0]);
+        return EINVAL;
+    }
+
+    FlightHeader header;
+    std::vector<FlightRecord> records;
+
+    int res = load_flight_records(argv[1], header, records);
+    if (res) {
+        fprintf(stderr, "%s: %s\n", argv[1], res == EINVAL ? "not a flight recorder file" : strerror(res));
+        return res;
+    }
+
+    if (argc == 3) {
+        const size_t last = (size_t) atol(argv[2]);
+        if (last < records.size())
+            records.erase(records.begin(), records.end() - last);
+    }
+
+    write_flight_csv(stdout, header, records);
+    return 0;
+}
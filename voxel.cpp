@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#include "voxel.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace robo {
+
+// valid keys only use the low 48 bits
+static const uint64_t g_empty = UINT64_MAX;
+
+void get_default_voxel_config(VoxelConfig &config)
+{
+    config.voxel_mm         = 50;
+    config.capacity_bits    = 17;       // 128K slots, 2MB
+    config.max_load         = 0.75;
+    config.evict_window     = 16;
+
+    config.hit              = 4;
+    config.max_log_odds     = 64;
+    config.occupied         = 8;
+
+    config.sweep_slots      = 8192;     // whole table every 16 frames
+    config.decay            = 1;
+}
+
+static inline uint64_t make_key(int x, int y, int z)
+{
+    return ((uint64_t) (uint16_t) x << 32) | ((uint64_t) (uint16_t) y << 16) | (uint16_t) z;
+}
+
+static inline VoxelCoord get_coord(uint64_t key)
+{
+    VoxelCoord c;
+    c.x = (int16_t) (key >> 32);
+    c.y = (int16_t) (key >> 16);
+    c.z = (int16_t) key;
+    return c;
+}
+
+// floor(v / size) for size > 0
+static inline int floor_div(int v, int size)
+{
+    return v >= 0 ? v / size : -((-v + size - 1) / size);
+}
+
+VoxelMap::VoxelMap(const VoxelConfig &config)
+    :
+    m_config(config),
+    m_slots((size_t) 1 << config.capacity_bits),
+    m_mask(((size_t) 1 << config.capacity_bits) - 1),
+    m_size(0),
+    m_max_size((size_t) (config.max_load * ((size_t) 1 << config.capacity_bits))),
+    m_cursor(0),
+    m_frame(0),
+    m_dropped(0),
+    m_evicted(0)
+{
+    assert(config.voxel_mm > 0);
+    assert(config.capacity_bits > 0 && config.capacity_bits < 32);
+    assert(config.max_load > 0.0 && config.max_load < 1.0);
+    assert(config.evict_window > 0);
+
+    clear();
+}
+
+void VoxelMap::clear()
+{
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        m_slots[i].key = g_empty;
+        m_slots[i].log_odds = 0;
+        m_slots[i].reserved = 0;
+        m_slots[i].frame = 0;
+    }
+    m_size = 0;
+    m_cursor = 0;
+}
+
+size_t VoxelMap::home(uint64_t key) const
+{
+    return (size_t) ((key * 0x9e3779b97f4a7c15ull) >> (64 - m_config.capacity_bits));
+}
+
+void VoxelMap::hit(uint64_t key)
+{
+    size_t i = home(key);
+
+    while (m_slots[i].key != g_empty && m_slots[i].key != key)
+        i = (i + 1) & m_mask;
+
+    if (m_slots[i].key == g_empty) {
+        if (m_size >= m_max_size) {
+            // a turn fills the map with what is behind now, that must not
+            // keep what is in front out until it decays
+            if (!evict_near(home(key))) {
+                ++m_dropped;
+                return;
+            }
+
+            // the backward shift moved the run, find the hole again
+            i = home(key);
+            while (m_slots[i].key != g_empty)
+                i = (i + 1) & m_mask;
+        }
+
+        m_slots[i].key = key;
+        m_slots[i].log_odds = 0;
+        m_slots[i].frame = m_frame - 1;
+        ++m_size;
+    }
+
+    Slot &slot = m_slots[i];
+
+    // close obstacles cover many pixels per voxel, count them once
+    if (slot.frame == m_frame)
+        return;
+
+    slot.frame = m_frame;
+    const int v = slot.log_odds + m_config.hit;
+    slot.log_odds = (int16_t) (v > m_config.max_log_odds ? m_config.max_log_odds : v);
+}
+
+// Evicts the voxel hit longest ago (the weaker one of a tie) among
+// evict_window slots from index. False if every one there was hit this
+// frame.
+bool VoxelMap::evict_near(size_t index)
+{
+    size_t victim = m_slots.size();
+    uint32_t victim_age = 0;
+
+    for (int n = 0; n < m_config.evict_window; ++n, index = (index + 1) & m_mask) {
+        const Slot &slot = m_slots[index];
+        if (slot.key == g_empty || slot.frame == m_frame)
+            continue;
+
+        const uint32_t age = m_frame - slot.frame;
+        if (victim == m_slots.size() || age > victim_age ||
+            (age == victim_age && slot.log_odds < m_slots[victim].log_odds)) {
+            victim = index;
+            victim_age = age;
+        }
+    }
+
+    if (victim == m_slots.size())
+        return false;
+
+    erase(victim);
+    return true;
+}
+
+void VoxelMap::erase(size_t i)
+{
+    size_t j = i;
+
+    for (;;) {
+        j = (j + 1) & m_mask;
+        if (m_slots[j].key == g_empty)
+            break;
+
+        // j may move into the hole unless its home lies cyclically in (i, j]
+        const size_t k = home(m_slots[j].key);
+        const bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+        if (stays)
+            continue;
+
+        m_slots[i] = m_slots[j];
+        i = j;
+    }
+
+    m_slots[i].key = g_empty;
+    m_slots[i].log_odds = 0;
+    --m_size;
+    ++m_evicted;
+}
+
+void VoxelMap::integrate(const int16_t *points, size_t count, int stride)
+{
+    assert(stride > 0);
+
+    const int size = m_config.voxel_mm;
+    const size_t step = (size_t) stride * 3;
+
+    for (size_t i = 0; i < count * 3; i += step) {
+        const int16_t *p = points + i;
+        hit(make_key(floor_div(p[0], size), floor_div(p[1], size), floor_div(p[2], size)));
+    }
+}
+
+void VoxelMap::end_frame()
+{
+    size_t budget = (size_t) m_config.sweep_slots;
+    if (budget > m_slots.size())
+        budget = m_slots.size();
+
+    while (budget--) {
+        Slot &slot = m_slots[m_cursor];
+
+        if (slot.key != g_empty && slot.frame != m_frame) {
+            slot.log_odds -= m_config.decay;
+            if (slot.log_odds <= 0) {
+                // backward shift may pull an unvisited slot into cursor
+                erase(m_cursor);
+                continue;
+            }
+        }
+        m_cursor = (m_cursor + 1) & m_mask;
+    }
+
+    ++m_frame;
+}
+
+static inline bool inside(const VoxelBox &box, int32_t x, int32_t y, int32_t z)
+{
+    return x >= box.min[0] && x < box.max[0] &&
+           y >= box.min[1] && y < box.max[1] &&
+           z >= box.min[2] && z < box.max[2];
+}
+
+size_t VoxelMap::query(const VoxelBox &box, VoxelCoord *out, size_t max_count) const
+{
+    const int32_t size = m_config.voxel_mm;
+    size_t n = 0;
+
+    for (size_t i = 0; i < m_slots.size() && n < max_count; ++i) {
+        const Slot &slot = m_slots[i];
+        if (slot.key == g_empty || slot.log_odds < m_config.occupied)
+            continue;
+
+        const VoxelCoord c = get_coord(slot.key);
+
+        // voxel centre decides
+        if (inside(box, c.x * size + size / 2, c.y * size + size / 2, c.z * size + size / 2))
+            out[n++] = c;
+    }
+
+    return n;
+}
+
+void VoxelMap::project(int32_t x0, int32_t z0, int width, int depth,
+                       int32_t min_y, int32_t max_y, uint8_t *grid) const
+{
+    assert(width > 0 && depth > 0);
+
+    const int32_t size = m_config.voxel_mm;
+
+    memset(grid, 0, (size_t) width * depth);
+
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        const Slot &slot = m_slots[i];
+        if (slot.key == g_empty || slot.log_odds < m_config.occupied)
+            continue;
+
+        const VoxelCoord c = get_coord(slot.key);
+
+        const int32_t y = c.y * size + size / 2;
+        if (y < min_y || y >= max_y)
+            continue;
+
+        const int gx = floor_div(c.x * size + size / 2 - x0, size);
+        const int gz = floor_div(c.z * size + size / 2 - z0, size);
+        if (gx < 0 || gx >= width || gz < 0 || gz >= depth)
+            continue;
+
+        int v = slot.log_odds * 255 / m_config.max_log_odds;
+        v = v < 1 ? 1 : (v > 255 ? 255 : v);
+
+        uint8_t &cell = grid[(size_t) gz * width + gx];
+        if (v > cell)
+            cell = (uint8_t) v;
+    }
+}
+
+} // namespace robo
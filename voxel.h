@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2016 Tolga Ceylan
+ *
+ * CopyPolicy: Released under the terms of the GNU GPL v3.0.
+ */
+#ifndef __VOXEL__H__
+#define __VOXEL__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace robo {
+
+struct VoxelConfig
+{
+    int     voxel_mm;           // voxel edge
+    int     capacity_bits;      // table has 1 << capacity_bits slots
+    double  max_load;           // inserts beyond this load evict
+
+    // a full table's insert evicts the voxel hit longest ago among the
+    // evict_window slots from its home, never one hit this frame
+    int     evict_window;
+
+    // log-odds in fixed point, one hit per voxel per frame
+    int     hit;
+    int     max_log_odds;
+    int     occupied;           // threshold for queries
+
+    // every frame sweep_slots slots lose decay, voxels at 0 are evicted.
+    // Bounds both the per frame cost and how long a vanished obstacle
+    // stays in the map.
+    int     sweep_slots;
+    int     decay;
+};
+
+void get_default_voxel_config(VoxelConfig &config);
+
+struct VoxelCoord
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+// Axis aligned box in millimetres, min inclusive max exclusive.
+struct VoxelBox
+{
+    int32_t min[3];
+    int32_t max[3];
+};
+
+// Occupancy map in a spatially hashed voxel grid: flat open addressing
+// table (linear probing, backward shift deletion), no allocation after
+// construction. Memory is fixed by capacity_bits, eviction is driven by
+// the per frame decay sweep and, once the table is full, by new voxels
+// replacing stale ones near their home slot.
+//
+// Coordinates are whatever frame the points are in, the left camera for
+// now. TODO: needs robot pose from the controller to become a world map.
+class VoxelMap
+{
+public:
+    explicit VoxelMap(const VoxelConfig &config);
+
+    const VoxelConfig &config() const { return m_config; }
+
+    // points are int16_t xyz millimetre triplets, every stride'th used
+    void integrate(const int16_t *points, size_t count, int stride);
+
+    // decay sweep, call once per frame after integrate()
+    void end_frame();
+
+    // occupied voxels inside box, at most max_count written
+    size_t query(const VoxelBox &box, VoxelCoord *out, size_t max_count) const;
+
+    // Projects occupied voxels with y in [min_y, max_y) mm onto the x/z
+    // plane, width x depth cells of voxel_mm starting at (x0, z0) mm.
+    // grid is row major (z rows), cell value is the strongest voxel's
+    // log-odds scaled to 1..255, 0 for unknown/free.
+    void project(int32_t x0, int32_t z0, int width, int depth,
+                 int32_t min_y, int32_t max_y, uint8_t *grid) const;
+
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_slots.size(); }
+    uint64_t dropped() const { return m_dropped; }     // no victim in the window
+    uint64_t evicted() const { return m_evicted; }     // decayed or replaced
+
+    void clear();
+
+private:
+    struct Slot
+    {
+        uint64_t    key;
+        int16_t     log_odds;
+        uint16_t    reserved;
+        uint32_t    frame;      // last frame it was hit
+    };
+
+    size_t home(uint64_t key) const;
+    void hit(uint64_t key);
+    bool evict_near(size_t index);
+    void erase(size_t index);
+
+private:
+    VoxelConfig         m_config;
+    std::vector<Slot>   m_slots;
+    size_t              m_mask;
+    size_t              m_size;
+    size_t              m_max_size;
+    size_t              m_cursor;
+    uint32_t            m_frame;
+    uint64_t            m_dropped;
+    uint64_t            m_evicted;
+};
+
+} // namespace robo
+
+#endif // __VOXEL__H__